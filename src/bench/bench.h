@@ -0,0 +1,145 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * microtouch3m-bench - Microbenchmarks for the hot kernels
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+/*
+ * Minimal benchmark runner shared by the C and C++ benchmark programs.
+ *
+ * Each benchmark is a function running a given number of operations. The
+ * runner calibrates the number of operations so that one repetition takes at
+ * least BENCH_MIN_TIME_MS (default 50ms), runs BENCH_REPETITIONS repetitions
+ * and prints one JSON object per line with the min and median time per
+ * operation, so that results can be diffed or post-processed directly.
+ *
+ * Environment variables:
+ *   BENCH_FILTER       only run benchmarks whose name contains this string.
+ *   BENCH_MIN_TIME_MS  minimum time per repetition, in milliseconds.
+ */
+
+#ifndef MICROTOUCH3M_BENCH_H
+#define MICROTOUCH3M_BENCH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BENCH_REPETITIONS       5
+#define BENCH_DEFAULT_MIN_TIME_MS 50
+
+typedef void (* bench_func_t) (uint64_t n_ops, void *user_data);
+
+/* Sink to keep the compiler from optimizing away benchmark results */
+static volatile uint64_t bench_sink;
+
+static inline uint64_t
+bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000ULL) + (uint64_t) ts.tv_nsec;
+}
+
+static inline void
+bench_header (const char *suite,
+              const char *version)
+{
+    printf ("{\"suite\":\"%s\",\"version\":\"%s\",\"repetitions\":%d}\n",
+            suite, version, BENCH_REPETITIONS);
+    fflush (stdout);
+}
+
+static inline int
+bench_compare_double (const void *a,
+                      const void *b)
+{
+    double da = *((const double *) a);
+    double db = *((const double *) b);
+
+    return (da < db) ? -1 : ((da > db) ? 1 : 0);
+}
+
+static inline void
+bench_run (const char   *name,
+           bench_func_t  func,
+           void         *user_data,
+           uint64_t      bytes_per_op)
+{
+    const char *filter;
+    const char *min_time_str;
+    uint64_t    min_time_ns;
+    uint64_t    n_ops = 1;
+    uint64_t    elapsed;
+    double      ns_per_op[BENCH_REPETITIONS];
+    unsigned    i;
+
+    filter = getenv ("BENCH_FILTER");
+    if (filter && !strstr (name, filter))
+        return;
+
+    min_time_str = getenv ("BENCH_MIN_TIME_MS");
+    min_time_ns = (uint64_t) (min_time_str ? atoi (min_time_str) : BENCH_DEFAULT_MIN_TIME_MS) * 1000000ULL;
+    if (!min_time_ns)
+        min_time_ns = 1;
+
+    /* Warm up and calibrate: grow the number of operations until a single
+     * repetition lasts at least the minimum time */
+    for (;;) {
+        uint64_t start;
+
+        start = bench_now_ns ();
+        func (n_ops, user_data);
+        elapsed = bench_now_ns () - start;
+        if (elapsed >= min_time_ns)
+            break;
+        if (elapsed < min_time_ns / 100)
+            n_ops *= 10;
+        else
+            n_ops = (uint64_t) (((double) n_ops * min_time_ns * 1.2) / (elapsed ? elapsed : 1)) + 1;
+    }
+
+    for (i = 0; i < BENCH_REPETITIONS; i++) {
+        uint64_t start;
+
+        start = bench_now_ns ();
+        func (n_ops, user_data);
+        elapsed = bench_now_ns () - start;
+        ns_per_op[i] = (double) elapsed / (double) n_ops;
+    }
+
+    qsort (ns_per_op, BENCH_REPETITIONS, sizeof (double), bench_compare_double);
+
+    printf ("{\"benchmark\":\"%s\",\"iterations\":%llu,\"repetitions\":%d,"
+            "\"ns_per_op_min\":%.3f,\"ns_per_op_median\":%.3f",
+            name, (unsigned long long) n_ops, BENCH_REPETITIONS,
+            ns_per_op[0], ns_per_op[BENCH_REPETITIONS / 2]);
+    if (bytes_per_op)
+        printf (",\"bytes_per_op\":%llu,\"mb_per_s\":%.3f",
+                (unsigned long long) bytes_per_op,
+                ((double) bytes_per_op * 1000.0) / ns_per_op[0]);
+    printf ("}\n");
+    fflush (stdout);
+}
+
+#endif /* MICROTOUCH3M_BENCH_H */
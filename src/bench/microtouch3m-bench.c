@@ -0,0 +1,578 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * microtouch3m-bench - Microbenchmarks for the hot kernels
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <config.h>
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <math.h>
+
+#include <common.h>
+#include <ihex.h>
+
+#include <microtouch3m.h>
+
+#include "bench.h"
+
+#define PROGRAM_NAME    "microtouch3m-bench"
+#define PROGRAM_VERSION PACKAGE_VERSION
+
+/* Same fixed seed everywhere, so that every run processes the same input */
+#define BENCH_SEED 0x4d334d
+
+static uint32_t bench_rand_state;
+
+static uint32_t
+bench_rand (void)
+{
+    /* xorshift32 */
+    bench_rand_state ^= bench_rand_state << 13;
+    bench_rand_state ^= bench_rand_state >> 17;
+    bench_rand_state ^= bench_rand_state << 5;
+    return bench_rand_state;
+}
+
+static void
+bench_fill_random (uint8_t *buffer,
+                   size_t   size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+        buffer[i] = (uint8_t) bench_rand ();
+}
+
+/******************************************************************************/
+/* I/Q magnitude */
+
+/* Per-value double precision square root, as the CLI and the scope used to do
+ * before microtouch3m_iq_magnitude_batch(); kept as baseline */
+#define PROCESS_IQ(i,q) (uint64_t) sqrt ((((double)i) * ((double)i)) + (((double)q) * ((double)q)))
+
+#define IQ_SAMPLES 4096
+
+typedef struct {
+    int32_t  i[IQ_SAMPLES];
+    int32_t  q[IQ_SAMPLES];
+    uint64_t magnitude[IQ_SAMPLES];
+    int32_t  signal[IQ_SAMPLES];
+    uint64_t stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+} iq_context_t;
+
+static void
+bench_process_iq (uint64_t  n_ops,
+                  void     *user_data)
+{
+    iq_context_t *ctx = (iq_context_t *) user_data;
+    uint64_t      acc = 0;
+    uint64_t      op;
+
+    for (op = 0; op < n_ops; op++) {
+        unsigned int j;
+
+        for (j = 0; j < IQ_SAMPLES; j++)
+            acc += PROCESS_IQ (ctx->i[j], ctx->q[j]);
+    }
+    bench_sink = acc;
+}
+
+static void
+bench_iq_magnitude_batch (uint64_t  n_ops,
+                          void     *user_data)
+{
+    iq_context_t *ctx = (iq_context_t *) user_data;
+    uint64_t      op;
+
+    for (op = 0; op < n_ops; op++)
+        microtouch3m_iq_magnitude_batch (ctx->i, ctx->q, ctx->magnitude, IQ_SAMPLES);
+    bench_sink = ctx->magnitude[op % IQ_SAMPLES];
+}
+
+/* Same amount of values, but one call per 4-corner report, as the tools do */
+static void
+bench_iq_magnitude_batch_report (uint64_t  n_ops,
+                                 void     *user_data)
+{
+    iq_context_t *ctx = (iq_context_t *) user_data;
+    uint64_t      op;
+
+    for (op = 0; op < n_ops; op++) {
+        unsigned int j;
+
+        for (j = 0; j < IQ_SAMPLES; j += 4)
+            microtouch3m_iq_magnitude_batch (&ctx->i[j], &ctx->q[j], &ctx->magnitude[j], 4);
+    }
+    bench_sink = ctx->magnitude[op % IQ_SAMPLES];
+}
+
+/* Stray correction and scaling one report at a time, as the scope used to do
+ * before microtouch3m_scope_signal_batch() */
+static void
+bench_scope_signal_report (uint64_t  n_ops,
+                           void     *user_data)
+{
+    iq_context_t *ctx = (iq_context_t *) user_data;
+    const double  scale = 390.0 / 1000000.0;
+    uint64_t      op;
+
+    for (op = 0; op < n_ops; op++) {
+        unsigned int j;
+        unsigned int k;
+
+        for (j = 0; j < IQ_SAMPLES; j += MICROTOUCH3M_SCOPE_N_CORNERS) {
+            microtouch3m_iq_magnitude_batch (&ctx->i[j], &ctx->q[j], &ctx->magnitude[j], MICROTOUCH3M_SCOPE_N_CORNERS);
+            for (k = 0; k < MICROTOUCH3M_SCOPE_N_CORNERS; k++)
+                ctx->signal[j + k] = (int32_t) (((int64_t) ctx->magnitude[j + k] - (int64_t) ctx->stray_signal[k]) * scale);
+        }
+    }
+    bench_sink = ctx->signal[op % IQ_SAMPLES];
+}
+
+static void
+bench_scope_signal_batch (uint64_t  n_ops,
+                          void     *user_data)
+{
+    iq_context_t *ctx = (iq_context_t *) user_data;
+    const double  scale = 390.0 / 1000000.0;
+    uint64_t      op;
+
+    for (op = 0; op < n_ops; op++)
+        microtouch3m_scope_signal_batch (ctx->i, ctx->q, ctx->stray_signal, scale, ctx->signal,
+                                         IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS);
+    bench_sink = ctx->signal[op % IQ_SAMPLES];
+}
+
+/* Streaming statistics over the same batch, as the frequency check does */
+static void
+bench_scope_stats_add (uint64_t  n_ops,
+                       void     *user_data)
+{
+    iq_context_t               *ctx = (iq_context_t *) user_data;
+    microtouch3m_scope_stats_t *stats;
+    uint64_t                    op;
+
+    stats = microtouch3m_scope_stats_new ();
+    for (op = 0; op < n_ops; op++)
+        microtouch3m_scope_stats_add (stats, ctx->signal, IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS);
+    microtouch3m_scope_stats_free (stats);
+}
+
+/* Welch spectrum over the same batch, with the 256-point segments the cli uses */
+static void
+bench_scope_spectrum_add (uint64_t  n_ops,
+                          void     *user_data)
+{
+    iq_context_t                  *ctx = (iq_context_t *) user_data;
+    microtouch3m_scope_spectrum_t *spectrum;
+    uint64_t                       op;
+
+    spectrum = microtouch3m_scope_spectrum_new (256);
+    for (op = 0; op < n_ops; op++)
+        microtouch3m_scope_spectrum_add (spectrum, ctx->signal, IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS);
+    microtouch3m_scope_spectrum_free (spectrum);
+}
+
+/* Decimation of the same batch into buckets of 16 reports, as a stream */
+static void
+bench_scope_decimator_add (uint64_t                            n_ops,
+                           iq_context_t                       *ctx,
+                           microtouch3m_scope_decimator_mode_t  mode)
+{
+    static double                   x[(2 * (IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS / 16 + 1) + 1) * MICROTOUCH3M_SCOPE_N_CORNERS];
+    static int32_t                  points[(2 * (IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS / 16 + 1) + 1) * MICROTOUCH3M_SCOPE_N_CORNERS];
+    microtouch3m_scope_decimator_t *decimator;
+    uint64_t                        op;
+    size_t                          n_points = 0;
+
+    decimator = microtouch3m_scope_decimator_new (mode, MICROTOUCH3M_SCOPE_N_CORNERS, 16);
+    for (op = 0; op < n_ops; op++)
+        n_points += microtouch3m_scope_decimator_add (decimator, NULL, ctx->signal, IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS, x, points);
+    bench_sink = n_points + (uint64_t) points[0];
+    microtouch3m_scope_decimator_free (decimator);
+}
+
+static void
+bench_scope_decimator_minmax (uint64_t  n_ops,
+                              void     *user_data)
+{
+    bench_scope_decimator_add (n_ops, (iq_context_t *) user_data, MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX);
+}
+
+static void
+bench_scope_decimator_lttb (uint64_t  n_ops,
+                            void     *user_data)
+{
+    bench_scope_decimator_add (n_ops, (iq_context_t *) user_data, MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB);
+}
+
+/* Filtering of the same batch, with the mains and backlight notches plus a
+ * low-pass and a decimator, as a stream */
+static void
+bench_scope_filter_process (uint64_t  n_ops,
+                            void     *user_data)
+{
+    static int32_t               filtered[IQ_SAMPLES];
+    iq_context_t                *ctx = (iq_context_t *) user_data;
+    microtouch3m_scope_filter_t *filter;
+    uint64_t                     op;
+    size_t                       n = 0;
+
+    filter = microtouch3m_scope_filter_new (200.0);
+    microtouch3m_scope_filter_add_from_string (filter, "notch:50,notch:60,lowpass:30,average:4,decimate:2");
+    for (op = 0; op < n_ops; op++)
+        n += microtouch3m_scope_filter_process (filter, ctx->signal, IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS, filtered);
+    bench_sink = n + (uint64_t) filtered[0];
+    microtouch3m_scope_filter_free (filter);
+}
+
+/* Touch positions of the same batch, with linearization, as the scope app does */
+static void
+bench_touch_estimator_process (uint64_t  n_ops,
+                               void     *user_data)
+{
+    static microtouch3m_touch_position_t              positions[IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS];
+    iq_context_t                                     *ctx = (iq_context_t *) user_data;
+    microtouch3m_touch_estimator_t                   *estimator;
+    struct microtouch3m_device_linearization_data_s   data;
+    uint64_t                                          op;
+
+    memset (&data, 0x08, sizeof (data));
+    estimator = microtouch3m_touch_estimator_new ();
+    microtouch3m_touch_estimator_set_linearization_data (estimator, &data);
+    microtouch3m_touch_estimator_set_orientation (estimator, MICROTOUCH3M_DEVICE_ORIENTATION_UL);
+    for (op = 0; op < n_ops; op++)
+        microtouch3m_touch_estimator_process (estimator, ctx->signal, positions, IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS);
+    bench_sink = (uint64_t) positions[op % (IQ_SAMPLES / MICROTOUCH3M_SCOPE_N_CORNERS)].strength;
+    microtouch3m_touch_estimator_free (estimator);
+}
+
+static void
+run_process_iq (void)
+{
+    iq_context_t *ctx;
+    unsigned int  j;
+
+    ctx = malloc (sizeof (iq_context_t));
+    for (j = 0; j < IQ_SAMPLES; j++) {
+        /* Signal values as reported by the controller, in the order of 1e6 */
+        ctx->i[j] = (int32_t) (bench_rand () % 4000000) - 2000000;
+        ctx->q[j] = (int32_t) (bench_rand () % 4000000) - 2000000;
+    }
+    for (j = 0; j < MICROTOUCH3M_SCOPE_N_CORNERS; j++)
+        ctx->stray_signal[j] = bench_rand () % 2000000;
+
+    /* One op processes one 4-corner report */
+    bench_run ("process_iq/4096", bench_process_iq, ctx, 0);
+    bench_run ("iq_magnitude_batch/4096", bench_iq_magnitude_batch, ctx, 0);
+    bench_run ("iq_magnitude_batch/1024x4", bench_iq_magnitude_batch_report, ctx, 0);
+    bench_run ("scope_signal/1024x1", bench_scope_signal_report, ctx, 0);
+    bench_run ("scope_signal_batch/1024", bench_scope_signal_batch, ctx, 0);
+    bench_run ("scope_stats_add/1024", bench_scope_stats_add, ctx, 0);
+    bench_run ("scope_spectrum_add/1024", bench_scope_spectrum_add, ctx, 0);
+    bench_run ("scope_decimator_minmax/1024", bench_scope_decimator_minmax, ctx, 0);
+    bench_run ("scope_decimator_lttb/1024", bench_scope_decimator_lttb, ctx, 0);
+    bench_run ("scope_filter_process/1024", bench_scope_filter_process, ctx, 0);
+    bench_run ("touch_estimator_process/1024", bench_touch_estimator_process, ctx, 0);
+    free (ctx);
+}
+
+/******************************************************************************/
+/* Intel HEX records */
+
+/* Same size as the firmware images handled by the library */
+#define IHEX_IMAGE_SIZE   0x8000
+#define IHEX_RECORD_BYTES 16
+#define IHEX_TEXT_SIZE    (128 * 1024)
+
+typedef struct {
+    uint8_t  image[IHEX_IMAGE_SIZE];
+    char    *text;
+    size_t   text_size;
+} ihex_context_t;
+
+static void
+bench_ihex_read (uint64_t  n_ops,
+                 void     *user_data)
+{
+    ihex_context_t *ctx = (ihex_context_t *) user_data;
+    uint64_t        acc = 0;
+    uint64_t        op;
+
+    for (op = 0; op < n_ops; op++) {
+        FILE       *f;
+        IHexRecord  record;
+
+        f = fmemopen (ctx->text, ctx->text_size, "r");
+        while (Read_IHexRecord (&record, f) == IHEX_OK) {
+            acc += record.address + record.dataLen;
+            if (record.type == IHEX_TYPE_01)
+                break;
+        }
+        fclose (f);
+    }
+    bench_sink = acc;
+}
+
+static size_t
+ihex_write_image (FILE          *f,
+                  const uint8_t *image)
+{
+    IHexRecord record;
+    size_t     offset;
+
+    for (offset = 0; offset < IHEX_IMAGE_SIZE; offset += IHEX_RECORD_BYTES) {
+        New_IHexRecord (IHEX_TYPE_00, (uint16_t) offset, &image[offset], IHEX_RECORD_BYTES, &record);
+        Write_IHexRecord (&record, f);
+    }
+    New_IHexRecord (IHEX_TYPE_01, 0, NULL, 0, &record);
+    Write_IHexRecord (&record, f);
+
+    return (size_t) ftell (f);
+}
+
+static void
+bench_ihex_write (uint64_t  n_ops,
+                  void     *user_data)
+{
+    ihex_context_t *ctx = (ihex_context_t *) user_data;
+    uint64_t        acc = 0;
+    uint64_t        op;
+    char           *buffer;
+    FILE           *f;
+
+    buffer = malloc (IHEX_TEXT_SIZE);
+    f = fmemopen (buffer, IHEX_TEXT_SIZE, "w");
+    for (op = 0; op < n_ops; op++) {
+        rewind (f);
+        acc += ihex_write_image (f, ctx->image);
+    }
+    fclose (f);
+    free (buffer);
+    bench_sink = acc;
+}
+
+static void
+run_ihex (void)
+{
+    ihex_context_t *ctx;
+    FILE           *f;
+
+    ctx = calloc (1, sizeof (ihex_context_t));
+    bench_fill_random (ctx->image, sizeof (ctx->image));
+
+    ctx->text = calloc (1, IHEX_TEXT_SIZE);
+    f = fmemopen (ctx->text, IHEX_TEXT_SIZE, "w");
+    ctx->text_size = ihex_write_image (f, ctx->image);
+    fclose (f);
+
+    bench_run ("ihex_read/32768",  bench_ihex_read,  ctx, IHEX_IMAGE_SIZE);
+    bench_run ("ihex_write/32768", bench_ihex_write, ctx, IHEX_IMAGE_SIZE);
+
+    free (ctx->text);
+    free (ctx);
+}
+
+/******************************************************************************/
+/* Linearization data files */
+
+typedef struct {
+    char                                     path[64];
+    struct microtouch3m_device_linearization_data_s data;
+} linearization_context_t;
+
+static void
+bench_linearization_data_file_read (uint64_t  n_ops,
+                                    void     *user_data)
+{
+    linearization_context_t *ctx = (linearization_context_t *) user_data;
+    uint64_t                 acc = 0;
+    uint64_t                 op;
+
+    for (op = 0; op < n_ops; op++) {
+        struct microtouch3m_device_linearization_data_s data;
+
+        if (microtouch3m_linearization_data_file_read (ctx->path, &data) == MICROTOUCH3M_STATUS_OK)
+            acc += ((const uint8_t *) &data)[op % sizeof (data)];
+    }
+    bench_sink = acc;
+}
+
+static void
+run_linearization_data_file (void)
+{
+    linearization_context_t *ctx;
+    int                      fd;
+
+    ctx = calloc (1, sizeof (linearization_context_t));
+    bench_fill_random ((uint8_t *) &ctx->data, sizeof (ctx->data));
+
+    strcpy (ctx->path, "/tmp/microtouch3m-bench-XXXXXX");
+    fd = mkstemp (ctx->path);
+    if (fd < 0) {
+        fprintf (stderr, "error: couldn't create temporary file\n");
+        goto out;
+    }
+    close (fd);
+
+    if (microtouch3m_linearization_data_file_write (ctx->path, &ctx->data) != MICROTOUCH3M_STATUS_OK) {
+        fprintf (stderr, "error: couldn't write linearization data file\n");
+        goto out;
+    }
+
+    bench_run ("linearization_data_file_read", bench_linearization_data_file_read, ctx, 0);
+
+out:
+    unlink (ctx->path);
+    free (ctx);
+}
+
+/******************************************************************************/
+/* Hex strings */
+
+typedef struct {
+    uint8_t *mem;
+    size_t   size;
+    char    *str;
+    size_t   str_size;
+    uint8_t *bin;
+} strhex_context_t;
+
+static void
+bench_strhex (uint64_t  n_ops,
+              void     *user_data)
+{
+    strhex_context_t *ctx = (strhex_context_t *) user_data;
+    uint64_t          acc = 0;
+    uint64_t          op;
+
+    for (op = 0; op < n_ops; op++) {
+        char *str;
+
+        str = strhex (ctx->mem, ctx->size, ":");
+        acc += (uint8_t) str[0];
+        free (str);
+    }
+    bench_sink = acc;
+}
+
+static void
+bench_strhex_to (uint64_t  n_ops,
+                 void     *user_data)
+{
+    strhex_context_t *ctx = (strhex_context_t *) user_data;
+    uint64_t          acc = 0;
+    uint64_t          op;
+
+    for (op = 0; op < n_ops; op++)
+        acc += strhex_to (ctx->str, ctx->str_size, ctx->mem, ctx->size, ":");
+    bench_sink = acc;
+}
+
+static void
+bench_strhex_multiline (uint64_t  n_ops,
+                        void     *user_data)
+{
+    strhex_context_t *ctx = (strhex_context_t *) user_data;
+    uint64_t          acc = 0;
+    uint64_t          op;
+
+    for (op = 0; op < n_ops; op++) {
+        char *str;
+
+        str = strhex_multiline (ctx->mem, ctx->size, 16, "\t", " ");
+        acc += (uint8_t) str[0];
+        free (str);
+    }
+    bench_sink = acc;
+}
+
+static void
+bench_strbin (uint64_t  n_ops,
+              void     *user_data)
+{
+    strhex_context_t *ctx = (strhex_context_t *) user_data;
+    uint64_t          acc = 0;
+    uint64_t          op;
+
+    for (op = 0; op < n_ops; op++)
+        acc += (uint64_t) strbin (ctx->str, ctx->bin, ctx->size);
+    bench_sink = acc;
+}
+
+static void
+run_strhex_size (size_t size)
+{
+    strhex_context_t ctx;
+    char             name[64];
+
+    ctx.size     = size;
+    ctx.mem      = malloc (size);
+    ctx.str_size = STRHEX_SIZE (size, 1);
+    ctx.str      = malloc (ctx.str_size);
+    ctx.bin      = malloc (size);
+    bench_fill_random (ctx.mem, size);
+
+    snprintf (name, sizeof (name), "strhex/%zu", size);
+    bench_run (name, bench_strhex, &ctx, size);
+    snprintf (name, sizeof (name), "strhex_to/%zu", size);
+    bench_run (name, bench_strhex_to, &ctx, size);
+    snprintf (name, sizeof (name), "strhex_multiline/%zu", size);
+    bench_run (name, bench_strhex_multiline, &ctx, size);
+
+    /* strbin parses the output of strhex_to */
+    strhex_to (ctx.str, ctx.str_size, ctx.mem, ctx.size, ":");
+    snprintf (name, sizeof (name), "strbin/%zu", size);
+    bench_run (name, bench_strbin, &ctx, size);
+
+    free (ctx.bin);
+    free (ctx.str);
+    free (ctx.mem);
+}
+
+static void
+run_strhex (void)
+{
+    /* Single report vs full firmware image */
+    run_strhex_size (64);
+    run_strhex_size (IHEX_IMAGE_SIZE);
+}
+
+/******************************************************************************/
+
+int main (int argc, char **argv)
+{
+    bench_rand_state = BENCH_SEED;
+
+    bench_header (PROGRAM_NAME, PROGRAM_VERSION);
+
+    run_process_iq ();
+    run_ihex ();
+    run_linearization_data_file ();
+    run_strhex ();
+
+    return EXIT_SUCCESS;
+}
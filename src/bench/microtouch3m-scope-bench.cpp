@@ -0,0 +1,211 @@
+/*
+ * microtouch3m-scope - Graphical tool for monitoring MicroTouch 3M touchscreen scope
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Sergey Zhuravlevich
+ */
+
+#include "config.h"
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#include "SDL.h"
+
+#include "BitmapFontRenderer.hpp"
+#include "LineChart.hpp"
+#include "SDLUtils.hpp"
+
+#include "bench.h"
+
+/* Same geometry and pixel format as the scope window */
+static const int s_surface_w = 1280;
+static const int s_surface_h = 800;
+static const int s_surface_bpp = 16;
+
+/* Same amount of samples per curve as the scope charts */
+static const int s_chart_samples = 4000;
+
+static uint32_t s_rand_state = 0x4d334d;
+
+static uint32_t bench_rand()
+{
+    /* xorshift32 */
+    s_rand_state ^= s_rand_state << 13;
+    s_rand_state ^= s_rand_state >> 17;
+    s_rand_state ^= s_rand_state << 5;
+    return s_rand_state;
+}
+
+struct Line
+{
+    int32_t x0, y0, x1, y1;
+};
+
+struct DrawLineContext
+{
+    SDL_Surface *surface;
+    std::vector<Line> lines;
+};
+
+static void bench_draw_line(uint64_t n_ops, void *user_data)
+{
+    DrawLineContext *ctx = static_cast<DrawLineContext *>(user_data);
+    const Uint32 col = SDL_MapRGB(ctx->surface->format, 0x00, 0xff, 0x00);
+
+    for (uint64_t op = 0; op < n_ops; ++op)
+    {
+        const Line &l = ctx->lines[op % ctx->lines.size()];
+        sdl_utils::draw_line(ctx->surface, l.x0, l.y0, l.x1, l.y1, col);
+    }
+}
+
+static void run_draw_line(SDL_Surface *surface)
+{
+    DrawLineContext ctx;
+
+    ctx.surface = surface;
+
+    /* Short segments, like the ones drawn between two chart samples */
+    for (int i = 0; i < 1024; ++i)
+    {
+        Line l;
+        l.x0 = bench_rand() % s_surface_w;
+        l.y0 = bench_rand() % s_surface_h;
+        l.x1 = l.x0 + (int32_t) (bench_rand() % 3);
+        l.y1 = l.y0 + (int32_t) (bench_rand() % 64) - 32;
+        ctx.lines.push_back(l);
+    }
+
+    sdl_utils::set_clip_area(0, 0, s_surface_w, s_surface_h);
+    SDL_LockSurface(surface);
+    bench_run("draw_line/short", bench_draw_line, &ctx, 0);
+    SDL_UnlockSurface(surface);
+
+    /* Full-screen segments */
+    ctx.lines.clear();
+    for (int i = 0; i < 1024; ++i)
+    {
+        Line l;
+        l.x0 = bench_rand() % s_surface_w;
+        l.y0 = bench_rand() % s_surface_h;
+        l.x1 = bench_rand() % s_surface_w;
+        l.y1 = bench_rand() % s_surface_h;
+        ctx.lines.push_back(l);
+    }
+
+    sdl_utils::set_clip_area(0, 0, s_surface_w, s_surface_h);
+    SDL_LockSurface(surface);
+    bench_run("draw_line/long", bench_draw_line, &ctx, 0);
+    SDL_UnlockSurface(surface);
+}
+
+struct LineChartContext
+{
+    SDL_Surface *surface;
+    LineChart<int> chart;
+};
+
+static void bench_line_chart(uint64_t n_ops, void *user_data)
+{
+    LineChartContext *ctx = static_cast<LineChartContext *>(user_data);
+
+    for (uint64_t op = 0; op < n_ops; ++op)
+        ctx->chart.draw(ctx->surface);
+}
+
+static void run_line_chart(SDL_Surface *surface)
+{
+    LineChartContext ctx;
+
+    ctx.surface = surface;
+    ctx.chart.set_geometry(0, 0, s_surface_w, s_surface_h / 2);
+
+    /* One curve per corner, as in the scope */
+    const Color colors[] = { Color(0xff, 0x00, 0x00), Color(0x00, 0xff, 0x00),
+                             Color(0x00, 0x00, 0xff), Color(0xff, 0xff, 0x00) };
+    for (int c = 0; c < 4; ++c)
+    {
+        LineChart<int>::Curve &curve = ctx.chart.add_curve(colors[c], s_chart_samples, 0);
+        for (int i = 0; i < s_chart_samples; ++i)
+            curve.set(i, (int) (bench_rand() % (s_surface_h / 2)) - s_surface_h / 4);
+    }
+
+    SDL_LockSurface(surface);
+    bench_run("line_chart_draw/4x4000", bench_line_chart, &ctx, 0);
+    SDL_UnlockSurface(surface);
+}
+
+struct FontContext
+{
+    SDL_Surface *surface;
+    BitmapFontRenderer *renderer;
+    std::string text;
+};
+
+static void bench_font_draw(uint64_t n_ops, void *user_data)
+{
+    FontContext *ctx = static_cast<FontContext *>(user_data);
+
+    for (uint64_t op = 0; op < n_ops; ++op)
+        ctx->renderer->draw(ctx->surface, 10, 10, ctx->text);
+}
+
+static void run_font_draw(SDL_Surface *surface)
+{
+    FontContext ctx;
+    BitmapFontRenderer renderer;
+    std::stringstream ss;
+
+    /* Same layout as the strays text panel */
+    ss << std::left << std::setw(11) << "STRAYS:" << std::right << "\n";
+    ss << std::left << std::setw(11) << "UL" << std::right << std::setw(12) << -1234567 << "\n";
+    ss << std::left << std::setw(11) << "UR" << std::right << std::setw(12) << 2345678 << "\n";
+    ss << std::left << std::setw(11) << "LL" << std::right << std::setw(12) << -3456789 << "\n";
+    ss << std::left << std::setw(11) << "LR" << std::right << std::setw(12) << 4567890 << "\n";
+    ss << std::left << std::setw(11) << "RATE HZ" << std::right << std::setw(12) << 123.4 << "\n";
+
+    ctx.surface = surface;
+    ctx.renderer = &renderer;
+    ctx.text = ss.str();
+
+    bench_run("bitmap_font_draw/strays", bench_font_draw, &ctx, ctx.text.size());
+}
+
+int main(int argc, char **argv)
+{
+    SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE, s_surface_w, s_surface_h, s_surface_bpp,
+                                                0, 0, 0, 0);
+    if (!surface)
+    {
+        std::cerr << "Failed to create offscreen surface: " << SDL_GetError() << std::endl;
+        return 1;
+    }
+
+    bench_header("microtouch3m-scope-bench", PACKAGE_VERSION);
+
+    run_draw_line(surface);
+    run_line_chart(surface);
+    run_font_draw(surface);
+
+    SDL_FreeSurface(surface);
+
+    return 0;
+}
@@ -29,43 +29,155 @@
 
 #include "common.h"
 
+/* Two characters per byte value, so that encoding is a single lookup */
+#define HEX_ROW(h)                                                      \
+    h "0" h "1" h "2" h "3" h "4" h "5" h "6" h "7"                     \
+    h "8" h "9" h "A" h "B" h "C" h "D" h "E" h "F"
+
+static const char hexpairs[] =
+    HEX_ROW ("0") HEX_ROW ("1") HEX_ROW ("2") HEX_ROW ("3")
+    HEX_ROW ("4") HEX_ROW ("5") HEX_ROW ("6") HEX_ROW ("7")
+    HEX_ROW ("8") HEX_ROW ("9") HEX_ROW ("A") HEX_ROW ("B")
+    HEX_ROW ("C") HEX_ROW ("D") HEX_ROW ("E") HEX_ROW ("F");
+
+#define HEX_PAIR(out, byte) memcpy ((out), &hexpairs[(byte) * 2], 2)
+
+size_t
+strhex_to (char       *out,
+           size_t      out_size,
+           const void *mem,
+           size_t      size,
+           const char *delimiter)
+{
+    const uint8_t *data = mem;
+    size_t         i, j, delimiter_length, needed, n_bytes;
+
+    /* Allow delimiters of arbitrary sizes, including 0 */
+    delimiter_length = (delimiter ? strlen (delimiter) : 0);
+    needed = size ? ((2 * size) + ((size - 1) * delimiter_length)) : 0;
+
+    if (!out_size)
+        return needed;
+
+    /* Only print full bytes: how many of them fit? */
+    if (needed < out_size)
+        n_bytes = size;
+    else
+        n_bytes = (out_size - 1 + delimiter_length) / (2 + delimiter_length);
+
+    j = 0;
+    switch (delimiter_length) {
+    case 0:
+        for (i = 0; i < n_bytes; i++, j += 2)
+            HEX_PAIR (&out[j], data[i]);
+        break;
+    case 1:
+        for (i = 0; i < n_bytes; i++, j += 3) {
+            HEX_PAIR (&out[j], data[i]);
+            out[j + 2] = delimiter[0];
+        }
+        /* Remove trailing delimiter */
+        if (n_bytes)
+            j--;
+        break;
+    default:
+        for (i = 0; i < n_bytes; i++) {
+            HEX_PAIR (&out[j], data[i]);
+            j += 2;
+            if (i != (n_bytes - 1)) {
+                memcpy (&out[j], delimiter, delimiter_length);
+                j += delimiter_length;
+            }
+        }
+        break;
+    }
+
+    out[j] = '\0';
+    return needed;
+}
+
 char *
 strhex (const void *mem,
         size_t      size,
         const char *delimiter)
 {
-    const uint8_t *data = mem;
-    size_t         i, j, new_str_length, delimiter_length;
-    char          *new_str;
+    size_t  new_str_length;
+    char   *new_str;
 
     assert (size > 0);
 
-    /* Allow delimiters of arbitrary sizes, including 0 */
-    delimiter_length = (delimiter ? strlen (delimiter) : 0);
+    new_str_length = strhex_to (NULL, 0, mem, size, delimiter) + 1;
+    new_str = malloc (new_str_length);
+    if (new_str)
+        strhex_to (new_str, new_str_length, mem, size, delimiter);
+    return new_str;
+}
 
-    /* Get new string length. If input string has N bytes, we need:
-     * - 1 byte for last NUL char
-     * - 2N bytes for hexadecimal char representation of each byte...
-     * - N-1 times the delimiter length
-     * So... e.g. if delimiter is 1 byte,  a total of:
-     *   (1+2N+N-1) = 3N bytes are needed...
-     */
-    new_str_length =  1 + (2 * size) + ((size - 1) * delimiter_length);
+size_t
+strhex_multiline_to (char       *out,
+                     size_t      out_size,
+                     const void *mem,
+                     size_t      size,
+                     size_t      max_bytes_per_line,
+                     const char *line_prefix,
+                     const char *delimiter)
+{
+    const uint8_t *data = mem;
+    size_t         i, j, line_prefix_length, n_lines, delimiter_length, needed, line_length, separator_length;
 
-    /* Allocate memory for new array and initialize contents to NUL */
-    new_str = calloc (new_str_length, 1);
+    line_prefix_length = (line_prefix ? strlen (line_prefix) : 0);
+    delimiter_length = (delimiter ? strlen (delimiter) : 0);
 
-    /* Print hexadecimal representation of each byte... */
-    for (i = 0, j = 0; i < size; i++, j += (2 + delimiter_length)) {
-        /* Print character in output string... */
-        snprintf (&new_str[j], 3, "%02X", data[i]);
-        /* And if needed, add separator */
-        if (delimiter_length && i != (size - 1) )
-            strncpy (&new_str[j + 2], delimiter, delimiter_length);
+    if (!size)
+        needed = 0;
+    else {
+        /* Each line break replaces a delimiter with EOL + prefix */
+        n_lines = (size + max_bytes_per_line - 1) / max_bytes_per_line;
+        needed = (2 * size) + ((size - n_lines) * delimiter_length) + ((n_lines - 1) * (1 + line_prefix_length));
     }
 
-    /* Set output string */
-    return new_str;
+    if (!out_size)
+        return needed;
+
+    if (needed < out_size) {
+        /* Fast path, whole lines at once */
+        for (i = 0, j = 0; i < size; i += max_bytes_per_line) {
+            line_length = ((size - i) < max_bytes_per_line) ? (size - i) : max_bytes_per_line;
+            if (i) {
+                out[j++] = '\n';
+                memcpy (&out[j], line_prefix, line_prefix_length);
+                j += line_prefix_length;
+            }
+            j += strhex_to (&out[j], out_size - j, &data[i], line_length, delimiter);
+        }
+        out[j] = '\0';
+        return needed;
+    }
+
+    /* Truncated output, only print full bytes */
+    for (i = 0, j = 0; i < size; i++) {
+        if (!i)
+            separator_length = 0;
+        else if (i % max_bytes_per_line == 0)
+            separator_length = 1 + line_prefix_length;
+        else
+            separator_length = delimiter_length;
+
+        if (j + separator_length + 2 >= out_size)
+            break;
+
+        if (separator_length && (i % max_bytes_per_line == 0)) {
+            out[j] = '\n';
+            memcpy (&out[j + 1], line_prefix, line_prefix_length);
+        } else if (separator_length)
+            memcpy (&out[j], delimiter, delimiter_length);
+        j += separator_length;
+
+        HEX_PAIR (&out[j], data[i]);
+        j += 2;
+    }
+    out[j] = '\0';
+    return needed;
 }
 
 char *
@@ -75,48 +187,19 @@ strhex_multiline (const void *mem,
                   const char *line_prefix,
                   const char *delimiter)
 {
-    const uint8_t *data = mem;
-    size_t         i, j, new_str_length, line_prefix_length, n_line_prefixes, delimiter_length;
-    char          *new_str;
+    size_t  new_str_length;
+    char   *new_str;
 
     assert (size > 0);
 
-    line_prefix_length = (line_prefix ? strlen (line_prefix) : 0);
-    n_line_prefixes = size / max_bytes_per_line;
-
-    /* Allow delimiters of arbitrary sizes, including 0 */
-    delimiter_length = (delimiter ? strlen (delimiter) : 0);
-
-    new_str_length = 1 + (2 * size) + (n_line_prefixes * line_prefix_length) + ((size - 1) * delimiter_length);
-    new_str = calloc (new_str_length + 1, 1);
-
-    /* Print hexadecimal representation of each byte... */
-    for (i = 0, j = 0; i < size; i++) {
-        /* Print character in output string... */
-        snprintf (&new_str[j], 3, "%02X", data[i]);
-        /* And if needed, add separator or EOL + prefix*/
-        if (i != (size - 1)) {
-            if ((i + 1) % max_bytes_per_line == 0) {
-                new_str[j + 2] = '\n';
-                j += 3;
-                if (line_prefix_length) {
-                    strncpy (&new_str[j], line_prefix, line_prefix_length);
-                    j += line_prefix_length;
-                }
-            } else {
-                j += 2;
-                if (delimiter_length) {
-                    strncpy (&new_str[j], delimiter, delimiter_length);
-                    j += delimiter_length;
-                }
-            }
-        }
-    }
-
+    new_str_length = strhex_multiline_to (NULL, 0, mem, size, max_bytes_per_line, line_prefix, delimiter) + 1;
+    new_str = malloc (new_str_length);
+    if (new_str)
+        strhex_multiline_to (new_str, new_str_length, mem, size, max_bytes_per_line, line_prefix, delimiter);
     return new_str;
 }
 
-static const long hextable[] = {
+static const int8_t hextable[] = {
    [0 ... 255] = -1,
    ['0'] = 0, 1, 2, 3, 4, 5, 6, 7, 8, 9,
    ['A'] = 10, 11, 12, 13, 14, 15,
@@ -128,35 +211,38 @@ strbin (const char *str,
         uint8_t    *buffer,
         size_t      buffer_size)
 {
-    size_t str_len;
-    size_t i = 0, j = 0;
-
-    str_len = strlen (str);
-
-    while (i < str_len) {
-        long xdigith;
-        long xdigitl;
+    const uint8_t *p = (const uint8_t *) str;
+    size_t         j = 0;
+    int            xdigith;
+    int            xdigitl;
+
+    /* Single pass, no strlen(); the NUL terminator isn't a hex digit, so the
+     * table lookup also detects the end of the string */
+    while (*p) {
+        /* Fast path: two hex digits in a row */
+        if ((xdigith = hextable[p[0]]) >= 0 && (xdigitl = hextable[p[1]]) >= 0) {
+            if (j >= buffer_size)
+                return (ssize_t) -1;
+            buffer[j++] = (uint8_t) (xdigith << 4 | xdigitl);
+            p += 2;
+            continue;
+        }
 
-        if (str[i] == ' ' || str[i] == '\n' || str[i] == ':') {
-            i++;
+        if (*p == ' ' || *p == '\n' || *p == ':') {
+            p++;
             continue;
         }
 
         if (j >= buffer_size)
             return (ssize_t) -1;
 
-        xdigith = hextable [(int) str[i++]];
         if (xdigith < 0)
             return (ssize_t) -2;
 
-        if (i >= str_len)
+        if (!p[1])
             return (ssize_t) -3;
 
-        xdigitl = hextable [(int) str[i++]];
-        if (xdigitl < 0)
-            return (ssize_t) -4;
-
-        buffer[j++] = xdigith << 4 | xdigitl;
+        return (ssize_t) -4;
     }
 
     return (ssize_t) j;
@@ -211,3 +297,28 @@ str_usb_location (uint8_t        bus,
     return new_str;
 
 }
+
+/* CRC-32 (IEEE 802.3, reflected 0xEDB88320 polynomial), processed one nibble
+ * at a time so that the lookup table stays small */
+static const uint32_t crc32_nibble_table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+};
+
+uint32_t
+crc32_update (uint32_t    crc,
+              const void *mem,
+              size_t      size)
+{
+    const uint8_t *data = mem;
+    size_t         i;
+
+    crc = ~crc;
+    for (i = 0; i < size; i++) {
+        crc = (crc >> 4) ^ crc32_nibble_table[(crc ^ data[i]) & 0x0F];
+        crc = (crc >> 4) ^ crc32_nibble_table[(crc ^ (data[i] >> 4)) & 0x0F];
+    }
+    return ~crc;
+}
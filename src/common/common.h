@@ -27,6 +27,28 @@
 #include <stdint.h>
 #include <sys/types.h>
 
+/* Upper bound of the strhex() output size for a given input size and
+ * delimiter length, including the NUL terminator */
+#define STRHEX_SIZE(size, delimiter_length) (((size) * (2 + (delimiter_length))) + 1)
+
+/* The _to() variants write into a caller provided buffer and never allocate.
+ * As snprintf(), they return the length the full string would have (without
+ * NUL), and always NUL-terminate the output if out_size > 0. A truncated
+ * output only contains full bytes. */
+size_t strhex_to (char       *out,
+                  size_t      out_size,
+                  const void *mem,
+                  size_t      size,
+                  const char *delimiter);
+
+size_t strhex_multiline_to (char       *out,
+                            size_t      out_size,
+                            const void *mem,
+                            size_t      size,
+                            size_t      max_bytes_per_line,
+                            const char *line_prefix,
+                            const char *delimiter);
+
 char *strhex (const void *mem,
               size_t      size,
               const char *delimiter);
@@ -48,4 +70,9 @@ char *str_usb_location (uint8_t        bus,
                         const uint8_t *port_numbers,
                         int            port_numbers_len);
 
+/* Start with crc 0, and feed the result back in to process data in chunks */
+uint32_t crc32_update (uint32_t    crc,
+                       const void *mem,
+                       size_t      size);
+
 #endif /* COMMON_H */
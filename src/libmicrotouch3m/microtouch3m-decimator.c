@@ -0,0 +1,390 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Scope decimator
+ *
+ * Min/max: each bucket of each channel is reduced to its minimum and maximum,
+ * emitted in the order in which they happened.
+ *
+ * LTTB (largest triangle three buckets): the first sample is kept, and then
+ * each bucket is reduced to the sample forming the largest triangle with the
+ * sample kept from the previous bucket and the average of the next bucket.
+ * Streaming means a bucket is only reduced once the next one is complete, so
+ * two buckets are kept: the pending one, and the one being filled.
+ */
+
+struct microtouch3m_scope_decimator_s {
+    microtouch3m_scope_decimator_mode_t mode;
+    unsigned int                        n_channels;
+    unsigned int                        bucket_size;
+    uint64_t                            n_samples;
+
+    /* bucket being filled */
+    unsigned int                        count;
+
+    /* min/max, per channel */
+    double                             *min_x;
+    double                             *max_x;
+    int32_t                            *min_value;
+    int32_t                            *max_value;
+
+    /* lttb: samples of the bucket being filled and of the pending one */
+    double                             *x[2];
+    int32_t                            *value[2];    /* sample-major */
+    unsigned int                        current;
+    bool                                pending;
+    double                              sum_x;
+    double                             *sum_value;   /* per channel */
+    double                             *anchor_x;    /* per channel */
+    double                             *anchor_value;
+};
+
+microtouch3m_scope_decimator_t *
+microtouch3m_scope_decimator_new (microtouch3m_scope_decimator_mode_t mode,
+                                  unsigned int                        n_channels,
+                                  unsigned int                        bucket_size)
+{
+    microtouch3m_scope_decimator_t *decimator;
+
+    if (!n_channels || bucket_size < 2 ||
+        (mode != MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX && mode != MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB))
+        return NULL;
+
+    if (!(decimator = calloc (1, sizeof (microtouch3m_scope_decimator_t))))
+        return NULL;
+
+    decimator->mode        = mode;
+    decimator->n_channels  = n_channels;
+    decimator->bucket_size = bucket_size;
+
+    if (mode == MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX) {
+        if (!(decimator->min_x     = calloc (n_channels, sizeof (double)))  ||
+            !(decimator->max_x     = calloc (n_channels, sizeof (double)))  ||
+            !(decimator->min_value = calloc (n_channels, sizeof (int32_t))) ||
+            !(decimator->max_value = calloc (n_channels, sizeof (int32_t))))
+            goto error;
+    } else {
+        if (!(decimator->x[0]         = calloc (bucket_size, sizeof (double)))               ||
+            !(decimator->x[1]         = calloc (bucket_size, sizeof (double)))               ||
+            !(decimator->value[0]     = calloc (bucket_size * n_channels, sizeof (int32_t))) ||
+            !(decimator->value[1]     = calloc (bucket_size * n_channels, sizeof (int32_t))) ||
+            !(decimator->sum_value    = calloc (n_channels, sizeof (double)))                ||
+            !(decimator->anchor_x     = calloc (n_channels, sizeof (double)))                ||
+            !(decimator->anchor_value = calloc (n_channels, sizeof (double))))
+            goto error;
+    }
+
+    return decimator;
+
+error:
+    microtouch3m_scope_decimator_free (decimator);
+    return NULL;
+}
+
+void
+microtouch3m_scope_decimator_free (microtouch3m_scope_decimator_t *decimator)
+{
+    if (!decimator)
+        return;
+
+    free (decimator->min_x);
+    free (decimator->max_x);
+    free (decimator->min_value);
+    free (decimator->max_value);
+    free (decimator->x[0]);
+    free (decimator->x[1]);
+    free (decimator->value[0]);
+    free (decimator->value[1]);
+    free (decimator->sum_value);
+    free (decimator->anchor_x);
+    free (decimator->anchor_value);
+    free (decimator);
+}
+
+void
+microtouch3m_scope_decimator_reset (microtouch3m_scope_decimator_t *decimator)
+{
+    decimator->n_samples = 0;
+    decimator->count     = 0;
+    decimator->pending   = false;
+}
+
+size_t
+microtouch3m_scope_decimator_get_max_points (const microtouch3m_scope_decimator_t *decimator,
+                                             size_t                                n_samples)
+{
+    /* the buckets completed, the first sample (lttb) and the flushed ones */
+    return 2 * ((n_samples / decimator->bucket_size) + 1) + 1;
+}
+
+/******************************************************************************/
+/* Min/max */
+
+static size_t
+minmax_emit (microtouch3m_scope_decimator_t *decimator,
+             double                         *out_x,
+             int32_t                        *out_value)
+{
+    unsigned int c;
+    unsigned int n = decimator->n_channels;
+
+    for (c = 0; c < n; c++) {
+        bool min_first;
+
+        min_first = (decimator->min_x[c] <= decimator->max_x[c]);
+        out_x[c]         = min_first ? decimator->min_x[c]     : decimator->max_x[c];
+        out_value[c]     = min_first ? decimator->min_value[c] : decimator->max_value[c];
+        out_x[n + c]     = min_first ? decimator->max_x[c]     : decimator->min_x[c];
+        out_value[n + c] = min_first ? decimator->max_value[c] : decimator->min_value[c];
+    }
+
+    decimator->count = 0;
+    return 2;
+}
+
+static size_t
+minmax_add (microtouch3m_scope_decimator_t *decimator,
+            double                          x,
+            const int32_t                  *value,
+            double                         *out_x,
+            int32_t                        *out_value)
+{
+    unsigned int c;
+
+    for (c = 0; c < decimator->n_channels; c++) {
+        if (!decimator->count || value[c] < decimator->min_value[c]) {
+            decimator->min_value[c] = value[c];
+            decimator->min_x[c]     = x;
+        }
+        if (!decimator->count || value[c] > decimator->max_value[c]) {
+            decimator->max_value[c] = value[c];
+            decimator->max_x[c]     = x;
+        }
+    }
+
+    if (++decimator->count < decimator->bucket_size)
+        return 0;
+    return minmax_emit (decimator, out_x, out_value);
+}
+
+/******************************************************************************/
+/* LTTB */
+
+/* Reduces a bucket to one point per channel, given the point each channel
+ * selected before and the point it will be followed by */
+static void
+lttb_reduce (microtouch3m_scope_decimator_t *decimator,
+             unsigned int                    bucket,
+             unsigned int                    n_points,
+             double                          next_x,
+             const double                   *next_value,
+             double                         *out_x,
+             int32_t                        *out_value)
+{
+    const double  *x;
+    const int32_t *value;
+    unsigned int   c;
+    unsigned int   k;
+
+    x     = decimator->x[bucket];
+    value = decimator->value[bucket];
+
+    for (c = 0; c < decimator->n_channels; c++) {
+        double       ax = decimator->anchor_x[c];
+        double       ay = decimator->anchor_value[c];
+        double       best_area = -1.0;
+        unsigned int best = 0;
+
+        for (k = 0; k < n_points; k++) {
+            double area;
+
+            area = ((ax - next_x) * (value[k * decimator->n_channels + c] - ay)) -
+                   ((ax - x[k]) * (next_value[c] - ay));
+            if (area < 0.0)
+                area = -area;
+            if (area > best_area) {
+                best_area = area;
+                best = k;
+            }
+        }
+
+        out_x[c]     = x[best];
+        out_value[c] = value[best * decimator->n_channels + c];
+        decimator->anchor_x[c]     = out_x[c];
+        decimator->anchor_value[c] = out_value[c];
+    }
+}
+
+static size_t
+lttb_add (microtouch3m_scope_decimator_t *decimator,
+          double                          x,
+          const int32_t                  *value,
+          double                         *out_x,
+          int32_t                        *out_value)
+{
+    unsigned int c;
+    size_t       n_out = 0;
+
+    /* The first sample is always kept */
+    if (!decimator->n_samples) {
+        for (c = 0; c < decimator->n_channels; c++) {
+            out_x[c]     = x;
+            out_value[c] = value[c];
+            decimator->anchor_x[c]     = x;
+            decimator->anchor_value[c] = value[c];
+        }
+        return 1;
+    }
+
+    if (!decimator->count) {
+        decimator->sum_x = 0.0;
+        for (c = 0; c < decimator->n_channels; c++)
+            decimator->sum_value[c] = 0.0;
+    }
+
+    decimator->x[decimator->current][decimator->count] = x;
+    memcpy (&decimator->value[decimator->current][decimator->count * decimator->n_channels],
+            value, decimator->n_channels * sizeof (int32_t));
+    decimator->sum_x += x;
+    for (c = 0; c < decimator->n_channels; c++)
+        decimator->sum_value[c] += value[c];
+
+    if (++decimator->count < decimator->bucket_size)
+        return 0;
+
+    /* Bucket complete: the pending one can be reduced against its average */
+    if (decimator->pending) {
+        for (c = 0; c < decimator->n_channels; c++)
+            decimator->sum_value[c] /= decimator->bucket_size;
+        lttb_reduce (decimator, !decimator->current, decimator->bucket_size,
+                     decimator->sum_x / decimator->bucket_size, decimator->sum_value,
+                     out_x, out_value);
+        n_out = 1;
+    }
+
+    decimator->pending = true;
+    decimator->current = !decimator->current;
+    decimator->count   = 0;
+    return n_out;
+}
+
+static size_t
+lttb_flush (microtouch3m_scope_decimator_t *decimator,
+            double                         *out_x,
+            int32_t                        *out_value)
+{
+    unsigned int   n = decimator->n_channels;
+    unsigned int   last_bucket;
+    unsigned int   last;
+    unsigned int   c;
+    size_t         n_out = 0;
+
+    if (!decimator->pending && !decimator->count)
+        return 0;
+
+    /* The last sample is always kept, and targeted by the buckets before it */
+    last_bucket = decimator->count ? decimator->current : !decimator->current;
+    last        = decimator->count ? (decimator->count - 1) : (decimator->bucket_size - 1);
+    for (c = 0; c < n; c++)
+        decimator->sum_value[c] = decimator->value[last_bucket][last * n + c];
+
+    if (decimator->pending) {
+        lttb_reduce (decimator, !decimator->current, decimator->bucket_size,
+                     decimator->x[last_bucket][last], decimator->sum_value,
+                     &out_x[n_out * n], &out_value[n_out * n]);
+        n_out++;
+    }
+
+    if (decimator->count > 1) {
+        lttb_reduce (decimator, decimator->current, decimator->count - 1,
+                     decimator->x[last_bucket][last], decimator->sum_value,
+                     &out_x[n_out * n], &out_value[n_out * n]);
+        n_out++;
+    }
+
+    for (c = 0; c < n; c++) {
+        out_x[n_out * n + c]     = decimator->x[last_bucket][last];
+        out_value[n_out * n + c] = decimator->value[last_bucket][last * n + c];
+    }
+    return n_out + 1;
+}
+
+/******************************************************************************/
+
+size_t
+microtouch3m_scope_decimator_add (microtouch3m_scope_decimator_t *decimator,
+                                  const double                   *x,
+                                  const int32_t                  *signal,
+                                  size_t                          n_samples,
+                                  double                         *out_x,
+                                  int32_t                        *out_signal)
+{
+    size_t n;
+    size_t n_out = 0;
+
+    for (n = 0; n < n_samples; n++) {
+        double         sample_x;
+        const int32_t *value;
+        double        *point_x;
+        int32_t       *point_value;
+
+        sample_x    = x ? x[n] : (double) decimator->n_samples;
+        value       = &signal[n * decimator->n_channels];
+        point_x     = &out_x[n_out * decimator->n_channels];
+        point_value = &out_signal[n_out * decimator->n_channels];
+
+        if (decimator->mode == MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX)
+            n_out += minmax_add (decimator, sample_x, value, point_x, point_value);
+        else
+            n_out += lttb_add (decimator, sample_x, value, point_x, point_value);
+
+        decimator->n_samples++;
+    }
+
+    return n_out;
+}
+
+size_t
+microtouch3m_scope_decimator_flush (microtouch3m_scope_decimator_t *decimator,
+                                    double                         *out_x,
+                                    int32_t                        *out_signal)
+{
+    size_t n_out = 0;
+
+    if (decimator->mode == MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX) {
+        if (decimator->count)
+            n_out = minmax_emit (decimator, out_x, out_signal);
+    } else
+        n_out = lttb_flush (decimator, out_x, out_signal);
+
+    microtouch3m_scope_decimator_reset (decimator);
+    return n_out;
+}
@@ -0,0 +1,223 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Stray drift tracker
+ *
+ * Each corner is fitted with a least squares line over the last reads. When
+ * a new read is within the tolerance of the prediction the polling interval is
+ * doubled, up to the maximum; otherwise the trend is considered broken, the
+ * older reads are dropped and the interval goes back to the minimum.
+ */
+
+#define STRAY_TRACKER_WINDOW 8
+
+struct microtouch3m_stray_tracker_s {
+    unsigned int min_interval_ms;
+    unsigned int max_interval_ms;
+    double       tolerance;
+
+    unsigned int interval_ms;
+    double       residual;
+    uint64_t     n_updates;
+    uint64_t     n_fallbacks;
+
+    /* last reads, times relative to the first one */
+    bool         started;
+    double       start_s;
+    unsigned int n_reads;
+    unsigned int next;
+    double       time_s [STRAY_TRACKER_WINDOW];
+    double       stray_signal [STRAY_TRACKER_WINDOW][MICROTOUCH3M_SCOPE_N_CORNERS];
+};
+
+microtouch3m_stray_tracker_t *
+microtouch3m_stray_tracker_new (unsigned int min_interval_ms,
+                                unsigned int max_interval_ms,
+                                double       tolerance)
+{
+    microtouch3m_stray_tracker_t *tracker;
+
+    if (!min_interval_ms || max_interval_ms < min_interval_ms || tolerance < 0.0)
+        return NULL;
+
+    if (!(tracker = calloc (1, sizeof (microtouch3m_stray_tracker_t))))
+        return NULL;
+
+    tracker->min_interval_ms = min_interval_ms;
+    tracker->max_interval_ms = max_interval_ms;
+    tracker->tolerance       = tolerance;
+    microtouch3m_stray_tracker_reset (tracker);
+    return tracker;
+}
+
+void
+microtouch3m_stray_tracker_free (microtouch3m_stray_tracker_t *tracker)
+{
+    free (tracker);
+}
+
+void
+microtouch3m_stray_tracker_reset (microtouch3m_stray_tracker_t *tracker)
+{
+    tracker->interval_ms = tracker->min_interval_ms;
+    tracker->residual    = 0.0;
+    tracker->n_updates   = 0;
+    tracker->n_fallbacks = 0;
+    tracker->started     = false;
+    tracker->n_reads     = 0;
+    tracker->next        = 0;
+}
+
+static void
+predict (const microtouch3m_stray_tracker_t *tracker,
+         double                              time_s,
+         double                             *out)
+{
+    double       mean_t = 0.0;
+    double       var_t = 0.0;
+    unsigned int c;
+    unsigned int k;
+
+    for (k = 0; k < tracker->n_reads; k++)
+        mean_t += tracker->time_s[k];
+    mean_t /= tracker->n_reads;
+    for (k = 0; k < tracker->n_reads; k++)
+        var_t += (tracker->time_s[k] - mean_t) * (tracker->time_s[k] - mean_t);
+
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+        double mean_v = 0.0;
+        double cov = 0.0;
+
+        for (k = 0; k < tracker->n_reads; k++)
+            mean_v += tracker->stray_signal[k][c];
+        mean_v /= tracker->n_reads;
+
+        /* a single read, or all at once, gives no trend */
+        if (!(var_t > 0.0)) {
+            out[c] = mean_v;
+            continue;
+        }
+
+        for (k = 0; k < tracker->n_reads; k++)
+            cov += (tracker->time_s[k] - mean_t) * (tracker->stray_signal[k][c] - mean_v);
+        out[c] = mean_v + (cov / var_t) * (time_s - mean_t);
+    }
+}
+
+void
+microtouch3m_stray_tracker_update (microtouch3m_stray_tracker_t *tracker,
+                                   double                        time_s,
+                                   const uint64_t               *stray_signal)
+{
+    unsigned int c;
+
+    if (!tracker->started) {
+        tracker->started = true;
+        tracker->start_s = time_s;
+    }
+    time_s -= tracker->start_s;
+
+    if (tracker->n_reads) {
+        double predicted[MICROTOUCH3M_SCOPE_N_CORNERS];
+
+        predict (tracker, time_s, predicted);
+        tracker->residual = 0.0;
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+            double error;
+
+            error = fabs ((double) stray_signal[c] - predicted[c]);
+            if (error > tracker->residual)
+                tracker->residual = error;
+        }
+
+        if (tracker->residual > tracker->tolerance) {
+            tracker->interval_ms = tracker->min_interval_ms;
+            tracker->n_reads     = 0;
+            tracker->next        = 0;
+            tracker->n_fallbacks++;
+        } else if (tracker->interval_ms < tracker->max_interval_ms) {
+            tracker->interval_ms *= 2;
+            if (tracker->interval_ms > tracker->max_interval_ms)
+                tracker->interval_ms = tracker->max_interval_ms;
+        }
+    }
+
+    tracker->time_s[tracker->next] = time_s;
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+        tracker->stray_signal[tracker->next][c] = (double) stray_signal[c];
+    tracker->next = (tracker->next + 1) % STRAY_TRACKER_WINDOW;
+    if (tracker->n_reads < STRAY_TRACKER_WINDOW)
+        tracker->n_reads++;
+    tracker->n_updates++;
+}
+
+void
+microtouch3m_stray_tracker_predict (const microtouch3m_stray_tracker_t *tracker,
+                                    double                              time_s,
+                                    uint64_t                           *stray_signal)
+{
+    double       predicted[MICROTOUCH3M_SCOPE_N_CORNERS];
+    unsigned int c;
+
+    if (!tracker->n_reads) {
+        memset (stray_signal, 0, MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (uint64_t));
+        return;
+    }
+
+    predict (tracker, time_s - tracker->start_s, predicted);
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+        stray_signal[c] = predicted[c] > 0.0 ? (uint64_t) (predicted[c] + 0.5) : 0;
+}
+
+unsigned int
+microtouch3m_stray_tracker_get_interval_ms (const microtouch3m_stray_tracker_t *tracker)
+{
+    return tracker->interval_ms;
+}
+
+double
+microtouch3m_stray_tracker_get_residual (const microtouch3m_stray_tracker_t *tracker)
+{
+    return tracker->residual;
+}
+
+uint64_t
+microtouch3m_stray_tracker_get_n_updates (const microtouch3m_stray_tracker_t *tracker)
+{
+    return tracker->n_updates;
+}
+
+uint64_t
+microtouch3m_stray_tracker_get_n_fallbacks (const microtouch3m_stray_tracker_t *tracker)
+{
+    return tracker->n_fallbacks;
+}
@@ -0,0 +1,1183 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <endian.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include <assert.h>
+#include <pthread.h>
+
+#include "microtouch3m.h"
+#include "microtouch3m-log.h"
+#include "microtouch3m-protocol.h"
+#include "microtouch3m-transport.h"
+
+/******************************************************************************/
+/* Emulated controller
+ *
+ * Implements the device side of the vendor protocol on top of in-memory
+ * EEPROM, NOVRAM and settings blocks, so that every library operation can run
+ * without hardware. Requests the emulator doesn't know about are stalled, as
+ * the real controller does.
+ *
+ * The scope report stream is paced at the configured rate, and carries the
+ * strays, optionally drifting, plus a synthetic touch moving around the screen
+ * plus noise. The noise level depends on the selected frequency, so that
+ * frequency checks have a best choice. After a reset, the signals optionally
+ * settle from a large offset, slower at lower frequencies. The data only
+ * depends on the seed and the report number.
+ *
+ * Alternatively, the scope reports and strays are replayed from a recording,
+ * either following the recorded timestamps or as fast as they're read.
+ */
+
+#define EMULATOR_MAX_DEVICES       8
+#define EMULATOR_BUS_NUMBER        1
+#define EMULATOR_SETTINGS_SIZE     0x100
+#define EMULATOR_IDENTIFIER_SIZE   4
+#define EMULATOR_NOVRAM_N_BLOCKS   8
+#define EMULATOR_NOVRAM_BLOCK_MAX  0x100
+#define EMULATOR_POLL_US           10000
+#define EMULATOR_MAX_LAG_US        1000000
+
+#define EMULATOR_DEFAULT_RATE_HZ   100
+#define EMULATOR_DEFAULT_NOISE     4000
+#define EMULATOR_DEFAULT_SEED      1
+
+/* Synthetic touch: one every 4s, lasting 1.5s */
+#define TOUCH_PERIOD_S             4.0
+#define TOUCH_START_S              1.0
+#define TOUCH_END_S                2.5
+#define TOUCH_AMPLITUDE            250000.0
+
+/* Stray drift, following the scope report timeline */
+#define DRIFT_PERIOD_S             120.0
+
+/* Offset decaying after a reset, as the controller settles */
+#define SETTLE_AMPLITUDE           2000000.0
+
+struct emulator_config_s {
+    unsigned int devices;
+    unsigned int rate_hz;
+    unsigned int noise;
+    unsigned int latency_us;
+    bool         touch;
+    unsigned int drift;
+    unsigned int settle_ms;
+    uint32_t     seed;
+    char        *replay;
+    bool         pace_max;
+};
+
+struct emulator_device_s {
+    unsigned int    index;
+    pthread_mutex_t mutex;
+    /* Memory */
+    uint8_t        *eeprom;
+    uint8_t         novram [EMULATOR_NOVRAM_N_BLOCKS][EMULATOR_NOVRAM_BLOCK_MAX];
+    uint8_t         settings [EMULATOR_SETTINGS_SIZE];
+    uint8_t         identifier [EMULATOR_IDENTIFIER_SIZE];
+    uint16_t        frequency;
+    /* Status */
+    uint8_t         cmd_status;
+    uint16_t        async_reports; /* one bit per enabled report id */
+    /* Scope stream */
+    int32_t         strays [8];
+    int32_t         stray_drift; /* added to the I components */
+    int32_t         stray_settle; /* added to the I components */
+    uint64_t        settle_report; /* first report after the last reset */
+    int32_t         settle_amplitude;
+    uint32_t        rand_state;
+    uint64_t        n_scope_reports;
+    uint64_t        next_report_us;
+    uint8_t         pending [sizeof (struct report_scope_s)];
+    size_t          pending_offset;
+    size_t          pending_size;
+    /* Replay position and timeline */
+    size_t          replay_index;
+    bool            replay_started;
+    uint64_t        replay_base_us;
+    uint64_t        replay_base_timestamp_us;
+};
+
+struct transport_emulator_s {
+    transport_t                  parent;
+    struct emulator_config_s     config;
+    struct emulator_device_s     devices [EMULATOR_MAX_DEVICES];
+    /* Recording being replayed, if any */
+    microtouch3m_scope_record_t *replay_records;
+    size_t                       n_replay_records;
+    size_t                       n_replay_allocated;
+    bool                         replay_load_failed;
+};
+
+#define EMULATOR(transport)      ((struct transport_emulator_s *) (transport))
+#define EMULATOR_DEVICE(device)  ((struct emulator_device_s *) (device))
+
+static uint64_t
+monotonic_time_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+/******************************************************************************/
+/* Configuration */
+
+static bool
+parse_uint (const char   *key,
+            const char   *str,
+            unsigned int  min,
+            unsigned int  max,
+            unsigned int *out)
+{
+    char          *end = NULL;
+    unsigned long  value;
+
+    value = strtoul (str, &end, 10);
+    if (!str[0] || !end || end[0] || value < min || value > max) {
+        microtouch3m_log_error ("error: invalid emulator setting '%s': '%s' (expected %u-%u)", key, str, min, max);
+        return false;
+    }
+    *out = (unsigned int) value;
+    return true;
+}
+
+static bool
+parse_config (const char               *config,
+              struct emulator_config_s *out)
+{
+    char *str;
+    char *token;
+    char *saveptr = NULL;
+    bool  ret = true;
+
+    out->devices    = 1;
+    out->rate_hz    = EMULATOR_DEFAULT_RATE_HZ;
+    out->noise      = EMULATOR_DEFAULT_NOISE;
+    out->latency_us = 0;
+    out->touch      = false;
+    out->seed       = EMULATOR_DEFAULT_SEED;
+
+    if (!config || !config[0] || (strcmp (config, "1") == 0))
+        return true;
+
+    if (!(str = strdup (config)))
+        return false;
+
+    for (token = strtok_r (str, ",", &saveptr); token && ret; token = strtok_r (NULL, ",", &saveptr)) {
+        char         *value;
+        unsigned int  aux;
+
+        if (!(value = strchr (token, '='))) {
+            microtouch3m_log_error ("error: invalid emulator setting '%s': expected key=value", token);
+            ret = false;
+            break;
+        }
+        *value++ = '\0';
+
+        if (strcmp (token, "devices") == 0)
+            ret = parse_uint (token, value, 1, EMULATOR_MAX_DEVICES, &out->devices);
+        else if (strcmp (token, "rate") == 0)
+            ret = parse_uint (token, value, 1, 100000, &out->rate_hz);
+        else if (strcmp (token, "noise") == 0)
+            ret = parse_uint (token, value, 0, 1000000, &out->noise);
+        else if (strcmp (token, "latency") == 0)
+            ret = parse_uint (token, value, 0, 1000000, &out->latency_us);
+        else if (strcmp (token, "drift") == 0)
+            ret = parse_uint (token, value, 0, 100000000, &out->drift);
+        else if (strcmp (token, "settle") == 0)
+            ret = parse_uint (token, value, 0, 60000, &out->settle_ms);
+        else if (strcmp (token, "touch") == 0) {
+            if ((ret = parse_uint (token, value, 0, 1, &aux)))
+                out->touch = !!aux;
+        } else if (strcmp (token, "seed") == 0) {
+            if ((ret = parse_uint (token, value, 0, UINT32_MAX, &aux)))
+                out->seed = aux;
+        } else if (strcmp (token, "replay") == 0) {
+            free (out->replay);
+            if (!value[0] || !(out->replay = strdup (value))) {
+                microtouch3m_log_error ("error: invalid emulator setting '%s': '%s'", token, value);
+                ret = false;
+            }
+        } else if (strcmp (token, "pace") == 0) {
+            if (strcmp (value, "native") == 0)
+                out->pace_max = false;
+            else if (strcmp (value, "max") == 0)
+                out->pace_max = true;
+            else {
+                microtouch3m_log_error ("error: invalid emulator setting '%s': '%s' (expected native or max)", token, value);
+                ret = false;
+            }
+        } else {
+            microtouch3m_log_error ("error: unknown emulator setting '%s'", token);
+            ret = false;
+        }
+    }
+
+    free (str);
+    return ret;
+}
+
+/******************************************************************************/
+/* Synthetic data */
+
+static uint32_t
+device_rand (struct emulator_device_s *device)
+{
+    /* xorshift32, never seeded with 0 */
+    device->rand_state ^= device->rand_state << 13;
+    device->rand_state ^= device->rand_state >> 17;
+    device->rand_state ^= device->rand_state << 5;
+    return device->rand_state;
+}
+
+/* Triangular distribution in [-amplitude, amplitude] */
+static int32_t
+device_noise (struct emulator_device_s *device,
+              unsigned int              amplitude)
+{
+    uint32_t range;
+
+    if (!amplitude)
+        return 0;
+
+    range = (2 * amplitude) + 1;
+    return (int32_t) (((device_rand (device) % range) + (device_rand (device) % range)) / 2) - (int32_t) amplitude;
+}
+
+/* Lower frequencies take longer to settle */
+static double
+frequency_settle_factor (uint16_t frequency)
+{
+    switch (frequency) {
+    case MICROTOUCH3M_DEVICE_FREQUENCY_109096: return 1.00;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_95703:  return 1.15;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_85286:  return 1.30;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_76953:  return 1.40;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_70135:  return 1.55;
+    default:                                   return 1.00;
+    }
+}
+
+static double
+frequency_noise_factor (uint16_t frequency)
+{
+    switch (frequency) {
+    case MICROTOUCH3M_DEVICE_FREQUENCY_109096: return 1.00;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_95703:  return 0.60;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_85286:  return 0.30;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_76953:  return 0.80;
+    case MICROTOUCH3M_DEVICE_FREQUENCY_70135:  return 1.50;
+    default:                                   return 1.00;
+    }
+}
+
+/* Queues a scope report with the I/Q pairs of the UL, UR, LL and LR corners */
+static void
+device_set_scope_report (struct emulator_device_s *device,
+                         const int32_t            *values)
+{
+    uint8_t      *p;
+    uint32_t      value;
+    unsigned int  i;
+
+    memset (device->pending, 0, sizeof (device->pending));
+    device->pending[0] = REPORT_ID_SCOPE_DATA;
+
+    /* The packed struct fields are consecutive */
+    p = &device->pending[offsetof (struct report_scope_s, ul_i)];
+    for (i = 0; i < 8; i++) {
+        value = htole32 ((uint32_t) values[i]);
+        memcpy (&p[i * sizeof (uint32_t)], &value, sizeof (uint32_t));
+    }
+
+    device->pending_offset = 0;
+    device->pending_size   = sizeof (struct report_scope_s);
+}
+
+static void
+device_build_scope_report (struct transport_emulator_s *emulator,
+                           struct emulator_device_s    *device)
+{
+    /* Corner positions, in the UL, UR, LL, LR order of the report */
+    static const double corner_x[4] = { 0.0, 1.0, 0.0, 1.0 };
+    static const double corner_y[4] = { 0.0, 0.0, 1.0, 1.0 };
+    int32_t                values [8];
+    double                 t;
+    double                 phase;
+    double                 touch_x = 0.0;
+    double                 touch_y = 0.0;
+    bool                   touching;
+    unsigned int           noise;
+    unsigned int           i;
+
+    t = (double) device->n_scope_reports / (double) emulator->config.rate_hz;
+    phase = fmod (t, TOUCH_PERIOD_S);
+    touching = emulator->config.touch && (phase >= TOUCH_START_S) && (phase < TOUCH_END_S);
+    if (touching) {
+        touch_x = 0.5 + 0.35 * cos (2.0 * M_PI * t / 5.0);
+        touch_y = 0.5 + 0.35 * sin (2.0 * M_PI * t / 3.0);
+    }
+
+    noise = (unsigned int) (emulator->config.noise * frequency_noise_factor (device->frequency));
+    device->stray_drift = (int32_t) (emulator->config.drift * sin (2.0 * M_PI * t / DRIFT_PERIOD_S));
+    if (emulator->config.settle_ms) {
+        double settle_t;
+
+        settle_t = (double) (device->n_scope_reports - device->settle_report) / (double) emulator->config.rate_hz;
+        device->stray_settle = (int32_t) (device->settle_amplitude *
+                                          exp (-settle_t * 1000.0 / (emulator->config.settle_ms * frequency_settle_factor (device->frequency))));
+    }
+
+    for (i = 0; i < 4; i++) {
+        int32_t signal_i;
+        int32_t signal_q;
+
+        signal_i = device->strays[2 * i] + device->stray_drift + device->stray_settle;
+        signal_q = device->strays[(2 * i) + 1];
+
+        if (touching) {
+            double dx;
+            double dy;
+            double weight;
+
+            /* The closer to the corner, the bigger the current through it */
+            dx = touch_x - corner_x[i];
+            dy = touch_y - corner_y[i];
+            weight = 1.0 / (1.0 + 4.0 * ((dx * dx) + (dy * dy)));
+            signal_i += (int32_t) (TOUCH_AMPLITUDE * weight);
+            signal_q -= (int32_t) (TOUCH_AMPLITUDE * weight / 2.0);
+        }
+
+        values[2 * i]       = signal_i + device_noise (device, noise);
+        values[(2 * i) + 1] = signal_q + device_noise (device, noise);
+    }
+
+    device->n_scope_reports++;
+    device_set_scope_report (device, values);
+}
+
+/******************************************************************************/
+/* Replay */
+
+static bool
+replay_load_record (const microtouch3m_scope_record_t *record,
+                    void                              *user_data)
+{
+    struct transport_emulator_s *emulator = user_data;
+
+    if (emulator->n_replay_records == emulator->n_replay_allocated) {
+        microtouch3m_scope_record_t *records;
+        size_t                       n_allocated;
+
+        n_allocated = emulator->n_replay_allocated ? (2 * emulator->n_replay_allocated) : 4096;
+        if (!(records = realloc (emulator->replay_records, n_allocated * sizeof (microtouch3m_scope_record_t)))) {
+            microtouch3m_log_error ("error: couldn't allocate memory for the replayed records");
+            emulator->replay_load_failed = true;
+            return false;
+        }
+        emulator->replay_records     = records;
+        emulator->n_replay_allocated = n_allocated;
+    }
+
+    emulator->replay_records[emulator->n_replay_records++] = *record;
+    return true;
+}
+
+static bool
+replay_load (struct transport_emulator_s *emulator)
+{
+    if (microtouch3m_scope_recording_file_read (emulator->config.replay, NULL, replay_load_record, emulator) != MICROTOUCH3M_STATUS_OK ||
+        emulator->replay_load_failed)
+        return false;
+
+    microtouch3m_log ("replaying %zu records from %s", emulator->n_replay_records, emulator->config.replay);
+    return true;
+}
+
+/* Strays recorded at the current position are applied right away, so that
+ * strays read between monitoring runs match the recorded ones */
+static void
+device_replay_update_strays (struct transport_emulator_s *emulator,
+                             struct emulator_device_s    *device)
+{
+    const microtouch3m_scope_record_t *record;
+
+    while (device->replay_index < emulator->n_replay_records) {
+        record = &emulator->replay_records[device->replay_index];
+        if (record->type != MICROTOUCH3M_SCOPE_RECORD_STRAYS)
+            break;
+
+        device->strays[0] = record->ul_i;
+        device->strays[1] = record->ul_q;
+        device->strays[2] = record->ur_i;
+        device->strays[3] = record->ur_q;
+        device->strays[4] = record->ll_i;
+        device->strays[5] = record->ll_q;
+        device->strays[6] = record->lr_i;
+        device->strays[7] = record->lr_q;
+        device->replay_index++;
+    }
+}
+
+/* Queues the next recorded report if it's due, or gives the time to wait for
+ * it. Once all reports are given, there is no more data. */
+static int
+device_replay_next_report (struct transport_emulator_s *emulator,
+                           struct emulator_device_s    *device,
+                           uint64_t                     now_us,
+                           uint64_t                    *wait_us)
+{
+    const microtouch3m_scope_record_t *record;
+    int32_t                            values [8];
+
+    device_replay_update_strays (emulator, device);
+    if (device->replay_index == emulator->n_replay_records)
+        return TRANSPORT_ERROR_END_OF_DATA;
+
+    record = &emulator->replay_records[device->replay_index];
+
+    if (!emulator->config.pace_max) {
+        uint64_t due_us;
+
+        /* The recorded timeline is rebased when starting, and after long
+         * stalls (e.g. monitoring stopped) so that reports don't burst */
+        due_us = device->replay_base_us;
+        if (record->timestamp_us > device->replay_base_timestamp_us)
+            due_us += record->timestamp_us - device->replay_base_timestamp_us;
+        if (!device->replay_started || (now_us > due_us && now_us - due_us > EMULATOR_MAX_LAG_US)) {
+            device->replay_started           = true;
+            device->replay_base_us           = now_us;
+            device->replay_base_timestamp_us = record->timestamp_us;
+            due_us                           = now_us;
+        }
+        if (now_us < due_us) {
+            *wait_us = due_us - now_us;
+            return 0;
+        }
+    }
+
+    values[0] = record->ul_i;
+    values[1] = record->ul_q;
+    values[2] = record->ur_i;
+    values[3] = record->ur_q;
+    values[4] = record->ll_i;
+    values[5] = record->ll_q;
+    values[6] = record->lr_i;
+    values[7] = record->lr_q;
+    device_set_scope_report (device, values);
+    device->replay_index++;
+    return 0;
+}
+
+/******************************************************************************/
+/* Device state */
+
+static void
+device_reset (struct emulator_device_s *device,
+              uint8_t                   cmd_status)
+{
+    device->cmd_status     = cmd_status;
+    device->async_reports  = 0;
+    device->pending_offset = 0;
+    device->pending_size   = 0;
+    device->settle_report  = device->n_scope_reports;
+    device->stray_settle   = device->settle_amplitude;
+}
+
+static void
+settings_set_be16 (struct emulator_device_s *device,
+                   uint16_t                  offset,
+                   uint16_t                  value)
+{
+    assert (offset + sizeof (uint16_t) <= EMULATOR_SETTINGS_SIZE);
+    device->settings[offset]     = (uint8_t) (value >> 8);
+    device->settings[offset + 1] = (uint8_t) (value & 0xff);
+}
+
+static bool
+device_init (struct transport_emulator_s *emulator,
+             struct emulator_device_s    *device,
+             unsigned int                 index)
+{
+    static const int32_t default_strays[8] = {
+         1200000,  -400000, /* UL */
+         -900000,   700000, /* UR */
+          600000,  1100000, /* LL */
+        -1300000,  -200000, /* LR */
+    };
+    uint32_t     image_state = 0x4d334d;
+    unsigned int i;
+
+    device->index  = index;
+    device->eeprom = malloc (MICROTOUCH3M_FW_IMAGE_SIZE);
+    if (!device->eeprom)
+        return false;
+    pthread_mutex_init (&device->mutex, NULL);
+
+    /* Same firmware image in all devices, whatever the seed */
+    for (i = 0; i < MICROTOUCH3M_FW_IMAGE_SIZE; i++) {
+        image_state ^= image_state << 13;
+        image_state ^= image_state >> 17;
+        image_state ^= image_state << 5;
+        device->eeprom[i] = (uint8_t) image_state;
+    }
+
+    /* Calibration data block */
+    for (i = 0; i < 30; i++)
+        device->novram[1][i] = (uint8_t) (0x10 + i);
+
+    /* Settings within the valid ranges: sensitivity level 3 (touchdown 10),
+     * liftoff 8, palm 6, stray 4, stray alpha 4, not rotated */
+    settings_set_be16 (device, 0x005a, 0x00d2);
+    settings_set_be16 (device, 0x006a, 0x6666);
+    settings_set_be16 (device, 0x00e2, 0x007e);
+    settings_set_be16 (device, 0x00e6, 0x5555);
+    settings_set_be16 (device, 0x0050, 0x0004);
+    settings_set_be16 (device, VALUE_ORIENTATION, MICROTOUCH3M_DEVICE_ORIENTATION_LL);
+
+    device->identifier[0] = 'E';
+    device->identifier[1] = 'M';
+    device->identifier[2] = 'U';
+    device->identifier[3] = (uint8_t) ('0' + index);
+
+    device->frequency = MICROTOUCH3M_DEVICE_FREQUENCY_109096;
+
+    for (i = 0; i < 8; i++)
+        device->strays[i] = default_strays[i] + (int32_t) (index * 10000);
+
+    device->settle_amplitude = emulator->config.settle_ms ? (int32_t) SETTLE_AMPLITUDE : 0;
+
+    device->rand_state = (emulator->config.seed * 2654435761u) + index + 1;
+    if (!device->rand_state)
+        device->rand_state = 1;
+
+    /* Strays recorded before the first report */
+    if (emulator->config.replay)
+        device_replay_update_strays (emulator, device);
+
+    device_reset (device, CMD_STATUS_COMPLETED);
+    return true;
+}
+
+static void
+device_clear (struct emulator_device_s *device)
+{
+    if (!device->eeprom)
+        return;
+
+    pthread_mutex_destroy (&device->mutex);
+    free (device->eeprom);
+    device->eeprom = NULL;
+}
+
+/******************************************************************************/
+/* Requests */
+
+/* NOVRAM isn't byte addressable: the request index high byte selects a block,
+ * which is always transferred whole. Only the blocks used by the library are
+ * known: calibration (1), linearization (2) and constant touch timeout (6). */
+static const size_t novram_block_sizes [EMULATOR_NOVRAM_N_BLOCKS] = {
+    [1] = 30,
+    [2] = 50,
+    [6] = 12,
+};
+
+/* Gets the memory behind a parameter block id, starting at the request index,
+ * and how many bytes are available from there. The strays block is built on
+ * the fly in the given buffer and is read-only. NOVRAM blocks are flagged as
+ * whole, i.e. they can't be partially transferred. */
+static uint8_t *
+device_parameter_block (struct emulator_device_s *device,
+                        uint16_t                  parameter_id,
+                        uint16_t                  index,
+                        uint8_t                  *strays_buffer,
+                        size_t                   *size,
+                        bool                     *writable,
+                        bool                     *whole)
+{
+    uint8_t      *block;
+    size_t        block_size;
+    unsigned int  i;
+
+    *writable = true;
+    *whole    = false;
+    switch (parameter_id) {
+    case PARAMETER_ID_CONTROLLER_NOVRAM:
+        if ((index & 0xff) || (index >> 8) >= EMULATOR_NOVRAM_N_BLOCKS || !novram_block_sizes[index >> 8])
+            return NULL;
+        *size  = novram_block_sizes[index >> 8];
+        *whole = true;
+        return device->novram[index >> 8];
+    case PARAMETER_ID_CONTROLLER_SETTINGS:
+        block      = device->settings;
+        block_size = EMULATOR_SETTINGS_SIZE;
+        break;
+    case PARAMETER_ID_CONTROLLER_EEPROM:
+        block      = device->eeprom;
+        block_size = MICROTOUCH3M_FW_IMAGE_SIZE;
+        break;
+    case PARAMETER_ID_CONTROLLER_STRAYS:
+        for (i = 0; i < 8; i++) {
+            uint32_t value;
+
+            value = htole32 ((uint32_t) (device->strays[i] + ((i % 2) ? 0 : (device->stray_drift + device->stray_settle))));
+            memcpy (&strays_buffer[i * sizeof (uint32_t)], &value, sizeof (uint32_t));
+        }
+        block      = strays_buffer;
+        block_size = 8 * sizeof (uint32_t);
+        *writable  = false;
+        break;
+    default:
+        return NULL;
+    }
+
+    if (index > block_size)
+        return NULL;
+    *size = block_size - index;
+    return &block[index];
+}
+
+/* Gets the memory behind a single parameter number */
+static uint8_t *
+device_parameter (struct emulator_device_s *device,
+                  uint16_t                  parameter_number,
+                  size_t                   *size)
+{
+    switch (parameter_number) {
+    case ORIENTATION_PARAMETER_NUMBER:
+        *size = sizeof (uint16_t);
+        return &device->settings[VALUE_ORIENTATION];
+    case IDENTIFIER_PARAMETER_NUMBER:
+        *size = EMULATOR_IDENTIFIER_SIZE;
+        return device->identifier;
+    default:
+        return NULL;
+    }
+}
+
+static int
+build_parameter_report (uint8_t       *data,
+                        uint16_t       length,
+                        const uint8_t *contents,
+                        size_t         contents_size)
+{
+    struct parameter_report_s header;
+
+    if (length < sizeof (header) + contents_size)
+        return LIBUSB_ERROR_OVERFLOW;
+
+    header.report_id = REPORT_ID_PARAMETER;
+    header.data_size = htole16 ((uint16_t) contents_size);
+    memcpy (data, &header, sizeof (header));
+    memcpy (&data[sizeof (header)], contents, contents_size);
+    return (int) (sizeof (header) + contents_size);
+}
+
+static int
+device_in_request (struct emulator_device_s *device,
+                   uint8_t                   request,
+                   uint16_t                  value,
+                   uint16_t                  index,
+                   uint8_t                  *data,
+                   uint16_t                  length)
+{
+    switch (request) {
+    case REQUEST_STATUS: {
+        struct extended_status_report_s status;
+
+        memset (&status, 0, sizeof (status));
+        status.standard.cmd_status    = device->cmd_status;
+        status.standard.async_reports = htole16 (device->async_reports);
+        if (length > sizeof (status))
+            length = sizeof (status);
+        memcpy (data, &status, length);
+        return length;
+    }
+
+    case REQUEST_CONTROLLER_ID: {
+        struct report_controller_id_s controller_id;
+
+        memset (&controller_id, 0, sizeof (controller_id));
+        controller_id.report_id          = REQUEST_CONTROLLER_ID;
+        controller_id.controller_type    = htole16 (0x0021);
+        controller_id.firmware_major     = 5;
+        controller_id.firmware_minor     = 8;
+        controller_id.max_param_write    = htole16 (64);
+        controller_id.constants_checksum = htole16 (0x1234);
+        controller_id.pc_checksum        = htole32 (0x4d334d00 | device->index);
+        controller_id.asic_type          = htole16 (0x0001);
+        if (length > sizeof (controller_id))
+            length = sizeof (controller_id);
+        memcpy (data, &controller_id, length);
+        return length;
+    }
+
+    case REQUEST_GET_PARAMETER_BLOCK: {
+        uint8_t  strays_buffer [8 * sizeof (uint32_t)];
+        uint8_t *block;
+        size_t   block_size;
+        size_t   size;
+        bool     writable;
+        bool     whole;
+
+        if (length < sizeof (struct parameter_report_s))
+            return LIBUSB_ERROR_PIPE;
+        size = length - sizeof (struct parameter_report_s);
+
+        block = device_parameter_block (device, value, index, strays_buffer, &block_size, &writable, &whole);
+        if (!block || (!whole && size > block_size))
+            return LIBUSB_ERROR_PIPE;
+
+        /* Whole blocks are replied with their own size, whatever was requested */
+        return build_parameter_report (data, length, block, whole ? block_size : size);
+    }
+
+    case REQUEST_GET_PARAMETER: {
+        uint8_t *parameter;
+        size_t   size;
+
+        if (!(parameter = device_parameter (device, value, &size)))
+            return LIBUSB_ERROR_PIPE;
+        return build_parameter_report (data, length, parameter, size);
+    }
+
+    case REQUEST_GET_GENERIC: {
+        uint16_t frequency;
+
+        if (index != VALUE_FREQUENCY || length < 3)
+            return LIBUSB_ERROR_PIPE;
+        frequency = htole16 (device->frequency);
+        data[0] = 0;
+        memcpy (&data[1], &frequency, sizeof (frequency));
+        return 3;
+    }
+
+    default:
+        return LIBUSB_ERROR_PIPE;
+    }
+}
+
+static int
+device_out_request (struct emulator_device_s *device,
+                    uint8_t                   request,
+                    uint16_t                  value,
+                    uint16_t                  index,
+                    const uint8_t            *data,
+                    uint16_t                  length)
+{
+    switch (request) {
+    case REQUEST_ASYNC_SET_REPORT:
+        if (index >= 16)
+            return LIBUSB_ERROR_PIPE;
+        if (value == ASYNC_SET_REPORT_ENABLE) {
+            if ((index == REPORT_ID_SCOPE_DATA) && !(device->async_reports & (1 << index))) {
+                device->next_report_us = monotonic_time_us ();
+                device->pending_offset = 0;
+                device->pending_size   = 0;
+            }
+            device->async_reports |= (1 << index);
+        } else if (value == ASYNC_SET_REPORT_DISABLE) {
+            device->async_reports &= ~(1 << index);
+            if (index == REPORT_ID_SCOPE_DATA)
+                device->pending_size = 0;
+        } else
+            return LIBUSB_ERROR_PIPE;
+        return 0;
+
+    case REQUEST_SET_PARAMETER_BLOCK: {
+        uint8_t  strays_buffer [8 * sizeof (uint32_t)];
+        uint8_t *block;
+        size_t   block_size;
+        bool     writable;
+        bool     whole;
+
+        block = device_parameter_block (device, value, index, strays_buffer, &block_size, &writable, &whole);
+        if (!block || !writable || length > block_size || (whole && length != block_size))
+            return LIBUSB_ERROR_PIPE;
+        memcpy (block, data, length);
+        return length;
+    }
+
+    case REQUEST_SET_PARAMETER: {
+        uint8_t *parameter;
+        size_t   size;
+
+        if (!(parameter = device_parameter (device, value, &size)) || length != size)
+            return LIBUSB_ERROR_PIPE;
+        memcpy (parameter, data, length);
+        return length;
+    }
+
+    case REQUEST_SET_GENERIC: {
+        uint16_t frequency;
+
+        if (index != VALUE_FREQUENCY || length != sizeof (uint16_t))
+            return LIBUSB_ERROR_PIPE;
+        memcpy (&frequency, data, sizeof (frequency));
+        device->frequency = le16toh (frequency);
+        return length;
+    }
+
+    case REQUEST_RESET:
+        switch (value) {
+        case MICROTOUCH3M_DEVICE_RESET_SOFT:
+            device_reset (device, CMD_STATUS_SOFT_RESET_OCCURED);
+            return 0;
+        case MICROTOUCH3M_DEVICE_RESET_HARD:
+            device_reset (device, CMD_STATUS_HARD_RESET_OCCURED);
+            return 0;
+        case MICROTOUCH3M_DEVICE_RESET_REBOOT:
+            /* The controller reboots right away, without completing the request */
+            device_reset (device, CMD_STATUS_COMPLETED);
+            return LIBUSB_ERROR_PIPE;
+        default:
+            return LIBUSB_ERROR_PIPE;
+        }
+
+    default:
+        return LIBUSB_ERROR_PIPE;
+    }
+}
+
+/******************************************************************************/
+/* Transport */
+
+static void
+emulator_free (transport_t *transport)
+{
+    unsigned int i;
+
+    for (i = 0; i < EMULATOR_MAX_DEVICES; i++)
+        device_clear (&EMULATOR (transport)->devices[i]);
+    free (EMULATOR (transport)->replay_records);
+    free (EMULATOR (transport)->config.replay);
+    free (transport);
+}
+
+static ssize_t
+emulator_get_device_list (transport_t          *transport,
+                          transport_device_t ***list)
+{
+    struct transport_emulator_s  *emulator = EMULATOR (transport);
+    transport_device_t          **array;
+    unsigned int                  i;
+
+    array = calloc (emulator->config.devices + 1, sizeof (transport_device_t *));
+    if (!array)
+        return LIBUSB_ERROR_NO_MEM;
+
+    for (i = 0; i < emulator->config.devices; i++)
+        array[i] = (transport_device_t *) &emulator->devices[i];
+
+    *list = array;
+    return (ssize_t) emulator->config.devices;
+}
+
+static void
+emulator_free_device_list (transport_t         *transport,
+                           transport_device_t **list,
+                           int                  unref_devices)
+{
+    free (list);
+}
+
+/* Devices are owned by the transport, so no actual refcounting needed */
+static transport_device_t *
+emulator_ref_device (transport_t        *transport,
+                     transport_device_t *device)
+{
+    return device;
+}
+
+static void
+emulator_unref_device (transport_t        *transport,
+                       transport_device_t *device)
+{
+}
+
+static int
+emulator_get_device_ids (transport_t        *transport,
+                         transport_device_t *device,
+                         uint16_t           *vid,
+                         uint16_t           *pid)
+{
+    *vid = MICROTOUCH3M_VID;
+    *pid = MICROTOUCH3M_PID;
+    return 0;
+}
+
+static uint8_t
+emulator_get_bus_number (transport_t        *transport,
+                         transport_device_t *device)
+{
+    return EMULATOR_BUS_NUMBER;
+}
+
+static uint8_t
+emulator_get_device_address (transport_t        *transport,
+                             transport_device_t *device)
+{
+    return (uint8_t) (EMULATOR_DEVICE (device)->index + 2);
+}
+
+static int
+emulator_get_port_numbers (transport_t        *transport,
+                           transport_device_t *device,
+                           uint8_t            *port_numbers,
+                           int                 port_numbers_len)
+{
+    if (port_numbers_len < 2)
+        return LIBUSB_ERROR_OVERFLOW;
+
+    port_numbers[0] = 1;
+    port_numbers[1] = (uint8_t) (EMULATOR_DEVICE (device)->index + 1);
+    return 2;
+}
+
+/* Handles are the devices themselves */
+static int
+emulator_open (transport_t         *transport,
+               transport_device_t  *device,
+               transport_handle_t **handle)
+{
+    *handle = (transport_handle_t *) device;
+    return 0;
+}
+
+static void
+emulator_close (transport_t        *transport,
+                transport_handle_t *handle)
+{
+}
+
+static int
+emulator_control_transfer (transport_t        *transport,
+                           transport_handle_t *handle,
+                           uint8_t             request_type,
+                           uint8_t             request,
+                           uint16_t            value,
+                           uint16_t            index,
+                           uint8_t            *data,
+                           uint16_t            length,
+                           unsigned int        timeout_ms)
+{
+    struct transport_emulator_s *emulator = EMULATOR (transport);
+    struct emulator_device_s    *device = EMULATOR_DEVICE (handle);
+    int                          ret;
+
+    if (emulator->config.latency_us)
+        usleep (emulator->config.latency_us);
+
+    if ((request_type & (0x03 << 5)) != LIBUSB_REQUEST_TYPE_VENDOR)
+        return LIBUSB_ERROR_PIPE;
+
+    pthread_mutex_lock (&device->mutex);
+    if (emulator->config.replay && request == REQUEST_GET_PARAMETER_BLOCK && value == PARAMETER_ID_CONTROLLER_STRAYS)
+        device_replay_update_strays (emulator, device);
+    if (request_type & LIBUSB_ENDPOINT_IN)
+        ret = device_in_request (device, request, value, index, data, length);
+    else
+        ret = device_out_request (device, request, value, index, data, length);
+    pthread_mutex_unlock (&device->mutex);
+
+    return ret;
+}
+
+static int
+emulator_interrupt_transfer (transport_t        *transport,
+                             transport_handle_t *handle,
+                             uint8_t             endpoint,
+                             uint8_t            *data,
+                             int                 length,
+                             int                *transferred,
+                             unsigned int        timeout_ms)
+{
+    struct transport_emulator_s *emulator = EMULATOR (transport);
+    struct emulator_device_s    *device = EMULATOR_DEVICE (handle);
+    uint64_t                     period_us;
+    uint64_t                     deadline_us;
+    size_t                       chunk;
+
+    *transferred = 0;
+
+    if (endpoint != INTERRUPT_ENDPOINT_IN)
+        return LIBUSB_ERROR_PIPE;
+
+    period_us   = 1000000 / emulator->config.rate_hz;
+    deadline_us = timeout_ms ? (monotonic_time_us () + ((uint64_t) timeout_ms * 1000)) : UINT64_MAX;
+
+    /* Returns with the mutex locked and a report pending */
+    for (;;) {
+        uint64_t now_us;
+        uint64_t wait_us;
+
+        pthread_mutex_lock (&device->mutex);
+        if (device->pending_size)
+            break;
+
+        now_us = monotonic_time_us ();
+        if ((device->async_reports & (1 << REPORT_ID_SCOPE_DATA)) && emulator->config.replay) {
+            int ret;
+
+            if ((ret = device_replay_next_report (emulator, device, now_us, &wait_us)) != 0) {
+                pthread_mutex_unlock (&device->mutex);
+                return ret;
+            }
+            if (device->pending_size)
+                break;
+        } else if (device->async_reports & (1 << REPORT_ID_SCOPE_DATA)) {
+            if (now_us >= device->next_report_us) {
+                device_build_scope_report (emulator, device);
+                /* Don't try to catch up after a long stall */
+                device->next_report_us += period_us;
+                if (now_us - device->next_report_us < UINT64_MAX / 2 &&
+                    now_us - device->next_report_us > EMULATOR_MAX_LAG_US)
+                    device->next_report_us = now_us + period_us;
+                break;
+            }
+            wait_us = device->next_report_us - now_us;
+        } else
+            wait_us = EMULATOR_POLL_US;
+        pthread_mutex_unlock (&device->mutex);
+
+        if (now_us >= deadline_us)
+            return LIBUSB_ERROR_TIMEOUT;
+        if (wait_us > deadline_us - now_us)
+            wait_us = deadline_us - now_us;
+        usleep (wait_us);
+    }
+
+    /* Reports are given in chunks of at most the endpoint max packet size */
+    chunk = device->pending_size - device->pending_offset;
+    if (chunk > MAX_INTERRUPT_ENDPOINT_TRANSFER)
+        chunk = MAX_INTERRUPT_ENDPOINT_TRANSFER;
+    if (chunk > (size_t) length)
+        chunk = (size_t) length;
+
+    memcpy (data, &device->pending[device->pending_offset], chunk);
+    device->pending_offset += chunk;
+    if (device->pending_offset == device->pending_size) {
+        device->pending_offset = 0;
+        device->pending_size   = 0;
+    }
+    pthread_mutex_unlock (&device->mutex);
+
+    *transferred = (int) chunk;
+    return 0;
+}
+
+static int
+emulator_kernel_driver_active (transport_t        *transport,
+                               transport_handle_t *handle,
+                               int                 interface_number)
+{
+    return 0;
+}
+
+static int
+emulator_detach_kernel_driver (transport_t        *transport,
+                               transport_handle_t *handle,
+                               int                 interface_number)
+{
+    return LIBUSB_ERROR_NOT_FOUND;
+}
+
+static int
+emulator_claim_interface (transport_t        *transport,
+                          transport_handle_t *handle,
+                          int                 interface_number)
+{
+    return (interface_number == 0) ? 0 : LIBUSB_ERROR_NOT_FOUND;
+}
+
+static int
+emulator_release_interface (transport_t        *transport,
+                            transport_handle_t *handle,
+                            int                 interface_number)
+{
+    return (interface_number == 0) ? 0 : LIBUSB_ERROR_NOT_FOUND;
+}
+
+static const struct transport_ops_s emulator_ops = {
+    .name                 = "emulator",
+    .free                 = emulator_free,
+    .get_device_list      = emulator_get_device_list,
+    .free_device_list     = emulator_free_device_list,
+    .ref_device           = emulator_ref_device,
+    .unref_device         = emulator_unref_device,
+    .get_device_ids       = emulator_get_device_ids,
+    .get_bus_number       = emulator_get_bus_number,
+    .get_device_address   = emulator_get_device_address,
+    .get_port_numbers     = emulator_get_port_numbers,
+    .open                 = emulator_open,
+    .close                = emulator_close,
+    .control_transfer     = emulator_control_transfer,
+    .interrupt_transfer   = emulator_interrupt_transfer,
+    .kernel_driver_active = emulator_kernel_driver_active,
+    .detach_kernel_driver = emulator_detach_kernel_driver,
+    .claim_interface      = emulator_claim_interface,
+    .release_interface    = emulator_release_interface,
+};
+
+transport_t *
+transport_new_emulator (const char *config)
+{
+    struct transport_emulator_s *emulator;
+    unsigned int                 i;
+
+    emulator = calloc (1, sizeof (struct transport_emulator_s));
+    if (!emulator)
+        return NULL;
+
+    emulator->parent.ops = &emulator_ops;
+
+    if (!parse_config (config, &emulator->config))
+        goto outerr;
+
+    if (emulator->config.replay && !replay_load (emulator))
+        goto outerr;
+
+    for (i = 0; i < emulator->config.devices; i++) {
+        if (!device_init (emulator, &emulator->devices[i], i))
+            goto outerr;
+    }
+
+    microtouch3m_log ("emulating %u controller(s), scope reports at %uHz",
+                      emulator->config.devices, emulator->config.rate_hz);
+    return &emulator->parent;
+
+outerr:
+    emulator_free (&emulator->parent);
+    return NULL;
+}
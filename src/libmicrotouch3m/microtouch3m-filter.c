@@ -0,0 +1,578 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Scope filter
+ *
+ * A chain of stages applied to the 4 corners at once. Coefficients are
+ * computed when the stages are added. The state of each stage keeps the 4
+ * corners of each sample next to each other, so that the inner loops run over
+ * the corners with a constant trip count and can be vectorized.
+ *
+ * Samples are processed in chunks through a work buffer, one stage after the
+ * other, decimators compacting the chunk in place.
+ */
+
+#define FILTER_MAX_STAGES        16
+#define FILTER_CHUNK             256
+#define FILTER_DEFAULT_NOTCH_Q   30.0
+#define FILTER_DEFAULT_LOWPASS_Q 0.7071067811865476 /* Butterworth */
+
+/* Taps of the decimating FIR, per unit of decimation factor */
+#define FILTER_DECIMATOR_TAPS_PER_FACTOR 8
+
+typedef enum {
+    FILTER_STAGE_BIQUAD,
+    FILTER_STAGE_MOVING_AVERAGE,
+    FILTER_STAGE_DECIMATOR,
+} filter_stage_type_t;
+
+struct filter_stage_s {
+    filter_stage_type_t type;
+
+    /* biquad, normalized to a0 = 1, transposed direct form II */
+    double b0, b1, b2;
+    double a1, a2;
+    double z1 [MICROTOUCH3M_SCOPE_N_CORNERS];
+    double z2 [MICROTOUCH3M_SCOPE_N_CORNERS];
+
+    /* FIR: the history is stored twice, so that the last n_taps samples are
+     * always contiguous, oldest first from position */
+    unsigned int n_taps;
+    unsigned int factor;
+    unsigned int phase;
+    unsigned int position;
+    double      *taps;
+    double      *history;
+    double       sum [MICROTOUCH3M_SCOPE_N_CORNERS];
+};
+
+struct microtouch3m_scope_filter_s {
+    double                rate;
+    unsigned int          n_stages;
+    struct filter_stage_s stages [FILTER_MAX_STAGES];
+    bool                  primed;
+    double                work [FILTER_CHUNK * MICROTOUCH3M_SCOPE_N_CORNERS];
+};
+
+microtouch3m_scope_filter_t *
+microtouch3m_scope_filter_new (double rate)
+{
+    microtouch3m_scope_filter_t *filter;
+
+    if (!(rate > 0.0))
+        return NULL;
+
+    if (!(filter = calloc (1, sizeof (microtouch3m_scope_filter_t))))
+        return NULL;
+
+    filter->rate = rate;
+    return filter;
+}
+
+void
+microtouch3m_scope_filter_free (microtouch3m_scope_filter_t *filter)
+{
+    unsigned int i;
+
+    if (!filter)
+        return;
+
+    for (i = 0; i < filter->n_stages; i++) {
+        free (filter->stages[i].taps);
+        free (filter->stages[i].history);
+    }
+    free (filter);
+}
+
+void
+microtouch3m_scope_filter_reset (microtouch3m_scope_filter_t *filter)
+{
+    filter->primed = false;
+}
+
+/******************************************************************************/
+/* Stage setup */
+
+static struct filter_stage_s *
+filter_add_stage (microtouch3m_scope_filter_t *filter,
+                  filter_stage_type_t          type)
+{
+    struct filter_stage_s *stage;
+
+    if (filter->n_stages == FILTER_MAX_STAGES)
+        return NULL;
+
+    stage = &filter->stages[filter->n_stages];
+    memset (stage, 0, sizeof (struct filter_stage_s));
+    stage->type = type;
+    return stage;
+}
+
+/* Biquads from the audio EQ cookbook formulas */
+static bool
+filter_add_biquad (microtouch3m_scope_filter_t *filter,
+                   double                       frequency,
+                   double                       q,
+                   bool                         notch)
+{
+    struct filter_stage_s *stage;
+    double                 w0;
+    double                 alpha;
+    double                 cos_w0;
+    double                 a0;
+
+    if (!(frequency > 0.0) || !(frequency < filter->rate / 2.0) || !(q > 0.0))
+        return false;
+
+    if (!(stage = filter_add_stage (filter, FILTER_STAGE_BIQUAD)))
+        return false;
+
+    w0     = 2.0 * M_PI * frequency / filter->rate;
+    cos_w0 = cos (w0);
+    alpha  = sin (w0) / (2.0 * q);
+    a0     = 1.0 + alpha;
+
+    if (notch) {
+        stage->b0 = 1.0 / a0;
+        stage->b1 = -2.0 * cos_w0 / a0;
+        stage->b2 = 1.0 / a0;
+    } else {
+        stage->b0 = ((1.0 - cos_w0) / 2.0) / a0;
+        stage->b1 = (1.0 - cos_w0) / a0;
+        stage->b2 = ((1.0 - cos_w0) / 2.0) / a0;
+    }
+    stage->a1 = -2.0 * cos_w0 / a0;
+    stage->a2 = (1.0 - alpha) / a0;
+
+    filter->n_stages++;
+    filter->primed = false;
+    return true;
+}
+
+bool
+microtouch3m_scope_filter_add_notch (microtouch3m_scope_filter_t *filter,
+                                     double                       frequency,
+                                     double                       q)
+{
+    return filter_add_biquad (filter, frequency, q, true);
+}
+
+bool
+microtouch3m_scope_filter_add_lowpass (microtouch3m_scope_filter_t *filter,
+                                       double                       frequency,
+                                       double                       q)
+{
+    return filter_add_biquad (filter, frequency, q, false);
+}
+
+static bool
+filter_add_fir (microtouch3m_scope_filter_t *filter,
+                filter_stage_type_t          type,
+                unsigned int                 n_taps,
+                unsigned int                 factor)
+{
+    struct filter_stage_s *stage;
+
+    if (!(stage = filter_add_stage (filter, type)))
+        return false;
+
+    stage->n_taps  = n_taps;
+    stage->factor  = factor;
+    stage->taps    = calloc (n_taps, sizeof (double));
+    stage->history = calloc (2 * n_taps * MICROTOUCH3M_SCOPE_N_CORNERS, sizeof (double));
+    if (!stage->taps || !stage->history) {
+        free (stage->taps);
+        free (stage->history);
+        return false;
+    }
+
+    filter->n_stages++;
+    filter->primed = false;
+    return true;
+}
+
+bool
+microtouch3m_scope_filter_add_moving_average (microtouch3m_scope_filter_t *filter,
+                                              unsigned int                 length)
+{
+    if (length < 2 || length > 65536)
+        return false;
+
+    /* The running sum doesn't need the taps, but the history */
+    return filter_add_fir (filter, FILTER_STAGE_MOVING_AVERAGE, length, 1);
+}
+
+/* Blackman windowed sinc, cut at the new Nyquist frequency, unity DC gain */
+bool
+microtouch3m_scope_filter_add_decimator (microtouch3m_scope_filter_t *filter,
+                                         unsigned int                 factor)
+{
+    struct filter_stage_s *stage;
+    unsigned int           n_taps;
+    unsigned int           k;
+    double                 sum = 0.0;
+
+    if (factor < 2 || factor > 1024)
+        return false;
+
+    n_taps = (FILTER_DECIMATOR_TAPS_PER_FACTOR * factor) + 1;
+    if (!filter_add_fir (filter, FILTER_STAGE_DECIMATOR, n_taps, factor))
+        return false;
+
+    stage = &filter->stages[filter->n_stages - 1];
+    for (k = 0; k < n_taps; k++) {
+        double x;
+        double window;
+
+        x = (double) k - ((n_taps - 1) / 2.0);
+        window = 0.42 - (0.5 * cos (2.0 * M_PI * k / (n_taps - 1))) + (0.08 * cos (4.0 * M_PI * k / (n_taps - 1)));
+        stage->taps[k] = window * ((fabs (x) > 0.0) ? (sin (M_PI * x / factor) / (M_PI * x / factor)) : 1.0);
+        sum += stage->taps[k];
+    }
+    for (k = 0; k < n_taps; k++)
+        stage->taps[k] /= sum;
+
+    return true;
+}
+
+/* e.g. "notch:50,notch:100:20,lowpass:30,average:4,decimate:2" */
+bool
+microtouch3m_scope_filter_add_from_string (microtouch3m_scope_filter_t *filter,
+                                           const char                  *spec)
+{
+    char *str;
+    char *token;
+    char *saveptr = NULL;
+    bool  ret = true;
+
+    if (!spec || !spec[0] || !(str = strdup (spec)))
+        return false;
+
+    for (token = strtok_r (str, ",", &saveptr); token && ret; token = strtok_r (NULL, ",", &saveptr)) {
+        char          *value;
+        char          *end = NULL;
+        double         number;
+        double         q = 0.0;
+        unsigned long  integer;
+
+        if (!(value = strchr (token, ':'))) {
+            ret = false;
+            break;
+        }
+        *value++ = '\0';
+
+        if ((strcmp (token, "notch") == 0) || (strcmp (token, "lowpass") == 0)) {
+            number = strtod (value, &end);
+            if (end == value) {
+                ret = false;
+                break;
+            }
+            if (*end == ':') {
+                value = end + 1;
+                q = strtod (value, &end);
+                if (end == value) {
+                    ret = false;
+                    break;
+                }
+            }
+            if (*end) {
+                ret = false;
+                break;
+            }
+            if (token[0] == 'n')
+                ret = microtouch3m_scope_filter_add_notch (filter, number, (q > 0.0) ? q : FILTER_DEFAULT_NOTCH_Q);
+            else
+                ret = microtouch3m_scope_filter_add_lowpass (filter, number, (q > 0.0) ? q : FILTER_DEFAULT_LOWPASS_Q);
+        } else if ((strcmp (token, "average") == 0) || (strcmp (token, "decimate") == 0)) {
+            integer = strtoul (value, &end, 10);
+            if (end == value || *end || integer > UINT32_MAX) {
+                ret = false;
+                break;
+            }
+            if (token[0] == 'a')
+                ret = microtouch3m_scope_filter_add_moving_average (filter, (unsigned int) integer);
+            else
+                ret = microtouch3m_scope_filter_add_decimator (filter, (unsigned int) integer);
+        } else
+            ret = false;
+    }
+
+    free (str);
+    return ret;
+}
+
+unsigned int
+microtouch3m_scope_filter_get_n_stages (const microtouch3m_scope_filter_t *filter)
+{
+    return filter->n_stages;
+}
+
+unsigned int
+microtouch3m_scope_filter_get_decimation (const microtouch3m_scope_filter_t *filter)
+{
+    unsigned int decimation = 1;
+    unsigned int i;
+
+    for (i = 0; i < filter->n_stages; i++) {
+        if (filter->stages[i].type == FILTER_STAGE_DECIMATOR)
+            decimation *= filter->stages[i].factor;
+    }
+    return decimation;
+}
+
+/******************************************************************************/
+/* Processing */
+
+/* Loads the state every stage would have after a constant input, so that the
+ * output doesn't start with the step response to the signal level */
+static void
+filter_prime (microtouch3m_scope_filter_t *filter,
+              const double                *sample)
+{
+    double       level [MICROTOUCH3M_SCOPE_N_CORNERS];
+    unsigned int i;
+    unsigned int k;
+    unsigned int c;
+
+    memcpy (level, sample, sizeof (level));
+
+    for (i = 0; i < filter->n_stages; i++) {
+        struct filter_stage_s *stage = &filter->stages[i];
+
+        switch (stage->type) {
+        case FILTER_STAGE_BIQUAD: {
+            double gain;
+
+            gain = (stage->b0 + stage->b1 + stage->b2) / (1.0 + stage->a1 + stage->a2);
+            for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+                double y;
+
+                y = gain * level[c];
+                stage->z1[c] = y - (stage->b0 * level[c]);
+                stage->z2[c] = (stage->b2 * level[c]) - (stage->a2 * y);
+                level[c] = y;
+            }
+            break;
+        }
+        case FILTER_STAGE_MOVING_AVERAGE:
+        case FILTER_STAGE_DECIMATOR:
+            for (k = 0; k < 2 * stage->n_taps; k++)
+                memcpy (&stage->history[k * MICROTOUCH3M_SCOPE_N_CORNERS], level, sizeof (level));
+            for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+                stage->sum[c] = level[c] * stage->n_taps;
+            stage->position = 0;
+            stage->phase    = 0;
+            break;
+        }
+    }
+
+    filter->primed = true;
+}
+
+static void
+filter_biquad (struct filter_stage_s *stage,
+               double                *work,
+               size_t                 n)
+{
+    const double b0 = stage->b0;
+    const double b1 = stage->b1;
+    const double b2 = stage->b2;
+    const double a1 = stage->a1;
+    const double a2 = stage->a2;
+    double       z1 [MICROTOUCH3M_SCOPE_N_CORNERS];
+    double       z2 [MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t       i;
+    unsigned int c;
+
+    memcpy (z1, stage->z1, sizeof (z1));
+    memcpy (z2, stage->z2, sizeof (z2));
+
+    for (i = 0; i < n; i++) {
+        double *x = &work[i * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+            double in;
+            double out;
+
+            in    = x[c];
+            out   = (b0 * in) + z1[c];
+            z1[c] = (b1 * in) - (a1 * out) + z2[c];
+            z2[c] = (b2 * in) - (a2 * out);
+            x[c]  = out;
+        }
+    }
+
+    memcpy (stage->z1, z1, sizeof (z1));
+    memcpy (stage->z2, z2, sizeof (z2));
+}
+
+/* Appends a sample to the doubled history, returning the oldest one replaced */
+static const double *
+filter_history_push (struct filter_stage_s *stage,
+                     const double          *sample,
+                     double                *oldest)
+{
+    double       *first;
+    unsigned int  c;
+
+    first = &stage->history[stage->position * MICROTOUCH3M_SCOPE_N_CORNERS];
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+        oldest[c] = first[c];
+        first[c] = sample[c];
+        first[(stage->n_taps * MICROTOUCH3M_SCOPE_N_CORNERS) + c] = sample[c];
+    }
+    stage->position = (stage->position + 1) % stage->n_taps;
+
+    return &stage->history[stage->position * MICROTOUCH3M_SCOPE_N_CORNERS];
+}
+
+static void
+filter_moving_average (struct filter_stage_s *stage,
+                       double                *work,
+                       size_t                 n)
+{
+    const double scale = 1.0 / stage->n_taps;
+    double       oldest [MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t       i;
+    unsigned int k;
+    unsigned int c;
+
+    for (i = 0; i < n; i++) {
+        double *x = &work[i * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+        filter_history_push (stage, x, oldest);
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+            stage->sum[c] += x[c] - oldest[c];
+            x[c] = stage->sum[c] * scale;
+        }
+
+        /* Recompute the running sum once per cycle, so that rounding errors
+         * don't build up */
+        if (!stage->position) {
+            const double *window = stage->history;
+
+            for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+                stage->sum[c] = 0.0;
+            for (k = 0; k < stage->n_taps; k++) {
+                for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+                    stage->sum[c] += window[(k * MICROTOUCH3M_SCOPE_N_CORNERS) + c];
+            }
+        }
+    }
+}
+
+static size_t
+filter_decimator (struct filter_stage_s *stage,
+                  double                *work,
+                  size_t                 n)
+{
+    double       oldest [MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t       n_out = 0;
+    size_t       i;
+    unsigned int k;
+    unsigned int c;
+
+    for (i = 0; i < n; i++) {
+        const double *window;
+        double        acc [MICROTOUCH3M_SCOPE_N_CORNERS] = { 0.0 };
+
+        window = filter_history_push (stage, &work[i * MICROTOUCH3M_SCOPE_N_CORNERS], oldest);
+        if (++stage->phase < stage->factor)
+            continue;
+        stage->phase = 0;
+
+        for (k = 0; k < stage->n_taps; k++) {
+            for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+                acc[c] += stage->taps[k] * window[(k * MICROTOUCH3M_SCOPE_N_CORNERS) + c];
+        }
+
+        /* Outputs never overtake inputs, so the chunk is compacted in place */
+        memcpy (&work[n_out * MICROTOUCH3M_SCOPE_N_CORNERS], acc, sizeof (acc));
+        n_out++;
+    }
+
+    return n_out;
+}
+
+size_t
+microtouch3m_scope_filter_process (microtouch3m_scope_filter_t *filter,
+                                   const int32_t               *signal,
+                                   size_t                       n,
+                                   int32_t                     *filtered)
+{
+    size_t n_out = 0;
+    size_t offset;
+
+    for (offset = 0; offset < n; offset += FILTER_CHUNK) {
+        size_t       n_chunk;
+        size_t       i;
+        unsigned int s;
+
+        n_chunk = ((n - offset) < FILTER_CHUNK) ? (n - offset) : FILTER_CHUNK;
+        for (i = 0; i < n_chunk * MICROTOUCH3M_SCOPE_N_CORNERS; i++)
+            filter->work[i] = (double) signal[(offset * MICROTOUCH3M_SCOPE_N_CORNERS) + i];
+
+        if (!filter->primed)
+            filter_prime (filter, filter->work);
+
+        for (s = 0; s < filter->n_stages && n_chunk > 0; s++) {
+            struct filter_stage_s *stage = &filter->stages[s];
+
+            switch (stage->type) {
+            case FILTER_STAGE_BIQUAD:
+                filter_biquad (stage, filter->work, n_chunk);
+                break;
+            case FILTER_STAGE_MOVING_AVERAGE:
+                filter_moving_average (stage, filter->work, n_chunk);
+                break;
+            case FILTER_STAGE_DECIMATOR:
+                n_chunk = filter_decimator (stage, filter->work, n_chunk);
+                break;
+            }
+        }
+
+        /* Round and saturate */
+        for (i = 0; i < n_chunk * MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+            double value;
+
+            value = floor (filter->work[i] + 0.5);
+            if (value > (double) INT32_MAX)
+                value = (double) INT32_MAX;
+            else if (value < (double) INT32_MIN)
+                value = (double) INT32_MIN;
+            filtered[(n_out * MICROTOUCH3M_SCOPE_N_CORNERS) + i] = (int32_t) value;
+        }
+        n_out += n_chunk;
+    }
+
+    return n_out;
+}
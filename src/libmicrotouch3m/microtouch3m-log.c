@@ -25,6 +25,12 @@
 #include <malloc.h>
 #include <stdarg.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <errno.h>
+#include <time.h>
 
 #include <common.h>
 
@@ -34,7 +40,8 @@
 /******************************************************************************/
 /* Logging */
 
-static microtouch3m_log_handler_t default_handler;
+static microtouch3m_log_handler_t       default_handler;
+static volatile microtouch3m_log_mode_t log_mode = MICROTOUCH3M_LOG_MODE_IMMEDIATE;
 
 bool
 microtouch3m_log_is_enabled (void)
@@ -48,17 +55,612 @@ microtouch3m_log_set_handler (microtouch3m_log_handler_t handler)
     default_handler = handler;
 }
 
+/******************************************************************************/
+/* Deferred logging records
+ *
+ * In deferred mode the log calls don't format anything: they just store the
+ * format string pointer, a timestamp and the raw arguments in a record. The
+ * format string is parsed twice: once when capturing, to know how many
+ * arguments of which type to read from the va_list, and once more when the
+ * record is dispatched, to rebuild the message. Strings are copied into the
+ * record, as they may not be valid any more by then.
+ */
+
+#define LOG_RECORD_MAX_ARGS  12
+#define LOG_RECORD_DATA_SIZE 256
+#define LOG_MESSAGE_MAX_SIZE 1024
+
+/* Largest amount of bytes of a buffer kept in a record */
+#define LOG_BUFFER_NAME_MAX_SIZE 64
+
+enum log_record_kind_e {
+    LOG_RECORD_KIND_FORMAT,  /* fmt + args, formatted when dispatched */
+    LOG_RECORD_KIND_MESSAGE, /* already formatted message in data */
+    LOG_RECORD_KIND_BUFFER,  /* name + raw bytes in data, hex-dumped when dispatched */
+};
+
+union log_arg_u {
+    int64_t     i;
+    uint64_t    u;
+    double      d;
+    const void *p;
+};
+
+struct log_record_s {
+    uint64_t        timestamp_ns;
+    pthread_t       thread_id;
+    const char     *fmt;
+    uint8_t         kind;
+    uint8_t         n_args;
+    uint16_t        data_size;
+    union log_arg_u args [LOG_RECORD_MAX_ARGS];
+    char            data [LOG_RECORD_DATA_SIZE];
+};
+
+enum log_length_e {
+    LOG_LENGTH_NONE,
+    LOG_LENGTH_HH,
+    LOG_LENGTH_H,
+    LOG_LENGTH_L,
+    LOG_LENGTH_LL,
+    LOG_LENGTH_Z,
+    LOG_LENGTH_J,
+    LOG_LENGTH_T,
+    LOG_LENGTH_BIG_L,
+};
+
+struct log_spec_s {
+    size_t            prefix_len; /* '%' plus flags, width and precision */
+    enum log_length_e length;
+    char              conversion;
+    const char       *end;
+};
+
+static uint64_t
+monotonic_time_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/* Parses the conversion specification starting at the '%' in p. Anything we
+ * don't know how to defer (e.g. '*' width or precision, %n) is reported as
+ * unsupported. */
+static bool
+log_spec_parse (const char        *p,
+                struct log_spec_s *spec)
+{
+    const char *s;
+
+    s  = p + 1;
+    s += strspn (s, "-+ #0");
+    s += strspn (s, "0123456789");
+    if (*s == '.') {
+        s++;
+        s += strspn (s, "0123456789");
+    }
+    spec->prefix_len = s - p;
+
+    spec->length = LOG_LENGTH_NONE;
+    switch (*s) {
+    case 'h':
+        if (s[1] == 'h') {
+            spec->length = LOG_LENGTH_HH;
+            s++;
+        } else
+            spec->length = LOG_LENGTH_H;
+        s++;
+        break;
+    case 'l':
+        if (s[1] == 'l') {
+            spec->length = LOG_LENGTH_LL;
+            s++;
+        } else
+            spec->length = LOG_LENGTH_L;
+        s++;
+        break;
+    case 'z': spec->length = LOG_LENGTH_Z;     s++; break;
+    case 'j': spec->length = LOG_LENGTH_J;     s++; break;
+    case 't': spec->length = LOG_LENGTH_T;     s++; break;
+    case 'L': spec->length = LOG_LENGTH_BIG_L; s++; break;
+    default:
+        break;
+    }
+
+    if (!*s)
+        return false;
+
+    spec->conversion = *s;
+    spec->end        = s + 1;
+    return !!strchr ("%diouxXcspmeEfFgGaA", *s);
+}
+
+static bool
+log_record_add_string (struct log_record_s *record,
+                       const char          *str)
+{
+    size_t len;
+
+    if (!str)
+        str = "(null)";
+
+    len = strlen (str);
+    if (record->data_size + len + 1 > LOG_RECORD_DATA_SIZE)
+        return false;
+
+    memcpy (&record->data[record->data_size], str, len + 1);
+    record->args[record->n_args++].u = record->data_size;
+    record->data_size += len + 1;
+    return true;
+}
+
+static bool
+log_record_capture (struct log_record_s *record,
+                    int                  saved_errno,
+                    const char          *fmt,
+                    va_list              args)
+{
+    const char        *p;
+    struct log_spec_s  spec;
+    union log_arg_u   *arg;
+
+    record->n_args    = 0;
+    record->data_size = 0;
+
+    for (p = strchr (fmt, '%'); p; p = strchr (spec.end, '%')) {
+        if (!log_spec_parse (p, &spec))
+            return false;
+
+        if (spec.conversion == '%')
+            continue;
+
+        if (record->n_args == LOG_RECORD_MAX_ARGS)
+            return false;
+
+        arg = &record->args[record->n_args];
+        switch (spec.conversion) {
+        case 'd':
+        case 'i':
+            switch (spec.length) {
+            case LOG_LENGTH_HH: arg->i = (signed char) va_arg (args, int); break;
+            case LOG_LENGTH_H:  arg->i = (short)       va_arg (args, int); break;
+            case LOG_LENGTH_L:  arg->i = va_arg (args, long);              break;
+            case LOG_LENGTH_LL: arg->i = va_arg (args, long long);         break;
+            case LOG_LENGTH_Z:  arg->i = va_arg (args, ssize_t);           break;
+            case LOG_LENGTH_J:  arg->i = va_arg (args, intmax_t);          break;
+            case LOG_LENGTH_T:  arg->i = va_arg (args, ptrdiff_t);         break;
+            default:            arg->i = va_arg (args, int);               break;
+            }
+            record->n_args++;
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            switch (spec.length) {
+            case LOG_LENGTH_HH: arg->u = (unsigned char)  va_arg (args, unsigned int); break;
+            case LOG_LENGTH_H:  arg->u = (unsigned short) va_arg (args, unsigned int); break;
+            case LOG_LENGTH_L:  arg->u = va_arg (args, unsigned long);                 break;
+            case LOG_LENGTH_LL: arg->u = va_arg (args, unsigned long long);            break;
+            case LOG_LENGTH_Z:  arg->u = va_arg (args, size_t);                        break;
+            case LOG_LENGTH_J:  arg->u = va_arg (args, uintmax_t);                     break;
+            case LOG_LENGTH_T:  arg->u = va_arg (args, ptrdiff_t);                     break;
+            default:            arg->u = va_arg (args, unsigned int);                  break;
+            }
+            record->n_args++;
+            break;
+        case 'c':
+            arg->i = va_arg (args, int);
+            record->n_args++;
+            break;
+        case 'e':
+        case 'E':
+        case 'f':
+        case 'F':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            arg->d = (spec.length == LOG_LENGTH_BIG_L) ? (double) va_arg (args, long double) : va_arg (args, double);
+            record->n_args++;
+            break;
+        case 'p':
+            arg->p = va_arg (args, void *);
+            record->n_args++;
+            break;
+        case 's':
+            if (!log_record_add_string (record, va_arg (args, const char *)))
+                return false;
+            break;
+        case 'm':
+            if (!log_record_add_string (record, strerror (saved_errno)))
+                return false;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void
+log_record_fill (struct log_record_s *record,
+                 pthread_t            thread_id,
+                 int                  saved_errno,
+                 const char          *fmt,
+                 va_list              args)
+{
+    va_list args_copy;
+
+    record->timestamp_ns = monotonic_time_ns ();
+    record->thread_id    = thread_id;
+    record->fmt          = fmt;
+
+    va_copy (args_copy, args);
+    if (log_record_capture (record, saved_errno, fmt, args_copy))
+        record->kind = LOG_RECORD_KIND_FORMAT;
+    else {
+        /* Fallback to formatting right away */
+        record->kind = LOG_RECORD_KIND_MESSAGE;
+        errno = saved_errno;
+        vsnprintf (record->data, sizeof (record->data), fmt, args);
+    }
+    va_end (args_copy);
+}
+
+static void
+log_record_fill_buffer (struct log_record_s *record,
+                        pthread_t            thread_id,
+                        const char          *fmt,
+                        const char          *name,
+                        const void          *mem,
+                        size_t               size)
+{
+    size_t name_len;
+    size_t captured;
+
+    record->timestamp_ns = monotonic_time_ns ();
+    record->thread_id    = thread_id;
+    record->fmt          = fmt;
+    record->kind         = LOG_RECORD_KIND_BUFFER;
+
+    name_len = strnlen (name, LOG_BUFFER_NAME_MAX_SIZE - 1);
+    memcpy (record->data, name, name_len);
+    record->data[name_len] = '\0';
+
+    captured = LOG_RECORD_DATA_SIZE - (name_len + 1);
+    if (captured > size)
+        captured = size;
+    memcpy (&record->data[name_len + 1], mem, captured);
+
+    record->args[0].u = size;
+    record->args[1].u = name_len + 1;
+    record->args[2].u = captured;
+    record->n_args    = 3;
+    record->data_size = name_len + 1 + captured;
+}
+
+static void
+log_record_format (const struct log_record_s *record,
+                   char                      *out,
+                   size_t                     out_size)
+{
+    const char        *p;
+    const char        *literal;
+    struct log_spec_s  spec;
+    char               spec_str[32];
+    size_t             len = 0;
+    unsigned int       i   = 0;
+    int                n;
+
+#define LOG_APPEND(...) do {                                        \
+        n = snprintf (&out[len], out_size - len, __VA_ARGS__);      \
+        if (n < 0 || (size_t) n >= out_size - len)                  \
+            return;                                                 \
+        len += n;                                                   \
+    } while (0)
+
+    out[0] = '\0';
+
+    for (literal = record->fmt, p = strchr (literal, '%'); p; literal = spec.end, p = strchr (literal, '%')) {
+        LOG_APPEND ("%.*s", (int) (p - literal), literal);
+
+        /* Already validated while capturing */
+        log_spec_parse (p, &spec);
+
+        if (spec.conversion == '%') {
+            LOG_APPEND ("%%");
+            continue;
+        }
+
+        if (spec.prefix_len > sizeof (spec_str) - 4)
+            return;
+
+        /* Rebuild the specification with the length modifier matching the
+         * type we stored the argument with */
+        memcpy (spec_str, p, spec.prefix_len);
+        spec_str[spec.prefix_len] = '\0';
+
+        switch (spec.conversion) {
+        case 'd':
+        case 'i':
+            strcat (spec_str, "ll");
+            strncat (spec_str, &spec.conversion, 1);
+            LOG_APPEND (spec_str, (long long) record->args[i++].i);
+            break;
+        case 'o':
+        case 'u':
+        case 'x':
+        case 'X':
+            strcat (spec_str, "ll");
+            strncat (spec_str, &spec.conversion, 1);
+            LOG_APPEND (spec_str, (unsigned long long) record->args[i++].u);
+            break;
+        case 'c':
+            strcat (spec_str, "c");
+            LOG_APPEND (spec_str, (int) record->args[i++].i);
+            break;
+        case 'p':
+            strcat (spec_str, "p");
+            LOG_APPEND (spec_str, record->args[i++].p);
+            break;
+        case 's':
+        case 'm':
+            strcat (spec_str, "s");
+            LOG_APPEND (spec_str, &record->data[record->args[i++].u]);
+            break;
+        default:
+            strncat (spec_str, &spec.conversion, 1);
+            LOG_APPEND (spec_str, record->args[i++].d);
+            break;
+        }
+    }
+
+    LOG_APPEND ("%s", literal);
+
+#undef LOG_APPEND
+}
+
+static void
+log_record_dispatch (const struct log_record_s *record)
+{
+    char message[LOG_MESSAGE_MAX_SIZE];
+    char hex[STRHEX_SIZE (LOG_RECORD_DATA_SIZE, 1)];
+
+    if (!default_handler)
+        return;
+
+    switch (record->kind) {
+    case LOG_RECORD_KIND_FORMAT:
+        log_record_format (record, message, sizeof (message));
+        default_handler (record->thread_id, message);
+        break;
+    case LOG_RECORD_KIND_MESSAGE:
+        default_handler (record->thread_id, record->data);
+        break;
+    case LOG_RECORD_KIND_BUFFER:
+        strhex_to (hex, sizeof (hex), &record->data[record->args[1].u], record->args[2].u, ":");
+        snprintf (message, sizeof (message), record->fmt,
+                  record->data, (size_t) record->args[0].u, hex,
+                  (record->args[2].u < record->args[0].u) ? " ..." : "");
+        default_handler (record->thread_id, message);
+        break;
+    default:
+        break;
+    }
+}
+
+/******************************************************************************/
+/* Deferred logging rings
+ *
+ * Each thread logs into its own single-producer single-consumer ring, so
+ * producers never lock nor allocate once their ring exists. Rings live in a
+ * lock-free list and are never freed; when a thread exits its ring is released
+ * and may be adopted by a new thread. The consumer (either the background
+ * thread or an explicit flush) merges all rings in timestamp order.
+ */
+
+#define LOG_RING_SIZE 512 /* records per thread, power of 2 */
+
+struct log_ring_s {
+    struct log_ring_s   *next;
+    volatile int         in_use;
+    volatile uint32_t    head;    /* next record to write, updated by the producer */
+    volatile uint32_t    tail;    /* next record to read, updated by the consumer */
+    volatile uint32_t    dropped; /* records lost because the ring was full */
+    struct log_record_s  records [LOG_RING_SIZE];
+};
+
+static struct log_ring_s * volatile rings;
+static __thread struct log_ring_s  *thread_ring;
+static pthread_key_t                ring_key;
+static pthread_once_t               ring_key_once = PTHREAD_ONCE_INIT;
+
+static pthread_mutex_t consumer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t       consumer_thread;
+static volatile int    consumer_running;
+
+#define LOG_CONSUMER_PERIOD_MS 50
+
+static void
+ring_release (void *data)
+{
+    __sync_lock_release (&((struct log_ring_s *) data)->in_use);
+}
+
+static void
+ring_key_init (void)
+{
+    pthread_key_create (&ring_key, ring_release);
+}
+
+static struct log_ring_s *
+ring_get (void)
+{
+    struct log_ring_s *ring;
+
+    if (thread_ring)
+        return thread_ring;
+
+    pthread_once (&ring_key_once, ring_key_init);
+
+    /* Adopt a ring released by a thread that already exited */
+    for (ring = rings; ring; ring = ring->next) {
+        if (__sync_bool_compare_and_swap (&ring->in_use, 0, 1))
+            break;
+    }
+
+    if (!ring) {
+        if (!(ring = calloc (1, sizeof (struct log_ring_s))))
+            return NULL;
+        ring->in_use = 1;
+        do {
+            ring->next = rings;
+        } while (!__sync_bool_compare_and_swap (&rings, ring->next, ring));
+    }
+
+    pthread_setspecific (ring_key, ring);
+    thread_ring = ring;
+    return ring;
+}
+
+/* Returns the record to fill, or NULL if the ring is full. */
+static struct log_record_s *
+ring_reserve (struct log_ring_s *ring)
+{
+    if (ring->head - ring->tail >= LOG_RING_SIZE) {
+        __sync_fetch_and_add (&ring->dropped, 1);
+        return NULL;
+    }
+    return &ring->records[ring->head & (LOG_RING_SIZE - 1)];
+}
+
+static void
+ring_commit (struct log_ring_s *ring)
+{
+    /* Record contents must be visible before the new head */
+    __sync_synchronize ();
+    ring->head++;
+}
+
+static void
+log_flush_rings (void)
+{
+    struct log_ring_s *ring;
+    struct log_ring_s *oldest;
+    unsigned int       dropped;
+    char               message[64];
+
+    pthread_mutex_lock (&consumer_mutex);
+
+    for (;;) {
+        oldest = NULL;
+        for (ring = rings; ring; ring = ring->next) {
+            if (ring->tail == ring->head)
+                continue;
+            __sync_synchronize ();
+            if (!oldest ||
+                ring->records[ring->tail & (LOG_RING_SIZE - 1)].timestamp_ns < oldest->records[oldest->tail & (LOG_RING_SIZE - 1)].timestamp_ns)
+                oldest = ring;
+        }
+
+        if (!oldest)
+            break;
+
+        log_record_dispatch (&oldest->records[oldest->tail & (LOG_RING_SIZE - 1)]);
+
+        /* Record must be fully read before the slot is given back */
+        __sync_synchronize ();
+        oldest->tail++;
+    }
+
+    for (dropped = 0, ring = rings; ring; ring = ring->next)
+        dropped += __sync_fetch_and_and (&ring->dropped, 0);
+
+    if (dropped && default_handler) {
+        snprintf (message, sizeof (message), "warn: %u log messages dropped", dropped);
+        default_handler (pthread_self (), message);
+    }
+
+    pthread_mutex_unlock (&consumer_mutex);
+}
+
+static void *
+consumer_thread_func (void *user_data)
+{
+    struct timespec period = { 0, LOG_CONSUMER_PERIOD_MS * 1000000 };
+
+    while (consumer_running) {
+        log_flush_rings ();
+        nanosleep (&period, NULL);
+    }
+    return NULL;
+}
+
+microtouch3m_status_t
+microtouch3m_log_set_mode (microtouch3m_log_mode_t mode)
+{
+    if (mode == log_mode)
+        return MICROTOUCH3M_STATUS_OK;
+
+    switch (mode) {
+    case MICROTOUCH3M_LOG_MODE_DEFERRED:
+        consumer_running = 1;
+        if (pthread_create (&consumer_thread, NULL, consumer_thread_func, NULL) != 0) {
+            consumer_running = 0;
+            return MICROTOUCH3M_STATUS_FAILED;
+        }
+        log_mode = mode;
+        return MICROTOUCH3M_STATUS_OK;
+    case MICROTOUCH3M_LOG_MODE_IMMEDIATE:
+        log_mode = mode;
+        consumer_running = 0;
+        pthread_join (consumer_thread, NULL);
+        log_flush_rings ();
+        return MICROTOUCH3M_STATUS_OK;
+    default:
+        return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
+    }
+}
+
+void
+microtouch3m_log_flush (void)
+{
+    log_flush_rings ();
+}
+
+/******************************************************************************/
+/* Logging entry points */
+
 void
 microtouch3m_log_full (pthread_t   thread_id,
                        const char *fmt,
                        ...)
 {
-    char    *message;
-    va_list  args;
+    char                *message;
+    va_list              args;
+    int                  saved_errno;
+    struct log_ring_s   *ring;
+    struct log_record_s *record;
 
     if (!default_handler)
         return;
 
+    saved_errno = errno;
+    if ((log_mode == MICROTOUCH3M_LOG_MODE_DEFERRED) && ((ring = ring_get ()) != NULL)) {
+        if ((record = ring_reserve (ring)) != NULL) {
+            va_start (args, fmt);
+            log_record_fill (record, thread_id, saved_errno, fmt, args);
+            va_end (args);
+            ring_commit (ring);
+        }
+        errno = saved_errno;
+        return;
+    }
+
     va_start (args, fmt);
     if (vasprintf (&message, fmt, args) == -1)
         return;
@@ -69,17 +671,47 @@ microtouch3m_log_full (pthread_t   thread_id,
     free (message);
 }
 
+static bool
+log_buffer_deferred (pthread_t   thread_id,
+                     const char *fmt,
+                     const char *name,
+                     const void *mem,
+                     size_t      size)
+{
+    struct log_ring_s   *ring;
+    struct log_record_s *record;
+
+    if (log_mode != MICROTOUCH3M_LOG_MODE_DEFERRED || !(ring = ring_get ()))
+        return false;
+
+    if ((record = ring_reserve (ring)) != NULL) {
+        log_record_fill_buffer (record, thread_id, fmt, name, mem, size);
+        ring_commit (ring);
+    }
+    return true;
+}
+
 void
 microtouch3m_log_raw_full (pthread_t   thread_id,
                            const char *prefix,
                            const void *mem,
                            size_t      size)
 {
+    char  hex[STRHEX_SIZE (LOG_RECORD_DATA_SIZE, 1)];
     char *memstr;
 
     if (!default_handler || !mem || !size)
         return;
 
+    if (log_buffer_deferred (thread_id, "%s (%zu bytes) %s%s", prefix, mem, size))
+        return;
+
+    /* Only allocate for buffers too big for the stack one */
+    if (strhex_to (hex, sizeof (hex), mem, size, ":") < sizeof (hex)) {
+        microtouch3m_log_full (thread_id, "%s (%zu bytes) %s", prefix, size, hex);
+        return;
+    }
+
     memstr = strhex (mem, size, ":");
     if (!memstr)
         return;
@@ -89,16 +721,27 @@ microtouch3m_log_raw_full (pthread_t   thread_id,
 }
 
 void
-microtouch3m_log_buffer (const char    *name,
-                         const uint8_t *buffer,
-                         size_t         buffer_size)
+microtouch3m_log_buffer_full (pthread_t      thread_id,
+                              const char    *name,
+                              const uint8_t *buffer,
+                              size_t         buffer_size)
 {
+    char  hex_stack[STRHEX_SIZE (LOG_RECORD_DATA_SIZE, 1)];
     char *hex;
 
     if (!default_handler)
         return;
 
+    if (log_buffer_deferred (thread_id, "%s (%zu bytes): %s%s", name, buffer, buffer_size))
+        return;
+
+    /* Only allocate for buffers too big for the stack one */
+    if (strhex_to (hex_stack, sizeof (hex_stack), buffer, buffer_size, ":") < sizeof (hex_stack)) {
+        microtouch3m_log_full (thread_id, "%s (%zu bytes): %s", name, buffer_size, hex_stack);
+        return;
+    }
+
     hex = strhex (buffer, buffer_size, ":");
-    microtouch3m_log ("%s (%d bytes): %s", name, buffer_size, hex);
+    microtouch3m_log_full (thread_id, "%s (%zu bytes): %s", name, buffer_size, hex);
     free (hex);
 }
@@ -29,21 +29,58 @@
 /******************************************************************************/
 /* Logging */
 
-void microtouch3m_log_full     (pthread_t   thread_id,
-                                const char *fmt,
-                                ...);
-void microtouch3m_log_raw_full (pthread_t   thread_id,
-                                const char *prefix,
-                                const void *mem,
-                                size_t      size);
+void microtouch3m_log_full        (pthread_t   thread_id,
+                                   const char *fmt,
+                                   ...) __attribute__ ((format (printf, 2, 3)));
+void microtouch3m_log_raw_full    (pthread_t   thread_id,
+                                   const char *prefix,
+                                   const void *mem,
+                                   size_t      size);
+void microtouch3m_log_buffer_full (pthread_t      thread_id,
+                                   const char    *name,
+                                   const uint8_t *buffer,
+                                   size_t         buffer_size);
 
-void microtouch3m_log_buffer   (const char    *name,
-                                const uint8_t *buffer,
-                                size_t         buffer_size);
+bool microtouch3m_log_is_enabled (void);
+
+/******************************************************************************/
+/* Log levels
+ *
+ * Messages below MICROTOUCH3M_LOG_LEVEL_MIN are discarded at compile time,
+ * arguments included; configure with --with-log-level to change it.
+ */
 
-#define microtouch3m_log(...) microtouch3m_log_full (pthread_self (), ## __VA_ARGS__ )
-#define microtouch3m_log_raw(prefix, mem,size) microtouch3m_log_raw_full (pthread_self (), prefix, mem, size)
+#define MICROTOUCH3M_LOG_LEVEL_DEBUG 0
+#define MICROTOUCH3M_LOG_LEVEL_INFO  1
+#define MICROTOUCH3M_LOG_LEVEL_WARN  2
+#define MICROTOUCH3M_LOG_LEVEL_ERROR 3
 
-bool microtouch3m_log_is_enabled (void);
+#if !defined MICROTOUCH3M_LOG_LEVEL_MIN
+# define MICROTOUCH3M_LOG_LEVEL_MIN MICROTOUCH3M_LOG_LEVEL_DEBUG
+#endif
+
+#define MICROTOUCH3M_LOG_LEVEL_ENABLED(level) ((level) >= MICROTOUCH3M_LOG_LEVEL_MIN)
+
+#define microtouch3m_log_level(level, ...) do {                         \
+        if (MICROTOUCH3M_LOG_LEVEL_ENABLED (level))                     \
+            microtouch3m_log_full (pthread_self (), ## __VA_ARGS__ );   \
+    } while (0)
+
+#define microtouch3m_log_debug(...) microtouch3m_log_level (MICROTOUCH3M_LOG_LEVEL_DEBUG, ## __VA_ARGS__ )
+#define microtouch3m_log_info(...)  microtouch3m_log_level (MICROTOUCH3M_LOG_LEVEL_INFO,  ## __VA_ARGS__ )
+#define microtouch3m_log_warn(...)  microtouch3m_log_level (MICROTOUCH3M_LOG_LEVEL_WARN,  ## __VA_ARGS__ )
+#define microtouch3m_log_error(...) microtouch3m_log_level (MICROTOUCH3M_LOG_LEVEL_ERROR, ## __VA_ARGS__ )
+
+#define microtouch3m_log(...) microtouch3m_log_info (__VA_ARGS__)
+
+#define microtouch3m_log_raw(prefix, mem, size) do {                                \
+        if (MICROTOUCH3M_LOG_LEVEL_ENABLED (MICROTOUCH3M_LOG_LEVEL_DEBUG))          \
+            microtouch3m_log_raw_full (pthread_self (), prefix, mem, size);         \
+    } while (0)
+
+#define microtouch3m_log_buffer(name, buffer, buffer_size) do {                     \
+        if (MICROTOUCH3M_LOG_LEVEL_ENABLED (MICROTOUCH3M_LOG_LEVEL_DEBUG))          \
+            microtouch3m_log_buffer_full (pthread_self (), name, buffer, buffer_size); \
+    } while (0)
 
 #endif /* MICROTOUCH3M_LOG_H */
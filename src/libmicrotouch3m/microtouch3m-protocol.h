@@ -0,0 +1,152 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#if !defined MICROTOUCH3M_PROTOCOL_H
+# define MICROTOUCH3M_PROTOCOL_H
+
+#include <stdint.h>
+
+#include <libusb.h>
+
+/******************************************************************************/
+/* Vendor protocol
+ *
+ * Wire format of the requests and reports exchanged with the controller, shared
+ * by the library and the emulated controller. Multi-byte fields are little
+ * endian, except for the values in the settings block, which are big endian.
+ */
+
+#define MICROTOUCH3M_VID 0x0596
+#define MICROTOUCH3M_PID 0x0001
+
+/******************************************************************************/
+/* IN/OUT requests */
+
+enum request_e {
+    REQUEST_ASYNC_SET_REPORT    = 0x01,
+    REQUEST_GET_PARAMETER_BLOCK = 0x02,
+    REQUEST_SET_PARAMETER_BLOCK = 0x03,
+    REQUEST_STATUS              = 0x06,
+    REQUEST_RESET               = 0x07,
+    REQUEST_CONTROLLER_ID       = 0x0A,
+    REQUEST_GET_PARAMETER       = 0x10,
+    REQUEST_SET_PARAMETER       = 0x11,
+    REQUEST_GET_GENERIC         = 0x12,
+    REQUEST_SET_GENERIC         = 0x13,
+};
+
+enum parameter_id_e {
+    PARAMETER_ID_CONTROLLER_NOVRAM   = 0x0000,
+    PARAMETER_ID_CONTROLLER_STRAYS   = 0x0003,
+    PARAMETER_ID_CONTROLLER_SETTINGS = 0x0017,
+    PARAMETER_ID_CONTROLLER_EEPROM   = 0x0020,
+};
+
+enum report_id_e {
+    REPORT_ID_COORDINATE_DATA = 0x0001,
+    REPORT_ID_SCOPE_DATA      = 0x0002,
+    REPORT_ID_PARAMETER       = 0x0004,
+};
+
+enum async_set_report_e {
+    ASYNC_SET_REPORT_DISABLE = 0x0000,
+    ASYNC_SET_REPORT_ENABLE  = 0x0001,
+};
+
+struct parameter_report_s {
+    uint8_t  report_id;
+    uint16_t data_size;
+    uint8_t  data [];
+} __attribute__((packed));
+
+/* Parameters used by more than one request */
+#define VALUE_FREQUENCY              0x0002 /* generic, index */
+#define VALUE_ORIENTATION            0x00f2 /* settings block, index */
+#define ORIENTATION_PARAMETER_NUMBER 1
+#define IDENTIFIER_PARAMETER_NUMBER  2
+
+/******************************************************************************/
+/* Status */
+
+typedef enum {
+    CMD_STATUS_FAILURE            = 0,
+    CMD_STATUS_ONGOING            = 1,
+    CMD_STATUS_STAGE_1_COMPLETED  = 2,
+    CMD_STATUS_COMPLETED          = 3,
+    CMD_STATUS_SOFT_RESET_OCCURED = 4,
+    CMD_STATUS_HARD_RESET_OCCURED = 5,
+} cmd_status_t;
+
+struct standard_status_report_s {
+    uint8_t  report_id;
+    uint16_t poc_status;
+    uint8_t  cmd_status;
+    uint8_t  touch_status;
+    uint16_t async_reports;
+    uint8_t  reserved;
+} __attribute__((packed));
+
+struct extended_status_report_s {
+    struct standard_status_report_s standard;
+    uint8_t  reserved;
+    uint16_t extended_poc_status;
+    uint8_t  reserved2[9];
+} __attribute__((packed));
+
+/******************************************************************************/
+/* Controller ID */
+
+struct report_controller_id_s {
+    uint8_t  report_id;
+    uint16_t controller_type;
+    uint8_t  firmware_major;
+    uint8_t  firmware_minor;
+    uint8_t  features;
+    uint16_t constants_checksum;
+    uint16_t max_param_write;
+    uint8_t  reserved[8];
+    uint32_t pc_checksum;
+    uint16_t asic_type;
+} __attribute__((packed));
+
+/******************************************************************************/
+/* Async reports */
+
+#define MAX_INTERRUPT_ENDPOINT_TRANSFER 32
+#define INTERRUPT_ENDPOINT_IN           (LIBUSB_ENDPOINT_IN | 1)
+
+struct report_scope_s {
+    uint8_t  report_id;
+    uint16_t wtf;
+    uint32_t ul_i;
+    uint32_t ul_q;
+    uint32_t ur_i;
+    uint32_t ur_q;
+    uint32_t ll_i;
+    uint32_t ll_q;
+    uint32_t lr_i;
+    uint32_t lr_q;
+} __attribute__((packed));
+
+#endif /* MICROTOUCH3M_PROTOCOL_H */
@@ -0,0 +1,259 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <time.h>
+#include <assert.h>
+
+#include "microtouch3m.h"
+#include "microtouch3m-log.h"
+#include "microtouch3m-recording.h"
+
+/******************************************************************************/
+/* Scope recording file format
+ *
+ * A fixed size file header, followed by fixed size records. All fields in
+ * little endian.
+ */
+
+#define RECORDING_FILE_MAGIC          "M3MSCOPE"
+#define RECORDING_FILE_FORMAT_VERSION 1
+
+struct recording_file_header_s {
+    char     magic [8];
+    uint16_t format_version;
+    uint16_t header_size;
+    uint16_t record_size;
+    uint16_t reserved;
+    uint64_t start_time_us;   /* CLOCK_REALTIME */
+} __attribute__((packed));
+
+struct recording_record_s {
+    uint64_t timestamp_us;    /* since recording start */
+    uint8_t  type;
+    uint8_t  reserved [3];
+    int32_t  values [8];      /* UL, UR, LL, LR; I and Q each */
+} __attribute__((packed));
+
+/******************************************************************************/
+/* Recording writer
+ *
+ * Unlike USB transfer traces, records are small and come at the report rate at
+ * most, so a large stdio buffer is enough to keep file I/O out of most of the
+ * reports: the buffer holds a few seconds of reports even at high rates.
+ */
+
+#define RECORDING_BUFFER_SIZE (64 * 1024)
+
+struct recording_s {
+    FILE     *f;
+    char     *buffer;
+    uint64_t  start_us;
+    bool      write_failed;
+};
+
+static uint64_t
+clock_time_us (clockid_t clock_id)
+{
+    struct timespec ts;
+
+    clock_gettime (clock_id, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+recording_t *
+recording_new (const char *path)
+{
+    recording_t                    *recording;
+    struct recording_file_header_s  header;
+
+    assert (path);
+
+    if (!(recording = calloc (1, sizeof (recording_t))))
+        return NULL;
+
+    if (!(recording->buffer = malloc (RECORDING_BUFFER_SIZE))) {
+        microtouch3m_log_error ("error: couldn't allocate scope recording buffer");
+        goto outerr;
+    }
+
+    if (!(recording->f = fopen (path, "we"))) {
+        microtouch3m_log_error ("error: couldn't open scope recording file '%s': %s", path, strerror (errno));
+        goto outerr;
+    }
+    setvbuf (recording->f, recording->buffer, _IOFBF, RECORDING_BUFFER_SIZE);
+
+    recording->start_us = clock_time_us (CLOCK_MONOTONIC);
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, RECORDING_FILE_MAGIC, sizeof (header.magic));
+    header.format_version = htole16 (RECORDING_FILE_FORMAT_VERSION);
+    header.header_size    = htole16 (sizeof (header));
+    header.record_size    = htole16 (sizeof (struct recording_record_s));
+    header.start_time_us  = htole64 (clock_time_us (CLOCK_REALTIME));
+
+    if (fwrite (&header, sizeof (header), 1, recording->f) != 1) {
+        microtouch3m_log_error ("error: couldn't write scope recording file header: %s", strerror (errno));
+        goto outerr;
+    }
+
+    microtouch3m_log ("scope recording started: %s", path);
+    return recording;
+
+outerr:
+    if (recording->f) {
+        fclose (recording->f);
+        unlink (path);
+    }
+    free (recording->buffer);
+    free (recording);
+    return NULL;
+}
+
+void
+recording_free (recording_t *recording)
+{
+    assert (recording);
+
+    if (fclose (recording->f) != 0)
+        recording->write_failed = true;
+    if (recording->write_failed)
+        microtouch3m_log_error ("error: couldn't write scope recording file contents");
+    microtouch3m_log ("scope recording finished");
+
+    free (recording->buffer);
+    free (recording);
+}
+
+void
+recording_add (recording_t                      *recording,
+               microtouch3m_scope_record_type_t  type,
+               uint64_t                          timestamp_us,
+               const int32_t                    *values)
+{
+    struct recording_record_s record;
+    unsigned int              i;
+
+    memset (&record, 0, sizeof (record));
+    record.timestamp_us = htole64 ((timestamp_us > recording->start_us) ? (timestamp_us - recording->start_us) : 0);
+    record.type         = (uint8_t) type;
+    for (i = 0; i < 8; i++)
+        record.values[i] = (int32_t) htole32 ((uint32_t) values[i]);
+
+    if (fwrite (&record, sizeof (record), 1, recording->f) != 1)
+        recording->write_failed = true;
+}
+
+/******************************************************************************/
+/* Recording reader */
+
+microtouch3m_status_t
+microtouch3m_scope_recording_file_read (const char                          *path,
+                                        microtouch3m_scope_recording_info_t *info,
+                                        microtouch3m_scope_record_f          callback,
+                                        void                                *user_data)
+{
+    microtouch3m_status_t           st = MICROTOUCH3M_STATUS_OK;
+    FILE                           *f;
+    struct recording_file_header_s  file_header;
+    struct recording_record_s       header;
+    microtouch3m_scope_record_t     record;
+    size_t                          n;
+
+    assert (path);
+    assert (callback);
+
+    if (!(f = fopen (path, "re"))) {
+        microtouch3m_log_error ("error: couldn't open scope recording file '%s': %s", path, strerror (errno));
+        return MICROTOUCH3M_STATUS_FAILED;
+    }
+
+    if (fread (&file_header, sizeof (file_header), 1, f) != 1 ||
+        memcmp (file_header.magic, RECORDING_FILE_MAGIC, sizeof (file_header.magic)) != 0) {
+        microtouch3m_log_error ("error: '%s' is not a scope recording file", path);
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if (le16toh (file_header.format_version) != RECORDING_FILE_FORMAT_VERSION ||
+        le16toh (file_header.record_size) != sizeof (struct recording_record_s)) {
+        microtouch3m_log_error ("error: unsupported scope recording file format version: %u", le16toh (file_header.format_version));
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if (le16toh (file_header.header_size) < sizeof (file_header) ||
+        fseek (f, le16toh (file_header.header_size), SEEK_SET) < 0) {
+        microtouch3m_log_error ("error: invalid scope recording file header size");
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if (info)
+        info->start_time_us = le64toh (file_header.start_time_us);
+
+    while ((n = fread (&header, 1, sizeof (header), f)) > 0) {
+        if (n != sizeof (header)) {
+            microtouch3m_log_error ("error: truncated scope recording record");
+            st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+            goto out;
+        }
+
+        if (header.type != MICROTOUCH3M_SCOPE_RECORD_REPORT && header.type != MICROTOUCH3M_SCOPE_RECORD_STRAYS) {
+            microtouch3m_log_error ("error: unknown scope recording record type: %u", header.type);
+            st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+            goto out;
+        }
+
+        record.timestamp_us = le64toh (header.timestamp_us);
+        record.type         = (microtouch3m_scope_record_type_t) header.type;
+        record.ul_i         = (int32_t) le32toh ((uint32_t) header.values[0]);
+        record.ul_q         = (int32_t) le32toh ((uint32_t) header.values[1]);
+        record.ur_i         = (int32_t) le32toh ((uint32_t) header.values[2]);
+        record.ur_q         = (int32_t) le32toh ((uint32_t) header.values[3]);
+        record.ll_i         = (int32_t) le32toh ((uint32_t) header.values[4]);
+        record.ll_q         = (int32_t) le32toh ((uint32_t) header.values[5]);
+        record.lr_i         = (int32_t) le32toh ((uint32_t) header.values[6]);
+        record.lr_q         = (int32_t) le32toh ((uint32_t) header.values[7]);
+
+        if (!callback (&record, user_data))
+            break;
+    }
+
+    if (ferror (f)) {
+        microtouch3m_log_error ("error: couldn't read scope recording file: %s", strerror (errno));
+        st = MICROTOUCH3M_STATUS_FAILED;
+    }
+
+out:
+    fclose (f);
+    return st;
+}
@@ -0,0 +1,48 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#if !defined MICROTOUCH3M_RECORDING_H
+# define MICROTOUCH3M_RECORDING_H
+
+#include <stdint.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Scope recordings */
+
+typedef struct recording_s recording_t;
+
+recording_t *recording_new  (const char *path);
+void         recording_free (recording_t *recording);
+
+/* The timestamp is given in CLOCK_MONOTONIC microseconds, and stored relative
+ * to the recording start. The values are the I/Q pairs of the UL, UR, LL and
+ * LR corners. */
+void         recording_add  (recording_t                      *recording,
+                             microtouch3m_scope_record_type_t  type,
+                             uint64_t                          timestamp_us,
+                             const int32_t                    *values);
+
+#endif /* MICROTOUCH3M_RECORDING_H */
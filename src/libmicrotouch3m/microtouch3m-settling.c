@@ -0,0 +1,215 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Settling detector
+ *
+ * Keeps the last two windows of samples of each corner. The stream is settled
+ * once, for every corner, the variances of both windows are within the given
+ * ratio of each other, so that no transient or spike is left in them, and the
+ * least squares trend of the last window moves the signal less than the given
+ * number of standard deviations along the window.
+ */
+
+struct microtouch3m_settling_detector_s {
+    unsigned int window;
+    double       slope_threshold;
+    double       variance_ratio;
+    uint64_t     max_samples;
+
+    uint64_t     n_samples;
+    bool         settled;
+    bool         timed_out;
+
+    /* last 2 windows of samples of each corner, oldest first from next */
+    unsigned int next;
+    double      *history [MICROTOUCH3M_SCOPE_N_CORNERS];
+};
+
+microtouch3m_settling_detector_t *
+microtouch3m_settling_detector_new (unsigned int window,
+                                    double       slope_threshold,
+                                    double       variance_ratio,
+                                    uint64_t     max_samples)
+{
+    microtouch3m_settling_detector_t *detector;
+    unsigned int                      c;
+
+    if (window < 3 || slope_threshold < 0.0 || variance_ratio < 1.0)
+        return NULL;
+
+    if (!(detector = calloc (1, sizeof (microtouch3m_settling_detector_t))))
+        return NULL;
+
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+        if (!(detector->history[c] = calloc (2 * window, sizeof (double)))) {
+            microtouch3m_settling_detector_free (detector);
+            return NULL;
+        }
+    }
+
+    detector->window          = window;
+    detector->slope_threshold = slope_threshold;
+    detector->variance_ratio  = variance_ratio;
+    detector->max_samples     = max_samples;
+    return detector;
+}
+
+void
+microtouch3m_settling_detector_free (microtouch3m_settling_detector_t *detector)
+{
+    unsigned int c;
+
+    if (!detector)
+        return;
+
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+        free (detector->history[c]);
+    free (detector);
+}
+
+void
+microtouch3m_settling_detector_reset (microtouch3m_settling_detector_t *detector)
+{
+    detector->n_samples = 0;
+    detector->settled   = false;
+    detector->timed_out = false;
+    detector->next      = 0;
+}
+
+/* Variance and least squares slope, per sample, of a window of the history */
+static void
+window_fit (const microtouch3m_settling_detector_t *detector,
+            const double                           *history,
+            unsigned int                            first,
+            double                                 *variance,
+            double                                 *slope)
+{
+    double       mean_k;
+    double       mean = 0.0;
+    double       sum_squares = 0.0;
+    double       cov = 0.0;
+    double       var_k = 0.0;
+    unsigned int k;
+
+    for (k = 0; k < detector->window; k++)
+        mean += history[(detector->next + first + k) % (2 * detector->window)];
+    mean /= detector->window;
+
+    mean_k = (detector->window - 1) / 2.0;
+    for (k = 0; k < detector->window; k++) {
+        double value;
+
+        value = history[(detector->next + first + k) % (2 * detector->window)] - mean;
+        sum_squares += value * value;
+        cov += (k - mean_k) * value;
+        var_k += (k - mean_k) * (k - mean_k);
+    }
+
+    *variance = sum_squares / (detector->window - 1);
+    *slope = cov / var_k;
+}
+
+static bool
+check_settled (const microtouch3m_settling_detector_t *detector)
+{
+    unsigned int c;
+
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+        double previous_variance;
+        double variance;
+        double slope;
+        double unused;
+
+        window_fit (detector, detector->history[c], 0, &previous_variance, &unused);
+        window_fit (detector, detector->history[c], detector->window, &variance, &slope);
+
+        /* One signal unit of variance, so that noiseless signals settle */
+        previous_variance += 1.0;
+        variance += 1.0;
+
+        if (variance > previous_variance * detector->variance_ratio ||
+            previous_variance > variance * detector->variance_ratio)
+            return false;
+
+        if (fabs (slope) * (detector->window - 1) > detector->slope_threshold * sqrt (variance))
+            return false;
+    }
+
+    return true;
+}
+
+size_t
+microtouch3m_settling_detector_add (microtouch3m_settling_detector_t *detector,
+                                    const int32_t                    *signal,
+                                    size_t                            n)
+{
+    size_t       i;
+    unsigned int c;
+
+    if (detector->settled)
+        return 0;
+
+    for (i = 0; i < n; i++) {
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+            detector->history[c][detector->next] = (double) signal[(i * MICROTOUCH3M_SCOPE_N_CORNERS) + c];
+        detector->next = (detector->next + 1) % (2 * detector->window);
+        detector->n_samples++;
+
+        if (detector->n_samples >= 2 * detector->window && check_settled (detector))
+            detector->settled = true;
+        else if (detector->max_samples && detector->n_samples >= detector->max_samples)
+            detector->settled = detector->timed_out = true;
+
+        if (detector->settled)
+            return i + 1;
+    }
+
+    return n;
+}
+
+bool
+microtouch3m_settling_detector_is_settled (const microtouch3m_settling_detector_t *detector)
+{
+    return detector->settled;
+}
+
+bool
+microtouch3m_settling_detector_is_timed_out (const microtouch3m_settling_detector_t *detector)
+{
+    return detector->timed_out;
+}
+
+uint64_t
+microtouch3m_settling_detector_get_n_settling (const microtouch3m_settling_detector_t *detector)
+{
+    return detector->n_samples;
+}
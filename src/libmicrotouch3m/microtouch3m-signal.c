@@ -0,0 +1,342 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stddef.h>
+#include <assert.h>
+
+#if defined __SSE2__
+# include <emmintrin.h>
+#elif defined __ARM_NEON__ || defined __ARM_NEON
+# include <arm_neon.h>
+# define HAVE_NEON 1
+#endif
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* I/Q magnitude
+ *
+ * The magnitude is floor (sqrt (i*i + q*q)), computed exactly for the whole
+ * int32 range. The sum of squares needs up to 63 bits, so it doesn't fit in a
+ * double without rounding; the SIMD paths compute an estimate, which is then
+ * fixed up with integer arithmetic. Sums below 2^52, i.e. all the values
+ * seen in practice, are exact in double precision and so is the truncated
+ * square root, so no fix up is needed for them. Without SIMD, the square root
+ * is computed digit by digit, without multiplications nor divisions, which is
+ * also the cheapest option on targets with soft-float.
+ */
+
+/* floor (sqrt (2^63)), the largest possible magnitude */
+#define MAGNITUDE_MAX 3037000499u
+
+static inline uint64_t
+iq_sum_of_squares (int32_t i,
+                   int32_t q)
+{
+    return (uint64_t) ((int64_t) i * (int64_t) i) + (uint64_t) ((int64_t) q * (int64_t) q);
+}
+
+static inline uint64_t
+isqrt64 (uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t) 1 << 62;
+
+    while (bit > value)
+        bit >>= 2;
+
+    while (bit) {
+        if (value >= result + bit) {
+            value  -= result + bit;
+            result  = (result >> 1) + bit;
+        } else
+            result >>= 1;
+        bit >>= 2;
+    }
+    return result;
+}
+
+/* Turns an estimate off by a few units into the exact floor (sqrt (value)) */
+static inline uint64_t
+isqrt64_refine (uint64_t value,
+                uint64_t estimate)
+{
+    if (estimate > MAGNITUDE_MAX)
+        estimate = MAGNITUDE_MAX;
+    while (estimate * estimate > value)
+        estimate--;
+    while ((estimate + 1) * (estimate + 1) <= value)
+        estimate++;
+    return estimate;
+}
+
+#if defined __SSE2__
+
+static size_t
+iq_magnitude_batch_sse2 (const int32_t *i,
+                         const int32_t *q,
+                         uint64_t      *magnitude,
+                         size_t         n)
+{
+    const __m128d exact_limit = _mm_set1_pd (4503599627370496.0); /* 2^52 */
+    size_t        k;
+
+    /* Two pairs at a time, which is what fits in double precision lanes */
+    for (k = 0; k + 2 <= n; k += 2) {
+        __m128d vi;
+        __m128d vq;
+        __m128d sum;
+        double  estimate[2];
+
+        vi  = _mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i *) &i[k]));
+        vq  = _mm_cvtepi32_pd (_mm_loadl_epi64 ((const __m128i *) &q[k]));
+        sum = _mm_add_pd (_mm_mul_pd (vi, vi), _mm_mul_pd (vq, vq));
+        _mm_storeu_pd (estimate, _mm_sqrt_pd (sum));
+
+        if (_mm_movemask_pd (_mm_cmplt_pd (sum, exact_limit)) == 0x3) {
+            magnitude[k]     = (uint64_t) estimate[0];
+            magnitude[k + 1] = (uint64_t) estimate[1];
+            continue;
+        }
+
+        magnitude[k]     = isqrt64_refine (iq_sum_of_squares (i[k],     q[k]),     (uint64_t) estimate[0]);
+        magnitude[k + 1] = isqrt64_refine (iq_sum_of_squares (i[k + 1], q[k + 1]), (uint64_t) estimate[1]);
+    }
+    return k;
+}
+
+#elif defined HAVE_NEON
+
+static size_t
+iq_magnitude_batch_neon (const int32_t *i,
+                         const int32_t *q,
+                         uint64_t      *magnitude,
+                         size_t         n)
+{
+    size_t k;
+
+    /* Four pairs at a time in single precision: sqrt (s) = s * rsqrt (s),
+     * with the reciprocal square root estimate refined twice */
+    for (k = 0; k + 4 <= n; k += 4) {
+        float32x4_t  vi;
+        float32x4_t  vq;
+        float32x4_t  s;
+        float32x4_t  rs;
+        float        estimate[4];
+        float        inverse[4];
+        unsigned int j;
+
+        vi = vcvtq_f32_s32 (vld1q_s32 (&i[k]));
+        vq = vcvtq_f32_s32 (vld1q_s32 (&q[k]));
+        s  = vmlaq_f32 (vmulq_f32 (vi, vi), vq, vq);
+        rs = vrsqrteq_f32 (s);
+        rs = vmulq_f32 (rs, vrsqrtsq_f32 (vmulq_f32 (s, rs), rs));
+        rs = vmulq_f32 (rs, vrsqrtsq_f32 (vmulq_f32 (s, rs), rs));
+        vst1q_f32 (estimate, vmulq_f32 (s, rs));
+        vst1q_f32 (inverse, rs);
+
+        for (j = 0; j < 4; j++) {
+            uint64_t value;
+            int64_t  root;
+
+            value = iq_sum_of_squares (i[k + j], q[k + j]);
+            /* Zero gives NaN estimates */
+            if (!value) {
+                magnitude[k + j] = 0;
+                continue;
+            }
+
+            /* Single precision is off by up to a few hundred units in the
+             * largest magnitudes, so one Newton step on the integer residual
+             * before the final fix up */
+            root = (int64_t) estimate[j];
+            if (root < 1)
+                root = 1;
+            else if (root > MAGNITUDE_MAX)
+                root = MAGNITUDE_MAX;
+            root += (int64_t) ((float) ((int64_t) value - (root * root)) * inverse[j] * 0.5f);
+            if (root < 0)
+                root = 0;
+            magnitude[k + j] = isqrt64_refine (value, (uint64_t) root);
+        }
+    }
+    return k;
+}
+
+#endif
+
+void
+microtouch3m_iq_magnitude_batch (const int32_t *i,
+                                 const int32_t *q,
+                                 uint64_t      *magnitude,
+                                 size_t         n)
+{
+    size_t k = 0;
+
+    assert (i || !n);
+    assert (q || !n);
+    assert (magnitude || !n);
+
+#if defined __SSE2__
+    k = iq_magnitude_batch_sse2 (i, q, magnitude, n);
+#elif defined HAVE_NEON
+    k = iq_magnitude_batch_neon (i, q, magnitude, n);
+#endif
+
+    for (; k < n; k++)
+        magnitude[k] = isqrt64 (iq_sum_of_squares (i[k], q[k]));
+}
+
+/******************************************************************************/
+/* Scope signals
+ *
+ * Magnitudes are computed in chunks into a small buffer on the stack, which
+ * is then corrected, scaled and saturated while still in cache.
+ */
+
+#define SCOPE_CHUNK_SAMPLES 64
+
+static inline int32_t
+scope_signal_saturate (int64_t value)
+{
+    if (value > INT32_MAX)
+        return INT32_MAX;
+    if (value < INT32_MIN)
+        return INT32_MIN;
+    return (int32_t) value;
+}
+
+static inline int32_t
+scope_signal_saturate_double (double value)
+{
+    if (value >= (double) INT32_MAX)
+        return INT32_MAX;
+    if (value <= (double) INT32_MIN)
+        return INT32_MIN;
+    return (int32_t) value;
+}
+
+#if defined __SSE2__
+
+/* Magnitudes are below 2^52, so they can be converted to double by placing
+ * them in the mantissa of 2^52 and subtracting it, which SSE2 lacks an
+ * instruction for. */
+static size_t
+scope_signal_scale_sse2 (const uint64_t *magnitude,
+                         const double   *stray,
+                         double          scale,
+                         int32_t        *signal,
+                         size_t          n_values)
+{
+    const __m128i magic_bits = _mm_set1_epi64x (0x4330000000000000ll);
+    const __m128d magic      = _mm_set1_pd (4503599627370496.0); /* 2^52 */
+    const __m128d vscale     = _mm_set1_pd (scale);
+    const __m128d vmax       = _mm_set1_pd ((double) INT32_MAX);
+    const __m128d vmin       = _mm_set1_pd ((double) INT32_MIN);
+    const __m128d stray_01   = _mm_loadu_pd (&stray[0]);
+    const __m128d stray_23   = _mm_loadu_pd (&stray[2]);
+    size_t        k;
+
+    /* One sample, i.e. four corners, at a time */
+    for (k = 0; k + 4 <= n_values; k += 4) {
+        __m128d v01;
+        __m128d v23;
+
+        v01 = _mm_sub_pd (_mm_castsi128_pd (_mm_or_si128 (_mm_loadu_si128 ((const __m128i *) &magnitude[k]), magic_bits)), magic);
+        v23 = _mm_sub_pd (_mm_castsi128_pd (_mm_or_si128 (_mm_loadu_si128 ((const __m128i *) &magnitude[k + 2]), magic_bits)), magic);
+        v01 = _mm_mul_pd (_mm_sub_pd (v01, stray_01), vscale);
+        v23 = _mm_mul_pd (_mm_sub_pd (v23, stray_23), vscale);
+        v01 = _mm_max_pd (_mm_min_pd (v01, vmax), vmin);
+        v23 = _mm_max_pd (_mm_min_pd (v23, vmax), vmin);
+
+        _mm_storeu_si128 ((__m128i *) &signal[k],
+                          _mm_unpacklo_epi64 (_mm_cvttpd_epi32 (v01), _mm_cvttpd_epi32 (v23)));
+    }
+    return k;
+}
+
+#endif /* __SSE2__ */
+
+static void
+scope_signal_scale (const uint64_t *magnitude,
+                    const uint64_t *stray_signal,
+                    double          scale,
+                    int32_t        *signal,
+                    size_t          n_values)
+{
+    size_t k = 0;
+
+    /* Unscaled signals don't need floating point at all (scale == 1.0) */
+    if (!(scale < 1.0) && !(scale > 1.0)) {
+        for (k = 0; k < n_values; k++)
+            signal[k] = scope_signal_saturate ((int64_t) magnitude[k] - (stray_signal ? (int64_t) stray_signal[k & 3] : 0));
+        return;
+    }
+
+    {
+        double stray[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+        if (stray_signal) {
+            for (k = 0; k < 4; k++)
+                stray[k] = (double) stray_signal[k];
+            k = 0;
+        }
+
+#if defined __SSE2__
+        k = scope_signal_scale_sse2 (magnitude, stray, scale, signal, n_values);
+#endif
+
+        for (; k < n_values; k++)
+            signal[k] = scope_signal_saturate_double (((double) magnitude[k] - stray[k & 3]) * scale);
+    }
+}
+
+void
+microtouch3m_scope_signal_batch (const int32_t  *i,
+                                 const int32_t  *q,
+                                 const uint64_t *stray_signal,
+                                 double          scale,
+                                 int32_t        *signal,
+                                 size_t          n_samples)
+{
+    uint64_t magnitude[SCOPE_CHUNK_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t   done;
+
+    assert (i || !n_samples);
+    assert (q || !n_samples);
+    assert (signal || !n_samples);
+
+    for (done = 0; done < n_samples; done += SCOPE_CHUNK_SAMPLES) {
+        size_t n_values;
+        size_t offset;
+
+        n_values = ((n_samples - done) < SCOPE_CHUNK_SAMPLES ? (n_samples - done) : SCOPE_CHUNK_SAMPLES) * MICROTOUCH3M_SCOPE_N_CORNERS;
+        offset   = done * MICROTOUCH3M_SCOPE_N_CORNERS;
+
+        microtouch3m_iq_magnitude_batch (&i[offset], &q[offset], magnitude, n_values);
+        scope_signal_scale (magnitude, stray_signal, scale, &signal[offset], n_values);
+    }
+}
@@ -0,0 +1,349 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Scope spectrum
+ *
+ * Welch's method: the signal of each corner is split in segments of 'size'
+ * samples overlapping by half, each segment has its mean removed and a Hann
+ * window applied, and the power spectra of all segments are averaged.
+ *
+ * The real FFT of each segment is computed with a complex FFT of half the
+ * size over the even/odd samples packed as real/imaginary parts, followed by
+ * a split step. All the tables and buffers are allocated upfront.
+ */
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+struct microtouch3m_scope_spectrum_s {
+    unsigned int  size;
+    unsigned int  half;
+
+    /* precomputed tables */
+    double       *window;
+    double        window_power;
+    double       *twiddle_re;  /* half entries: exp (-2*pi*i*k/size) */
+    double       *twiddle_im;
+    unsigned int *bitrev;      /* half entries */
+
+    /* input history, sample-major */
+    int32_t      *ring;
+    unsigned int  ring_pos;
+    unsigned int  n_filled;
+    unsigned int  n_since_segment;
+
+    /* FFT workspace */
+    double       *segment;
+    double       *work_re;
+    double       *work_im;
+
+    /* accumulated one-sided power spectra */
+    uint64_t      n_segments;
+    double       *power[MICROTOUCH3M_SCOPE_N_CORNERS];
+};
+
+static void
+fft_complex (const microtouch3m_scope_spectrum_t *spectrum,
+             double                              *re,
+             double                              *im)
+{
+    unsigned int n = spectrum->half;
+    unsigned int len;
+    unsigned int k;
+
+    for (k = 0; k < n; k++) {
+        unsigned int j = spectrum->bitrev[k];
+
+        if (j > k) {
+            double aux;
+
+            aux = re[k]; re[k] = re[j]; re[j] = aux;
+            aux = im[k]; im[k] = im[j]; im[j] = aux;
+        }
+    }
+
+    for (len = 2; len <= n; len <<= 1) {
+        unsigned int half_len = len >> 1;
+        /* twiddles of an n-point FFT are every other entry of the table */
+        unsigned int step = 2 * (n / len);
+        unsigned int start;
+
+        for (start = 0; start < n; start += len) {
+            unsigned int j;
+
+            for (j = 0; j < half_len; j++) {
+                unsigned int a = start + j;
+                unsigned int b = a + half_len;
+                double       w_re = spectrum->twiddle_re[j * step];
+                double       w_im = spectrum->twiddle_im[j * step];
+                double       t_re = w_re * re[b] - w_im * im[b];
+                double       t_im = w_re * im[b] + w_im * re[b];
+
+                re[b] = re[a] - t_re;
+                im[b] = im[a] - t_im;
+                re[a] += t_re;
+                im[a] += t_im;
+            }
+        }
+    }
+}
+
+/* Power spectrum of spectrum->segment, accumulated in 'power' */
+static void
+fft_real_power_accumulate (microtouch3m_scope_spectrum_t *spectrum,
+                           double                        *power)
+{
+    unsigned int n = spectrum->half;
+    double      *re = spectrum->work_re;
+    double      *im = spectrum->work_im;
+    double       norm;
+    unsigned int k;
+
+    for (k = 0; k < n; k++) {
+        re[k] = spectrum->segment[2 * k];
+        im[k] = spectrum->segment[2 * k + 1];
+    }
+
+    fft_complex (spectrum, re, im);
+
+    /* One-sided power, normalized so that the bins add up to the mean
+     * square of the segment */
+    norm = 1.0 / ((double) spectrum->size * spectrum->window_power);
+
+    power[0] += (re[0] + im[0]) * (re[0] + im[0]) * norm;
+    power[n] += (re[0] - im[0]) * (re[0] - im[0]) * norm;
+
+    for (k = 1; k < n; k++) {
+        double even_re, even_im;
+        double odd_re, odd_im;
+        double x_re, x_im;
+
+        /* E = (Z[k] + conj (Z[n-k])) / 2, O = -i (Z[k] - conj (Z[n-k])) / 2 */
+        even_re = (re[k] + re[n - k]) * 0.5;
+        even_im = (im[k] - im[n - k]) * 0.5;
+        odd_re  = (im[k] + im[n - k]) * 0.5;
+        odd_im  = (re[n - k] - re[k]) * 0.5;
+
+        /* X[k] = E + W^k O */
+        x_re = even_re + spectrum->twiddle_re[k] * odd_re - spectrum->twiddle_im[k] * odd_im;
+        x_im = even_im + spectrum->twiddle_re[k] * odd_im + spectrum->twiddle_im[k] * odd_re;
+
+        power[k] += 2.0 * (x_re * x_re + x_im * x_im) * norm;
+    }
+}
+
+static void
+spectrum_process_segment (microtouch3m_scope_spectrum_t *spectrum)
+{
+    unsigned int corner;
+
+    for (corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; corner++) {
+        double       mean = 0.0;
+        unsigned int k;
+
+        /* oldest sample first */
+        for (k = 0; k < spectrum->size; k++) {
+            unsigned int pos = (spectrum->ring_pos + k) % spectrum->size;
+
+            spectrum->segment[k] = (double) spectrum->ring[pos * MICROTOUCH3M_SCOPE_N_CORNERS + corner];
+            mean += spectrum->segment[k];
+        }
+        mean /= (double) spectrum->size;
+
+        for (k = 0; k < spectrum->size; k++)
+            spectrum->segment[k] = (spectrum->segment[k] - mean) * spectrum->window[k];
+
+        fft_real_power_accumulate (spectrum, spectrum->power[corner]);
+    }
+    spectrum->n_segments++;
+}
+
+microtouch3m_scope_spectrum_t *
+microtouch3m_scope_spectrum_new (unsigned int size)
+{
+    microtouch3m_scope_spectrum_t *spectrum;
+    unsigned int                   log2_half = 0;
+    unsigned int                   k;
+
+    if (size < MICROTOUCH3M_SCOPE_SPECTRUM_MIN_SIZE ||
+        size > MICROTOUCH3M_SCOPE_SPECTRUM_MAX_SIZE ||
+        (size & (size - 1)))
+        return NULL;
+
+    if (!(spectrum = calloc (1, sizeof (microtouch3m_scope_spectrum_t))))
+        return NULL;
+
+    spectrum->size = size;
+    spectrum->half = size / 2;
+
+    if (!(spectrum->window     = malloc (size * sizeof (double))) ||
+        !(spectrum->twiddle_re = malloc (spectrum->half * sizeof (double))) ||
+        !(spectrum->twiddle_im = malloc (spectrum->half * sizeof (double))) ||
+        !(spectrum->bitrev     = malloc (spectrum->half * sizeof (unsigned int))) ||
+        !(spectrum->ring       = malloc (size * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t))) ||
+        !(spectrum->segment    = malloc (size * sizeof (double))) ||
+        !(spectrum->work_re    = malloc (spectrum->half * sizeof (double))) ||
+        !(spectrum->work_im    = malloc (spectrum->half * sizeof (double))))
+        goto failed;
+
+    for (k = 0; k < MICROTOUCH3M_SCOPE_N_CORNERS; k++) {
+        if (!(spectrum->power[k] = malloc ((spectrum->half + 1) * sizeof (double))))
+            goto failed;
+    }
+
+    /* periodic Hann window */
+    for (k = 0; k < size; k++) {
+        spectrum->window[k] = 0.5 - 0.5 * cos (2.0 * M_PI * (double) k / (double) size);
+        spectrum->window_power += spectrum->window[k] * spectrum->window[k];
+    }
+
+    for (k = 0; k < spectrum->half; k++) {
+        spectrum->twiddle_re[k] = cos (2.0 * M_PI * (double) k / (double) size);
+        spectrum->twiddle_im[k] = -sin (2.0 * M_PI * (double) k / (double) size);
+    }
+
+    while ((1u << log2_half) < spectrum->half)
+        log2_half++;
+    for (k = 0; k < spectrum->half; k++) {
+        unsigned int reversed = 0;
+        unsigned int bit;
+
+        for (bit = 0; bit < log2_half; bit++) {
+            if (k & (1u << bit))
+                reversed |= 1u << (log2_half - 1 - bit);
+        }
+        spectrum->bitrev[k] = reversed;
+    }
+
+    microtouch3m_scope_spectrum_reset (spectrum);
+    return spectrum;
+
+failed:
+    microtouch3m_scope_spectrum_free (spectrum);
+    return NULL;
+}
+
+void
+microtouch3m_scope_spectrum_free (microtouch3m_scope_spectrum_t *spectrum)
+{
+    unsigned int k;
+
+    if (!spectrum)
+        return;
+
+    for (k = 0; k < MICROTOUCH3M_SCOPE_N_CORNERS; k++)
+        free (spectrum->power[k]);
+    free (spectrum->work_im);
+    free (spectrum->work_re);
+    free (spectrum->segment);
+    free (spectrum->ring);
+    free (spectrum->bitrev);
+    free (spectrum->twiddle_im);
+    free (spectrum->twiddle_re);
+    free (spectrum->window);
+    free (spectrum);
+}
+
+void
+microtouch3m_scope_spectrum_reset (microtouch3m_scope_spectrum_t *spectrum)
+{
+    unsigned int k;
+
+    assert (spectrum);
+
+    spectrum->ring_pos        = 0;
+    spectrum->n_filled        = 0;
+    spectrum->n_since_segment = 0;
+    spectrum->n_segments      = 0;
+    for (k = 0; k < MICROTOUCH3M_SCOPE_N_CORNERS; k++)
+        memset (spectrum->power[k], 0, (spectrum->half + 1) * sizeof (double));
+}
+
+unsigned int
+microtouch3m_scope_spectrum_get_n_bins (const microtouch3m_scope_spectrum_t *spectrum)
+{
+    assert (spectrum);
+
+    return spectrum->half + 1;
+}
+
+uint64_t
+microtouch3m_scope_spectrum_get_n_segments (const microtouch3m_scope_spectrum_t *spectrum)
+{
+    assert (spectrum);
+
+    return spectrum->n_segments;
+}
+
+void
+microtouch3m_scope_spectrum_add (microtouch3m_scope_spectrum_t *spectrum,
+                                 const int32_t                 *signal,
+                                 size_t                         n_samples)
+{
+    size_t n;
+
+    assert (spectrum);
+    assert (signal || !n_samples);
+
+    for (n = 0; n < n_samples; n++) {
+        memcpy (&spectrum->ring[spectrum->ring_pos * MICROTOUCH3M_SCOPE_N_CORNERS],
+                &signal[n * MICROTOUCH3M_SCOPE_N_CORNERS],
+                MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t));
+        spectrum->ring_pos = (spectrum->ring_pos + 1) % spectrum->size;
+        if (spectrum->n_filled < spectrum->size)
+            spectrum->n_filled++;
+        spectrum->n_since_segment++;
+
+        /* 50% overlap */
+        if (spectrum->n_filled == spectrum->size && spectrum->n_since_segment >= spectrum->half) {
+            spectrum_process_segment (spectrum);
+            spectrum->n_since_segment = 0;
+        }
+    }
+}
+
+void
+microtouch3m_scope_spectrum_get (const microtouch3m_scope_spectrum_t *spectrum,
+                                 unsigned int                         corner,
+                                 double                              *power)
+{
+    unsigned int k;
+
+    assert (spectrum);
+    assert (corner < MICROTOUCH3M_SCOPE_N_CORNERS);
+    assert (power);
+
+    for (k = 0; k <= spectrum->half; k++)
+        power[k] = (spectrum->n_segments ? spectrum->power[corner][k] / (double) spectrum->n_segments : 0.0);
+}
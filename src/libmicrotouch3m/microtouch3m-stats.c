@@ -0,0 +1,292 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Streaming quantiles
+ *
+ * Extended P-square estimator (Jain & Chlamtac, 1985; Raatikainen, 1987): a
+ * single set of markers tracks the minimum, the maximum, every target quantile
+ * and the halfway points between each of them and its neighbours. Marker
+ * heights are adjusted with a piecewise-parabolic prediction as their
+ * positions drift from the desired ones, so the quantiles are estimated in
+ * constant memory without storing the samples, and sharing the markers keeps
+ * a single cell search and adjustment pass per sample.
+ */
+
+static const double quantiles[] = { 0.01, 0.05, 0.50, 0.95, 0.99 };
+
+#define N_QUANTILES (sizeof (quantiles) / sizeof (quantiles[0]))
+
+#define P2_MARKERS (int) (2 * N_QUANTILES + 3)
+
+/* Marker tracking the i-th quantile */
+#define P2_QUANTILE_MARKER(i) (2 * (i) + 2)
+
+struct p2_s {
+    double  height[P2_MARKERS];
+    int64_t position[P2_MARKERS];
+    double  desired[P2_MARKERS];
+    double  increment[P2_MARKERS];
+};
+
+static void
+p2_init (struct p2_s *p2)
+{
+    unsigned int i;
+    int          j;
+
+    /* Fractions of the samples below each marker */
+    p2->increment[0]              = 0.0;
+    p2->increment[P2_MARKERS - 1] = 1.0;
+    for (i = 0; i < N_QUANTILES; i++) {
+        p2->increment[P2_QUANTILE_MARKER (i) - 1] = (quantiles[i] + p2->increment[P2_QUANTILE_MARKER (i) - 2]) / 2.0;
+        p2->increment[P2_QUANTILE_MARKER (i)]     = quantiles[i];
+    }
+    p2->increment[P2_MARKERS - 2] = (quantiles[N_QUANTILES - 1] + 1.0) / 2.0;
+
+    for (j = 0; j < P2_MARKERS; j++) {
+        p2->height[j]   = 0.0;
+        p2->position[j] = j;
+        p2->desired[j]  = (double) (P2_MARKERS - 1) * p2->increment[j];
+    }
+}
+
+static double
+p2_parabolic (const struct p2_s *p2,
+              int                i,
+              int                d)
+{
+    const double  *q = p2->height;
+    const int64_t *n = p2->position;
+
+    return q[i] + (double) d / (double) (n[i + 1] - n[i - 1]) *
+        ((double) (n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (double) (n[i + 1] - n[i]) +
+         (double) (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (double) (n[i] - n[i - 1]));
+}
+
+/* Only for samples after the first P2_MARKERS ones, which are just stored
+ * sorted in the marker heights */
+static void
+p2_add (struct p2_s *p2,
+        double       x)
+{
+    int k;
+    int i;
+
+    if (x < p2->height[0]) {
+        p2->height[0] = x;
+        k = 0;
+    } else if (x >= p2->height[P2_MARKERS - 1]) {
+        p2->height[P2_MARKERS - 1] = x;
+        k = P2_MARKERS - 2;
+    } else {
+        for (k = 0; k < P2_MARKERS - 2; k++) {
+            if (x < p2->height[k + 1])
+                break;
+        }
+    }
+
+    for (i = k + 1; i < P2_MARKERS; i++)
+        p2->position[i]++;
+    for (i = 0; i < P2_MARKERS; i++)
+        p2->desired[i] += p2->increment[i];
+
+    for (i = 1; i < P2_MARKERS - 1; i++) {
+        double d;
+        int    sign;
+        double height;
+
+        d = p2->desired[i] - (double) p2->position[i];
+        if (!((d >= 1.0 && (p2->position[i + 1] - p2->position[i]) > 1) ||
+              (d <= -1.0 && (p2->position[i - 1] - p2->position[i]) < -1)))
+            continue;
+
+        sign = (d < 0.0 ? -1 : 1);
+        height = p2_parabolic (p2, i, sign);
+        if (!(p2->height[i - 1] < height && height < p2->height[i + 1]))
+            height = p2->height[i] + (double) sign * (p2->height[i + sign] - p2->height[i]) /
+                (double) (p2->position[i + sign] - p2->position[i]);
+        p2->height[i]    = height;
+        p2->position[i] += sign;
+    }
+}
+
+/******************************************************************************/
+/* Scope statistics */
+
+struct stats_channel_s {
+    uint64_t    n_samples;
+    int64_t     min;
+    int64_t     max;
+    double      mean;
+    double      m2;
+    double      mean_square;
+    struct p2_s p2;
+};
+
+struct microtouch3m_scope_stats_s {
+    struct stats_channel_s channels[MICROTOUCH3M_SCOPE_STATS_CHANNEL_N];
+};
+
+static void
+stats_channel_reset (struct stats_channel_s *channel)
+{
+    memset (channel, 0, sizeof (*channel));
+    p2_init (&channel->p2);
+}
+
+static void
+stats_channel_add (struct stats_channel_s *channel,
+                   int64_t                 value)
+{
+    double x;
+    double delta;
+    int    j;
+
+    x = (double) value;
+    channel->n_samples++;
+
+    if (channel->n_samples == 1 || value < channel->min)
+        channel->min = value;
+    if (channel->n_samples == 1 || value > channel->max)
+        channel->max = value;
+
+    /* Welford */
+    delta = x - channel->mean;
+    channel->mean += delta / (double) channel->n_samples;
+    channel->m2   += delta * (x - channel->mean);
+    channel->mean_square += (x * x - channel->mean_square) / (double) channel->n_samples;
+
+    if (channel->n_samples > (uint64_t) P2_MARKERS) {
+        p2_add (&channel->p2, x);
+        return;
+    }
+
+    /* Insertion sort of the first samples into the markers */
+    for (j = (int) channel->n_samples - 1; j > 0 && channel->p2.height[j - 1] > x; j--)
+        channel->p2.height[j] = channel->p2.height[j - 1];
+    channel->p2.height[j] = x;
+}
+
+static double
+stats_channel_quantile (const struct stats_channel_s *channel,
+                        unsigned int                  i)
+{
+    /* Nearest rank over the stored samples until the estimator starts */
+    if (channel->n_samples <= (uint64_t) P2_MARKERS) {
+        unsigned int rank;
+
+        if (!channel->n_samples)
+            return 0.0;
+        rank = (unsigned int) ceil (quantiles[i] * (double) channel->n_samples);
+        return channel->p2.height[rank > 0 ? rank - 1 : 0];
+    }
+    return channel->p2.height[P2_QUANTILE_MARKER (i)];
+}
+
+microtouch3m_scope_stats_t *
+microtouch3m_scope_stats_new (void)
+{
+    microtouch3m_scope_stats_t *stats;
+
+    if (!(stats = malloc (sizeof (microtouch3m_scope_stats_t))))
+        return NULL;
+    microtouch3m_scope_stats_reset (stats);
+    return stats;
+}
+
+void
+microtouch3m_scope_stats_free (microtouch3m_scope_stats_t *stats)
+{
+    free (stats);
+}
+
+void
+microtouch3m_scope_stats_reset (microtouch3m_scope_stats_t *stats)
+{
+    unsigned int i;
+
+    assert (stats);
+
+    for (i = 0; i < MICROTOUCH3M_SCOPE_STATS_CHANNEL_N; i++)
+        stats_channel_reset (&stats->channels[i]);
+}
+
+void
+microtouch3m_scope_stats_add (microtouch3m_scope_stats_t *stats,
+                              const int32_t              *signal,
+                              size_t                      n_samples)
+{
+    size_t n;
+
+    assert (stats);
+    assert (signal || !n_samples);
+
+    for (n = 0; n < n_samples; n++) {
+        const int32_t *sample = &signal[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        int64_t        sum = 0;
+        unsigned int   i;
+
+        for (i = 0; i < MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+            stats_channel_add (&stats->channels[i], sample[i]);
+            sum += sample[i];
+        }
+        stats_channel_add (&stats->channels[MICROTOUCH3M_SCOPE_STATS_CHANNEL_SUM], sum);
+    }
+}
+
+void
+microtouch3m_scope_stats_get (const microtouch3m_scope_stats_t   *stats,
+                              microtouch3m_scope_stats_channel_t  channel,
+                              microtouch3m_scope_stats_summary_t *summary)
+{
+    const struct stats_channel_s *c;
+
+    assert (stats);
+    assert (channel < MICROTOUCH3M_SCOPE_STATS_CHANNEL_N);
+    assert (summary);
+
+    c = &stats->channels[channel];
+
+    summary->n_samples = c->n_samples;
+    summary->min       = c->min;
+    summary->max       = c->max;
+    summary->mean      = c->mean;
+    summary->variance  = (c->n_samples > 1 ? c->m2 / (double) (c->n_samples - 1) : 0.0);
+    summary->stddev    = sqrt (summary->variance);
+    summary->rms       = sqrt (c->mean_square);
+    summary->p1        = stats_channel_quantile (c, 0);
+    summary->p5        = stats_channel_quantile (c, 1);
+    summary->p50       = stats_channel_quantile (c, 2);
+    summary->p95       = stats_channel_quantile (c, 3);
+    summary->p99       = stats_channel_quantile (c, 4);
+}
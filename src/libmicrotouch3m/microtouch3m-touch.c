@@ -0,0 +1,201 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* Touch position estimation
+ *
+ * The raw position is the share of the signal through the right corners (X)
+ * and through the lower corners (Y). The linearization grid is converted
+ * upfront to offsets in normalized units, with the rows flipped so that row 0
+ * is the upper edge like the Y axis, and is interpolated bilinearly.
+ */
+
+#define LINEARIZATION_GRID_SIZE  5
+#define LINEARIZATION_COEF_SCALE (1.0 / 512.0)
+
+struct microtouch3m_touch_estimator_s {
+    microtouch3m_device_orientation_t orientation;
+    uint64_t                          threshold;
+    bool                              linearization;
+    double                            offset_x[LINEARIZATION_GRID_SIZE][LINEARIZATION_GRID_SIZE];
+    double                            offset_y[LINEARIZATION_GRID_SIZE][LINEARIZATION_GRID_SIZE];
+};
+
+microtouch3m_touch_estimator_t *
+microtouch3m_touch_estimator_new (void)
+{
+    microtouch3m_touch_estimator_t *estimator;
+
+    if (!(estimator = calloc (1, sizeof (microtouch3m_touch_estimator_t))))
+        return NULL;
+
+    estimator->orientation = MICROTOUCH3M_DEVICE_ORIENTATION_LL;
+    estimator->threshold   = 1;
+    return estimator;
+}
+
+void
+microtouch3m_touch_estimator_free (microtouch3m_touch_estimator_t *estimator)
+{
+    free (estimator);
+}
+
+void
+microtouch3m_touch_estimator_set_linearization_data (microtouch3m_touch_estimator_t                        *estimator,
+                                                     const struct microtouch3m_device_linearization_data_s *data)
+{
+    unsigned int row;
+    unsigned int col;
+
+    estimator->linearization = !!data;
+    if (!data)
+        return;
+
+    for (row = 0; row < LINEARIZATION_GRID_SIZE; row++) {
+        for (col = 0; col < LINEARIZATION_GRID_SIZE; col++) {
+            const struct microtouch3m_device_linearization_data_item_s *item;
+
+            /* items[4][*] is the upper edge */
+            item = &data->items[LINEARIZATION_GRID_SIZE - 1 - row][col];
+            estimator->offset_x[row][col] = item->x_coef * LINEARIZATION_COEF_SCALE;
+            estimator->offset_y[row][col] = item->y_coef * LINEARIZATION_COEF_SCALE;
+        }
+    }
+}
+
+void
+microtouch3m_touch_estimator_set_orientation (microtouch3m_touch_estimator_t    *estimator,
+                                              microtouch3m_device_orientation_t  orientation)
+{
+    estimator->orientation = orientation;
+}
+
+void
+microtouch3m_touch_estimator_set_threshold (microtouch3m_touch_estimator_t *estimator,
+                                            uint64_t                        threshold)
+{
+    estimator->threshold = threshold;
+}
+
+static double
+bilinear (const double grid[LINEARIZATION_GRID_SIZE][LINEARIZATION_GRID_SIZE],
+          unsigned int row,
+          unsigned int col,
+          double       fx,
+          double       fy)
+{
+    return ((grid[row][col]     * (1.0 - fx)) + (grid[row][col + 1]     * fx)) * (1.0 - fy) +
+           ((grid[row + 1][col] * (1.0 - fx)) + (grid[row + 1][col + 1] * fx)) * fy;
+}
+
+static void
+linearize (const microtouch3m_touch_estimator_t *estimator,
+           double                               *x,
+           double                               *y)
+{
+    double       gx;
+    double       gy;
+    double       fx;
+    double       fy;
+    unsigned int col;
+    unsigned int row;
+
+    /* Grid coordinates, clamped to the last cell */
+    gx = *x * (LINEARIZATION_GRID_SIZE - 1);
+    gy = *y * (LINEARIZATION_GRID_SIZE - 1);
+    gx = gx < 0.0 ? 0.0 : (gx > (LINEARIZATION_GRID_SIZE - 1) ? (LINEARIZATION_GRID_SIZE - 1) : gx);
+    gy = gy < 0.0 ? 0.0 : (gy > (LINEARIZATION_GRID_SIZE - 1) ? (LINEARIZATION_GRID_SIZE - 1) : gy);
+    col = (unsigned int) gx;
+    row = (unsigned int) gy;
+    if (col > LINEARIZATION_GRID_SIZE - 2)
+        col = LINEARIZATION_GRID_SIZE - 2;
+    if (row > LINEARIZATION_GRID_SIZE - 2)
+        row = LINEARIZATION_GRID_SIZE - 2;
+    fx = gx - col;
+    fy = gy - row;
+
+    *x += bilinear (estimator->offset_x, row, col, fx, fy);
+    *y += bilinear (estimator->offset_y, row, col, fx, fy);
+}
+
+void
+microtouch3m_touch_estimator_process (const microtouch3m_touch_estimator_t *estimator,
+                                      const int32_t                        *signal,
+                                      microtouch3m_touch_position_t        *positions,
+                                      size_t                                n_samples)
+{
+    size_t n;
+
+    for (n = 0; n < n_samples; n++) {
+        const int32_t *corners = &signal[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        int64_t        ul, ur, ll, lr;
+        int64_t        sum;
+        double         x;
+        double         y;
+
+        ul = corners[0] > 0 ? corners[0] : 0;
+        ur = corners[1] > 0 ? corners[1] : 0;
+        ll = corners[2] > 0 ? corners[2] : 0;
+        lr = corners[3] > 0 ? corners[3] : 0;
+        sum = ul + ur + ll + lr;
+
+        if (sum > 0) {
+            x = (double) (ur + lr) / (double) sum;
+            y = (double) (ll + lr) / (double) sum;
+        } else
+            x = y = 0.5;
+
+        if (estimator->linearization)
+            linearize (estimator, &x, &y);
+
+        switch (estimator->orientation) {
+        case MICROTOUCH3M_DEVICE_ORIENTATION_UL:
+            positions[n].x = y;
+            positions[n].y = 1.0 - x;
+            break;
+        case MICROTOUCH3M_DEVICE_ORIENTATION_UR:
+            positions[n].x = 1.0 - x;
+            positions[n].y = 1.0 - y;
+            break;
+        case MICROTOUCH3M_DEVICE_ORIENTATION_LR:
+            positions[n].x = 1.0 - y;
+            positions[n].y = x;
+            break;
+        case MICROTOUCH3M_DEVICE_ORIENTATION_LL:
+        default:
+            positions[n].x = x;
+            positions[n].y = y;
+            break;
+        }
+
+        positions[n].strength = sum;
+        positions[n].touched  = (sum > 0) && ((uint64_t) sum >= estimator->threshold);
+    }
+}
@@ -0,0 +1,464 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <endian.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "microtouch3m.h"
+#include "microtouch3m-log.h"
+#include "microtouch3m-trace.h"
+
+/******************************************************************************/
+/* Trace file format
+ *
+ * A fixed size file header, followed by one record per transfer, each one a
+ * fixed size header plus the payload. All fields in little endian.
+ */
+
+#define TRACE_FILE_MAGIC          "M3MTRACE"
+#define TRACE_FILE_FORMAT_VERSION 1
+
+struct trace_file_header_s {
+    char     magic [8];
+    uint16_t format_version;
+    uint16_t header_size;
+    uint32_t dropped_records;
+    uint64_t start_time_us;   /* CLOCK_REALTIME */
+} __attribute__((packed));
+
+struct trace_record_header_s {
+    uint64_t timestamp_us;    /* since trace start */
+    uint32_t latency_us;
+    int32_t  result;
+    uint8_t  type;
+    uint8_t  bus_number;
+    uint8_t  device_address;
+    uint8_t  request_type;
+    uint8_t  request;
+    uint8_t  reserved;
+    uint16_t value;
+    uint16_t index;
+    uint16_t length;
+    uint16_t payload_size;
+} __attribute__((packed));
+
+/******************************************************************************/
+/* Trace writer
+ *
+ * Records are appended to one of two preallocated buffers, so that adding a
+ * record never allocates nor does any file I/O. A flusher thread writes the
+ * buffer to disk when it gets full, and periodically. Records that don't fit
+ * while the other buffer is still being written are dropped and counted.
+ *
+ * Appending doesn't take the mutex: space is reserved in the active buffer
+ * with a CAS on its state word, which also counts the appends still copying
+ * their record. The mutex is only taken to swap the buffers.
+ */
+
+#define TRACE_BUFFER_SIZE     (256 * 1024)
+#define TRACE_FLUSH_PERIOD_S  1
+
+/* Buffer state word: fill level, appends in progress and closed flag */
+#define TRACE_STATE_FILL_MASK    0x000FFFFF
+#define TRACE_STATE_WRITER       0x00100000
+#define TRACE_STATE_WRITERS_MASK 0x7FF00000
+#define TRACE_STATE_CLOSED       0x80000000
+
+struct trace_s {
+    int                   fd;
+    uint64_t              start_us;
+    uint64_t              start_time_us;
+    pthread_t             thread;
+    pthread_mutex_t       mutex;
+    pthread_cond_t        cond;
+    bool                  running;
+    uint8_t              *buffer [2];
+    volatile uint32_t     state [2];
+    volatile unsigned int active;
+    bool                  pending;  /* inactive buffer waiting to be written */
+    volatile uint32_t     dropped;
+    bool                  write_failed;
+};
+
+static uint64_t
+clock_time_us (clockid_t clock_id)
+{
+    struct timespec ts;
+
+    clock_gettime (clock_id, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
+
+static bool
+write_all (int         fd,
+           const void *data,
+           size_t      size)
+{
+    const uint8_t *p = data;
+    ssize_t        n;
+
+    while (size > 0) {
+        if ((n = write (fd, p, size)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        p    += n;
+        size -= n;
+    }
+    return true;
+}
+
+static bool
+trace_write_header (trace_t *trace)
+{
+    struct trace_file_header_s header;
+
+    memset (&header, 0, sizeof (header));
+    memcpy (header.magic, TRACE_FILE_MAGIC, sizeof (header.magic));
+    header.format_version  = htole16 (TRACE_FILE_FORMAT_VERSION);
+    header.header_size     = htole16 (sizeof (header));
+    header.dropped_records = htole32 (trace->dropped);
+    header.start_time_us   = htole64 (trace->start_time_us);
+
+    return (pwrite (trace->fd, &header, sizeof (header), 0) == sizeof (header));
+}
+
+/* Must be called with the mutex held */
+static void
+trace_swap_buffers (trace_t *trace)
+{
+    /* New appends go to the other buffer from now on */
+    __sync_fetch_and_or (&trace->state[trace->active], TRACE_STATE_CLOSED);
+    trace->active ^= 1;
+    trace->pending = true;
+}
+
+static void *
+trace_thread_func (void *user_data)
+{
+    trace_t         *trace = user_data;
+    struct timespec  deadline;
+    unsigned int     idx;
+    size_t           fill;
+
+    pthread_mutex_lock (&trace->mutex);
+    for (;;) {
+        if (trace->running && !trace->pending) {
+            clock_gettime (CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += TRACE_FLUSH_PERIOD_S;
+            pthread_cond_timedwait (&trace->cond, &trace->mutex, &deadline);
+        }
+
+        /* Periodic flush, or last one when stopping */
+        if (!trace->pending && (trace->state[trace->active] & TRACE_STATE_FILL_MASK))
+            trace_swap_buffers (trace);
+
+        if (trace->pending) {
+            idx = trace->active ^ 1;
+            pthread_mutex_unlock (&trace->mutex);
+            /* Wait for the appends still copying into the closed buffer */
+            while (trace->state[idx] & TRACE_STATE_WRITERS_MASK)
+                sched_yield ();
+            fill = trace->state[idx] & TRACE_STATE_FILL_MASK;
+            if (!write_all (trace->fd, trace->buffer[idx], fill))
+                trace->write_failed = true;
+            __sync_fetch_and_and (&trace->state[idx], 0);
+            pthread_mutex_lock (&trace->mutex);
+            trace->pending = false;
+            continue;
+        }
+
+        if (!trace->running)
+            break;
+    }
+    pthread_mutex_unlock (&trace->mutex);
+    return NULL;
+}
+
+trace_t *
+trace_new (const char *path)
+{
+    trace_t *trace;
+
+    assert (path);
+
+    if (!(trace = calloc (1, sizeof (trace_t))))
+        return NULL;
+
+    trace->fd = -1;
+    pthread_mutex_init (&trace->mutex, NULL);
+    pthread_cond_init (&trace->cond, NULL);
+
+    if (!(trace->buffer[0] = malloc (TRACE_BUFFER_SIZE)) ||
+        !(trace->buffer[1] = malloc (TRACE_BUFFER_SIZE))) {
+        microtouch3m_log_error ("error: couldn't allocate trace buffers");
+        goto outerr;
+    }
+
+    if ((trace->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) < 0) {
+        microtouch3m_log_error ("error: couldn't open trace file '%s': %s", path, strerror (errno));
+        goto outerr;
+    }
+
+    trace->start_us      = clock_time_us (CLOCK_MONOTONIC);
+    trace->start_time_us = clock_time_us (CLOCK_REALTIME);
+
+    if (!trace_write_header (trace) || lseek (trace->fd, 0, SEEK_END) < 0) {
+        microtouch3m_log_error ("error: couldn't write trace file header: %s", strerror (errno));
+        goto outerr;
+    }
+
+    trace->running = true;
+    if (pthread_create (&trace->thread, NULL, trace_thread_func, trace) != 0) {
+        microtouch3m_log_error ("error: couldn't create trace flusher thread");
+        trace->running = false;
+        goto outerr;
+    }
+
+    microtouch3m_log ("USB transfer trace started: %s", path);
+    return trace;
+
+outerr:
+    if (trace->fd >= 0) {
+        close (trace->fd);
+        unlink (path);
+    }
+    free (trace->buffer[0]);
+    free (trace->buffer[1]);
+    pthread_cond_destroy (&trace->cond);
+    pthread_mutex_destroy (&trace->mutex);
+    free (trace);
+    return NULL;
+}
+
+void
+trace_free (trace_t *trace)
+{
+    assert (trace);
+
+    pthread_mutex_lock (&trace->mutex);
+    trace->running = false;
+    pthread_cond_signal (&trace->cond);
+    pthread_mutex_unlock (&trace->mutex);
+    pthread_join (trace->thread, NULL);
+
+    /* Header updated with the amount of records lost */
+    if (!trace_write_header (trace))
+        trace->write_failed = true;
+
+    if (trace->write_failed)
+        microtouch3m_log_error ("error: couldn't write USB transfer trace file contents");
+    if (trace->dropped)
+        microtouch3m_log_warn ("warn: %u USB transfer trace records dropped", trace->dropped);
+    microtouch3m_log ("USB transfer trace finished");
+
+    close (trace->fd);
+    free (trace->buffer[0]);
+    free (trace->buffer[1]);
+    pthread_cond_destroy (&trace->cond);
+    pthread_mutex_destroy (&trace->mutex);
+    free (trace);
+}
+
+void
+trace_add (trace_t                           *trace,
+           const microtouch3m_trace_record_t *record)
+{
+    struct trace_record_header_s header;
+    size_t                       payload_size;
+    size_t                       size;
+    unsigned int                 idx;
+    uint32_t                     state;
+    bool                         drop;
+    uint8_t                     *p;
+
+    payload_size = record->payload ? record->payload_size : 0;
+    if (payload_size > UINT16_MAX)
+        payload_size = UINT16_MAX;
+
+    header.timestamp_us   = htole64 ((record->timestamp_us > trace->start_us) ? (record->timestamp_us - trace->start_us) : 0);
+    header.latency_us     = htole32 (record->latency_us);
+    header.result         = (int32_t) htole32 ((uint32_t) record->result);
+    header.type           = record->type;
+    header.bus_number     = record->bus_number;
+    header.device_address = record->device_address;
+    header.request_type   = record->request_type;
+    header.request        = record->request;
+    header.reserved       = 0;
+    header.value          = htole16 (record->value);
+    header.index          = htole16 (record->index);
+    header.length         = htole16 (record->length);
+    header.payload_size   = htole16 (payload_size);
+
+    size = sizeof (header) + payload_size;
+
+    /* Reserve space in the active buffer */
+    for (;;) {
+        idx   = trace->active;
+        state = trace->state[idx];
+
+        /* Being swapped, the other buffer is about to be the active one */
+        if (state & TRACE_STATE_CLOSED)
+            continue;
+
+        if ((state & TRACE_STATE_FILL_MASK) + size > TRACE_BUFFER_SIZE) {
+            drop = false;
+            pthread_mutex_lock (&trace->mutex);
+            if (idx == trace->active) {
+                if (trace->pending)
+                    drop = true;
+                else {
+                    trace_swap_buffers (trace);
+                    pthread_cond_signal (&trace->cond);
+                }
+            }
+            pthread_mutex_unlock (&trace->mutex);
+            if (drop) {
+                __sync_fetch_and_add (&trace->dropped, 1);
+                return;
+            }
+            continue;
+        }
+
+        if (__sync_bool_compare_and_swap (&trace->state[idx], state, state + TRACE_STATE_WRITER + size))
+            break;
+    }
+
+    p = &trace->buffer[idx][state & TRACE_STATE_FILL_MASK];
+    memcpy (p, &header, sizeof (header));
+    if (payload_size)
+        memcpy (p + sizeof (header), record->payload, payload_size);
+
+    __sync_fetch_and_sub (&trace->state[idx], TRACE_STATE_WRITER);
+}
+
+/******************************************************************************/
+/* Trace reader */
+
+microtouch3m_status_t
+microtouch3m_trace_file_read (const char                  *path,
+                              microtouch3m_trace_info_t   *info,
+                              microtouch3m_trace_record_f  callback,
+                              void                        *user_data)
+{
+    microtouch3m_status_t         st = MICROTOUCH3M_STATUS_OK;
+    FILE                         *f;
+    struct trace_file_header_s    file_header;
+    struct trace_record_header_s  header;
+    microtouch3m_trace_record_t   record;
+    uint8_t                      *payload;
+    size_t                        n;
+
+    assert (path);
+    assert (callback);
+
+    if (!(payload = malloc (UINT16_MAX))) {
+        microtouch3m_log_error ("error: couldn't allocate trace record payload buffer");
+        return MICROTOUCH3M_STATUS_FAILED;
+    }
+
+    if (!(f = fopen (path, "re"))) {
+        microtouch3m_log_error ("error: couldn't open trace file '%s': %s", path, strerror (errno));
+        free (payload);
+        return MICROTOUCH3M_STATUS_FAILED;
+    }
+
+    if (fread (&file_header, sizeof (file_header), 1, f) != 1 ||
+        memcmp (file_header.magic, TRACE_FILE_MAGIC, sizeof (file_header.magic)) != 0) {
+        microtouch3m_log_error ("error: '%s' is not a trace file", path);
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if (le16toh (file_header.format_version) != TRACE_FILE_FORMAT_VERSION) {
+        microtouch3m_log_error ("error: unsupported trace file format version: %u", le16toh (file_header.format_version));
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if (le16toh (file_header.header_size) < sizeof (file_header) ||
+        fseek (f, le16toh (file_header.header_size), SEEK_SET) < 0) {
+        microtouch3m_log_error ("error: invalid trace file header size");
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if (info) {
+        info->start_time_us   = le64toh (file_header.start_time_us);
+        info->dropped_records = le32toh (file_header.dropped_records);
+    }
+
+    while ((n = fread (&header, 1, sizeof (header), f)) > 0) {
+        if (n != sizeof (header)) {
+            microtouch3m_log_error ("error: truncated trace record header");
+            st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+            goto out;
+        }
+
+        record.timestamp_us   = le64toh (header.timestamp_us);
+        record.latency_us     = le32toh (header.latency_us);
+        record.result         = (int32_t) le32toh ((uint32_t) header.result);
+        record.type           = (microtouch3m_trace_transfer_t) header.type;
+        record.bus_number     = header.bus_number;
+        record.device_address = header.device_address;
+        record.request_type   = header.request_type;
+        record.request        = header.request;
+        record.value          = le16toh (header.value);
+        record.index          = le16toh (header.index);
+        record.length         = le16toh (header.length);
+        record.payload_size   = le16toh (header.payload_size);
+        record.payload        = payload;
+
+        if (record.payload_size && fread (payload, record.payload_size, 1, f) != 1) {
+            microtouch3m_log_error ("error: truncated trace record payload");
+            st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+            goto out;
+        }
+
+        if (!callback (&record, user_data))
+            break;
+    }
+
+    if (ferror (f)) {
+        microtouch3m_log_error ("error: couldn't read trace file: %s", strerror (errno));
+        st = MICROTOUCH3M_STATUS_FAILED;
+    }
+
+out:
+    fclose (f);
+    free (payload);
+    return st;
+}
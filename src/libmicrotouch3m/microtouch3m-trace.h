@@ -0,0 +1,45 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+
+#if !defined MICROTOUCH3M_TRACE_H
+# define MICROTOUCH3M_TRACE_H
+
+#include <stdint.h>
+
+#include "microtouch3m.h"
+
+/******************************************************************************/
+/* USB transfer traces */
+
+typedef struct trace_s trace_t;
+
+trace_t *trace_new  (const char *path);
+void     trace_free (trace_t    *trace);
+
+/* The record timestamp is given in CLOCK_MONOTONIC microseconds, and stored
+ * relative to the trace start. */
+void     trace_add  (trace_t                           *trace,
+                     const microtouch3m_trace_record_t *record);
+
+#endif /* MICROTOUCH3M_TRACE_H */
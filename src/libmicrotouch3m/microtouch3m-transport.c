@@ -0,0 +1,234 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include <libusb.h>
+
+#include "microtouch3m-log.h"
+#include "microtouch3m-transport.h"
+
+/******************************************************************************/
+/* libusb transport
+ *
+ * Transport devices and handles are the libusb ones, just cast.
+ */
+
+struct transport_usb_s {
+    transport_t     parent;
+    libusb_context *usb;
+};
+
+#define USB_CONTEXT(transport)    (((struct transport_usb_s *) (transport))->usb)
+#define USB_DEVICE(device)        ((libusb_device *) (device))
+#define USB_HANDLE(handle)        ((libusb_device_handle *) (handle))
+
+static void
+usb_free (transport_t *transport)
+{
+    libusb_exit (USB_CONTEXT (transport));
+    free (transport);
+}
+
+static ssize_t
+usb_get_device_list (transport_t          *transport,
+                     transport_device_t ***list)
+{
+    return libusb_get_device_list (USB_CONTEXT (transport), (libusb_device ***) list);
+}
+
+static void
+usb_free_device_list (transport_t         *transport,
+                      transport_device_t **list,
+                      int                  unref_devices)
+{
+    libusb_free_device_list ((libusb_device **) list, unref_devices);
+}
+
+static transport_device_t *
+usb_ref_device (transport_t        *transport,
+                transport_device_t *device)
+{
+    return (transport_device_t *) libusb_ref_device (USB_DEVICE (device));
+}
+
+static void
+usb_unref_device (transport_t        *transport,
+                  transport_device_t *device)
+{
+    libusb_unref_device (USB_DEVICE (device));
+}
+
+static int
+usb_get_device_ids (transport_t        *transport,
+                    transport_device_t *device,
+                    uint16_t           *vid,
+                    uint16_t           *pid)
+{
+    struct libusb_device_descriptor desc;
+    int                             ret;
+
+    if ((ret = libusb_get_device_descriptor (USB_DEVICE (device), &desc)) != 0)
+        return ret;
+
+    *vid = desc.idVendor;
+    *pid = desc.idProduct;
+    return 0;
+}
+
+static uint8_t
+usb_get_bus_number (transport_t        *transport,
+                    transport_device_t *device)
+{
+    return libusb_get_bus_number (USB_DEVICE (device));
+}
+
+static uint8_t
+usb_get_device_address (transport_t        *transport,
+                        transport_device_t *device)
+{
+    return libusb_get_device_address (USB_DEVICE (device));
+}
+
+static int
+usb_get_port_numbers (transport_t        *transport,
+                      transport_device_t *device,
+                      uint8_t            *port_numbers,
+                      int                 port_numbers_len)
+{
+    return libusb_get_port_numbers (USB_DEVICE (device), port_numbers, port_numbers_len);
+}
+
+static int
+usb_open (transport_t         *transport,
+          transport_device_t  *device,
+          transport_handle_t **handle)
+{
+    return libusb_open (USB_DEVICE (device), (libusb_device_handle **) handle);
+}
+
+static void
+usb_close (transport_t        *transport,
+           transport_handle_t *handle)
+{
+    libusb_close (USB_HANDLE (handle));
+}
+
+static int
+usb_control_transfer (transport_t        *transport,
+                      transport_handle_t *handle,
+                      uint8_t             request_type,
+                      uint8_t             request,
+                      uint16_t            value,
+                      uint16_t            index,
+                      uint8_t            *data,
+                      uint16_t            length,
+                      unsigned int        timeout_ms)
+{
+    return libusb_control_transfer (USB_HANDLE (handle), request_type, request, value, index, data, length, timeout_ms);
+}
+
+static int
+usb_interrupt_transfer (transport_t        *transport,
+                        transport_handle_t *handle,
+                        uint8_t             endpoint,
+                        uint8_t            *data,
+                        int                 length,
+                        int                *transferred,
+                        unsigned int        timeout_ms)
+{
+    return libusb_interrupt_transfer (USB_HANDLE (handle), endpoint, data, length, transferred, timeout_ms);
+}
+
+static int
+usb_kernel_driver_active (transport_t        *transport,
+                          transport_handle_t *handle,
+                          int                 interface_number)
+{
+    return libusb_kernel_driver_active (USB_HANDLE (handle), interface_number);
+}
+
+static int
+usb_detach_kernel_driver (transport_t        *transport,
+                          transport_handle_t *handle,
+                          int                 interface_number)
+{
+    return libusb_detach_kernel_driver (USB_HANDLE (handle), interface_number);
+}
+
+static int
+usb_claim_interface (transport_t        *transport,
+                     transport_handle_t *handle,
+                     int                 interface_number)
+{
+    return libusb_claim_interface (USB_HANDLE (handle), interface_number);
+}
+
+static int
+usb_release_interface (transport_t        *transport,
+                       transport_handle_t *handle,
+                       int                 interface_number)
+{
+    return libusb_release_interface (USB_HANDLE (handle), interface_number);
+}
+
+static const struct transport_ops_s usb_ops = {
+    .name                 = "usb",
+    .free                 = usb_free,
+    .get_device_list      = usb_get_device_list,
+    .free_device_list     = usb_free_device_list,
+    .ref_device           = usb_ref_device,
+    .unref_device         = usb_unref_device,
+    .get_device_ids       = usb_get_device_ids,
+    .get_bus_number       = usb_get_bus_number,
+    .get_device_address   = usb_get_device_address,
+    .get_port_numbers     = usb_get_port_numbers,
+    .open                 = usb_open,
+    .close                = usb_close,
+    .control_transfer     = usb_control_transfer,
+    .interrupt_transfer   = usb_interrupt_transfer,
+    .kernel_driver_active = usb_kernel_driver_active,
+    .detach_kernel_driver = usb_detach_kernel_driver,
+    .claim_interface      = usb_claim_interface,
+    .release_interface    = usb_release_interface,
+};
+
+transport_t *
+transport_new_usb (void)
+{
+    struct transport_usb_s *transport;
+
+    transport = calloc (1, sizeof (struct transport_usb_s));
+    if (!transport)
+        return NULL;
+
+    if (libusb_init (&transport->usb) != 0) {
+        microtouch3m_log_error ("error: couldn't initialize libusb");
+        free (transport);
+        return NULL;
+    }
+
+    transport->parent.ops = &usb_ops;
+    return &transport->parent;
+}
@@ -0,0 +1,146 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#if !defined MICROTOUCH3M_TRANSPORT_H
+# define MICROTOUCH3M_TRANSPORT_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+/******************************************************************************/
+/* USB transport
+ *
+ * All the USB operations the library runs go through a transport, so that the
+ * libusb backend can be replaced by an emulated controller. The operations
+ * mirror the libusb ones they replace, including the error reporting: failures
+ * are given as negative libusb_error values.
+ *
+ * The only exception is TRANSPORT_ERROR_END_OF_DATA, given by interrupt
+ * transfers of an emulated device once the recording it replays is over.
+ *
+ * Devices and handles are opaque to the library, and only valid with the
+ * transport that created them. A transport must outlive all its devices.
+ */
+
+/* Not a libusb_error value, all of those are above -100 */
+#define TRANSPORT_ERROR_END_OF_DATA -1000
+
+typedef struct transport_s        transport_t;
+typedef struct transport_device_s transport_device_t;
+typedef struct transport_handle_s transport_handle_t;
+
+struct transport_ops_s {
+    const char *name;
+
+    void                 (* free)                 (transport_t          *transport);
+
+    /* Device enumeration; the list is NULL-terminated */
+    ssize_t              (* get_device_list)      (transport_t          *transport,
+                                                   transport_device_t ***list);
+    void                 (* free_device_list)     (transport_t          *transport,
+                                                   transport_device_t  **list,
+                                                   int                   unref_devices);
+    transport_device_t * (* ref_device)           (transport_t          *transport,
+                                                   transport_device_t   *device);
+    void                 (* unref_device)         (transport_t          *transport,
+                                                   transport_device_t   *device);
+    int                  (* get_device_ids)       (transport_t          *transport,
+                                                   transport_device_t   *device,
+                                                   uint16_t             *vid,
+                                                   uint16_t             *pid);
+    uint8_t              (* get_bus_number)       (transport_t          *transport,
+                                                   transport_device_t   *device);
+    uint8_t              (* get_device_address)   (transport_t          *transport,
+                                                   transport_device_t   *device);
+    int                  (* get_port_numbers)     (transport_t          *transport,
+                                                   transport_device_t   *device,
+                                                   uint8_t              *port_numbers,
+                                                   int                   port_numbers_len);
+
+    /* Device access */
+    int                  (* open)                 (transport_t          *transport,
+                                                   transport_device_t   *device,
+                                                   transport_handle_t  **handle);
+    void                 (* close)                (transport_t          *transport,
+                                                   transport_handle_t   *handle);
+    int                  (* control_transfer)     (transport_t          *transport,
+                                                   transport_handle_t   *handle,
+                                                   uint8_t               request_type,
+                                                   uint8_t               request,
+                                                   uint16_t              value,
+                                                   uint16_t              index,
+                                                   uint8_t              *data,
+                                                   uint16_t              length,
+                                                   unsigned int          timeout_ms);
+    int                  (* interrupt_transfer)   (transport_t          *transport,
+                                                   transport_handle_t   *handle,
+                                                   uint8_t               endpoint,
+                                                   uint8_t              *data,
+                                                   int                   length,
+                                                   int                  *transferred,
+                                                   unsigned int          timeout_ms);
+    int                  (* kernel_driver_active) (transport_t          *transport,
+                                                   transport_handle_t   *handle,
+                                                   int                   interface_number);
+    int                  (* detach_kernel_driver) (transport_t          *transport,
+                                                   transport_handle_t   *handle,
+                                                   int                   interface_number);
+    int                  (* claim_interface)      (transport_t          *transport,
+                                                   transport_handle_t   *handle,
+                                                   int                   interface_number);
+    int                  (* release_interface)    (transport_t          *transport,
+                                                   transport_handle_t   *handle,
+                                                   int                   interface_number);
+};
+
+/* Backends embed this as their first member */
+struct transport_s {
+    const struct transport_ops_s *ops;
+};
+
+/* Backends */
+transport_t *transport_new_usb      (void);
+transport_t *transport_new_emulator (const char *config);
+
+/* Helpers dispatching to the backend */
+#define transport_free(t)                          (t)->ops->free (t)
+#define transport_get_device_list(t, l)            (t)->ops->get_device_list (t, l)
+#define transport_free_device_list(t, l, u)        (t)->ops->free_device_list (t, l, u)
+#define transport_ref_device(t, d)                 (t)->ops->ref_device (t, d)
+#define transport_unref_device(t, d)               (t)->ops->unref_device (t, d)
+#define transport_get_device_ids(t, d, v, p)       (t)->ops->get_device_ids (t, d, v, p)
+#define transport_get_bus_number(t, d)             (t)->ops->get_bus_number (t, d)
+#define transport_get_device_address(t, d)         (t)->ops->get_device_address (t, d)
+#define transport_get_port_numbers(t, d, p, n)     (t)->ops->get_port_numbers (t, d, p, n)
+#define transport_open(t, d, h)                    (t)->ops->open (t, d, h)
+#define transport_close(t, h)                      (t)->ops->close (t, h)
+#define transport_control_transfer(t, h, rt, r, v, i, d, l, to) \
+    (t)->ops->control_transfer (t, h, rt, r, v, i, d, l, to)
+#define transport_interrupt_transfer(t, h, e, d, l, tr, to) \
+    (t)->ops->interrupt_transfer (t, h, e, d, l, tr, to)
+#define transport_kernel_driver_active(t, h, i)    (t)->ops->kernel_driver_active (t, h, i)
+#define transport_detach_kernel_driver(t, h, i)    (t)->ops->detach_kernel_driver (t, h, i)
+#define transport_claim_interface(t, h, i)         (t)->ops->claim_interface (t, h, i)
+#define transport_release_interface(t, h, i)       (t)->ops->release_interface (t, h, i)
+
+#endif /* MICROTOUCH3M_TRANSPORT_H */
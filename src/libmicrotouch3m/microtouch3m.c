@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stddef.h>
 #include <malloc.h>
 #include <assert.h>
 #include <string.h>
@@ -40,6 +41,7 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <math.h>
+#include <time.h>
 
 #include <libusb.h>
 
@@ -47,6 +49,10 @@
 
 #include "microtouch3m.h"
 #include "microtouch3m-log.h"
+#include "microtouch3m-trace.h"
+#include "microtouch3m-recording.h"
+#include "microtouch3m-protocol.h"
+#include "microtouch3m-transport.h"
 
 #include "ihex.h"
 
@@ -63,8 +69,14 @@
 /******************************************************************************/
 /* Common */
 
-#define MICROTOUCH3M_VID 0x0596
-#define MICROTOUCH3M_PID 0x0001
+static uint64_t
+monotonic_time_us (void)
+{
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec * 1000000) + (ts.tv_nsec / 1000);
+}
 
 /******************************************************************************/
 /* Status */
@@ -78,6 +90,7 @@ static const char *status_str[] = {
     [MICROTOUCH3M_STATUS_INVALID_DATA]      = "invalid data",
     [MICROTOUCH3M_STATUS_INVALID_FORMAT]    = "invalid format",
     [MICROTOUCH3M_STATUS_INVALID_STATE]     = "invalid state",
+    [MICROTOUCH3M_STATUS_END_OF_DATA]       = "end of data",
 };
 
 const char *
@@ -90,28 +103,51 @@ microtouch3m_status_to_string (microtouch3m_status_t st)
 /* Library context */
 
 struct microtouch3m_context_s {
-    volatile int    refcount;
-    libusb_context *usb;
+    volatile int  refcount;
+    transport_t  *transport;
+    trace_t      *trace;
 };
 
-microtouch3m_context_t *
-microtouch3m_context_new (void)
+/* Takes ownership of the transport, also on error */
+static microtouch3m_context_t *
+context_new_with_transport (transport_t *transport)
 {
     microtouch3m_context_t *ctx;
 
-    ctx = calloc (1, sizeof (microtouch3m_context_t));
-    if (!ctx)
+    if (!transport)
         return NULL;
 
-    if (libusb_init (&ctx->usb) != 0) {
-        free (ctx);
+    ctx = calloc (1, sizeof (microtouch3m_context_t));
+    if (!ctx) {
+        transport_free (transport);
         return NULL;
     }
 
-    ctx->refcount = 1;
+    ctx->transport = transport;
+    ctx->refcount  = 1;
     return ctx;
 }
 
+microtouch3m_context_t *
+microtouch3m_context_new (void)
+{
+    const char *emulator_config;
+
+    /* Allow running any program using the library against the emulator */
+    emulator_config = getenv (MICROTOUCH3M_EMULATOR_ENV);
+    if (emulator_config)
+        return microtouch3m_context_new_emulated (emulator_config);
+
+    return context_new_with_transport (transport_new_usb ());
+}
+
+microtouch3m_context_t *
+microtouch3m_context_new_emulated (const char *config)
+{
+    microtouch3m_log ("using emulated controller: '%s'", config ? config : "");
+    return context_new_with_transport (transport_new_emulator (config));
+}
+
 microtouch3m_context_t *
 microtouch3m_context_ref (microtouch3m_context_t *ctx)
 {
@@ -127,29 +163,121 @@ microtouch3m_context_unref (microtouch3m_context_t *ctx)
     if (__sync_fetch_and_sub (&ctx->refcount, 1) != 1)
         return;
 
-    assert (ctx->usb);
-    libusb_exit (ctx->usb);
+    microtouch3m_context_trace_stop (ctx);
+
+    assert (ctx->transport);
+    transport_free (ctx->transport);
 
     free (ctx);
 }
 
+microtouch3m_status_t
+microtouch3m_context_trace_start (microtouch3m_context_t *ctx,
+                                  const char             *path)
+{
+    assert (ctx);
+    assert (path);
+
+    if (ctx->trace) {
+        microtouch3m_log_error ("error: USB transfer trace already started");
+        return MICROTOUCH3M_STATUS_INVALID_STATE;
+    }
+
+    if (!(ctx->trace = trace_new (path)))
+        return MICROTOUCH3M_STATUS_FAILED;
+
+    return MICROTOUCH3M_STATUS_OK;
+}
+
+void
+microtouch3m_context_trace_stop (microtouch3m_context_t *ctx)
+{
+    assert (ctx);
+
+    if (!ctx->trace)
+        return;
+
+    trace_free (ctx->trace);
+    ctx->trace = NULL;
+}
+
 /******************************************************************************/
 /* Device */
 
+#define N_REGIONS (MICROTOUCH3M_DEVICE_REGION_EEPROM + 1)
+
+struct region_cache_s {
+    uint8_t *data;  /* region contents, allocated on first read */
+    uint8_t *valid; /* one flag per page */
+};
+
+/* Counters updated atomically, without locks */
+struct transfer_stats_s {
+    volatile uint64_t n_transfers;
+    volatile uint64_t n_errors;
+    volatile uint64_t n_bytes;
+    volatile uint64_t latency_total_us;
+    volatile uint64_t latency_min_us; /* UINT64_MAX if unset */
+    volatile uint64_t latency_max_us;
+    volatile uint64_t latency_histogram [MICROTOUCH3M_DEVICE_STATS_LATENCY_BUCKETS];
+};
+
+/* Async report stream statistics; written by the monitoring thread only */
+#define REPORT_STATS_INTERVAL_BUCKETS   256
+#define REPORT_STATS_INTERVAL_BUCKET_US 100
+#define REPORT_STATS_RATE_WINDOW_US     1000000
+
+struct report_stats_s {
+    volatile uint64_t start_us;
+    volatile uint64_t last_report_us;  /* 0 if no report received yet */
+    volatile uint64_t n_reports;
+    volatile uint64_t n_short_transfers;
+    volatile uint64_t n_timeouts;
+    volatile uint64_t n_errors;
+    volatile uint64_t n_intervals;
+    volatile uint64_t interval_total_us;
+    volatile uint64_t interval_min_us; /* UINT64_MAX if unset */
+    volatile uint64_t interval_max_us;
+    volatile uint64_t interval_histogram [REPORT_STATS_INTERVAL_BUCKETS];
+    volatile uint64_t n_callbacks;
+    volatile uint64_t callback_total_us;
+    volatile uint64_t callback_max_us;
+    volatile uint64_t window_start_us;
+    volatile uint64_t window_reports;
+    volatile uint64_t window_rate_mhz; /* rate of the last complete window, 0 if none */
+    /* The monitoring thread is the only writer of the counters: resets from
+     * other threads are requested here, and applied by that thread */
+    volatile unsigned int reset_requests;
+    volatile unsigned int reset_applied;
+};
+
 struct microtouch3m_device_s {
     volatile int            refcount;
     microtouch3m_context_t *ctx;
-    libusb_device          *usbdev;
-    libusb_device_handle   *usbhandle;
+    transport_device_t     *usbdev;
+    transport_handle_t     *usbhandle;
     /* FW operation progress callback */
     microtouch3m_device_firmware_progress_f *progress_callback;
     float                                    progress_freq;
     void                                    *progress_user_data;
+    /* FW operation detailed progress callback */
+    microtouch3m_device_firmware_progress_full_f *progress_full_callback;
+    float                                         progress_full_freq;
+    void                                         *progress_full_user_data;
+    /* Memory region page cache */
+    struct region_cache_s region_cache [N_REGIONS];
+    /* Transfer statistics */
+    struct transfer_stats_s stats_control [MICROTOUCH3M_DEVICE_STATS_MAX_REQUESTS];
+    struct transfer_stats_s stats_interrupt;
+    /* Async report stream statistics */
+    struct report_stats_s report_stats;
+    /* Scope recording */
+    recording_t *recording;
 };
 
 static microtouch3m_device_t *
 device_new_by_usbdev (microtouch3m_context_t *ctx,
-                      libusb_device          *usbdev)
+                      transport_device_t     *usbdev)
 {
     microtouch3m_device_t *dev;
 
@@ -160,11 +288,13 @@ device_new_by_usbdev (microtouch3m_context_t *ctx,
     dev->ctx      = microtouch3m_context_ref (ctx);
     dev->refcount = 1;
     dev->usbdev   = usbdev;
+    microtouch3m_device_reset_stats (dev);
+    microtouch3m_device_reset_async_report_stats (dev);
     return dev;
 
 outerr:
     if (usbdev)
-        libusb_unref_device (usbdev);
+        transport_unref_device (ctx->transport, usbdev);
     if (dev)
         free (dev);
     return NULL;
@@ -172,7 +302,7 @@ outerr:
 
 #define MAX_PORT_NUMBERS 7
 
-static libusb_device **
+static transport_device_t **
 find_usb_device (microtouch3m_context_t *ctx,
                  bool                    any,
                  bool                    first,
@@ -182,12 +312,12 @@ find_usb_device (microtouch3m_context_t *ctx,
                  int                     port_numbers_len,
                  unsigned int           *out_n_devices)
 {
-    libusb_device **list  = NULL;
-    libusb_device **found = NULL;
-    unsigned int    n_found = 0;
-    unsigned int    i;
-    ssize_t         ret;
-    char           *port_numbers_str = NULL;
+    transport_device_t **list  = NULL;
+    transport_device_t **found = NULL;
+    unsigned int         n_found = 0;
+    unsigned int         i;
+    ssize_t              ret;
+    char                *port_numbers_str = NULL;
 
     /* At least one search method requested */
     assert ((device_address) || (port_numbers_len) || (first) || (any));
@@ -196,8 +326,8 @@ find_usb_device (microtouch3m_context_t *ctx,
     /* bus number requested unless first or any */
     assert (bus_number || first || any);
 
-    if ((ret = libusb_get_device_list (ctx->usb, &list)) < 0) {
-        microtouch3m_log ("error: couldn't list USB devices: %s", libusb_strerror (ret));
+    if ((ret = transport_get_device_list (ctx->transport, &list)) < 0) {
+        microtouch3m_log_error ("error: couldn't list USB devices: %s", libusb_strerror (ret));
         return NULL;
     }
 
@@ -209,28 +339,30 @@ find_usb_device (microtouch3m_context_t *ctx,
 
     assert (list);
     for (i = 0; list[i]; i++) {
-        libusb_device                    *iter;
-        struct libusb_device_descriptor   desc;
-        libusb_device                   **aux;
+        transport_device_t  *iter;
+        uint16_t             vid;
+        uint16_t             pid;
+        transport_device_t **aux;
 
         iter = list[i];
 
-        if (libusb_get_device_descriptor (iter, &desc) != 0)
+        if (transport_get_device_ids (ctx->transport, iter, &vid, &pid) != 0)
             continue;
 
-        if (desc.idVendor != MICROTOUCH3M_VID)
+        if (vid != MICROTOUCH3M_VID)
             continue;
 
-        if (desc.idProduct != MICROTOUCH3M_PID)
+        if (pid != MICROTOUCH3M_PID)
             continue;
 
         microtouch3m_log ("Microtouch 3M device found at %03u:%03u",
-                          libusb_get_bus_number (iter), libusb_get_device_address (iter));
+                          transport_get_bus_number (ctx->transport, iter),
+                          transport_get_device_address (ctx->transport, iter));
 
         if (bus_number) {
             uint8_t iter_bus_number;
 
-            iter_bus_number = libusb_get_bus_number (iter);
+            iter_bus_number = transport_get_bus_number (ctx->transport, iter);
             if (bus_number != iter_bus_number && bus_number != 0) {
                 microtouch3m_log ("  skipped because bus number (%03u) is not %03u", iter_bus_number, bus_number);
                 continue;
@@ -240,7 +372,7 @@ find_usb_device (microtouch3m_context_t *ctx,
         if (device_address) {
             uint8_t iter_device_address;
 
-            iter_device_address = libusb_get_device_address (iter);
+            iter_device_address = transport_get_device_address (ctx->transport, iter);
             if (device_address != iter_device_address && device_address != 0) {
                 microtouch3m_log ("  skipped because device address (%03u) is not %03u", iter_device_address, device_address);
                 continue;
@@ -255,7 +387,7 @@ find_usb_device (microtouch3m_context_t *ctx,
 
             assert (port_numbers_str);
 
-            iter_port_numbers_len = libusb_get_port_numbers (iter, (uint8_t *) iter_port_numbers, MAX_PORT_NUMBERS);
+            iter_port_numbers_len = transport_get_port_numbers (ctx->transport, iter, (uint8_t *) iter_port_numbers, MAX_PORT_NUMBERS);
             iter_port_numbers_str = str_usb_location (bus_number, iter_port_numbers, iter_port_numbers_len);
             if (!iter_port_numbers_str)
                 goto out_port_numbers;
@@ -274,33 +406,34 @@ find_usb_device (microtouch3m_context_t *ctx,
                 continue;
         }
 
-        aux = realloc (found, (n_found + 1) * sizeof (libusb_device *));
+        aux = realloc (found, (n_found + 1) * sizeof (transport_device_t *));
         if (!aux) {
             microtouch3m_log ("error reallocating array of devices");
             continue;
         }
         found = aux;
-        found[n_found++] = libusb_ref_device (iter);
+        found[n_found++] = transport_ref_device (ctx->transport, iter);
 
         if (!any)
             break;
     }
 
     free (port_numbers_str);
-    libusb_free_device_list (list, 1);
+    transport_free_device_list (ctx->transport, list, 1);
 
     if (!found)
-        microtouch3m_log ("error: couldn't find MicroTouch 3M device");
+        microtouch3m_log_error ("error: couldn't find MicroTouch 3M device");
 
     *out_n_devices = n_found;
 
     return found;
 }
 
-/* Note: don't use libusb_free_device_list () as WE created this array */
+/* Note: don't use transport_free_device_list () as WE created this array */
 static void
-usb_device_array_free (libusb_device **array,
-                       unsigned int    n_items)
+usb_device_array_free (microtouch3m_context_t  *ctx,
+                       transport_device_t     **array,
+                       unsigned int             n_items)
 {
     unsigned int i;
 
@@ -309,12 +442,12 @@ usb_device_array_free (libusb_device **array,
 
     for (i = 0; i < n_items; i++) {
         if (array[i])
-            libusb_unref_device (array[i]);
+            transport_unref_device (ctx->transport, array[i]);
     }
     free (array);
 }
 
-static libusb_device *
+static transport_device_t *
 find_one_usb_device (microtouch3m_context_t *ctx,
                      bool                    first,
                      uint8_t                 bus_number,
@@ -322,9 +455,9 @@ find_one_usb_device (microtouch3m_context_t *ctx,
                      const uint8_t          *port_numbers,
                      int                     port_numbers_len)
 {
-    libusb_device  *usbdev = NULL;
-    libusb_device **usbdevs;
-    unsigned int    n_devices;
+    transport_device_t  *usbdev = NULL;
+    transport_device_t **usbdevs;
+    unsigned int         n_devices;
 
     usbdevs = find_usb_device (ctx, false, first, bus_number, device_address, port_numbers, port_numbers_len, &n_devices);
     if (!usbdevs || !n_devices)
@@ -332,9 +465,9 @@ find_one_usb_device (microtouch3m_context_t *ctx,
 
     assert (n_devices == 1);
 
-    usbdev = libusb_ref_device (usbdevs[0]);
+    usbdev = transport_ref_device (ctx->transport, usbdevs[0]);
 
-    usb_device_array_free (usbdevs, n_devices);
+    usb_device_array_free (ctx, usbdevs, n_devices);
 
     return usbdev;
 }
@@ -360,7 +493,7 @@ microtouch3m_device_array_new (microtouch3m_context_t *ctx,
                                unsigned int           *out_n_items)
 {
     microtouch3m_device_t **devices = NULL;
-    libusb_device         **usbdevs = NULL;
+    transport_device_t    **usbdevs = NULL;
     unsigned int            n_devices = 0;
     unsigned int            i;
 
@@ -376,19 +509,19 @@ microtouch3m_device_array_new (microtouch3m_context_t *ctx,
 
     for (i = 0; i < n_devices; i++) {
         /* On device creation failure, usbdev is consumed as well */
-        devices[i] = device_new_by_usbdev (ctx, libusb_ref_device (usbdevs[i]));
+        devices[i] = device_new_by_usbdev (ctx, transport_ref_device (ctx->transport, usbdevs[i]));
         /* Any error creating a device makes the whole process fail */
         if (!devices[i])
             goto out_err;
     }
-    usb_device_array_free (usbdevs, n_devices);
+    usb_device_array_free (ctx, usbdevs, n_devices);
 
     *out_n_items = n_devices;
     return devices;
 
 out_err:
     microtouch3m_device_array_free (devices, n_devices);
-    usb_device_array_free (usbdevs, n_devices);
+    usb_device_array_free (ctx, usbdevs, n_devices);
     *out_n_items = 0;
     return NULL;
 }
@@ -396,7 +529,7 @@ out_err:
 microtouch3m_device_t *
 microtouch3m_device_new_first (microtouch3m_context_t *ctx)
 {
-    libusb_device *usbdev;
+    transport_device_t *usbdev;
 
     usbdev = find_one_usb_device (ctx, true, 0, 0, NULL, 0);
     if (!usbdev)
@@ -411,7 +544,7 @@ microtouch3m_device_new_by_usb_address (microtouch3m_context_t *ctx,
                                         uint8_t                 bus_number,
                                         uint8_t                 device_address)
 {
-    libusb_device *usbdev;
+    transport_device_t *usbdev;
 
     usbdev = find_one_usb_device (ctx, false, bus_number, device_address, NULL, 0);
     if (!usbdev)
@@ -427,7 +560,7 @@ microtouch3m_device_new_by_usb_location (microtouch3m_context_t *ctx,
                                          const uint8_t          *port_numbers,
                                          int                     port_numbers_len)
 {
-    libusb_device *usbdev;
+    transport_device_t *usbdev;
 
     usbdev = find_one_usb_device (ctx, false, bus_number, 0, port_numbers, port_numbers_len);
     if (!usbdev)
@@ -448,15 +581,24 @@ microtouch3m_device_ref (microtouch3m_device_t *dev)
 void
 microtouch3m_device_unref (microtouch3m_device_t *dev)
 {
+    unsigned int i;
+
     assert (dev);
     if (__sync_fetch_and_sub (&dev->refcount, 1) != 1)
         return;
 
+    microtouch3m_device_scope_recording_stop (dev);
+
     if (dev->usbhandle)
-        libusb_close (dev->usbhandle);
+        transport_close (dev->ctx->transport, dev->usbhandle);
+
+    for (i = 0; i < N_REGIONS; i++) {
+        free (dev->region_cache[i].data);
+        free (dev->region_cache[i].valid);
+    }
 
     assert (dev->usbdev);
-    libusb_unref_device (dev->usbdev);
+    transport_unref_device (dev->ctx->transport, dev->usbdev);
 
     assert (dev->ctx);
     microtouch3m_context_unref (dev->ctx);
@@ -467,13 +609,13 @@ microtouch3m_device_unref (microtouch3m_device_t *dev)
 uint8_t
 microtouch3m_device_get_usb_bus_number (microtouch3m_device_t *dev)
 {
-    return libusb_get_bus_number (dev->usbdev);
+    return transport_get_bus_number (dev->ctx->transport, dev->usbdev);
 }
 
 uint8_t
 microtouch3m_device_get_usb_device_address (microtouch3m_device_t *dev)
 {
-    return libusb_get_device_address (dev->usbdev);
+    return transport_get_device_address (dev->ctx->transport, dev->usbdev);
 }
 
 uint8_t
@@ -483,7 +625,7 @@ microtouch3m_device_get_usb_location (microtouch3m_device_t *dev,
 {
     int n;
 
-    return (((n = libusb_get_port_numbers (dev->usbdev, port_numbers, port_numbers_len)) < 0) ? 0 : n);
+    return (((n = transport_get_port_numbers (dev->ctx->transport, dev->usbdev, port_numbers, port_numbers_len)) < 0) ? 0 : n);
 }
 
 /******************************************************************************/
@@ -496,8 +638,8 @@ microtouch3m_device_open (microtouch3m_device_t *dev)
 
     assert (dev);
 
-    if (!dev->usbhandle && ((ret = libusb_open (dev->usbdev, &dev->usbhandle)) < 0)) {
-        microtouch3m_log ("error: couldn't open usb device: %s", libusb_strerror (ret));
+    if (!dev->usbhandle && ((ret = transport_open (dev->ctx->transport, dev->usbdev, &dev->usbhandle)) < 0)) {
+        microtouch3m_log_error ("error: couldn't open usb device: %s", libusb_strerror (ret));
         return MICROTOUCH3M_STATUS_FAILED;
     }
 
@@ -512,49 +654,254 @@ microtouch3m_device_close (microtouch3m_device_t *dev)
     if (!dev->usbhandle)
         return;
 
-    libusb_close (dev->usbhandle);
+    transport_close (dev->ctx->transport, dev->usbhandle);
     dev->usbhandle = NULL;
+
+    /* The device may be rebooted or updated while we don't have it open */
+    microtouch3m_device_region_cache_invalidate (dev);
+}
+
+/******************************************************************************/
+/* Transfer statistics */
+
+/* Bucket i holds latencies below (MICROTOUCH3M_LATENCY_BUCKET_BASE_US << i) us,
+ * the last one all the remaining ones */
+static unsigned int
+latency_bucket (uint64_t     latency_us,
+                unsigned int n_buckets)
+{
+    unsigned int bucket;
+
+    for (bucket = 0; bucket < (n_buckets - 1); bucket++) {
+        if (latency_us < ((uint64_t) MICROTOUCH3M_LATENCY_BUCKET_BASE_US << bucket))
+            break;
+    }
+    return bucket;
+}
+
+static void
+transfer_stats_reset (struct transfer_stats_s *stats)
+{
+    unsigned int i;
+
+    stats->n_transfers      = 0;
+    stats->n_errors         = 0;
+    stats->n_bytes          = 0;
+    stats->latency_total_us = 0;
+    stats->latency_min_us   = UINT64_MAX;
+    stats->latency_max_us   = 0;
+    for (i = 0; i < MICROTOUCH3M_DEVICE_STATS_LATENCY_BUCKETS; i++)
+        stats->latency_histogram[i] = 0;
+}
+
+static void
+transfer_stats_update (struct transfer_stats_s *stats,
+                       int                      result,
+                       uint64_t                 latency_us)
+{
+    uint64_t current;
+
+    __sync_fetch_and_add (&stats->latency_histogram[latency_bucket (latency_us, MICROTOUCH3M_DEVICE_STATS_LATENCY_BUCKETS)], 1);
+
+    __sync_fetch_and_add (&stats->n_transfers, 1);
+    if (result < 0)
+        __sync_fetch_and_add (&stats->n_errors, 1);
+    else
+        __sync_fetch_and_add (&stats->n_bytes, result);
+    __sync_fetch_and_add (&stats->latency_total_us, latency_us);
+
+    while ((latency_us < (current = stats->latency_min_us)) &&
+           !__sync_bool_compare_and_swap (&stats->latency_min_us, current, latency_us));
+    while ((latency_us > (current = stats->latency_max_us)) &&
+           !__sync_bool_compare_and_swap (&stats->latency_max_us, current, latency_us));
+}
+
+static void
+transfer_stats_copy (const struct transfer_stats_s        *stats,
+                     microtouch3m_device_transfer_stats_t *out)
+{
+    unsigned int i;
+
+    out->n_transfers      = stats->n_transfers;
+    out->n_errors         = stats->n_errors;
+    out->n_bytes          = stats->n_bytes;
+    out->latency_total_us = stats->latency_total_us;
+    out->latency_min_us   = (stats->latency_min_us == UINT64_MAX) ? 0 : stats->latency_min_us;
+    out->latency_max_us   = stats->latency_max_us;
+    for (i = 0; i < MICROTOUCH3M_DEVICE_STATS_LATENCY_BUCKETS; i++)
+        out->latency_histogram[i] = stats->latency_histogram[i];
+}
+
+void
+microtouch3m_device_get_stats (microtouch3m_device_t       *dev,
+                               microtouch3m_device_stats_t *stats)
+{
+    unsigned int i;
+
+    assert (dev);
+    assert (stats);
+
+    for (i = 0; i < MICROTOUCH3M_DEVICE_STATS_MAX_REQUESTS; i++)
+        transfer_stats_copy (&dev->stats_control[i], &stats->control[i]);
+    transfer_stats_copy (&dev->stats_interrupt, &stats->interrupt);
+}
+
+void
+microtouch3m_device_reset_stats (microtouch3m_device_t *dev)
+{
+    unsigned int i;
+
+    assert (dev);
+
+    for (i = 0; i < MICROTOUCH3M_DEVICE_STATS_MAX_REQUESTS; i++)
+        transfer_stats_reset (&dev->stats_control[i]);
+    transfer_stats_reset (&dev->stats_interrupt);
 }
 
 /******************************************************************************/
 /* IN/OUT requests */
 
-enum request_e {
-    REQUEST_ASYNC_SET_REPORT    = 0x01,
-    REQUEST_GET_PARAMETER_BLOCK = 0x02,
-    REQUEST_SET_PARAMETER_BLOCK = 0x03,
-    REQUEST_STATUS              = 0x06,
-    REQUEST_RESET               = 0x07,
-    REQUEST_CONTROLLER_ID       = 0x0A,
-    REQUEST_GET_PARAMETER       = 0x10,
-    REQUEST_SET_PARAMETER       = 0x11,
-    REQUEST_GET_GENERIC         = 0x12,
-    REQUEST_SET_GENERIC         = 0x13,
+static const char *request_str[] = {
+    [REQUEST_ASYNC_SET_REPORT]    = "async-set-report",
+    [REQUEST_GET_PARAMETER_BLOCK] = "get-parameter-block",
+    [REQUEST_SET_PARAMETER_BLOCK] = "set-parameter-block",
+    [REQUEST_STATUS]              = "status",
+    [REQUEST_RESET]               = "reset",
+    [REQUEST_CONTROLLER_ID]       = "controller-id",
+    [REQUEST_GET_PARAMETER]       = "get-parameter",
+    [REQUEST_SET_PARAMETER]       = "set-parameter",
+    [REQUEST_GET_GENERIC]         = "get-generic",
+    [REQUEST_SET_GENERIC]         = "set-generic",
 };
 
-enum parameter_id_e {
-    PARAMETER_ID_CONTROLLER_NOVRAM   = 0x0000,
-    PARAMETER_ID_CONTROLLER_STRAYS   = 0x0003,
-    PARAMETER_ID_CONTROLLER_SETTINGS = 0x0017,
-    PARAMETER_ID_CONTROLLER_EEPROM   = 0x0020,
-};
+const char *
+microtouch3m_trace_request_to_string (uint8_t request)
+{
+    return (((request < (sizeof (request_str) / sizeof (request_str[0]))) && (request_str[request])) ? request_str[request] : "unknown");
+}
+
+const char *
+microtouch3m_trace_result_to_string (int32_t result)
+{
+    return ((result < 0) ? libusb_strerror ((enum libusb_error) result) : "success");
+}
+
+/* Called after every USB transfer, to update statistics and trace it */
+static void
+transfer_done (microtouch3m_device_t         *dev,
+               microtouch3m_trace_transfer_t  type,
+               uint8_t                        request_type,
+               uint8_t                        request,
+               uint16_t                       value,
+               uint16_t                       index,
+               const uint8_t                 *data,
+               size_t                         length,
+               int                            result,
+               uint64_t                       start_us)
+{
+    microtouch3m_trace_record_t record;
+    uint64_t                    latency_us;
+
+    latency_us = monotonic_time_us () - start_us;
+
+    if (type == MICROTOUCH3M_TRACE_TRANSFER_INTERRUPT)
+        transfer_stats_update (&dev->stats_interrupt, result, latency_us);
+    else if (request < MICROTOUCH3M_DEVICE_STATS_MAX_REQUESTS)
+        transfer_stats_update (&dev->stats_control[request], result, latency_us);
+
+    if (!dev->ctx->trace)
+        return;
 
-enum report_id_e {
-    REPORT_ID_COORDINATE_DATA = 0x0001,
-    REPORT_ID_SCOPE_DATA      = 0x0002,
-    REPORT_ID_PARAMETER       = 0x0004,
+    record.timestamp_us   = start_us;
+    record.latency_us     = latency_us;
+    record.type           = type;
+    record.bus_number     = transport_get_bus_number (dev->ctx->transport, dev->usbdev);
+    record.device_address = transport_get_device_address (dev->ctx->transport, dev->usbdev);
+    record.request_type   = request_type;
+    record.request        = request;
+    record.value          = value;
+    record.index          = index;
+    record.length         = length;
+    record.result         = result;
+    record.payload        = data;
+    /* Data received in IN transfers, data to send in OUT transfers */
+    if (request_type & LIBUSB_ENDPOINT_IN)
+        record.payload_size = (result > 0) ? result : 0;
+    else
+        record.payload_size = length;
+
+    trace_add (dev->ctx->trace, &record);
+}
+
+/* Memory regions are read and written through parameter block requests, using
+ * the byte offset within the region as request index, as the firmware dump
+ * does. NOVRAM is not a region: it's addressed by block number in the index
+ * high byte, and each block must be transferred whole with its own size. */
+
+#define REGION_PAGE_SIZE 64
+
+struct region_info_s {
+    const char *name;
+    uint16_t    parameter_id;
+    size_t      size;
 };
 
-enum async_set_report_e {
-    ASYNC_SET_REPORT_DISABLE = 0x0000,
-    ASYNC_SET_REPORT_ENABLE  = 0x0001,
+static const struct region_info_s region_info[N_REGIONS] = {
+    [MICROTOUCH3M_DEVICE_REGION_EEPROM] = { "eeprom", PARAMETER_ID_CONTROLLER_EEPROM, MICROTOUCH3M_FW_IMAGE_SIZE },
 };
 
-struct parameter_report_s {
-    uint8_t  report_id;
-    uint16_t data_size;
-    uint8_t  data [];
-} __attribute__((packed));
+static void
+region_cache_invalidate (microtouch3m_device_t        *dev,
+                         microtouch3m_device_region_t  region,
+                         size_t                        offset,
+                         size_t                        size)
+{
+    struct region_cache_s *cache;
+    size_t                 page;
+    size_t                 page_last;
+
+    cache = &dev->region_cache[region];
+    if (!cache->valid || offset >= region_info[region].size)
+        return;
+
+    if (!size)
+        size = 1;
+    if (size > region_info[region].size - offset)
+        size = region_info[region].size - offset;
+
+    page_last = (offset + size - 1) / REGION_PAGE_SIZE;
+    for (page = offset / REGION_PAGE_SIZE; page <= page_last; page++)
+        cache->valid[page] = 0;
+}
+
+/* Any request that may modify the device memory drops the affected cached
+ * pages. Writes to parameters other than the memory regions themselves (e.g.
+ * settings, calibration) are persisted in NOVRAM, which isn't cached. */
+static void
+region_cache_invalidate_for_request (microtouch3m_device_t *dev,
+                                     enum request_e         parameter_cmd,
+                                     uint16_t               parameter_value,
+                                     uint16_t               parameter_index,
+                                     size_t                 parameter_data_size)
+{
+    unsigned int i;
+
+    switch (parameter_cmd) {
+    case REQUEST_SET_PARAMETER_BLOCK:
+        for (i = 0; i < N_REGIONS; i++) {
+            if (region_info[i].parameter_id == parameter_value) {
+                region_cache_invalidate (dev, i, parameter_index, parameter_data_size);
+                return;
+            }
+        }
+        return;
+    case REQUEST_RESET:
+        microtouch3m_device_region_cache_invalidate (dev);
+        return;
+    default:
+        return;
+    }
+}
 
 static microtouch3m_status_t
 run_in_request (microtouch3m_device_t     *dev,
@@ -565,34 +912,43 @@ run_in_request (microtouch3m_device_t     *dev,
                 size_t                     parameter_data_size,
                 enum libusb_error         *out_usb_error)
 {
-    int desc_size;
+    int      desc_size;
+    uint64_t start_us;
 
     assert (dev);
     assert (parameter_data);
 
-    if ((desc_size = libusb_control_transfer (dev->usbhandle,
-                                              LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
-                                              parameter_cmd,
-                                              parameter_value,
-                                              parameter_index,
-                                              parameter_data,
-                                              parameter_data_size,
-                                              5000)) < 0) {
+    start_us  = monotonic_time_us ();
+    desc_size = transport_control_transfer (dev->ctx->transport,
+                                            dev->usbhandle,
+                                            LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                                            parameter_cmd,
+                                            parameter_value,
+                                            parameter_index,
+                                            parameter_data,
+                                            parameter_data_size,
+                                            5000);
+    transfer_done (dev, MICROTOUCH3M_TRACE_TRANSFER_CONTROL,
+                   LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                   parameter_cmd, parameter_value, parameter_index,
+                   parameter_data, parameter_data_size, desc_size, start_us);
+
+    if (desc_size < 0) {
         if (out_usb_error)
             *out_usb_error = (enum libusb_error) desc_size;
-        microtouch3m_log ("warn: while running IN request 0x%02x value 0x%04x index 0x%04x: %s",
-                          parameter_cmd, parameter_value, parameter_index, libusb_strerror (desc_size));
+        microtouch3m_log_warn ("warn: while running IN request 0x%02x value 0x%04x index 0x%04x: %s",
+                               parameter_cmd, parameter_value, parameter_index, libusb_strerror (desc_size));
         return MICROTOUCH3M_STATUS_INVALID_IO;
     }
 
     if (desc_size != parameter_data_size) {
-        microtouch3m_log ("error: couldn't run IN request 0x%02x value 0x%04x index 0x%04x: invalid data size read (%d != %d)",
-                          parameter_cmd, parameter_value, parameter_index, desc_size, parameter_data_size);
+        microtouch3m_log_error ("error: couldn't run IN request 0x%02x value 0x%04x index 0x%04x: invalid data size read (%d != %zu)",
+                                parameter_cmd, parameter_value, parameter_index, desc_size, parameter_data_size);
         return MICROTOUCH3M_STATUS_INVALID_DATA;
     }
 
-    microtouch3m_log ("successfully run IN request 0x%02x value 0x%04x index 0x%04x",
-                      parameter_cmd, parameter_value, parameter_index);
+    microtouch3m_log_debug ("successfully run IN request 0x%02x value 0x%04x index 0x%04x",
+                            parameter_cmd, parameter_value, parameter_index);
     return MICROTOUCH3M_STATUS_OK;
 }
 
@@ -617,14 +973,14 @@ run_parameter_in_request (microtouch3m_device_t     *dev,
         return st;
 
     if (parameter_report->report_id != REPORT_ID_PARAMETER) {
-        microtouch3m_log ("error: couldn't run parameter IN request 0x%02x value 0x%04x index 0x%04x: invalid report id (%d != %d)",
-                          parameter_cmd, parameter_value, parameter_index, parameter_report->report_id, REPORT_ID_PARAMETER);
+        microtouch3m_log_error ("error: couldn't run parameter IN request 0x%02x value 0x%04x index 0x%04x: invalid report id (%d != %d)",
+                                parameter_cmd, parameter_value, parameter_index, parameter_report->report_id, REPORT_ID_PARAMETER);
         return MICROTOUCH3M_STATUS_INVALID_DATA;
     }
 
     if (le16toh (parameter_report->data_size) != (parameter_report_size - sizeof (struct parameter_report_s))) {
-        microtouch3m_log ("error: couldn't run parameter IN request 0x%02x value 0x%04x index 0x%04x: invalid read data size reported (%d != %d)",
-                          parameter_cmd, parameter_value, parameter_index, le16toh (parameter_report->data_size), (parameter_report_size - sizeof (struct parameter_report_s)));
+        microtouch3m_log_error ("error: couldn't run parameter IN request 0x%02x value 0x%04x index 0x%04x: invalid read data size reported (%d != %zu)",
+                                parameter_cmd, parameter_value, parameter_index, le16toh (parameter_report->data_size), (parameter_report_size - sizeof (struct parameter_report_s)));
         return MICROTOUCH3M_STATUS_INVALID_FORMAT;
     }
 
@@ -640,64 +996,52 @@ run_out_request (microtouch3m_device_t *dev,
                  size_t                 parameter_data_size,
                  enum libusb_error     *out_usb_error)
 {
-    int desc_size;
+    int      desc_size;
+    uint64_t start_us;
 
     assert (dev);
 
-    if ((desc_size = libusb_control_transfer (dev->usbhandle,
-                                              LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
-                                              parameter_cmd,
-                                              parameter_value,
-                                              parameter_index,
-                                              (uint8_t *) parameter_data,
-                                              parameter_data_size,
-                                              5000)) < 0) {
+    /* Invalidate before running the request, as even a failed one may have
+     * modified the device memory */
+    region_cache_invalidate_for_request (dev, parameter_cmd, parameter_value, parameter_index, parameter_data_size);
+
+    start_us  = monotonic_time_us ();
+    desc_size = transport_control_transfer (dev->ctx->transport,
+                                            dev->usbhandle,
+                                            LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                                            parameter_cmd,
+                                            parameter_value,
+                                            parameter_index,
+                                            (uint8_t *) parameter_data,
+                                            parameter_data_size,
+                                            5000);
+    transfer_done (dev, MICROTOUCH3M_TRACE_TRANSFER_CONTROL,
+                   LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE,
+                   parameter_cmd, parameter_value, parameter_index,
+                   parameter_data, parameter_data_size, desc_size, start_us);
+
+    if (desc_size < 0) {
         if (out_usb_error)
             *out_usb_error = (enum libusb_error) desc_size;
-        microtouch3m_log ("warn: while running OUT request 0x%02x value 0x%04x index 0x%04x data %u bytes: %s",
-                          parameter_cmd, parameter_value, parameter_index, parameter_data_size, libusb_strerror (desc_size));
+        microtouch3m_log_warn ("warn: while running OUT request 0x%02x value 0x%04x index 0x%04x data %zu bytes: %s",
+                               parameter_cmd, parameter_value, parameter_index, parameter_data_size, libusb_strerror (desc_size));
         return MICROTOUCH3M_STATUS_INVALID_IO;
     }
 
     if (desc_size != parameter_data_size) {
-        microtouch3m_log ("error: couldn't run OUT request 0x%02x value 0x%04x index 0x%04x: invalid data size written (%d != %d)",
-                          parameter_cmd, parameter_value, parameter_index, desc_size, parameter_data_size);
+        microtouch3m_log_error ("error: couldn't run OUT request 0x%02x value 0x%04x index 0x%04x: invalid data size written (%d != %zu)",
+                                parameter_cmd, parameter_value, parameter_index, desc_size, parameter_data_size);
         return MICROTOUCH3M_STATUS_INVALID_DATA;
     }
 
-    microtouch3m_log ("successfully run OUT request 0x%02x value 0x%04x index 0x%04x data %u bytes",
-                      parameter_cmd, parameter_value, parameter_index, parameter_data_size);
+    microtouch3m_log_debug ("successfully run OUT request 0x%02x value 0x%04x index 0x%04x data %zu bytes",
+                            parameter_cmd, parameter_value, parameter_index, parameter_data_size);
     return MICROTOUCH3M_STATUS_OK;
 }
 
 /******************************************************************************/
 /* Status */
 
-typedef enum {
-    CMD_STATUS_FAILURE            = 0,
-    CMD_STATUS_ONGOING            = 1,
-    CMD_STATUS_STAGE_1_COMPLETED  = 2,
-    CMD_STATUS_COMPLETED          = 3,
-    CMD_STATUS_SOFT_RESET_OCCURED = 4,
-    CMD_STATUS_HARD_RESET_OCCURED = 5,
-} cmd_status_t;
-
-struct standard_status_report_s {
-    uint8_t  report_id;
-    uint16_t poc_status;
-    uint8_t  cmd_status;
-    uint8_t  touch_status;
-    uint16_t async_reports;
-    uint8_t  reserved;
-} __attribute__((packed));
-
-struct extended_status_report_s {
-    struct standard_status_report_s standard;
-    uint8_t  reserved;
-    uint16_t extended_poc_status;
-    uint8_t  reserved2[9];
-} __attribute__((packed));
-
 static microtouch3m_status_t
 device_get_status_standard (microtouch3m_device_t           *dev,
                             struct standard_status_report_s *out_status)
@@ -712,7 +1056,7 @@ device_get_status_standard (microtouch3m_device_t           *dev,
                               (uint8_t *) out_status,
                               sizeof (struct standard_status_report_s),
                               NULL)) != MICROTOUCH3M_STATUS_OK) {
-        microtouch3m_log ("error: couldn't read standard status");
+        microtouch3m_log_error ("error: couldn't read standard status");
     }
     return st;
 }
@@ -731,7 +1075,7 @@ device_get_status_extended (microtouch3m_device_t           *dev,
                               (uint8_t *) out_status,
                               sizeof (struct extended_status_report_s),
                               NULL)) != MICROTOUCH3M_STATUS_OK) {
-        microtouch3m_log ("error: couldn't read extended status");
+        microtouch3m_log_error ("error: couldn't read extended status");
     }
     return st;
 }
@@ -763,19 +1107,6 @@ device_wait_cmd_status (microtouch3m_device_t *dev,
 /******************************************************************************/
 /* Query controller ID */
 
-struct report_controller_id_s {
-    uint8_t  report_id;
-    uint16_t controller_type;
-    uint8_t  firmware_major;
-    uint8_t  firmware_minor;
-    uint8_t  features;
-    uint16_t constants_checksum;
-    uint16_t max_param_write;
-    uint8_t  reserved[8];
-    uint32_t pc_checksum;
-    uint16_t asic_type;
-} __attribute__((packed));
-
 microtouch3m_status_t
 microtouch3m_device_query_controller_id (microtouch3m_device_t *dev,
                                          uint16_t              *controller_type,
@@ -872,7 +1203,7 @@ microtouch3m_device_reset (microtouch3m_device_t       *dev,
      * We do want to get a EPIPE error */
     switch (reset) {
     case MICROTOUCH3M_DEVICE_RESET_REBOOT:
-        microtouch3m_log ("error: reboot reset request ignored");
+        microtouch3m_log_error ("error: reboot reset request ignored");
         return MICROTOUCH3M_STATUS_FAILED;
     case MICROTOUCH3M_DEVICE_RESET_SOFT:
         expected_cmd_status = CMD_STATUS_SOFT_RESET_OCCURED;
@@ -881,7 +1212,7 @@ microtouch3m_device_reset (microtouch3m_device_t       *dev,
         expected_cmd_status = CMD_STATUS_HARD_RESET_OCCURED;
         break;
     default:
-        microtouch3m_log ("error: invalid reset type requested");
+        microtouch3m_log_error ("error: invalid reset type requested");
         return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
 
@@ -1285,8 +1616,6 @@ microtouch3m_device_set_extended_sensitivity (microtouch3m_device_t *dev,
 /******************************************************************************/
 /* Frequency */
 
-#define VALUE_FREQUENCY 0x0002
-
 /* The frequency constants are gathered after analyzing the USB traffic
  * generated by the MT7SDU program in Windows. These are the 5 different
  * frequency settings, although the application also allowed 2 more (higher)
@@ -1345,7 +1674,7 @@ microtouch3m_device_get_frequency (microtouch3m_device_t           *dev,
 
     /* Validate the setting by looking for a string representation */
     if (!microtouch3m_device_frequency_to_string (aux.value)) {
-        microtouch3m_log ("error: unknown frequency setting reported: 0x%04x", aux.value);
+        microtouch3m_log_error ("error: unknown frequency setting reported: 0x%04x", aux.value);
         return MICROTOUCH3M_STATUS_INVALID_DATA;
     }
 
@@ -1369,7 +1698,7 @@ microtouch3m_device_set_frequency (microtouch3m_device_t           *dev,
 
     /* Validate the setting by looking for a string representation */
     if (!(str = microtouch3m_device_frequency_to_string (freq))) {
-        microtouch3m_log ("error: unknown frequency setting requested: 0x%04x", freq);
+        microtouch3m_log_error ("error: unknown frequency setting requested: 0x%04x", freq);
         return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
 
@@ -1447,7 +1776,7 @@ microtouch3m_device_set_constant_touch_timeout (microtouch3m_device_t *dev,
     uint16_t                                         write_timeout_ticks;
 
     if ((timeout_ms % CONSTANT_TOUCH_TIMEOUT_MS_PER_TICK) != 0) {
-        microtouch3m_log ("invalid constant touch timeout specified: not a multiple of %ms (%u)",
+        microtouch3m_log ("invalid constant touch timeout specified: not a multiple of %ums (%u)",
                           CONSTANT_TOUCH_TIMEOUT_MS_PER_TICK, timeout_ms);
         return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
@@ -1549,6 +1878,20 @@ microtouch3m_read_strays (microtouch3m_device_t *dev,
     if (lr_stray_q)
         *lr_stray_q = (int32_t) (le32toh (parameter_report.lr_stray_q));
 
+    if (dev->recording) {
+        int32_t values[8];
+
+        values[0] = (int32_t) (le32toh (parameter_report.ul_stray_i));
+        values[1] = (int32_t) (le32toh (parameter_report.ul_stray_q));
+        values[2] = (int32_t) (le32toh (parameter_report.ur_stray_i));
+        values[3] = (int32_t) (le32toh (parameter_report.ur_stray_q));
+        values[4] = (int32_t) (le32toh (parameter_report.ll_stray_i));
+        values[5] = (int32_t) (le32toh (parameter_report.ll_stray_q));
+        values[6] = (int32_t) (le32toh (parameter_report.lr_stray_i));
+        values[7] = (int32_t) (le32toh (parameter_report.lr_stray_q));
+        recording_add (dev->recording, MICROTOUCH3M_SCOPE_RECORD_STRAYS, monotonic_time_us (), values);
+    }
+
     /* Success! */
     microtouch3m_log ("successfully read strays");
     return MICROTOUCH3M_STATUS_OK;
@@ -1648,14 +1991,14 @@ microtouch3m_linearization_data_file_read (const char
 
     fd = open (path, O_RDONLY);
     if (fd < 0) {
-        microtouch3m_log ("error: couldn't open file with linearization data: %s", strerror (errno));
+        microtouch3m_log_error ("error: couldn't open file with linearization data: %s", strerror (errno));
         st = MICROTOUCH3M_STATUS_FAILED;
         goto out;
     }
 
     n_read = read (fd, buffer, LINEARIZATION_FILE_SIZE);
     if (n_read <= 0) {
-        microtouch3m_log ("error: couldn't read linearization data file contents: %s", strerror (errno));
+        microtouch3m_log_error ("error: couldn't read linearization data file contents: %s", strerror (errno));
         st = MICROTOUCH3M_STATUS_INVALID_IO;
         goto out;
     }
@@ -1674,7 +2017,7 @@ microtouch3m_linearization_data_file_read (const char
                 val <= 0xff)
                 data->items[i][j].x_coef = (int8_t) (val & 0xFF);
             else {
-                microtouch3m_log ("error: invalid linearization data detected at X[%d][%d]", i, j);
+                microtouch3m_log_error ("error: invalid linearization data detected at X[%d][%d]", i, j);
                 st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
                 goto out;
             }
@@ -1688,7 +2031,7 @@ microtouch3m_linearization_data_file_read (const char
                 val <= 0xff)
                 data->items[i][j].y_coef = (int8_t) (val & 0xFF);
             else {
-                microtouch3m_log ("error: invalid linearization data detected at Y[%d][%d]", i, j);
+                microtouch3m_log_error ("error: invalid linearization data detected at Y[%d][%d]", i, j);
                 st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
                 goto out;
             }
@@ -1725,13 +2068,13 @@ microtouch3m_linearization_data_file_write (const char
 
     fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
     if (fd < 0) {
-        microtouch3m_log ("error: couldn't open output file to write: %s", strerror (errno));
+        microtouch3m_log_error ("error: couldn't open output file to write: %s", strerror (errno));
         st = MICROTOUCH3M_STATUS_FAILED;
         goto out;
     }
 
     if (write (fd, buffer, LINEARIZATION_FILE_SIZE) < 0) {
-        microtouch3m_log ("error: couldn't write to output file: %s", strerror (errno));
+        microtouch3m_log_error ("error: couldn't write to output file: %s", strerror (errno));
         st = MICROTOUCH3M_STATUS_INVALID_IO;
         goto out;
     }
@@ -1748,7 +2091,6 @@ out:
 /******************************************************************************/
 /* Controller identifier */
 
-#define IDENTIFIER_PARAMETER_NUMBER 2
 struct parameter_report_identifier_data_s {
     struct parameter_report_s               header;
     struct microtouch3m_device_identifier_s identifier;
@@ -1807,7 +2149,6 @@ microtouch3m_device_orientation_to_string (microtouch3m_device_orientation_t ori
     return orientation_str[orientation];
 }
 
-#define ORIENTATION_PARAMETER_NUMBER 1
 struct parameter_report_orientation_data_s {
     struct parameter_report_s header;
     uint16_t                  orientation; /* BE */
@@ -1834,7 +2175,7 @@ microtouch3m_device_get_orientation (microtouch3m_device_t             *dev,
     aux = be16toh (parameter_report.orientation);
     str = microtouch3m_device_orientation_to_string (aux);
     if (!str) {
-        microtouch3m_log ("error: unexpected orientation value: %04x", aux);
+        microtouch3m_log_error ("error: unexpected orientation value: %04x", aux);
         return MICROTOUCH3M_STATUS_INVALID_DATA;
     }
 
@@ -1845,8 +2186,6 @@ microtouch3m_device_get_orientation (microtouch3m_device_t             *dev,
     return MICROTOUCH3M_STATUS_OK;
 }
 
-#define VALUE_ORIENTATION 0x00f2
-
 microtouch3m_status_t
 microtouch3m_device_set_orientation (microtouch3m_device_t             *dev,
                                      microtouch3m_device_orientation_t  orientation)
@@ -1896,133 +2235,565 @@ device_restore_orientation (microtouch3m_device_t             *dev,
 }
 
 /******************************************************************************/
-/* Device async report operation */
+/* Memory regions */
 
-#define MAX_INTERRUPT_ENDPOINT_TRANSFER 32
-
-struct report_scope_s {
-    uint8_t  report_id;
-    uint16_t wtf;
-    uint32_t ul_i;
-    uint32_t ul_q;
-    uint32_t ur_i;
-    uint32_t ur_q;
-    uint32_t ll_i;
-    uint32_t ll_q;
-    uint32_t lr_i;
-    uint32_t lr_q;
+struct parameter_report_region_page_s {
+    struct parameter_report_s header;
+    uint8_t                   data [REGION_PAGE_SIZE];
 } __attribute__((packed));
 
-microtouch3m_status_t
-microtouch3m_device_monitor_async_reports (microtouch3m_device_t                    *dev,
-                                           microtouch3m_device_async_report_scope_f *callback,
-                                           void                                     *user_data)
+const char *
+microtouch3m_device_region_to_string (microtouch3m_device_region_t region)
 {
-    microtouch3m_status_t st;
-    bool                  continue_loop = true;
-    bool                  first_found = false;
+    return ((region < N_REGIONS) ? region_info[region].name : "unknown");
+}
 
-    if (libusb_kernel_driver_active (dev->usbhandle, 0)) {
-        microtouch3m_log ("kernel driver is active...");
-        if (libusb_detach_kernel_driver (dev->usbhandle, 0) == 0)
-            microtouch3m_log ("kernel driver now detached");
+size_t
+microtouch3m_device_region_get_size (microtouch3m_device_region_t region)
+{
+    return ((region < N_REGIONS) ? region_info[region].size : 0);
+}
+
+void
+microtouch3m_device_region_cache_invalidate (microtouch3m_device_t *dev)
+{
+    unsigned int i;
+
+    assert (dev);
+
+    for (i = 0; i < N_REGIONS; i++) {
+        if (dev->region_cache[i].valid)
+            memset (dev->region_cache[i].valid, 0, region_info[i].size / REGION_PAGE_SIZE);
     }
+}
 
-    if (libusb_claim_interface (dev->usbhandle, 0) < 0) {
-        microtouch3m_log ("couldn't claim USB interface");
-        return MICROTOUCH3M_STATUS_FAILED;
+static microtouch3m_status_t
+region_check_range (microtouch3m_device_t        *dev,
+                    microtouch3m_device_region_t  region,
+                    size_t                        offset,
+                    size_t                        length)
+{
+    if (region >= N_REGIONS) {
+        microtouch3m_log_error ("error: unknown memory region: %d", region);
+        return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
 
-    microtouch3m_log ("disable coordinate data reports...");
-    if ((st = run_out_request (dev,
-                               REQUEST_ASYNC_SET_REPORT,
-                               ASYNC_SET_REPORT_DISABLE,
-                               REPORT_ID_COORDINATE_DATA,
-                               NULL,
-                               0,
-                               NULL)) != MICROTOUCH3M_STATUS_OK) {
-        microtouch3m_log ("error: couldn't disable coordinate data reports");
-        return st;
+    if ((offset > region_info[region].size) || (length > region_info[region].size - offset)) {
+        microtouch3m_log_error ("error: range out of %s region bounds (offset 0x%04zx, length %zu, region size %zu)",
+                                region_info[region].name, offset, length, region_info[region].size);
+        return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
 
-    microtouch3m_log ("disable scope data reports...");
-    if ((st = run_out_request (dev,
-                               REQUEST_ASYNC_SET_REPORT,
-                               ASYNC_SET_REPORT_DISABLE,
-                               REPORT_ID_SCOPE_DATA,
-                               NULL,
-                               0,
-                               NULL)) != MICROTOUCH3M_STATUS_OK) {
-        microtouch3m_log ("error: couldn't disable scope data reports");
-        return st;
+    if (!dev->usbhandle) {
+        microtouch3m_log_error ("error: device not open");
+        return MICROTOUCH3M_STATUS_INVALID_STATE;
     }
 
-    microtouch3m_log ("reading current status...");
-    {
-        struct extended_status_report_s status;
+    return MICROTOUCH3M_STATUS_OK;
+}
 
-        if ((st = device_get_status_extended (dev, &status)) != MICROTOUCH3M_STATUS_OK)
-            return st;
+microtouch3m_status_t
+microtouch3m_device_read_region (microtouch3m_device_t        *dev,
+                                 microtouch3m_device_region_t  region,
+                                 size_t                        offset,
+                                 uint8_t                      *buffer,
+                                 size_t                        length)
+{
+    microtouch3m_status_t  st;
+    struct region_cache_s *cache;
+    size_t                 page;
+    size_t                 page_last;
+    unsigned int           n_transfers = 0;
 
-        /* NOTE: we probably want to do something here, like check that all reports are
-         * disabled */
-    }
+    assert (dev);
+    assert (buffer || !length);
 
-    microtouch3m_log ("enable scope data reports...");
-    if ((st = run_out_request (dev,
-                               REQUEST_ASYNC_SET_REPORT,
-                               ASYNC_SET_REPORT_ENABLE,
-                               REPORT_ID_SCOPE_DATA,
-                               NULL,
-                               0,
-                               NULL)) != MICROTOUCH3M_STATUS_OK) {
-        microtouch3m_log ("error: couldn't enable scope data reports");
+    if ((st = region_check_range (dev, region, offset, length)) != MICROTOUCH3M_STATUS_OK)
         return st;
-    }
 
-    microtouch3m_log ("scope mode enabled");
-
-    while (continue_loop) {
-        /* Note: we want 35 bytes, but we can only read 32 max at the same time... */
-        struct report_scope_s report = { 0 };
-        int                   transferred = 0;
-        int32_t               ul_i, ul_q;
-        int32_t               ur_i, ur_q;
-        int32_t               ll_i, ll_q;
-        int32_t               lr_i, lr_q;
+    if (!length)
+        return MICROTOUCH3M_STATUS_OK;
 
-        assert (sizeof (report) > MAX_INTERRUPT_ENDPOINT_TRANSFER);
-        if (libusb_interrupt_transfer (dev->usbhandle,
-                                       (LIBUSB_ENDPOINT_IN | 1),
-                                       (uint8_t *) &report,
-                                       MAX_INTERRUPT_ENDPOINT_TRANSFER,
-                                       &transferred,
-                                       5000) != 0) {
-            goto report_error;
-        }
-        if (transferred != MAX_INTERRUPT_ENDPOINT_TRANSFER) {
-            if (!first_found) {
-                first_found = true;
-                continue;
-            }
-            goto report_error;
+    cache = &dev->region_cache[region];
+    if (!cache->data) {
+        cache->data  = malloc (region_info[region].size);
+        cache->valid = calloc (region_info[region].size / REGION_PAGE_SIZE, 1);
+        if (!cache->data || !cache->valid) {
+            microtouch3m_log_error ("error: couldn't allocate %s region cache", region_info[region].name);
+            free (cache->data);
+            free (cache->valid);
+            cache->data  = NULL;
+            cache->valid = NULL;
+            return MICROTOUCH3M_STATUS_FAILED;
         }
-        microtouch3m_log_buffer ("async report received", (uint8_t *) &report, transferred);
+    }
 
-        if (libusb_interrupt_transfer (dev->usbhandle,
-                                       (LIBUSB_ENDPOINT_IN | 1),
-                                       &(((uint8_t *) &report)[MAX_INTERRUPT_ENDPOINT_TRANSFER]),
-                                       sizeof (report) - MAX_INTERRUPT_ENDPOINT_TRANSFER,
-                                       &transferred,
-                                       5000) != 0) {
-            goto report_error;
-        }
-        if (transferred != sizeof (report) - MAX_INTERRUPT_ENDPOINT_TRANSFER)
-            goto report_error;
-        microtouch3m_log_buffer ("async report received", &(((uint8_t *) &report)[MAX_INTERRUPT_ENDPOINT_TRANSFER]), transferred);
+    /* Only the pages not already cached are transferred */
+    page_last = (offset + length - 1) / REGION_PAGE_SIZE;
+    for (page = offset / REGION_PAGE_SIZE; page <= page_last; page++) {
+        struct parameter_report_region_page_s parameter_report;
 
-        ul_i = (int32_t) (le32toh (report.ul_i));
-        ul_q = (int32_t) (le32toh (report.ul_q));
+        if (cache->valid[page])
+            continue;
+
+        if ((st = run_parameter_in_request (dev,
+                                            REQUEST_GET_PARAMETER_BLOCK,
+                                            region_info[region].parameter_id,
+                                            page * REGION_PAGE_SIZE,
+                                            (struct parameter_report_s *) &parameter_report,
+                                            sizeof (parameter_report),
+                                            NULL)) != MICROTOUCH3M_STATUS_OK)
+            return st;
+
+        memcpy (&cache->data[page * REGION_PAGE_SIZE], parameter_report.data, REGION_PAGE_SIZE);
+        cache->valid[page] = 1;
+        n_transfers++;
+    }
+
+    memcpy (buffer, &cache->data[offset], length);
+
+    microtouch3m_log ("successfully read %zu bytes at offset 0x%04zx from %s region (%u transfers)",
+                      length, offset, region_info[region].name, n_transfers);
+    return MICROTOUCH3M_STATUS_OK;
+}
+
+microtouch3m_status_t
+microtouch3m_device_write_region (microtouch3m_device_t        *dev,
+                                  microtouch3m_device_region_t  region,
+                                  size_t                        offset,
+                                  const uint8_t                *buffer,
+                                  size_t                        length)
+{
+    microtouch3m_status_t st;
+    size_t                done;
+    size_t                chunk;
+    size_t                page_offset;
+    size_t                page_start;
+    uint8_t               page[REGION_PAGE_SIZE];
+    unsigned int          n_partial = 0;
+
+    assert (dev);
+    assert (buffer || !length);
+
+    if ((st = region_check_range (dev, region, offset, length)) != MICROTOUCH3M_STATUS_OK)
+        return st;
+
+    /* The device is only written whole pages at page-aligned offsets, as the
+     * firmware update does; partially written pages are read first */
+    for (done = 0; done < length; done += chunk) {
+        page_start  = (offset + done) % REGION_PAGE_SIZE;
+        page_offset = offset + done - page_start;
+        chunk = REGION_PAGE_SIZE - page_start;
+        if (chunk > length - done)
+            chunk = length - done;
+
+        if (chunk < REGION_PAGE_SIZE) {
+            if ((st = microtouch3m_device_read_region (dev, region, page_offset, page, REGION_PAGE_SIZE)) != MICROTOUCH3M_STATUS_OK)
+                return st;
+            n_partial++;
+        }
+        memcpy (&page[page_start], &buffer[done], chunk);
+
+        if ((st = run_out_request (dev,
+                                   REQUEST_SET_PARAMETER_BLOCK,
+                                   region_info[region].parameter_id,
+                                   page_offset,
+                                   page,
+                                   REGION_PAGE_SIZE,
+                                   NULL)) != MICROTOUCH3M_STATUS_OK)
+            return st;
+    }
+
+    microtouch3m_log ("successfully written %zu bytes at offset 0x%04zx into %s region (%u partial pages)",
+                      length, offset, region_info[region].name, n_partial);
+    return MICROTOUCH3M_STATUS_OK;
+}
+
+/******************************************************************************/
+/* Device async report operation */
+
+static int
+run_interrupt_in_transfer (microtouch3m_device_t *dev,
+                           uint8_t               *data,
+                           int                    data_size,
+                           int                   *transferred)
+{
+    int      ret;
+    uint64_t start_us;
+
+    start_us = monotonic_time_us ();
+    ret = transport_interrupt_transfer (dev->ctx->transport,
+                                        dev->usbhandle,
+                                        INTERRUPT_ENDPOINT_IN,
+                                        data,
+                                        data_size,
+                                        transferred,
+                                        5000);
+    /* Not a real transfer, nothing to account for */
+    if (ret == TRANSPORT_ERROR_END_OF_DATA)
+        return ret;
+    transfer_done (dev, MICROTOUCH3M_TRACE_TRANSFER_INTERRUPT,
+                   INTERRUPT_ENDPOINT_IN, 0, 0, 0,
+                   data, data_size, (ret != 0) ? ret : *transferred, start_us);
+    return ret;
+}
+
+static void
+report_stats_reset (struct report_stats_s *stats)
+{
+    unsigned int i;
+
+    stats->last_report_us    = 0;
+    stats->n_reports         = 0;
+    stats->n_short_transfers = 0;
+    stats->n_timeouts        = 0;
+    stats->n_errors          = 0;
+    stats->n_intervals       = 0;
+    stats->interval_total_us = 0;
+    stats->interval_min_us   = UINT64_MAX;
+    stats->interval_max_us   = 0;
+    for (i = 0; i < REPORT_STATS_INTERVAL_BUCKETS; i++)
+        stats->interval_histogram[i] = 0;
+    stats->n_callbacks       = 0;
+    stats->callback_total_us = 0;
+    stats->callback_max_us   = 0;
+    stats->window_reports    = 0;
+    stats->window_rate_mhz   = 0;
+    stats->window_start_us   = 0;
+    stats->start_us          = 0;
+}
+
+/* Applies the pending resets, if any; called by the monitoring thread before
+ * updating the counters, so the stats restart from there */
+static void
+report_stats_sync_reset (struct report_stats_s *stats)
+{
+    unsigned int requests;
+
+    requests = stats->reset_requests;
+    if (requests == stats->reset_applied)
+        return;
+
+    report_stats_reset (stats);
+    stats->start_us        = monotonic_time_us ();
+    stats->window_start_us = stats->start_us;
+    stats->reset_applied   = requests;
+}
+
+static void
+report_stats_start (struct report_stats_s *stats)
+{
+    report_stats_sync_reset (stats);
+
+    /* Intervals never span two monitoring runs */
+    stats->last_report_us = 0;
+
+    if (!stats->start_us) {
+        stats->start_us        = monotonic_time_us ();
+        stats->window_start_us = stats->start_us;
+    }
+}
+
+static void
+report_stats_add_report (struct report_stats_s *stats)
+{
+    uint64_t now_us;
+    uint64_t interval_us;
+    uint64_t bucket;
+
+    now_us = monotonic_time_us ();
+
+    if (stats->last_report_us) {
+        interval_us = now_us - stats->last_report_us;
+        bucket = interval_us / REPORT_STATS_INTERVAL_BUCKET_US;
+        if (bucket >= REPORT_STATS_INTERVAL_BUCKETS)
+            bucket = REPORT_STATS_INTERVAL_BUCKETS - 1;
+        __sync_fetch_and_add (&stats->interval_histogram[bucket], 1);
+        __sync_fetch_and_add (&stats->interval_total_us, interval_us);
+        __sync_fetch_and_add (&stats->n_intervals, 1);
+        /* Single writer, no need to loop */
+        if (interval_us < stats->interval_min_us)
+            stats->interval_min_us = interval_us;
+        if (interval_us > stats->interval_max_us)
+            stats->interval_max_us = interval_us;
+    }
+    stats->last_report_us = now_us;
+    __sync_fetch_and_add (&stats->n_reports, 1);
+
+    stats->window_reports++;
+    if (now_us - stats->window_start_us >= REPORT_STATS_RATE_WINDOW_US) {
+        stats->window_rate_mhz = (stats->window_reports * 1000000000ULL) / (now_us - stats->window_start_us);
+        stats->window_start_us = now_us;
+        stats->window_reports  = 0;
+    }
+}
+
+/* Rate during the last window, as of now. The reports of the current window
+ * are taken as spread until the last one, and the part of the last window
+ * before the current one started is filled with the rate of the previous
+ * one. Computed on read, so that a stalled stream decays to 0. */
+static float
+report_stats_get_rate (const struct report_stats_s *stats,
+                       uint64_t                     now_us)
+{
+    uint64_t last_report_us;
+    uint64_t window_start_us;
+    uint64_t window_rate_mhz;
+    uint64_t cut_us;
+    double   n_reports;
+
+    last_report_us = stats->last_report_us;
+    if (!last_report_us || last_report_us > now_us || now_us - last_report_us >= REPORT_STATS_RATE_WINDOW_US)
+        return 0.0f;
+
+    window_start_us = stats->window_start_us;
+    window_rate_mhz = stats->window_rate_mhz;
+    n_reports       = (double) stats->window_reports;
+
+    /* Until the first window is complete, use the average since start */
+    if (!window_rate_mhz)
+        return (now_us > window_start_us) ? (float) (n_reports * 1000000.0 / (double) (now_us - window_start_us)) : 0.0f;
+
+    cut_us = now_us - REPORT_STATS_RATE_WINDOW_US;
+    if (cut_us > window_start_us && last_report_us > window_start_us)
+        n_reports *= (double) (last_report_us - cut_us) / (double) (last_report_us - window_start_us);
+    else if (cut_us < window_start_us)
+        n_reports += (double) window_rate_mhz * (double) (window_start_us - cut_us) / 1000000000.0;
+
+    return (float) (n_reports * 1000000.0 / (double) REPORT_STATS_RATE_WINDOW_US);
+}
+
+static void
+report_stats_add_transfer_error (struct report_stats_s *stats,
+                                 int                    ret)
+{
+    if (ret == LIBUSB_ERROR_TIMEOUT)
+        __sync_fetch_and_add (&stats->n_timeouts, 1);
+    else
+        __sync_fetch_and_add (&stats->n_errors, 1);
+}
+
+static bool
+run_report_callback (microtouch3m_device_t                    *dev,
+                     microtouch3m_device_async_report_scope_f *callback,
+                     microtouch3m_status_t                     status,
+                     int32_t                                   ul_i,
+                     int32_t                                   ul_q,
+                     int32_t                                   ur_i,
+                     int32_t                                   ur_q,
+                     int32_t                                   ll_i,
+                     int32_t                                   ll_q,
+                     int32_t                                   lr_i,
+                     int32_t                                   lr_q,
+                     void                                     *user_data)
+{
+    bool     ret;
+    uint64_t start_us;
+    uint64_t elapsed_us;
+
+    start_us = monotonic_time_us ();
+    ret = callback (dev, status, ul_i, ul_q, ur_i, ur_q, ll_i, ll_q, lr_i, lr_q, user_data);
+    elapsed_us = monotonic_time_us () - start_us;
+
+    __sync_fetch_and_add (&dev->report_stats.callback_total_us, elapsed_us);
+    __sync_fetch_and_add (&dev->report_stats.n_callbacks, 1);
+    if (elapsed_us > dev->report_stats.callback_max_us)
+        dev->report_stats.callback_max_us = elapsed_us;
+    return ret;
+}
+
+void
+microtouch3m_device_reset_async_report_stats (microtouch3m_device_t *dev)
+{
+    assert (dev);
+
+    /* Applied by the monitoring thread, see report_stats_sync_reset() */
+    __sync_fetch_and_add (&dev->report_stats.reset_requests, 1);
+}
+
+void
+microtouch3m_device_get_async_report_stats (microtouch3m_device_t                    *dev,
+                                            microtouch3m_device_async_report_stats_t *stats)
+{
+    const struct report_stats_s *rs;
+    uint64_t                     now_us;
+    uint64_t                     n_intervals;
+    uint64_t                     n_callbacks;
+    uint64_t                     threshold;
+    uint64_t                     accumulated;
+    unsigned int                 i;
+
+    assert (dev);
+    assert (stats);
+
+    rs = &dev->report_stats;
+    memset (stats, 0, sizeof (microtouch3m_device_async_report_stats_t));
+
+    /* Nothing since the last reset, even if not applied yet */
+    if (!rs->start_us || rs->reset_requests != rs->reset_applied)
+        return;
+
+    now_us = monotonic_time_us ();
+    stats->elapsed_us        = now_us - rs->start_us;
+    stats->n_reports         = rs->n_reports;
+    stats->n_short_transfers = rs->n_short_transfers;
+    stats->n_timeouts        = rs->n_timeouts;
+    stats->n_errors          = rs->n_errors;
+
+    stats->report_rate       = report_stats_get_rate (rs, now_us);
+
+    n_intervals = rs->n_intervals;
+    if (n_intervals) {
+        stats->interval_min_us  = (rs->interval_min_us == UINT64_MAX) ? 0 : rs->interval_min_us;
+        stats->interval_max_us  = rs->interval_max_us;
+        stats->interval_mean_us = rs->interval_total_us / n_intervals;
+
+        /* The p99 is the upper limit of the bucket where the 99% of the
+         * intervals is reached; in the overflow bucket, use the maximum */
+        threshold = n_intervals - (n_intervals / 100);
+        accumulated = 0;
+        for (i = 0; i < REPORT_STATS_INTERVAL_BUCKETS; i++) {
+            accumulated += rs->interval_histogram[i];
+            if (accumulated >= threshold)
+                break;
+        }
+        if (i < (REPORT_STATS_INTERVAL_BUCKETS - 1))
+            stats->interval_p99_us = (i + 1) * REPORT_STATS_INTERVAL_BUCKET_US;
+        else
+            stats->interval_p99_us = stats->interval_max_us;
+        if (stats->interval_p99_us > stats->interval_max_us)
+            stats->interval_p99_us = stats->interval_max_us;
+    }
+
+    n_callbacks = rs->n_callbacks;
+    if (n_callbacks) {
+        stats->callback_mean_us = rs->callback_total_us / n_callbacks;
+        stats->callback_max_us  = rs->callback_max_us;
+    }
+}
+
+microtouch3m_status_t
+microtouch3m_device_monitor_async_reports (microtouch3m_device_t                    *dev,
+                                           microtouch3m_device_async_report_scope_f *callback,
+                                           void                                     *user_data)
+{
+    microtouch3m_status_t st;
+    bool                  continue_loop = true;
+    bool                  first_found = false;
+
+    if (transport_kernel_driver_active (dev->ctx->transport, dev->usbhandle, 0)) {
+        microtouch3m_log ("kernel driver is active...");
+        if (transport_detach_kernel_driver (dev->ctx->transport, dev->usbhandle, 0) == 0)
+            microtouch3m_log ("kernel driver now detached");
+    }
+
+    if (transport_claim_interface (dev->ctx->transport, dev->usbhandle, 0) < 0) {
+        microtouch3m_log ("couldn't claim USB interface");
+        return MICROTOUCH3M_STATUS_FAILED;
+    }
+
+    microtouch3m_log ("disable coordinate data reports...");
+    if ((st = run_out_request (dev,
+                               REQUEST_ASYNC_SET_REPORT,
+                               ASYNC_SET_REPORT_DISABLE,
+                               REPORT_ID_COORDINATE_DATA,
+                               NULL,
+                               0,
+                               NULL)) != MICROTOUCH3M_STATUS_OK) {
+        microtouch3m_log_error ("error: couldn't disable coordinate data reports");
+        return st;
+    }
+
+    microtouch3m_log ("disable scope data reports...");
+    if ((st = run_out_request (dev,
+                               REQUEST_ASYNC_SET_REPORT,
+                               ASYNC_SET_REPORT_DISABLE,
+                               REPORT_ID_SCOPE_DATA,
+                               NULL,
+                               0,
+                               NULL)) != MICROTOUCH3M_STATUS_OK) {
+        microtouch3m_log_error ("error: couldn't disable scope data reports");
+        return st;
+    }
+
+    microtouch3m_log ("reading current status...");
+    {
+        struct extended_status_report_s status;
+
+        if ((st = device_get_status_extended (dev, &status)) != MICROTOUCH3M_STATUS_OK)
+            return st;
+
+        /* NOTE: we probably want to do something here, like check that all reports are
+         * disabled */
+    }
+
+    microtouch3m_log ("enable scope data reports...");
+    if ((st = run_out_request (dev,
+                               REQUEST_ASYNC_SET_REPORT,
+                               ASYNC_SET_REPORT_ENABLE,
+                               REPORT_ID_SCOPE_DATA,
+                               NULL,
+                               0,
+                               NULL)) != MICROTOUCH3M_STATUS_OK) {
+        microtouch3m_log_error ("error: couldn't enable scope data reports");
+        return st;
+    }
+
+    microtouch3m_log ("scope mode enabled");
+
+    report_stats_start (&dev->report_stats);
+
+    while (continue_loop) {
+        /* Note: we want 35 bytes, but we can only read 32 max at the same time... */
+        struct report_scope_s report = { 0 };
+        int                   transferred = 0;
+        int                   ret;
+        int32_t               ul_i, ul_q;
+        int32_t               ur_i, ur_q;
+        int32_t               ll_i, ll_q;
+        int32_t               lr_i, lr_q;
+
+        report_stats_sync_reset (&dev->report_stats);
+
+        assert (sizeof (report) > MAX_INTERRUPT_ENDPOINT_TRANSFER);
+        if ((ret = run_interrupt_in_transfer (dev,
+                                              (uint8_t *) &report,
+                                              MAX_INTERRUPT_ENDPOINT_TRANSFER,
+                                              &transferred)) != 0) {
+            /* A replayed recording is over: not an error, just stop */
+            if (ret == TRANSPORT_ERROR_END_OF_DATA) {
+                microtouch3m_log ("no more async reports to replay");
+                st = MICROTOUCH3M_STATUS_END_OF_DATA;
+                break;
+            }
+            report_stats_add_transfer_error (&dev->report_stats, ret);
+            goto report_error;
+        }
+        if (transferred != MAX_INTERRUPT_ENDPOINT_TRANSFER) {
+            __sync_fetch_and_add (&dev->report_stats.n_short_transfers, 1);
+            if (!first_found) {
+                first_found = true;
+                continue;
+            }
+            goto report_error;
+        }
+        microtouch3m_log_buffer ("async report received", (uint8_t *) &report, transferred);
+
+        if ((ret = run_interrupt_in_transfer (dev,
+                                              &(((uint8_t *) &report)[MAX_INTERRUPT_ENDPOINT_TRANSFER]),
+                                              sizeof (report) - MAX_INTERRUPT_ENDPOINT_TRANSFER,
+                                              &transferred)) != 0) {
+            report_stats_add_transfer_error (&dev->report_stats, ret);
+            goto report_error;
+        }
+        if (transferred != sizeof (report) - MAX_INTERRUPT_ENDPOINT_TRANSFER) {
+            __sync_fetch_and_add (&dev->report_stats.n_short_transfers, 1);
+            goto report_error;
+        }
+        microtouch3m_log_buffer ("async report received", &(((uint8_t *) &report)[MAX_INTERRUPT_ENDPOINT_TRANSFER]), transferred);
+
+        ul_i = (int32_t) (le32toh (report.ul_i));
+        ul_q = (int32_t) (le32toh (report.ul_q));
         ur_i = (int32_t) (le32toh (report.ur_i));
         ur_q = (int32_t) (le32toh (report.ur_q));
         ll_i = (int32_t) (le32toh (report.ll_i));
@@ -2041,20 +2812,41 @@ microtouch3m_device_monitor_async_reports (microtouch3m_device_t
         microtouch3m_log ("LR(Q): %d", lr_q);
 #endif
 
-        continue_loop = callback (dev,
-                                  MICROTOUCH3M_STATUS_OK,
-                                  ul_i, ul_q,
-                                  ur_i, ur_q,
-                                  ll_i, ll_q,
-                                  lr_i, lr_q,
-                                  user_data);
+        if (dev->recording) {
+            int32_t values[8];
+
+            values[0] = ul_i; values[1] = ul_q;
+            values[2] = ur_i; values[3] = ur_q;
+            values[4] = ll_i; values[5] = ll_q;
+            values[6] = lr_i; values[7] = lr_q;
+            recording_add (dev->recording, MICROTOUCH3M_SCOPE_RECORD_REPORT, monotonic_time_us (), values);
+        }
+
+        report_stats_add_report (&dev->report_stats);
+
+        continue_loop = run_report_callback (dev,
+                                             callback,
+                                             MICROTOUCH3M_STATUS_OK,
+                                             ul_i, ul_q,
+                                             ur_i, ur_q,
+                                             ll_i, ll_q,
+                                             lr_i, lr_q,
+                                             user_data);
         continue;
 
  report_error:
-        continue_loop = callback (dev,
-                                  MICROTOUCH3M_STATUS_FAILED,
-                                  0, 0, 0, 0, 0, 0, 0, 0,
-                                  user_data);
+        continue_loop = run_report_callback (dev,
+                                             callback,
+                                             MICROTOUCH3M_STATUS_FAILED,
+                                             0, 0, 0, 0, 0, 0, 0, 0,
+                                             user_data);
+
+        /* No point in waiting for more reports if the device is gone */
+        if (ret == LIBUSB_ERROR_NO_DEVICE) {
+            microtouch3m_log_error ("error: device is gone");
+            st = MICROTOUCH3M_STATUS_INVALID_IO;
+            break;
+        }
     }
 
     microtouch3m_log ("operation finished");
@@ -2067,12 +2859,45 @@ microtouch3m_device_monitor_async_reports (microtouch3m_device_t
                      0,
                      NULL);
 
-    libusb_release_interface (dev->usbhandle, 0);
+    transport_release_interface (dev->ctx->transport, dev->usbhandle, 0);
 
     microtouch3m_log ("scope mode disabled");
+    return st;
+}
+
+/******************************************************************************/
+/* Scope recordings */
+
+microtouch3m_status_t
+microtouch3m_device_scope_recording_start (microtouch3m_device_t *dev,
+                                           const char            *path)
+{
+    assert (dev);
+    assert (path);
+
+    if (dev->recording) {
+        microtouch3m_log_error ("error: scope recording already started");
+        return MICROTOUCH3M_STATUS_INVALID_STATE;
+    }
+
+    if (!(dev->recording = recording_new (path)))
+        return MICROTOUCH3M_STATUS_FAILED;
+
     return MICROTOUCH3M_STATUS_OK;
 }
 
+void
+microtouch3m_device_scope_recording_stop (microtouch3m_device_t *dev)
+{
+    assert (dev);
+
+    if (!dev->recording)
+        return;
+
+    recording_free (dev->recording);
+    dev->recording = NULL;
+}
+
 /******************************************************************************/
 /* Firmware common */
 
@@ -2087,23 +2912,90 @@ microtouch3m_device_firmware_progress_register (microtouch3m_device_t
     dev->progress_user_data = user_data;
 }
 
+void
+microtouch3m_device_firmware_progress_full_register (microtouch3m_device_t                        *dev,
+                                                     microtouch3m_device_firmware_progress_full_f *callback,
+                                                     float                                         freq,
+                                                     void                                         *user_data)
+{
+    dev->progress_full_callback  = callback;
+    dev->progress_full_freq      = freq;
+    dev->progress_full_user_data = user_data;
+}
+
+struct firmware_progress_s {
+    uint64_t                                     start_us;
+    uint64_t                                     last_full_report_us;
+    size_t                                       last_full_report_bytes;
+    float                                        last_progress;
+    float                                        last_full_progress;
+    microtouch3m_device_firmware_progress_info_t info;
+};
+
 static void
-report_progress (microtouch3m_device_t *dev,
-                 int                    current_step,
-                 int                    total_steps,
-                 float                 *progress)
+firmware_progress_init (struct firmware_progress_s *fp,
+                        size_t                      bytes_total)
 {
-    float new_progress;
+    memset (fp, 0, sizeof (struct firmware_progress_s));
+    fp->start_us            = monotonic_time_us ();
+    fp->last_full_report_us = fp->start_us;
+    fp->info.bytes_total    = bytes_total;
+}
 
-    if (!dev->progress_callback)
-        return;
+static void
+report_progress (microtouch3m_device_t      *dev,
+                 struct firmware_progress_s *fp)
+{
+    bool     last;
+    uint64_t now_us;
+
+    /* The last report is always given */
+    last = (fp->info.bytes_transferred == fp->info.bytes_total);
 
-    new_progress = 100.0 * (((float) current_step) / ((float) total_steps));
-    if (!progress || (new_progress > (*progress + dev->progress_freq))) {
-        dev->progress_callback (dev, new_progress, dev->progress_user_data);
-        if (progress)
-            *progress = new_progress;
+    fp->info.progress = 100.0 * (((float) fp->info.bytes_transferred) / ((float) fp->info.bytes_total));
+
+    if (dev->progress_callback && (last || (fp->info.progress > (fp->last_progress + dev->progress_freq)))) {
+        dev->progress_callback (dev, fp->info.progress, dev->progress_user_data);
+        fp->last_progress = fp->info.progress;
     }
+
+    if (!dev->progress_full_callback || !(last || (fp->info.progress > (fp->last_full_progress + dev->progress_full_freq))))
+        return;
+
+    now_us = monotonic_time_us ();
+    fp->info.elapsed_us = now_us - fp->start_us;
+    if (now_us > fp->last_full_report_us)
+        fp->info.throughput = ((float) (fp->info.bytes_transferred - fp->last_full_report_bytes) * 1000000.0) / (float) (now_us - fp->last_full_report_us);
+    if (fp->info.elapsed_us > 0)
+        fp->info.average_throughput = ((float) fp->info.bytes_transferred * 1000000.0) / (float) fp->info.elapsed_us;
+    if (fp->info.bytes_transferred > 0)
+        fp->info.eta_us = (fp->info.elapsed_us * (fp->info.bytes_total - fp->info.bytes_transferred)) / fp->info.bytes_transferred;
+
+    dev->progress_full_callback (dev, &fp->info, dev->progress_full_user_data);
+    fp->last_full_progress     = fp->info.progress;
+    fp->last_full_report_us    = now_us;
+    fp->last_full_report_bytes = fp->info.bytes_transferred;
+}
+
+static void
+firmware_progress_transfer_done (microtouch3m_device_t      *dev,
+                                 struct firmware_progress_s *fp,
+                                 uint64_t                    transfer_start_us,
+                                 size_t                      transfer_size)
+{
+    uint64_t latency_us;
+
+    latency_us = monotonic_time_us () - transfer_start_us;
+    fp->info.latency_histogram[latency_bucket (latency_us, MICROTOUCH3M_FW_PROGRESS_LATENCY_BUCKETS)]++;
+
+    if (!fp->info.n_transfers || latency_us < fp->info.latency_min_us)
+        fp->info.latency_min_us = latency_us;
+    if (latency_us > fp->info.latency_max_us)
+        fp->info.latency_max_us = latency_us;
+    fp->info.n_transfers++;
+    fp->info.bytes_transferred += transfer_size;
+
+    report_progress (dev, fp);
 }
 
 /******************************************************************************/
@@ -2121,30 +3013,34 @@ microtouch3m_device_firmware_dump (microtouch3m_device_t *dev,
                                    uint8_t               *buffer,
                                    size_t                 buffer_size)
 {
-    uint16_t     offset;
-    unsigned int i;
-    float        progress = 0.0;
+    uint16_t                   offset;
+    unsigned int               i;
+    struct firmware_progress_s progress;
 
     assert (dev);
     assert (buffer);
 
     if (buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
-        microtouch3m_log ("error: not enough space in buffer to contain the full firmware image file (%zu < %zu)",
-                          buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
+        microtouch3m_log_error ("error: not enough space in buffer to contain the full firmware image file (%zu < %zu)",
+                                buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
         return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
 
     if (!dev->usbhandle) {
-        microtouch3m_log ("error: device not open");
+        microtouch3m_log_error ("error: device not open");
         return MICROTOUCH3M_STATUS_INVALID_STATE;
     }
 
     microtouch3m_log ("reading firmware from controller EEPROM...");
 
+    firmware_progress_init (&progress, MICROTOUCH3M_FW_IMAGE_SIZE);
+
     for (i = 0, offset = 0; offset < MICROTOUCH3M_FW_IMAGE_SIZE; offset += PARAMETER_REPORT_FIRMWARE_DUMP_DATA_SIZE, i++) {
         struct parameter_report_firmware_dump_s parameter_report;
         microtouch3m_status_t                   st;
+        uint64_t                                transfer_start_us;
 
+        transfer_start_us = monotonic_time_us ();
         if ((st = run_parameter_in_request (dev,
                                             REQUEST_GET_PARAMETER_BLOCK,
                                             PARAMETER_ID_CONTROLLER_EEPROM,
@@ -2155,12 +3051,9 @@ microtouch3m_device_firmware_dump (microtouch3m_device_t *dev,
             return st;
 
         memcpy (&buffer[offset], parameter_report.data, PARAMETER_REPORT_FIRMWARE_DUMP_DATA_SIZE);
-        report_progress (dev, offset, MICROTOUCH3M_FW_IMAGE_SIZE, &progress);
+        firmware_progress_transfer_done (dev, &progress, transfer_start_us, PARAMETER_REPORT_FIRMWARE_DUMP_DATA_SIZE);
     }
 
-    if (progress < 100.0)
-        report_progress (dev, MICROTOUCH3M_FW_IMAGE_SIZE, MICROTOUCH3M_FW_IMAGE_SIZE, NULL);
-
     /* Success! */
     microtouch3m_log ("successfully read firmware from controller EEPROM");
     return MICROTOUCH3M_STATUS_OK;
@@ -2302,29 +3195,33 @@ microtouch3m_device_firmware_update (microtouch3m_device_t *dev,
                                      const uint8_t         *buffer,
                                      size_t                 buffer_size)
 {
-    uint16_t     offset;
-    unsigned int i;
-    float        progress = 0.0;
+    uint16_t                   offset;
+    unsigned int               i;
+    struct firmware_progress_s progress;
 
     assert (dev);
     assert (buffer);
 
     if (buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
-        microtouch3m_log ("error: not enough space in buffer to contain the full firmware image file (%zu < %zu)",
-                          buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
+        microtouch3m_log_error ("error: not enough space in buffer to contain the full firmware image file (%zu < %zu)",
+                                buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
         return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
     }
 
     if (!dev->usbhandle) {
-        microtouch3m_log ("error: device not open");
+        microtouch3m_log_error ("error: device not open");
         return MICROTOUCH3M_STATUS_INVALID_STATE;
     }
 
     microtouch3m_log ("updating firmware in controller EEPROM...");
 
+    firmware_progress_init (&progress, MICROTOUCH3M_FW_IMAGE_SIZE);
+
     for (i = 0, offset = 0; offset < MICROTOUCH3M_FW_IMAGE_SIZE; offset += FIRMWARE_UPDATE_DATA_SIZE, i++) {
         microtouch3m_status_t st;
+        uint64_t              transfer_start_us;
 
+        transfer_start_us = monotonic_time_us ();
         if ((st = run_out_request (dev,
                                    REQUEST_SET_PARAMETER_BLOCK,
                                    PARAMETER_ID_CONTROLLER_EEPROM,
@@ -2334,12 +3231,9 @@ microtouch3m_device_firmware_update (microtouch3m_device_t *dev,
                                    NULL)) != MICROTOUCH3M_STATUS_OK)
             return st;
 
-        report_progress (dev, offset, MICROTOUCH3M_FW_IMAGE_SIZE, &progress);
+        firmware_progress_transfer_done (dev, &progress, transfer_start_us, FIRMWARE_UPDATE_DATA_SIZE);
     }
 
-    if (progress < 100.0)
-        report_progress (dev, MICROTOUCH3M_FW_IMAGE_SIZE, MICROTOUCH3M_FW_IMAGE_SIZE, NULL);
-
     /* Success! */
     microtouch3m_log ("successfully written firmware to controller EEPROM");
     return MICROTOUCH3M_STATUS_OK;
@@ -2369,67 +3263,216 @@ ihex_error_to_status (int ihex_error)
     }
 }
 
-microtouch3m_status_t
-microtouch3m_firmware_file_write (const char    *path,
-                                  const uint8_t *buffer,
-                                  size_t         buffer_size)
+/* Each Intel HEX record is rendered as ':', count (2), address (4), type (2),
+ * data (2 per byte), checksum (2) and the "\r\n" line terminator */
+#define IHEX_RECORD_TEXT_SIZE(data_len) (1 + 2 + 4 + 2 + (2 * (data_len)) + 2 + 2)
+
+#define SEGMENT_RECORD_DATA_SIZE 2
+#define FIRMWARE_FILE_TEXT_SIZE                                         \
+    (IHEX_RECORD_TEXT_SIZE (SEGMENT_RECORD_DATA_SIZE) +                 \
+     ((EXPECTED_N_DATA_RECORDS) * IHEX_RECORD_TEXT_SIZE (RECORD_DATA_SIZE)) + \
+     IHEX_RECORD_TEXT_SIZE (0))
+
+static const char hex_digits[16] = {
+    '0', '1', '2', '3', '4', '5', '6', '7',
+    '8', '9', 'A', 'B', 'C', 'D', 'E', 'F'
+};
+
+static char *
+ihex_render_byte (char    *out,
+                  uint8_t  byte)
 {
-    microtouch3m_status_t  status = MICROTOUCH3M_STATUS_FAILED;
-    FILE                  *f = NULL;
-    uint16_t               offset;
-    IHexRecord             record;
-    int                    ihex_ret;
-    static const uint8_t   segment_record_data[2] = { 0 };
+    out[0] = hex_digits[byte >> 4];
+    out[1] = hex_digits[byte & 0x0F];
+    return out + 2;
+}
 
-    assert (path);
-    assert (buffer);
+static char *
+ihex_render_record (char          *out,
+                    uint8_t        type,
+                    uint16_t       address,
+                    const uint8_t *data,
+                    uint8_t        data_len)
+{
+    uint8_t i;
+    uint8_t checksum;
+
+    checksum = data_len + type + (uint8_t) (address >> 8) + (uint8_t) (address & 0xFF);
+
+    *out++ = ':';
+    out = ihex_render_byte (out, data_len);
+    out = ihex_render_byte (out, (uint8_t) (address >> 8));
+    out = ihex_render_byte (out, (uint8_t) (address & 0xFF));
+    out = ihex_render_byte (out, type);
+    for (i = 0; i < data_len; i++) {
+        out = ihex_render_byte (out, data[i]);
+        checksum += data[i];
+    }
+    /* Two's complement on checksum */
+    out = ihex_render_byte (out, (uint8_t) (~checksum + 1));
+    *out++ = '\r';
+    *out++ = '\n';
+    return out;
+}
 
-    if (buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
-        microtouch3m_log ("error: not enough space in buffer to contain the full firmware image file (%zu < %zu)", buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
-        status = MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
-        goto out;
+static microtouch3m_status_t
+write_fd_contents (int         fd,
+                   const char *contents,
+                   size_t      contents_size)
+{
+    size_t written = 0;
+
+    /* A single write() is expected for regular files, but partial writes
+     * and signal interruptions must still be handled */
+    while (written < contents_size) {
+        ssize_t n;
+
+        n = write (fd, &contents[written], contents_size - written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            microtouch3m_log_error ("error: couldn't write to output file: %s", strerror (errno));
+            return MICROTOUCH3M_STATUS_INVALID_IO;
+        }
+        written += n;
     }
 
-    f = fopen (path, "w");
-    if (!f) {
-        microtouch3m_log ("error: opening firmware file failed: %s", strerror (errno));
+    return MICROTOUCH3M_STATUS_OK;
+}
+
+static microtouch3m_status_t
+write_file (const char   *path,
+            const void   *contents,
+            size_t        contents_size,
+            unsigned int  flags)
+{
+    microtouch3m_status_t  status = MICROTOUCH3M_STATUS_FAILED;
+    char                  *tmp_path = NULL;
+    int                    fd = -1;
+    struct stat            st;
+    mode_t                 mode;
+
+    if (flags & MICROTOUCH3M_FIRMWARE_FILE_WRITE_FLAG_ATOMIC) {
+        /* Keep the permissions of the file being replaced, if any */
+        if (stat (path, &st) == 0)
+            mode = st.st_mode & 07777;
+        else
+            mode = S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH;
+
+        if (asprintf (&tmp_path, "%s.XXXXXX", path) == -1) {
+            tmp_path = NULL;
+            status = MICROTOUCH3M_STATUS_NO_MEMORY;
+            goto out;
+        }
+        fd = mkstemp (tmp_path);
+        if (fd < 0) {
+            free (tmp_path);
+            tmp_path = NULL;
+        }
+        /* mkstemp() creates files only accessible by the owner */
+        else if (fchmod (fd, mode) < 0) {
+            microtouch3m_log_error ("error: couldn't set temporary firmware file permissions: %s", strerror (errno));
+            status = MICROTOUCH3M_STATUS_FAILED;
+            goto out;
+        }
+    } else
+        fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+    if (fd < 0) {
+        microtouch3m_log_error ("error: opening firmware file failed: %s", strerror (errno));
         status = MICROTOUCH3M_STATUS_FAILED;
         goto out;
     }
 
-    /* Write initial segment record */
-    if (((ihex_ret = New_IHexRecord (IHEX_TYPE_02, 0x0000, segment_record_data, sizeof (segment_record_data), &record)) != IHEX_OK) ||
-        ((ihex_ret = Write_IHexRecord (&record, f)) != IHEX_OK)) {
-        status = ihex_error_to_status (ihex_ret);
+    if ((status = write_fd_contents (fd, contents, contents_size)) != MICROTOUCH3M_STATUS_OK)
         goto out;
-    }
 
-    /* Write all data records */
-    for (offset = 0; offset < MICROTOUCH3M_FW_IMAGE_SIZE; offset += RECORD_DATA_SIZE) {
-        if (((ihex_ret = New_IHexRecord (IHEX_TYPE_00, offset, &buffer[offset], RECORD_DATA_SIZE, &record)) != IHEX_OK) ||
-            ((ihex_ret = Write_IHexRecord (&record, f)) != IHEX_OK)) {
-            status = ihex_error_to_status (ihex_ret);
+    if (tmp_path) {
+        if (fsync (fd) < 0) {
+            microtouch3m_log_error ("error: couldn't sync temporary firmware file: %s", strerror (errno));
+            status = MICROTOUCH3M_STATUS_INVALID_IO;
+            goto out;
+        }
+        close (fd);
+        fd = -1;
+
+        if (rename (tmp_path, path) < 0) {
+            microtouch3m_log_error ("error: couldn't rename temporary firmware file: %s", strerror (errno));
+            status = MICROTOUCH3M_STATUS_FAILED;
             goto out;
         }
+        free (tmp_path);
+        tmp_path = NULL;
+    }
+
+    status = MICROTOUCH3M_STATUS_OK;
+
+out:
+
+    if (!(fd < 0))
+        close (fd);
+
+    /* Only set if the atomic write didn't complete */
+    if (tmp_path) {
+        unlink (tmp_path);
+        free (tmp_path);
+    }
+
+    return status;
+}
+
+microtouch3m_status_t
+microtouch3m_firmware_file_write_full (const char    *path,
+                                       const uint8_t *buffer,
+                                       size_t         buffer_size,
+                                       unsigned int   flags)
+{
+    microtouch3m_status_t  status = MICROTOUCH3M_STATUS_FAILED;
+    char                  *contents = NULL;
+    char                  *out;
+    uint16_t               offset;
+    static const uint8_t   segment_record_data[SEGMENT_RECORD_DATA_SIZE] = { 0 };
+
+    assert (path);
+    assert (buffer);
+
+    if (buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
+        microtouch3m_log_error ("error: not enough space in buffer to contain the full firmware image file (%zu < %zu)", buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
+        status = MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
+        goto out;
     }
 
-    /* Write final end-of-file record */
-    if (((ihex_ret = New_IHexRecord (IHEX_TYPE_01, 0x0000, NULL, 0, &record)) != IHEX_OK) ||
-        ((ihex_ret = Write_IHexRecord (&record, f)) != IHEX_OK)) {
-        status = ihex_error_to_status (ihex_ret);
+    contents = malloc (FIRMWARE_FILE_TEXT_SIZE);
+    if (!contents) {
+        status = MICROTOUCH3M_STATUS_NO_MEMORY;
         goto out;
     }
 
-    status = MICROTOUCH3M_STATUS_OK;
+    /* Render initial segment record, all data records and the final
+     * end-of-file record */
+    out = ihex_render_record (contents, IHEX_TYPE_02, 0x0000, segment_record_data, sizeof (segment_record_data));
+    for (offset = 0; offset < MICROTOUCH3M_FW_IMAGE_SIZE; offset += RECORD_DATA_SIZE)
+        out = ihex_render_record (out, IHEX_TYPE_00, offset, &buffer[offset], RECORD_DATA_SIZE);
+    out = ihex_render_record (out, IHEX_TYPE_01, 0x0000, NULL, 0);
+    assert (out - contents == FIRMWARE_FILE_TEXT_SIZE);
+
+    status = write_file (path, contents, FIRMWARE_FILE_TEXT_SIZE, flags);
 
 out:
 
-    if (f)
-        fclose (f);
+    free (contents);
 
     return status;
 }
 
+microtouch3m_status_t
+microtouch3m_firmware_file_write (const char    *path,
+                                  const uint8_t *buffer,
+                                  size_t         buffer_size)
+{
+    return microtouch3m_firmware_file_write_full (path, buffer, buffer_size, MICROTOUCH3M_FIRMWARE_FILE_WRITE_FLAG_NONE);
+}
+
 microtouch3m_status_t
 microtouch3m_firmware_file_read (const char *path,
                                  uint8_t    *buffer,
@@ -2447,14 +3490,14 @@ microtouch3m_firmware_file_read (const char *path,
     /* Note: if buffer not given, we just validate file */
 
     if (buffer && buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
-        microtouch3m_log ("error: not enough space in buffer to store the full firmware image file (%zu < %zu)", buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
+        microtouch3m_log_error ("error: not enough space in buffer to store the full firmware image file (%zu < %zu)", buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
         status = MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
         goto out;
     }
 
     f = fopen (path, "r");
     if (!f) {
-        microtouch3m_log ("error: opening firmware file failed: %s", strerror (errno));
+        microtouch3m_log_error ("error: opening firmware file failed: %s", strerror (errno));
         status = MICROTOUCH3M_STATUS_FAILED;
         goto out;
     }
@@ -2468,7 +3511,7 @@ microtouch3m_firmware_file_read (const char *path,
             if (ihex_ret == IHEX_ERROR_EOF) {
                 /* Did we not receive the last record? */
                 if (!exii_last_found) {
-                    microtouch3m_log ("error: last record missing");
+                    microtouch3m_log_error ("error: last record missing");
                     status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
                     goto out;
                 }
@@ -2488,14 +3531,14 @@ microtouch3m_firmware_file_read (const char *path,
         if (!exii_first_found) {
             /* It must be a extended segment address record */
             if (record.type != IHEX_TYPE_02) {
-                microtouch3m_log ("error: unexpected record type found (0x%x) when expecting the first record (0x%x)", record.type, IHEX_TYPE_02);
+                microtouch3m_log_error ("error: unexpected record type found (0x%x) when expecting the first record (0x%x)", record.type, IHEX_TYPE_02);
                 status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
                 goto out;
             }
 
             /* The first record should report record address 0 */
             if (record.address != 0) {
-                microtouch3m_log ("error: unexpected record address (0x%04x) when expecting the first record", record.address);
+                microtouch3m_log_error ("error: unexpected record address (0x%04x) when expecting the first record", record.address);
                 status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
                 goto out;
             }
@@ -2512,21 +3555,21 @@ microtouch3m_firmware_file_read (const char *path,
 
         /* No data records should happen after the last record reported */
         if (exii_last_found) {
-            microtouch3m_log ("error: additional record found after the last one");
+            microtouch3m_log_error ("error: additional record found after the last one");
             status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
             goto out;
         }
 
         /* Make sure we don't read more bytes than the expected ones */
         if (record.dataLen + bytes_read > MICROTOUCH3M_FW_IMAGE_SIZE) {
-            microtouch3m_log ("error: too many bytes read (%zu > %zu)", (record.dataLen + bytes_read), MICROTOUCH3M_FW_IMAGE_SIZE);
+            microtouch3m_log_error ("error: too many bytes read (%zu > %zu)", (record.dataLen + bytes_read), MICROTOUCH3M_FW_IMAGE_SIZE);
             status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
             goto out;
         }
 
         /* Records in a EXII firmware file have 16 bytes max */
         if (record.dataLen != 16) {
-            microtouch3m_log ("error: unexpected number of bytes in record (%zu != 16)", record.dataLen);
+            microtouch3m_log_error ("error: unexpected number of bytes in record (%d != 16)", record.dataLen);
             status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
             goto out;
         }
@@ -2544,7 +3587,7 @@ microtouch3m_firmware_file_read (const char *path,
     /* Firmware files are fixed size, so if the number of bytes per record is
      * also fixed, the number of data records themselves must also be fixed */
     if (n_data_records != EXPECTED_N_DATA_RECORDS) {
-        microtouch3m_log ("error: unexpected number of data records (%zu != %zu)", n_data_records, EXPECTED_N_DATA_RECORDS);
+        microtouch3m_log_error ("error: unexpected number of data records (%u != %zu)", n_data_records, (size_t) (EXPECTED_N_DATA_RECORDS));
         status = MICROTOUCH3M_STATUS_INVALID_FORMAT;
         goto out;
     }
@@ -2573,6 +3616,243 @@ out:
     return status;
 }
 
+/******************************************************************************/
+/* Firmware images */
+
+#define FIRMWARE_IMAGE_MAGIC          "M3MFWIMG"
+#define FIRMWARE_IMAGE_FORMAT_VERSION 1
+
+/* All fields in little endian */
+struct firmware_image_header_s {
+    char     magic[8];
+    uint16_t format_version;
+    uint16_t header_size;
+    uint32_t image_size;
+    uint32_t image_checksum;
+    uint16_t controller_type;
+    uint8_t  firmware_major;
+    uint8_t  firmware_minor;
+    uint16_t constants_checksum;
+    uint16_t asic_type;
+    uint32_t pc_checksum;
+    uint8_t  reserved[28];
+    /* CRC-32 of all the previous header fields */
+    uint32_t header_checksum;
+} __attribute__((packed));
+
+struct firmware_image_s {
+    struct firmware_image_header_s header;
+    uint8_t                        image[MICROTOUCH3M_FW_IMAGE_SIZE];
+} __attribute__((packed));
+
+static microtouch3m_status_t
+firmware_image_header_parse (const struct firmware_image_header_s *header,
+                             microtouch3m_firmware_image_info_t   *info)
+{
+    if (memcmp (header->magic, FIRMWARE_IMAGE_MAGIC, sizeof (header->magic)) != 0) {
+        microtouch3m_log_error ("error: invalid firmware image file: magic mismatch");
+        return MICROTOUCH3M_STATUS_INVALID_FORMAT;
+    }
+
+    if (le32toh (header->header_checksum) != crc32_update (0, header, offsetof (struct firmware_image_header_s, header_checksum))) {
+        microtouch3m_log_error ("error: invalid firmware image file: header checksum mismatch");
+        return MICROTOUCH3M_STATUS_INVALID_DATA;
+    }
+
+    if (le16toh (header->format_version) != FIRMWARE_IMAGE_FORMAT_VERSION) {
+        microtouch3m_log_error ("error: unsupported firmware image file format version: %u", le16toh (header->format_version));
+        return MICROTOUCH3M_STATUS_INVALID_FORMAT;
+    }
+
+    if (le16toh (header->header_size) != sizeof (struct firmware_image_header_s)) {
+        microtouch3m_log_error ("error: unexpected firmware image file header size (%u != %zu)", le16toh (header->header_size), sizeof (struct firmware_image_header_s));
+        return MICROTOUCH3M_STATUS_INVALID_FORMAT;
+    }
+
+    if (le32toh (header->image_size) != MICROTOUCH3M_FW_IMAGE_SIZE) {
+        microtouch3m_log_error ("error: unexpected firmware image size (%u != %zu)", le32toh (header->image_size), MICROTOUCH3M_FW_IMAGE_SIZE);
+        return MICROTOUCH3M_STATUS_INVALID_FORMAT;
+    }
+
+    if (info) {
+        info->controller_type    = le16toh (header->controller_type);
+        info->firmware_major     = header->firmware_major;
+        info->firmware_minor     = header->firmware_minor;
+        info->constants_checksum = le16toh (header->constants_checksum);
+        info->asic_type          = le16toh (header->asic_type);
+        info->pc_checksum        = le32toh (header->pc_checksum);
+        info->image_checksum     = le32toh (header->image_checksum);
+    }
+
+    return MICROTOUCH3M_STATUS_OK;
+}
+
+static microtouch3m_status_t
+firmware_image_file_load (const char *path,
+                          void       *contents,
+                          size_t      contents_size,
+                          size_t     *out_contents_read)
+{
+    int     fd;
+    ssize_t n_read;
+
+    fd = open (path, O_RDONLY);
+    if (fd < 0) {
+        microtouch3m_log_error ("error: opening firmware image file failed: %s", strerror (errno));
+        return MICROTOUCH3M_STATUS_FAILED;
+    }
+
+    do {
+        n_read = read (fd, contents, contents_size);
+    } while (n_read < 0 && errno == EINTR);
+
+    close (fd);
+
+    if (n_read < 0) {
+        microtouch3m_log_error ("error: couldn't read firmware image file: %s", strerror (errno));
+        return MICROTOUCH3M_STATUS_INVALID_IO;
+    }
+
+    *out_contents_read = (size_t) n_read;
+    return MICROTOUCH3M_STATUS_OK;
+}
+
+uint32_t
+microtouch3m_firmware_image_checksum (const uint8_t *buffer,
+                                      size_t         buffer_size)
+{
+    assert (buffer);
+    assert (buffer_size >= MICROTOUCH3M_FW_IMAGE_SIZE);
+
+    return crc32_update (0, buffer, MICROTOUCH3M_FW_IMAGE_SIZE);
+}
+
+microtouch3m_status_t
+microtouch3m_firmware_image_read_info (const char                         *path,
+                                       microtouch3m_firmware_image_info_t *info)
+{
+    microtouch3m_status_t          st;
+    struct firmware_image_header_s header;
+    size_t                         n_read = 0;
+
+    assert (path);
+    assert (info);
+
+    if ((st = firmware_image_file_load (path, &header, sizeof (header), &n_read)) != MICROTOUCH3M_STATUS_OK)
+        return st;
+
+    if (n_read != sizeof (header)) {
+        microtouch3m_log_error ("error: invalid firmware image file: header too short");
+        return MICROTOUCH3M_STATUS_INVALID_FORMAT;
+    }
+
+    return firmware_image_header_parse (&header, info);
+}
+
+microtouch3m_status_t
+microtouch3m_firmware_image_read (const char                         *path,
+                                  uint8_t                            *buffer,
+                                  size_t                              buffer_size,
+                                  microtouch3m_firmware_image_info_t *info)
+{
+    microtouch3m_status_t              st;
+    struct firmware_image_s           *contents = NULL;
+    size_t                             n_read = 0;
+    microtouch3m_firmware_image_info_t parsed_info;
+    uint32_t                           image_checksum;
+
+    assert (path);
+
+    /* Note: if buffer not given, we just validate file */
+
+    if (buffer && buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
+        microtouch3m_log_error ("error: not enough space in buffer to store the full firmware image (%zu < %zu)", buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
+        st = MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
+        goto out;
+    }
+
+    /* Allocate one additional byte, so that we can detect trailing data */
+    if (!(contents = malloc (sizeof (struct firmware_image_s) + 1))) {
+        st = MICROTOUCH3M_STATUS_NO_MEMORY;
+        goto out;
+    }
+
+    if ((st = firmware_image_file_load (path, contents, sizeof (struct firmware_image_s) + 1, &n_read)) != MICROTOUCH3M_STATUS_OK)
+        goto out;
+
+    if (n_read != sizeof (struct firmware_image_s)) {
+        microtouch3m_log_error ("error: unexpected firmware image file size (%zu != %zu)", n_read, sizeof (struct firmware_image_s));
+        st = MICROTOUCH3M_STATUS_INVALID_FORMAT;
+        goto out;
+    }
+
+    if ((st = firmware_image_header_parse (&contents->header, &parsed_info)) != MICROTOUCH3M_STATUS_OK)
+        goto out;
+
+    image_checksum = microtouch3m_firmware_image_checksum (contents->image, MICROTOUCH3M_FW_IMAGE_SIZE);
+    if (image_checksum != parsed_info.image_checksum) {
+        microtouch3m_log_error ("error: firmware image checksum mismatch (0x%08x != 0x%08x)", image_checksum, parsed_info.image_checksum);
+        st = MICROTOUCH3M_STATUS_INVALID_DATA;
+        goto out;
+    }
+
+    if (buffer)
+        memcpy (buffer, contents->image, MICROTOUCH3M_FW_IMAGE_SIZE);
+    if (info)
+        memcpy (info, &parsed_info, sizeof (parsed_info));
+
+    st = MICROTOUCH3M_STATUS_OK;
+
+out:
+
+    free (contents);
+
+    return st;
+}
+
+microtouch3m_status_t
+microtouch3m_firmware_image_write (const char                               *path,
+                                   const uint8_t                            *buffer,
+                                   size_t                                    buffer_size,
+                                   const microtouch3m_firmware_image_info_t *info,
+                                   unsigned int                              flags)
+{
+    microtouch3m_status_t    st;
+    struct firmware_image_s *contents;
+
+    assert (path);
+    assert (buffer);
+    assert (info);
+
+    if (buffer_size < MICROTOUCH3M_FW_IMAGE_SIZE) {
+        microtouch3m_log_error ("error: not enough space in buffer to contain the full firmware image (%zu < %zu)", buffer_size, MICROTOUCH3M_FW_IMAGE_SIZE);
+        return MICROTOUCH3M_STATUS_INVALID_ARGUMENTS;
+    }
+
+    if (!(contents = calloc (1, sizeof (struct firmware_image_s))))
+        return MICROTOUCH3M_STATUS_NO_MEMORY;
+
+    memcpy (contents->header.magic, FIRMWARE_IMAGE_MAGIC, sizeof (contents->header.magic));
+    contents->header.format_version     = htole16 (FIRMWARE_IMAGE_FORMAT_VERSION);
+    contents->header.header_size        = htole16 (sizeof (struct firmware_image_header_s));
+    contents->header.image_size         = htole32 (MICROTOUCH3M_FW_IMAGE_SIZE);
+    contents->header.image_checksum     = htole32 (microtouch3m_firmware_image_checksum (buffer, MICROTOUCH3M_FW_IMAGE_SIZE));
+    contents->header.controller_type    = htole16 (info->controller_type);
+    contents->header.firmware_major     = info->firmware_major;
+    contents->header.firmware_minor     = info->firmware_minor;
+    contents->header.constants_checksum = htole16 (info->constants_checksum);
+    contents->header.asic_type          = htole16 (info->asic_type);
+    contents->header.pc_checksum        = htole32 (info->pc_checksum);
+    contents->header.header_checksum    = htole32 (crc32_update (0, &contents->header, offsetof (struct firmware_image_header_s, header_checksum)));
+    memcpy (contents->image, buffer, MICROTOUCH3M_FW_IMAGE_SIZE);
+
+    st = write_file (path, contents, sizeof (struct firmware_image_s), flags);
+
+    free (contents);
+
+    return st;
+}
+
 /******************************************************************************/
 /* Library version info */
 
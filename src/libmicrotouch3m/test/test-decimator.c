@@ -0,0 +1,269 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define MAX_POINTS 1024
+
+#define assert_close(value, expected, tolerance)                        \
+    ck_assert_msg (fabs ((value) - (expected)) <= (tolerance),          \
+                   "%s: %.9g, expected %.9g +/- %g",                    \
+                   #value, (double) (value), (double) (expected), (double) (tolerance))
+
+START_TEST (test_decimator_invalid)
+{
+    ck_assert (microtouch3m_scope_decimator_new (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX, 0, 4) == NULL);
+    ck_assert (microtouch3m_scope_decimator_new (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX, 4, 1) == NULL);
+    ck_assert (microtouch3m_scope_decimator_new (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB, 4, 0) == NULL);
+    ck_assert (microtouch3m_scope_decimator_new ((microtouch3m_scope_decimator_mode_t) 7, 4, 4) == NULL);
+}
+END_TEST
+
+/******************************************************************************/
+
+/* Each bucket gives its minimum and maximum, in the order they happened */
+START_TEST (test_decimator_minmax)
+{
+    static const int32_t signal[] = {
+        /* bucket 0 */
+        3, -1,   9, -1,   1, -1,   5, -1,
+        /* bucket 1 */
+        2, 10,   2, 20,   8, 30,   0, 40,
+        /* partial bucket */
+        6, 50,   4, 60,
+    };
+    microtouch3m_scope_decimator_t *decimator;
+    double                          x[MAX_POINTS * 2];
+    int32_t                         value[MAX_POINTS * 2];
+    size_t                          n;
+
+    decimator = microtouch3m_scope_decimator_new (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX, 2, 4);
+    ck_assert (decimator != NULL);
+
+    n = microtouch3m_scope_decimator_add (decimator, NULL, signal, 10, x, value);
+    ck_assert_uint_eq (n, 4);
+
+    /* channel 0 */
+    assert_close (x[0 * 2], 1.0, 0.0); ck_assert_int_eq (value[0 * 2], 9);
+    assert_close (x[1 * 2], 2.0, 0.0); ck_assert_int_eq (value[1 * 2], 1);
+    assert_close (x[2 * 2], 6.0, 0.0); ck_assert_int_eq (value[2 * 2], 8);
+    assert_close (x[3 * 2], 7.0, 0.0); ck_assert_int_eq (value[3 * 2], 0);
+
+    /* channel 1: constant bucket, then increasing */
+    assert_close (x[0 * 2 + 1], 0.0, 0.0); ck_assert_int_eq (value[0 * 2 + 1], -1);
+    assert_close (x[1 * 2 + 1], 0.0, 0.0); ck_assert_int_eq (value[1 * 2 + 1], -1);
+    assert_close (x[2 * 2 + 1], 4.0, 0.0); ck_assert_int_eq (value[2 * 2 + 1], 10);
+    assert_close (x[3 * 2 + 1], 7.0, 0.0); ck_assert_int_eq (value[3 * 2 + 1], 40);
+
+    /* the partial bucket on flush, and nothing afterwards */
+    n = microtouch3m_scope_decimator_flush (decimator, x, value);
+    ck_assert_uint_eq (n, 2);
+    assert_close (x[0], 8.0, 0.0); ck_assert_int_eq (value[0], 6);
+    assert_close (x[2], 9.0, 0.0); ck_assert_int_eq (value[2], 4);
+    ck_assert_int_eq (value[1], 50);
+    ck_assert_int_eq (value[3], 60);
+
+    ck_assert_uint_eq (microtouch3m_scope_decimator_flush (decimator, x, value), 0);
+
+    microtouch3m_scope_decimator_free (decimator);
+}
+END_TEST
+
+/******************************************************************************/
+
+/* The first and last samples are kept, and a spike is kept within its bucket */
+START_TEST (test_decimator_lttb)
+{
+    microtouch3m_scope_decimator_t *decimator;
+    int32_t                         signal[41];
+    double                          x[MAX_POINTS];
+    int32_t                         value[MAX_POINTS];
+    size_t                          n;
+    size_t                          k;
+
+    for (k = 0; k < 41; k++)
+        signal[k] = (k == 14) ? 1000 : 0;
+
+    decimator = microtouch3m_scope_decimator_new (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB, 1, 4);
+    ck_assert (decimator != NULL);
+
+    /* first sample, then one point per bucket once the next one is complete */
+    n = microtouch3m_scope_decimator_add (decimator, NULL, signal, 41, x, value);
+    n += microtouch3m_scope_decimator_flush (decimator, &x[n], &value[n]);
+
+    /* first + 10 buckets + last */
+    ck_assert_uint_eq (n, 12);
+    assert_close (x[0], 0.0, 0.0);
+    assert_close (x[n - 1], 40.0, 0.0);
+    for (k = 1; k < n; k++)
+        ck_assert_msg (x[k] > x[k - 1], "points out of order at %u", (unsigned int) k);
+
+    /* the spike is in the 4th bucket (samples 13..16) */
+    assert_close (x[4], 14.0, 0.0);
+    ck_assert_int_eq (value[4], 1000);
+
+    microtouch3m_scope_decimator_free (decimator);
+}
+END_TEST
+
+/* Points on a line stay on it, at the given positions */
+START_TEST (test_decimator_lttb_positions)
+{
+    microtouch3m_scope_decimator_t *decimator;
+    int32_t                         signal[100];
+    double                          sample_x[100];
+    double                          x[MAX_POINTS];
+    int32_t                         value[MAX_POINTS];
+    size_t                          n;
+    size_t                          k;
+
+    for (k = 0; k < 100; k++) {
+        sample_x[k] = 0.5 * k + 10.0;
+        signal[k]   = 3 * (int32_t) k - 50;
+    }
+
+    decimator = microtouch3m_scope_decimator_new (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB, 1, 8);
+    ck_assert (decimator != NULL);
+
+    n = microtouch3m_scope_decimator_add (decimator, sample_x, signal, 100, x, value);
+    n += microtouch3m_scope_decimator_flush (decimator, &x[n], &value[n]);
+    ck_assert_uint_gt (n, 2);
+
+    for (k = 0; k < n; k++)
+        assert_close ((double) value[k], 6.0 * (x[k] - 10.0) - 50.0, 1e-9);
+    assert_close (x[0], 10.0, 0.0);
+    assert_close (x[n - 1], 59.5, 0.0);
+
+    microtouch3m_scope_decimator_free (decimator);
+}
+END_TEST
+
+/******************************************************************************/
+
+/* Adding in chunks gives the same points, within the advertised maximum */
+static void
+check_chunked (microtouch3m_scope_decimator_mode_t mode)
+{
+    microtouch3m_scope_decimator_t *whole;
+    microtouch3m_scope_decimator_t *chunked;
+    int32_t                         signal[1000 * MICROTOUCH3M_SCOPE_N_CORNERS];
+    double                          expected_x[MAX_POINTS * MICROTOUCH3M_SCOPE_N_CORNERS];
+    int32_t                         expected_value[MAX_POINTS * MICROTOUCH3M_SCOPE_N_CORNERS];
+    double                          x[MAX_POINTS * MICROTOUCH3M_SCOPE_N_CORNERS];
+    int32_t                         value[MAX_POINTS * MICROTOUCH3M_SCOPE_N_CORNERS];
+    uint32_t                        state = 3;
+    size_t                          n_expected;
+    size_t                          n_out = 0;
+    size_t                          done;
+    size_t                          n;
+    size_t                          k;
+
+    for (k = 0; k < 1000 * MICROTOUCH3M_SCOPE_N_CORNERS; k++) {
+        state = state * 1664525u + 1013904223u;
+        signal[k] = (int32_t) (state >> 12) - 0x80000;
+    }
+
+    whole   = microtouch3m_scope_decimator_new (mode, MICROTOUCH3M_SCOPE_N_CORNERS, 5);
+    chunked = microtouch3m_scope_decimator_new (mode, MICROTOUCH3M_SCOPE_N_CORNERS, 5);
+    ck_assert (whole != NULL && chunked != NULL);
+
+    n_expected  = microtouch3m_scope_decimator_add (whole, NULL, signal, 1000, expected_x, expected_value);
+    ck_assert_uint_le (n_expected, microtouch3m_scope_decimator_get_max_points (whole, 1000));
+    n_expected += microtouch3m_scope_decimator_flush (whole,
+                                                      &expected_x[n_expected * MICROTOUCH3M_SCOPE_N_CORNERS],
+                                                      &expected_value[n_expected * MICROTOUCH3M_SCOPE_N_CORNERS]);
+
+    for (done = 0, n = 1; done < 1000; done += n, n = (n * 7) % 23 + 1) {
+        size_t n_points;
+
+        if (n > 1000 - done)
+            n = 1000 - done;
+        n_points = microtouch3m_scope_decimator_add (chunked, NULL, &signal[done * MICROTOUCH3M_SCOPE_N_CORNERS], n,
+                                                     &x[n_out * MICROTOUCH3M_SCOPE_N_CORNERS],
+                                                     &value[n_out * MICROTOUCH3M_SCOPE_N_CORNERS]);
+        ck_assert_uint_le (n_points, microtouch3m_scope_decimator_get_max_points (chunked, n));
+        n_out += n_points;
+    }
+    n_out += microtouch3m_scope_decimator_flush (chunked,
+                                                 &x[n_out * MICROTOUCH3M_SCOPE_N_CORNERS],
+                                                 &value[n_out * MICROTOUCH3M_SCOPE_N_CORNERS]);
+
+    ck_assert_uint_eq (n_out, n_expected);
+    ck_assert (memcmp (x, expected_x, n_out * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (double)) == 0);
+    ck_assert (memcmp (value, expected_value, n_out * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t)) == 0);
+
+    microtouch3m_scope_decimator_free (whole);
+    microtouch3m_scope_decimator_free (chunked);
+}
+
+START_TEST (test_decimator_minmax_chunked)
+{
+    check_chunked (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX);
+}
+END_TEST
+
+START_TEST (test_decimator_lttb_chunked)
+{
+    check_chunked (MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("decimator");
+
+    tc = tcase_create ("scope-decimator");
+    tcase_add_test (tc, test_decimator_invalid);
+    tcase_add_test (tc, test_decimator_minmax);
+    tcase_add_test (tc, test_decimator_lttb);
+    tcase_add_test (tc, test_decimator_lttb_positions);
+    tcase_add_test (tc, test_decimator_minmax_chunked);
+    tcase_add_test (tc, test_decimator_lttb_chunked);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
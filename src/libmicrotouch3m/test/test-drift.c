@@ -0,0 +1,200 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define MIN_INTERVAL_MS 1000
+#define MAX_INTERVAL_MS 16000
+#define TOLERANCE       10.0
+
+static microtouch3m_stray_tracker_t *
+create_tracker (void)
+{
+    microtouch3m_stray_tracker_t *tracker;
+
+    tracker = microtouch3m_stray_tracker_new (MIN_INTERVAL_MS, MAX_INTERVAL_MS, TOLERANCE);
+    ck_assert (tracker != NULL);
+    return tracker;
+}
+
+/* Strays drifting linearly, at a different rate on each corner */
+static void
+drift_at (double    time_s,
+          uint64_t *stray_signal)
+{
+    unsigned int c;
+
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+        stray_signal[c] = (uint64_t) 1000000000 + (uint64_t) (c * 1000) + (uint64_t) (time_s * (c + 1));
+}
+
+/******************************************************************************/
+
+START_TEST (test_tracker_invalid)
+{
+    microtouch3m_stray_tracker_t *tracker;
+    uint64_t                      stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS] = { 1, 1, 1, 1 };
+    unsigned int                  c;
+
+    ck_assert (microtouch3m_stray_tracker_new (0, MAX_INTERVAL_MS, TOLERANCE) == NULL);
+    ck_assert (microtouch3m_stray_tracker_new (MIN_INTERVAL_MS, MIN_INTERVAL_MS - 1, TOLERANCE) == NULL);
+    ck_assert (microtouch3m_stray_tracker_new (MIN_INTERVAL_MS, MAX_INTERVAL_MS, -1.0) == NULL);
+
+    /* Nothing predicted before the first read */
+    tracker = create_tracker ();
+    microtouch3m_stray_tracker_predict (tracker, 10.0, stray_signal);
+    for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+        ck_assert_uint_eq (stray_signal[c], 0);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), MIN_INTERVAL_MS);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_updates (tracker), 0);
+    microtouch3m_stray_tracker_free (tracker);
+}
+END_TEST
+
+/* Every predictable read doubles the interval, up to the maximum */
+START_TEST (test_tracker_constant)
+{
+    static const unsigned int     intervals_ms[] = { 1000, 2000, 4000, 8000, 16000, 16000, 16000 };
+    microtouch3m_stray_tracker_t *tracker;
+    uint64_t                      stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS] = { 5000, 6000, 7000, 8000 };
+    uint64_t                      predicted[MICROTOUCH3M_SCOPE_N_CORNERS];
+    double                        time_s = 100.0;
+    unsigned int                  i;
+
+    tracker = create_tracker ();
+    for (i = 0; i < sizeof (intervals_ms) / sizeof (intervals_ms[0]); i++) {
+        microtouch3m_stray_tracker_update (tracker, time_s, stray_signal);
+        ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), intervals_ms[i]);
+        time_s += microtouch3m_stray_tracker_get_interval_ms (tracker) / 1000.0;
+    }
+
+    microtouch3m_stray_tracker_predict (tracker, time_s + 3600.0, predicted);
+    ck_assert (memcmp (predicted, stray_signal, sizeof (predicted)) == 0);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_updates (tracker), i);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_fallbacks (tracker), 0);
+    microtouch3m_stray_tracker_free (tracker);
+}
+END_TEST
+
+/* A linear drift is predicted exactly once two reads are fitted */
+START_TEST (test_tracker_linear)
+{
+    microtouch3m_stray_tracker_t *tracker;
+    uint64_t                      stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    uint64_t                      predicted[MICROTOUCH3M_SCOPE_N_CORNERS];
+    double                        time_s = 0.0;
+    unsigned int                  i;
+
+    tracker = create_tracker ();
+    for (i = 0; i < 20; i++) {
+        drift_at (time_s, stray_signal);
+        microtouch3m_stray_tracker_update (tracker, 1000.0 + time_s, stray_signal);
+        if (i >= 2)
+            ck_assert_msg (microtouch3m_stray_tracker_get_residual (tracker) < 1e-3,
+                           "residual %g at read %u", microtouch3m_stray_tracker_get_residual (tracker), i);
+        time_s += microtouch3m_stray_tracker_get_interval_ms (tracker) / 1000.0;
+    }
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), MAX_INTERVAL_MS);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_fallbacks (tracker), 0);
+
+    time_s += 1234.0;
+    drift_at (time_s, stray_signal);
+    microtouch3m_stray_tracker_predict (tracker, 1000.0 + time_s, predicted);
+    ck_assert (memcmp (predicted, stray_signal, sizeof (predicted)) == 0);
+    microtouch3m_stray_tracker_free (tracker);
+}
+END_TEST
+
+/* A jump breaks the trend, going back to the minimum interval */
+START_TEST (test_tracker_fallback)
+{
+    microtouch3m_stray_tracker_t *tracker;
+    uint64_t                      stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS] = { 5000, 6000, 7000, 8000 };
+    uint64_t                      predicted[MICROTOUCH3M_SCOPE_N_CORNERS];
+    unsigned int                  i;
+
+    tracker = create_tracker ();
+    for (i = 0; i < 5; i++)
+        microtouch3m_stray_tracker_update (tracker, i, stray_signal);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), MAX_INTERVAL_MS);
+
+    stray_signal[2] += 11;
+    microtouch3m_stray_tracker_update (tracker, i++, stray_signal);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), MIN_INTERVAL_MS);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_fallbacks (tracker), 1);
+    ck_assert (fabs (microtouch3m_stray_tracker_get_residual (tracker) - 11.0) < 1e-6);
+
+    /* The fit restarts from the new level */
+    microtouch3m_stray_tracker_predict (tracker, i + 100.0, predicted);
+    ck_assert (memcmp (predicted, stray_signal, sizeof (predicted)) == 0);
+    microtouch3m_stray_tracker_update (tracker, i++, stray_signal);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), 2 * MIN_INTERVAL_MS);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_updates (tracker), 7);
+
+    microtouch3m_stray_tracker_reset (tracker);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_interval_ms (tracker), MIN_INTERVAL_MS);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_updates (tracker), 0);
+    ck_assert_uint_eq (microtouch3m_stray_tracker_get_n_fallbacks (tracker), 0);
+    microtouch3m_stray_tracker_predict (tracker, 0.0, predicted);
+    ck_assert_uint_eq (predicted[0], 0);
+    microtouch3m_stray_tracker_free (tracker);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("drift");
+
+    tc = tcase_create ("stray-tracker");
+    tcase_add_test (tc, test_tracker_invalid);
+    tcase_add_test (tc, test_tracker_constant);
+    tcase_add_test (tc, test_tracker_linear);
+    tcase_add_test (tc, test_tracker_fallback);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
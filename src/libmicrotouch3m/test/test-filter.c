@@ -0,0 +1,268 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define RATE      1000.0
+#define N_SAMPLES 4000
+#define SPEC      "notch:50,lowpass:30,average:4,decimate:2"
+
+static int32_t signal_buffer   [N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS];
+static int32_t expected_buffer [N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS];
+static int32_t filtered_buffer [N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+static microtouch3m_scope_filter_t *
+create_filter (const char *spec)
+{
+    microtouch3m_scope_filter_t *filter;
+
+    filter = microtouch3m_scope_filter_new (RATE);
+    ck_assert (filter != NULL);
+    if (spec)
+        ck_assert (microtouch3m_scope_filter_add_from_string (filter, spec));
+    return filter;
+}
+
+/* A noisy ramp on every corner, different on each */
+static void
+fill_signal (void)
+{
+    uint32_t state = 11;
+    size_t   i;
+
+    for (i = 0; i < N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+        state = state * 1664525u + 1013904223u;
+        signal_buffer[i] = (int32_t) (i * 37) + (int32_t) (state >> 16) - 0x8000;
+    }
+}
+
+/******************************************************************************/
+
+START_TEST (test_filter_invalid)
+{
+    static const char *invalid_specs[] = {
+        "",
+        "bogus:3",
+        "notch",
+        "notch:",
+        "notch:abc",
+        "notch:50:",
+        "notch:50x",
+        "notch:0",
+        "notch:500",
+        "notch:600",
+        "lowpass:-1",
+        "average:1",
+        "average:4.5",
+        "decimate:1",
+        "decimate:2000",
+    };
+    microtouch3m_scope_filter_t *filter;
+    unsigned int                 i;
+
+    ck_assert (microtouch3m_scope_filter_new (0.0) == NULL);
+    ck_assert (microtouch3m_scope_filter_new (-RATE) == NULL);
+
+    for (i = 0; i < sizeof (invalid_specs) / sizeof (invalid_specs[0]); i++) {
+        filter = create_filter (NULL);
+        ck_assert_msg (!microtouch3m_scope_filter_add_from_string (filter, invalid_specs[i]),
+                       "spec '%s' accepted", invalid_specs[i]);
+        ck_assert_uint_eq (microtouch3m_scope_filter_get_n_stages (filter), 0);
+        microtouch3m_scope_filter_free (filter);
+    }
+
+    /* At most 16 stages, keeping the ones before the failing one */
+    filter = create_filter (NULL);
+    for (i = 0; i < 16; i++)
+        ck_assert (microtouch3m_scope_filter_add_moving_average (filter, 2));
+    ck_assert (!microtouch3m_scope_filter_add_notch (filter, 50.0, 30.0));
+    ck_assert_uint_eq (microtouch3m_scope_filter_get_n_stages (filter), 16);
+    microtouch3m_scope_filter_free (filter);
+
+    filter = create_filter (NULL);
+    ck_assert (!microtouch3m_scope_filter_add_from_string (filter, "notch:50,average:0,lowpass:30"));
+    ck_assert_uint_eq (microtouch3m_scope_filter_get_n_stages (filter), 1);
+    microtouch3m_scope_filter_free (filter);
+}
+END_TEST
+
+/******************************************************************************/
+
+/* Without stages the signal goes through unchanged */
+START_TEST (test_filter_empty)
+{
+    microtouch3m_scope_filter_t *filter;
+
+    fill_signal ();
+    filter = create_filter (NULL);
+    ck_assert_uint_eq (microtouch3m_scope_filter_get_decimation (filter), 1);
+    ck_assert_uint_eq (microtouch3m_scope_filter_process (filter, signal_buffer, N_SAMPLES, filtered_buffer), N_SAMPLES);
+    ck_assert (memcmp (filtered_buffer, signal_buffer, sizeof (signal_buffer)) == 0);
+    microtouch3m_scope_filter_free (filter);
+}
+END_TEST
+
+/* A constant input is given back exactly, from the first output on */
+START_TEST (test_filter_dc)
+{
+    static const int32_t levels[MICROTOUCH3M_SCOPE_N_CORNERS] = { 0, 12345, -987654, 2000000000 };
+    microtouch3m_scope_filter_t *filter;
+    size_t                       n_out;
+    size_t                       i;
+    unsigned int                 c;
+
+    for (i = 0; i < N_SAMPLES; i++)
+        memcpy (&signal_buffer[i * MICROTOUCH3M_SCOPE_N_CORNERS], levels, sizeof (levels));
+
+    filter = create_filter (SPEC);
+    ck_assert_uint_eq (microtouch3m_scope_filter_get_n_stages (filter), 4);
+    ck_assert_uint_eq (microtouch3m_scope_filter_get_decimation (filter), 2);
+
+    n_out = microtouch3m_scope_filter_process (filter, signal_buffer, N_SAMPLES, filtered_buffer);
+    ck_assert_uint_eq (n_out, N_SAMPLES / 2);
+    for (i = 0; i < n_out; i++) {
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+            ck_assert_int_eq (filtered_buffer[(i * MICROTOUCH3M_SCOPE_N_CORNERS) + c], levels[c]);
+    }
+    microtouch3m_scope_filter_free (filter);
+}
+END_TEST
+
+/* The notch removes a sine at its frequency and lets others through */
+static double
+tone_amplitude (double frequency)
+{
+    microtouch3m_scope_filter_t *filter;
+    double                       peak = 0.0;
+    size_t                       i;
+    unsigned int                 c;
+
+    for (i = 0; i < N_SAMPLES; i++) {
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++)
+            signal_buffer[(i * MICROTOUCH3M_SCOPE_N_CORNERS) + c] =
+                (int32_t) floor (1000000.0 + 100000.0 * sin (2.0 * M_PI * frequency * i / RATE + c) + 0.5);
+    }
+
+    filter = create_filter ("notch:50");
+    ck_assert_uint_eq (microtouch3m_scope_filter_process (filter, signal_buffer, N_SAMPLES, filtered_buffer), N_SAMPLES);
+    microtouch3m_scope_filter_free (filter);
+
+    /* Past the transient, a Q of 30 at 50 Hz settles in a few hundred ms */
+    for (i = N_SAMPLES / 2; i < N_SAMPLES; i++) {
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+            double deviation;
+
+            deviation = fabs ((double) filtered_buffer[(i * MICROTOUCH3M_SCOPE_N_CORNERS) + c] - 1000000.0);
+            if (deviation > peak)
+                peak = deviation;
+        }
+    }
+    return peak / 100000.0;
+}
+
+START_TEST (test_filter_notch)
+{
+    double amplitude;
+
+    amplitude = tone_amplitude (50.0);
+    ck_assert_msg (amplitude < 1e-3, "50 Hz tone amplitude %g", amplitude);
+    amplitude = tone_amplitude (200.0);
+    ck_assert_msg (amplitude > 0.99 && amplitude < 1.01, "200 Hz tone amplitude %g", amplitude);
+}
+END_TEST
+
+/******************************************************************************/
+
+/* Processing in chunks of any size, in place or not, gives the same output */
+START_TEST (test_filter_chunked)
+{
+    microtouch3m_scope_filter_t *filter;
+    size_t                       n_expected;
+    size_t                       n_out = 0;
+    size_t                       done;
+    size_t                       n;
+
+    fill_signal ();
+    filter = create_filter (SPEC);
+    n_expected = microtouch3m_scope_filter_process (filter, signal_buffer, N_SAMPLES, expected_buffer);
+    ck_assert_uint_eq (n_expected, N_SAMPLES / 2);
+
+    microtouch3m_scope_filter_reset (filter);
+    for (done = 0, n = 1; done < N_SAMPLES; done += n, n = (n * 13) % 301 + 1) {
+        if (n > N_SAMPLES - done)
+            n = N_SAMPLES - done;
+        n_out += microtouch3m_scope_filter_process (filter,
+                                                    &signal_buffer[done * MICROTOUCH3M_SCOPE_N_CORNERS], n,
+                                                    &filtered_buffer[n_out * MICROTOUCH3M_SCOPE_N_CORNERS]);
+    }
+    ck_assert_uint_eq (n_out, n_expected);
+    ck_assert (memcmp (filtered_buffer, expected_buffer, n_out * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t)) == 0);
+
+    /* In place */
+    microtouch3m_scope_filter_reset (filter);
+    memcpy (filtered_buffer, signal_buffer, sizeof (signal_buffer));
+    ck_assert_uint_eq (microtouch3m_scope_filter_process (filter, filtered_buffer, N_SAMPLES, filtered_buffer), n_expected);
+    ck_assert (memcmp (filtered_buffer, expected_buffer, n_expected * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t)) == 0);
+
+    microtouch3m_scope_filter_free (filter);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("filter");
+
+    tc = tcase_create ("scope-filter");
+    tcase_add_test (tc, test_filter_invalid);
+    tcase_add_test (tc, test_filter_empty);
+    tcase_add_test (tc, test_filter_dc);
+    tcase_add_test (tc, test_filter_notch);
+    tcase_add_test (tc, test_filter_chunked);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
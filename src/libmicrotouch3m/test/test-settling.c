@@ -0,0 +1,217 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define WINDOW          32
+#define SLOPE_THRESHOLD 2.0
+#define VARIANCE_RATIO  4.0
+#define N_SAMPLES       2000
+
+static int32_t signal_buffer [N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+/* An exponential transient of the given time constant, plus +/-100 of
+ * uniform noise, on every corner */
+static void
+fill_signal (double amplitude,
+             double time_constant)
+{
+    uint32_t     state = 5;
+    size_t       i;
+    unsigned int c;
+
+    for (i = 0; i < N_SAMPLES; i++) {
+        for (c = 0; c < MICROTOUCH3M_SCOPE_N_CORNERS; c++) {
+            double transient;
+
+            transient = (time_constant > 0.0) ? amplitude * exp (-(double) i / time_constant) : 0.0;
+            state = state * 1664525u + 1013904223u;
+            signal_buffer[(i * MICROTOUCH3M_SCOPE_N_CORNERS) + c] =
+                1000000 + (int32_t) (c * 1000) + (int32_t) floor (transient + 0.5) + (int32_t) (state >> 24) * 200 / 255 - 100;
+        }
+    }
+}
+
+static microtouch3m_settling_detector_t *
+create_detector (uint64_t max_samples)
+{
+    microtouch3m_settling_detector_t *detector;
+
+    detector = microtouch3m_settling_detector_new (WINDOW, SLOPE_THRESHOLD, VARIANCE_RATIO, max_samples);
+    ck_assert (detector != NULL);
+    return detector;
+}
+
+/******************************************************************************/
+
+START_TEST (test_settling_invalid)
+{
+    ck_assert (microtouch3m_settling_detector_new (2, SLOPE_THRESHOLD, VARIANCE_RATIO, 0) == NULL);
+    ck_assert (microtouch3m_settling_detector_new (WINDOW, -1.0, VARIANCE_RATIO, 0) == NULL);
+    ck_assert (microtouch3m_settling_detector_new (WINDOW, SLOPE_THRESHOLD, 0.5, 0) == NULL);
+}
+END_TEST
+
+/* A constant signal settles as soon as both windows are full */
+START_TEST (test_settling_constant)
+{
+    microtouch3m_settling_detector_t *detector;
+    int32_t                           constant[N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t                            i;
+
+    for (i = 0; i < N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS; i++)
+        constant[i] = 12345678;
+
+    detector = create_detector (0);
+    ck_assert_uint_eq (microtouch3m_settling_detector_add (detector, constant, 2 * WINDOW - 1), 2 * WINDOW - 1);
+    ck_assert (!microtouch3m_settling_detector_is_settled (detector));
+
+    /* Only the leading samples of the settling period are given back */
+    ck_assert_uint_eq (microtouch3m_settling_detector_add (detector, constant, 10), 1);
+    ck_assert (microtouch3m_settling_detector_is_settled (detector));
+    ck_assert (!microtouch3m_settling_detector_is_timed_out (detector));
+    ck_assert_uint_eq (microtouch3m_settling_detector_get_n_settling (detector), 2 * WINDOW);
+
+    /* Nothing is discarded once settled */
+    ck_assert_uint_eq (microtouch3m_settling_detector_add (detector, constant, 10), 0);
+    ck_assert_uint_eq (microtouch3m_settling_detector_get_n_settling (detector), 2 * WINDOW);
+
+    microtouch3m_settling_detector_reset (detector);
+    ck_assert (!microtouch3m_settling_detector_is_settled (detector));
+    ck_assert_uint_eq (microtouch3m_settling_detector_get_n_settling (detector), 0);
+    ck_assert_uint_eq (microtouch3m_settling_detector_add (detector, constant, N_SAMPLES), 2 * WINDOW);
+
+    microtouch3m_settling_detector_free (detector);
+}
+END_TEST
+
+/* Noise alone settles in the first windows, a transient only once it's
+ * buried in the noise */
+START_TEST (test_settling_transient)
+{
+    microtouch3m_settling_detector_t *detector;
+    size_t                            n_settling;
+
+    fill_signal (0.0, 0.0);
+    detector = create_detector (0);
+    n_settling = microtouch3m_settling_detector_add (detector, signal_buffer, N_SAMPLES);
+    ck_assert (microtouch3m_settling_detector_is_settled (detector));
+    ck_assert_msg (n_settling < 4 * WINDOW, "noise settled after %u samples", (unsigned int) n_settling);
+    microtouch3m_settling_detector_free (detector);
+
+    /* The trend along a window is below 2 standard deviations of the noise
+     * only about 8 time constants in */
+    fill_signal (500000.0, 50.0);
+    detector = create_detector (0);
+    n_settling = microtouch3m_settling_detector_add (detector, signal_buffer, N_SAMPLES);
+    ck_assert (microtouch3m_settling_detector_is_settled (detector));
+    ck_assert (!microtouch3m_settling_detector_is_timed_out (detector));
+    ck_assert_msg (n_settling > 300 && n_settling < 1000, "transient settled after %u samples", (unsigned int) n_settling);
+    ck_assert_uint_eq (microtouch3m_settling_detector_get_n_settling (detector), n_settling);
+    microtouch3m_settling_detector_free (detector);
+}
+END_TEST
+
+/* Chunks of any size settle at the same sample */
+START_TEST (test_settling_chunked)
+{
+    microtouch3m_settling_detector_t *detector;
+    size_t                            n_expected;
+    size_t                            done;
+    size_t                            n;
+
+    fill_signal (500000.0, 50.0);
+    detector = create_detector (0);
+    n_expected = microtouch3m_settling_detector_add (detector, signal_buffer, N_SAMPLES);
+
+    microtouch3m_settling_detector_reset (detector);
+    for (done = 0, n = 1; !microtouch3m_settling_detector_is_settled (detector); done += n, n = (n * 5) % 37 + 1) {
+        size_t n_settling;
+
+        n_settling = microtouch3m_settling_detector_add (detector, &signal_buffer[done * MICROTOUCH3M_SCOPE_N_CORNERS], n);
+        if (n_settling < n) {
+            ck_assert_uint_eq (done + n_settling, n_expected);
+            break;
+        }
+        ck_assert_uint_eq (n_settling, n);
+    }
+    ck_assert (microtouch3m_settling_detector_is_settled (detector));
+    microtouch3m_settling_detector_free (detector);
+}
+END_TEST
+
+/* A signal that keeps drifting times out after the maximum */
+START_TEST (test_settling_timeout)
+{
+    microtouch3m_settling_detector_t *detector;
+    size_t                            i;
+
+    for (i = 0; i < N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS; i++)
+        signal_buffer[i] = (int32_t) (i / MICROTOUCH3M_SCOPE_N_CORNERS) * 100;
+
+    detector = create_detector (500);
+    ck_assert_uint_eq (microtouch3m_settling_detector_add (detector, signal_buffer, N_SAMPLES), 500);
+    ck_assert (microtouch3m_settling_detector_is_settled (detector));
+    ck_assert (microtouch3m_settling_detector_is_timed_out (detector));
+    microtouch3m_settling_detector_free (detector);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("settling");
+
+    tc = tcase_create ("settling-detector");
+    tcase_add_test (tc, test_settling_invalid);
+    tcase_add_test (tc, test_settling_constant);
+    tcase_add_test (tc, test_settling_transient);
+    tcase_add_test (tc, test_settling_chunked);
+    tcase_add_test (tc, test_settling_timeout);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,268 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define N_RANDOM_PAIRS 2000000
+#define MAX_BATCH      67
+
+static uint64_t rand_state = 0x9e3779b97f4a7c15ull;
+
+static uint32_t
+rand_u32 (void)
+{
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 7;
+    rand_state ^= rand_state << 17;
+    return (uint32_t) (rand_state >> 32);
+}
+
+/* floor (sqrt (i^2 + q^2)), exactly */
+static uint64_t
+reference_magnitude (int32_t i,
+                     int32_t q)
+{
+    uint64_t value;
+    uint64_t root;
+
+    value = (uint64_t) ((int64_t) i * i) + (uint64_t) ((int64_t) q * q);
+    root  = (uint64_t) sqrt ((double) value);
+    while (root * root > value)
+        root--;
+    while ((root + 1) * (root + 1) <= value)
+        root++;
+    return root;
+}
+
+static void
+check_magnitudes (const int32_t *i,
+                  const int32_t *q,
+                  size_t         n)
+{
+    uint64_t magnitude[MAX_BATCH];
+    size_t   k;
+
+    microtouch3m_iq_magnitude_batch (i, q, magnitude, n);
+    for (k = 0; k < n; k++)
+        ck_assert_msg (magnitude[k] == reference_magnitude (i[k], q[k]),
+                       "magnitude of (%d, %d): %" PRIu64 " != %" PRIu64,
+                       i[k], q[k], magnitude[k], reference_magnitude (i[k], q[k]));
+}
+
+/******************************************************************************/
+
+START_TEST (test_iq_magnitude_extremes)
+{
+    static const int32_t values[] = {
+        0, 1, -1, 2, -2, 3, 4, 5, 46340, 46341, -46341,
+        0x3fffffff, -0x40000000, 0x7ffffffe, INT32_MAX, -INT32_MAX, INT32_MIN,
+    };
+    int32_t      i[MAX_BATCH];
+    int32_t      q[MAX_BATCH];
+    unsigned int a;
+    unsigned int b;
+    size_t       n = 0;
+
+    for (a = 0; a < sizeof (values) / sizeof (values[0]); a++) {
+        for (b = 0; b < sizeof (values) / sizeof (values[0]); b++) {
+            i[n] = values[a];
+            q[n] = values[b];
+            if (++n == MAX_BATCH) {
+                check_magnitudes (i, q, n);
+                n = 0;
+            }
+        }
+    }
+    check_magnitudes (i, q, n);
+}
+END_TEST
+
+/* Pythagorean triples land exactly on integer magnitudes, and one unit less
+ * in a component lands just below them */
+START_TEST (test_iq_magnitude_perfect_squares)
+{
+    int32_t i[MAX_BATCH];
+    int32_t q[MAX_BATCH];
+    int32_t k;
+    size_t  n = 0;
+
+    for (k = 1; k <= 429496729; k += 7919) {
+        i[n] = 3 * k;     q[n] = 4 * k;     n++;
+        i[n] = 3 * k - 1; q[n] = -4 * k;    n++;
+        i[n] = -3 * k;    q[n] = 4 * k - 1; n++;
+        if (n + 3 > MAX_BATCH) {
+            check_magnitudes (i, q, n);
+            n = 0;
+        }
+    }
+    check_magnitudes (i, q, n);
+}
+END_TEST
+
+/* Batches of every size, so that both the vectorized loop and its tail run */
+START_TEST (test_iq_magnitude_random)
+{
+    int32_t i[MAX_BATCH];
+    int32_t q[MAX_BATCH];
+    size_t  done;
+    size_t  n = 1;
+    size_t  k;
+
+    for (done = 0; done < N_RANDOM_PAIRS; done += n) {
+        n = 1 + (done % MAX_BATCH);
+        for (k = 0; k < n; k++) {
+            /* Small components every other batch */
+            i[k] = (int32_t) rand_u32 () >> ((done & 1) ? 16 : 0);
+            q[k] = (int32_t) rand_u32 () >> ((done & 1) ? 16 : 0);
+        }
+        check_magnitudes (i, q, n);
+    }
+}
+END_TEST
+
+/******************************************************************************/
+
+static int32_t
+reference_signal (int32_t  i,
+                  int32_t  q,
+                  uint64_t stray,
+                  double   scale)
+{
+    double value;
+
+    value = ((double) reference_magnitude (i, q) - (double) stray) * scale;
+    if (value >= (double) INT32_MAX)
+        return INT32_MAX;
+    if (value <= (double) INT32_MIN)
+        return INT32_MIN;
+    return (int32_t) value;
+}
+
+static void
+check_signals (const int32_t  *i,
+               const int32_t  *q,
+               const uint64_t *stray_signal,
+               double          scale,
+               size_t          n_samples)
+{
+    int32_t signal[MAX_BATCH * MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t  k;
+
+    microtouch3m_scope_signal_batch (i, q, stray_signal, scale, signal, n_samples);
+    for (k = 0; k < n_samples * MICROTOUCH3M_SCOPE_N_CORNERS; k++) {
+        int32_t expected;
+
+        expected = reference_signal (i[k], q[k], stray_signal ? stray_signal[k % MICROTOUCH3M_SCOPE_N_CORNERS] : 0, scale);
+        ck_assert_msg (signal[k] == expected,
+                       "signal of (%d, %d) at scale %g: %d != %d", i[k], q[k], scale, signal[k], expected);
+    }
+}
+
+START_TEST (test_scope_signal_random)
+{
+    static const double scales[] = { 1.0, 0.5, 2.0, 1e-3, -1.0 };
+    int32_t             i[MAX_BATCH * MICROTOUCH3M_SCOPE_N_CORNERS];
+    int32_t             q[MAX_BATCH * MICROTOUCH3M_SCOPE_N_CORNERS];
+    uint64_t            stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    unsigned int        s;
+    size_t              n_samples;
+    size_t              k;
+
+    for (s = 0; s < sizeof (scales) / sizeof (scales[0]); s++) {
+        for (n_samples = 1; n_samples <= MAX_BATCH; n_samples++) {
+            for (k = 0; k < n_samples * MICROTOUCH3M_SCOPE_N_CORNERS; k++) {
+                i[k] = (int32_t) rand_u32 () >> (k % 3 ? 8 : 0);
+                q[k] = (int32_t) rand_u32 () >> (k % 3 ? 8 : 0);
+            }
+            for (k = 0; k < MICROTOUCH3M_SCOPE_N_CORNERS; k++)
+                stray_signal[k] = rand_u32 () >> (k * 4);
+
+            check_signals (i, q, NULL, scales[s], n_samples);
+            check_signals (i, q, stray_signal, scales[s], n_samples);
+        }
+    }
+}
+END_TEST
+
+/* Magnitudes reach 2^31.5, out of the int32 range on both sides once the
+ * strays are removed */
+START_TEST (test_scope_signal_saturation)
+{
+    const int32_t  i[MICROTOUCH3M_SCOPE_N_CORNERS] = { INT32_MIN, INT32_MAX, 0,          1 };
+    const int32_t  q[MICROTOUCH3M_SCOPE_N_CORNERS] = { INT32_MIN, INT32_MAX, 0,          0 };
+    const uint64_t stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS] = { 0, 0, 3000000000ull, 0 };
+    int32_t        signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+
+    microtouch3m_scope_signal_batch (i, q, stray_signal, 1.0, signal, 1);
+    ck_assert_int_eq (signal[0], INT32_MAX);
+    ck_assert_int_eq (signal[1], INT32_MAX);
+    ck_assert_int_eq (signal[2], INT32_MIN);
+    ck_assert_int_eq (signal[3], 1);
+
+    check_signals (i, q, stray_signal, 1.0, 1);
+    check_signals (i, q, stray_signal, 0.25, 1);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("signal");
+
+    tc = tcase_create ("iq-magnitude");
+    tcase_set_timeout (tc, 60);
+    tcase_add_test (tc, test_iq_magnitude_extremes);
+    tcase_add_test (tc, test_iq_magnitude_perfect_squares);
+    tcase_add_test (tc, test_iq_magnitude_random);
+    suite_add_tcase (s, tc);
+
+    tc = tcase_create ("scope-signal");
+    tcase_add_test (tc, test_scope_signal_random);
+    tcase_add_test (tc, test_scope_signal_saturation);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
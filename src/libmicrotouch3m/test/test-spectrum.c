@@ -0,0 +1,235 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+#ifndef M_PI
+# define M_PI 3.14159265358979323846
+#endif
+
+/******************************************************************************/
+
+#define SIZE      64
+#define N_BINS    (SIZE / 2 + 1)
+#define N_SAMPLES (SIZE * 20)
+
+#define assert_close(value, expected, tolerance)                        \
+    ck_assert_msg (fabs ((value) - (expected)) <= (tolerance),          \
+                   "%s: %.9g, expected %.9g +/- %g",                    \
+                   #value, (double) (value), (double) (expected), (double) (tolerance))
+
+/* UL: sine at bin 8; UR: constant; LL: sine at bin 20 over an offset; LR: zero */
+static void
+build_signal (int32_t *signal,
+              size_t   n_samples)
+{
+    size_t k;
+
+    for (k = 0; k < n_samples; k++) {
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 0] = (int32_t) lrint (1000.0 * sin (2.0 * M_PI * 8.0 * k / SIZE));
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 1] = 5000;
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 2] = (int32_t) lrint (-70000.0 + 300.0 * cos (2.0 * M_PI * 20.0 * k / SIZE));
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 3] = 0;
+    }
+}
+
+/******************************************************************************/
+
+START_TEST (test_spectrum_sizes)
+{
+    static const unsigned int      invalid[] = { 0, 8, 24, 100, 8192 };
+    microtouch3m_scope_spectrum_t *spectrum;
+    unsigned int                   k;
+
+    for (k = 0; k < sizeof (invalid) / sizeof (invalid[0]); k++)
+        ck_assert_msg (microtouch3m_scope_spectrum_new (invalid[k]) == NULL, "size %u accepted", invalid[k]);
+
+    spectrum = microtouch3m_scope_spectrum_new (MICROTOUCH3M_SCOPE_SPECTRUM_MIN_SIZE);
+    ck_assert (spectrum != NULL);
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_bins (spectrum), MICROTOUCH3M_SCOPE_SPECTRUM_MIN_SIZE / 2 + 1);
+    microtouch3m_scope_spectrum_free (spectrum);
+
+    spectrum = microtouch3m_scope_spectrum_new (MICROTOUCH3M_SCOPE_SPECTRUM_MAX_SIZE);
+    ck_assert (spectrum != NULL);
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_bins (spectrum), MICROTOUCH3M_SCOPE_SPECTRUM_MAX_SIZE / 2 + 1);
+    microtouch3m_scope_spectrum_free (spectrum);
+}
+END_TEST
+
+/* Segments overlap by half */
+START_TEST (test_spectrum_segments)
+{
+    microtouch3m_scope_spectrum_t *spectrum;
+    int32_t                        signal[2 * SIZE * MICROTOUCH3M_SCOPE_N_CORNERS];
+    double                         power[N_BINS];
+    unsigned int                   k;
+
+    build_signal (signal, 2 * SIZE);
+
+    spectrum = microtouch3m_scope_spectrum_new (SIZE);
+    ck_assert (spectrum != NULL);
+
+    microtouch3m_scope_spectrum_add (spectrum, signal, SIZE - 1);
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_segments (spectrum), 0);
+    microtouch3m_scope_spectrum_get (spectrum, 0, power);
+    for (k = 0; k < N_BINS; k++)
+        assert_close (power[k], 0.0, 0.0);
+
+    microtouch3m_scope_spectrum_add (spectrum, &signal[(SIZE - 1) * MICROTOUCH3M_SCOPE_N_CORNERS], 1);
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_segments (spectrum), 1);
+
+    microtouch3m_scope_spectrum_add (spectrum, &signal[SIZE * MICROTOUCH3M_SCOPE_N_CORNERS], SIZE);
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_segments (spectrum), 3);
+
+    microtouch3m_scope_spectrum_reset (spectrum);
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_segments (spectrum), 0);
+    microtouch3m_scope_spectrum_get (spectrum, 0, power);
+    for (k = 0; k < N_BINS; k++)
+        assert_close (power[k], 0.0, 0.0);
+
+    microtouch3m_scope_spectrum_free (spectrum);
+}
+END_TEST
+
+/* Each tone shows up at its bin, the mean is removed, and the bins add up to
+ * the variance of the signal */
+START_TEST (test_spectrum_tones)
+{
+    static const double            variance[MICROTOUCH3M_SCOPE_N_CORNERS] = { 1000.0 * 1000.0 / 2.0, 0.0, 300.0 * 300.0 / 2.0, 0.0 };
+    static const unsigned int      tone[MICROTOUCH3M_SCOPE_N_CORNERS]     = { 8, 0, 20, 0 };
+    microtouch3m_scope_spectrum_t *spectrum;
+    int32_t                       *signal;
+    double                         power[N_BINS];
+    unsigned int                   corner;
+    unsigned int                   k;
+
+    signal = malloc (N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t));
+    ck_assert (signal != NULL);
+    build_signal (signal, N_SAMPLES);
+
+    spectrum = microtouch3m_scope_spectrum_new (SIZE);
+    ck_assert (spectrum != NULL);
+    microtouch3m_scope_spectrum_add (spectrum, signal, N_SAMPLES);
+
+    for (corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; corner++) {
+        double total = 0.0;
+
+        microtouch3m_scope_spectrum_get (spectrum, corner, power);
+        for (k = 0; k < N_BINS; k++)
+            total += power[k];
+
+        if (!tone[corner]) {
+            assert_close (total, 0.0, 1e-6);
+            continue;
+        }
+
+        assert_close (total, variance[corner], variance[corner] * 0.02);
+        for (k = 0; k < N_BINS; k++) {
+            if (k + 1 < tone[corner] || k > tone[corner] + 1)
+                ck_assert_msg (power[k] < variance[corner] * 1e-4, "corner %u: leak at bin %u: %g", corner, k, power[k]);
+            else if (k != tone[corner])
+                ck_assert_msg (power[k] < power[tone[corner]], "corner %u: bin %u above the tone", corner, k);
+        }
+    }
+
+    microtouch3m_scope_spectrum_free (spectrum);
+    free (signal);
+}
+END_TEST
+
+/* Adding in chunks gives the same spectra */
+START_TEST (test_spectrum_chunked)
+{
+    microtouch3m_scope_spectrum_t *whole;
+    microtouch3m_scope_spectrum_t *chunked;
+    int32_t                       *signal;
+    double                         expected[N_BINS];
+    double                         power[N_BINS];
+    unsigned int                   corner;
+    size_t                         done;
+    size_t                         n;
+
+    signal = malloc (N_SAMPLES * MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t));
+    ck_assert (signal != NULL);
+    build_signal (signal, N_SAMPLES);
+
+    whole   = microtouch3m_scope_spectrum_new (SIZE);
+    chunked = microtouch3m_scope_spectrum_new (SIZE);
+    ck_assert (whole != NULL && chunked != NULL);
+
+    microtouch3m_scope_spectrum_add (whole, signal, N_SAMPLES);
+    for (done = 0, n = 1; done < N_SAMPLES; done += n, n = (n * 5) % 41 + 1) {
+        if (n > N_SAMPLES - done)
+            n = N_SAMPLES - done;
+        microtouch3m_scope_spectrum_add (chunked, &signal[done * MICROTOUCH3M_SCOPE_N_CORNERS], n);
+    }
+
+    ck_assert_uint_eq (microtouch3m_scope_spectrum_get_n_segments (whole),
+                       microtouch3m_scope_spectrum_get_n_segments (chunked));
+    for (corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; corner++) {
+        microtouch3m_scope_spectrum_get (whole, corner, expected);
+        microtouch3m_scope_spectrum_get (chunked, corner, power);
+        ck_assert_msg (memcmp (expected, power, sizeof (power)) == 0, "corner %u differs", corner);
+    }
+
+    microtouch3m_scope_spectrum_free (whole);
+    microtouch3m_scope_spectrum_free (chunked);
+    free (signal);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("spectrum");
+
+    tc = tcase_create ("scope-spectrum");
+    tcase_add_test (tc, test_spectrum_sizes);
+    tcase_add_test (tc, test_spectrum_segments);
+    tcase_add_test (tc, test_spectrum_tones);
+    tcase_add_test (tc, test_spectrum_chunked);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
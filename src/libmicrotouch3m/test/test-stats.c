@@ -0,0 +1,235 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define assert_close(value, expected, tolerance)                        \
+    ck_assert_msg (fabs ((value) - (expected)) <= (tolerance),          \
+                   "%s: %.9g, expected %.9g +/- %g",                    \
+                   #value, (double) (value), (double) (expected), (double) (tolerance))
+
+static void
+get_summary (const microtouch3m_scope_stats_t   *stats,
+             microtouch3m_scope_stats_channel_t  channel,
+             microtouch3m_scope_stats_summary_t *summary)
+{
+    memset (summary, 0, sizeof (*summary));
+    microtouch3m_scope_stats_get (stats, channel, summary);
+}
+
+/******************************************************************************/
+
+START_TEST (test_stats_moments)
+{
+    microtouch3m_scope_stats_t         *stats;
+    microtouch3m_scope_stats_summary_t  summary;
+    int32_t                             signal[100 * MICROTOUCH3M_SCOPE_N_CORNERS];
+    int32_t                             k;
+
+    for (k = 0; k < 100; k++) {
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 0] = k + 1;
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 1] = -(k + 1);
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 2] = 7;
+        signal[k * MICROTOUCH3M_SCOPE_N_CORNERS + 3] = 2 * (k + 1);
+    }
+
+    stats = microtouch3m_scope_stats_new ();
+    ck_assert (stats != NULL);
+    microtouch3m_scope_stats_add (stats, signal, 100);
+
+    /* 1..100 */
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_UL, &summary);
+    ck_assert_uint_eq (summary.n_samples, 100);
+    ck_assert_int_eq (summary.min, 1);
+    ck_assert_int_eq (summary.max, 100);
+    assert_close (summary.mean, 50.5, 1e-9);
+    assert_close (summary.variance, 841.0 + 2.0 / 3.0, 1e-9);
+    assert_close (summary.stddev, sqrt (841.0 + 2.0 / 3.0), 1e-9);
+    assert_close (summary.rms, sqrt (3383.5), 1e-9);
+
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_UR, &summary);
+    ck_assert_int_eq (summary.min, -100);
+    ck_assert_int_eq (summary.max, -1);
+    assert_close (summary.mean, -50.5, 1e-9);
+    assert_close (summary.variance, 841.0 + 2.0 / 3.0, 1e-9);
+
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_LL, &summary);
+    ck_assert_int_eq (summary.min, 7);
+    ck_assert_int_eq (summary.max, 7);
+    assert_close (summary.mean, 7.0, 1e-9);
+    assert_close (summary.variance, 0.0, 1e-9);
+    assert_close (summary.p50, 7.0, 1e-9);
+
+    /* 2k + 7 */
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_SUM, &summary);
+    ck_assert_int_eq (summary.min, 9);
+    ck_assert_int_eq (summary.max, 207);
+    assert_close (summary.mean, 108.0, 1e-9);
+    assert_close (summary.variance, 4.0 * (841.0 + 2.0 / 3.0), 1e-9);
+
+    microtouch3m_scope_stats_free (stats);
+}
+END_TEST
+
+/* Up to 13 samples, the percentiles are the nearest ranks */
+START_TEST (test_stats_exact_percentiles)
+{
+    static const int32_t                values[] = { 5, 1, 4, 2, 3 };
+    microtouch3m_scope_stats_t         *stats;
+    microtouch3m_scope_stats_summary_t  summary;
+    int32_t                             signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    unsigned int                        k;
+
+    stats = microtouch3m_scope_stats_new ();
+    ck_assert (stats != NULL);
+
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_UL, &summary);
+    ck_assert_uint_eq (summary.n_samples, 0);
+    assert_close (summary.p50, 0.0, 0.0);
+
+    for (k = 0; k < 5; k++) {
+        signal[0] = signal[1] = signal[2] = signal[3] = values[k];
+        microtouch3m_scope_stats_add (stats, signal, 1);
+    }
+
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_LR, &summary);
+    assert_close (summary.p1,  1.0, 0.0);
+    assert_close (summary.p5,  1.0, 0.0);
+    assert_close (summary.p50, 3.0, 0.0);
+    assert_close (summary.p95, 5.0, 0.0);
+    assert_close (summary.p99, 5.0, 0.0);
+
+    microtouch3m_scope_stats_free (stats);
+}
+END_TEST
+
+/* P-square estimates over a long uniform stream */
+START_TEST (test_stats_estimated_percentiles)
+{
+    microtouch3m_scope_stats_t         *stats;
+    microtouch3m_scope_stats_summary_t  summary;
+    int32_t                             signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    uint32_t                            state = 1;
+    unsigned int                        k;
+
+    stats = microtouch3m_scope_stats_new ();
+    ck_assert (stats != NULL);
+
+    for (k = 0; k < 100000; k++) {
+        state = state * 1664525u + 1013904223u;
+        signal[0] = signal[1] = signal[2] = signal[3] = (int32_t) ((state >> 8) % 1000000);
+        microtouch3m_scope_stats_add (stats, signal, 1);
+    }
+
+    get_summary (stats, MICROTOUCH3M_SCOPE_STATS_CHANNEL_UL, &summary);
+    assert_close (summary.p1,   10000.0, 5000.0);
+    assert_close (summary.p5,   50000.0, 5000.0);
+    assert_close (summary.p50, 500000.0, 10000.0);
+    assert_close (summary.p95, 950000.0, 5000.0);
+    assert_close (summary.p99, 990000.0, 5000.0);
+
+    microtouch3m_scope_stats_free (stats);
+}
+END_TEST
+
+/* Adding in chunks, or after a reset, gives the same results */
+START_TEST (test_stats_chunked_and_reset)
+{
+    microtouch3m_scope_stats_t         *whole;
+    microtouch3m_scope_stats_t         *chunked;
+    microtouch3m_scope_stats_summary_t  expected;
+    microtouch3m_scope_stats_summary_t  summary;
+    int32_t                             signal[1000 * MICROTOUCH3M_SCOPE_N_CORNERS];
+    uint32_t                            state = 7;
+    unsigned int                        channel;
+    size_t                              done;
+    size_t                              k;
+
+    for (k = 0; k < 1000 * MICROTOUCH3M_SCOPE_N_CORNERS; k++) {
+        state = state * 1664525u + 1013904223u;
+        signal[k] = (int32_t) (state >> 4) - 0x08000000;
+    }
+
+    whole   = microtouch3m_scope_stats_new ();
+    chunked = microtouch3m_scope_stats_new ();
+    ck_assert (whole != NULL && chunked != NULL);
+
+    /* Garbage first, discarded by the reset */
+    microtouch3m_scope_stats_add (chunked, &signal[400], 100);
+    microtouch3m_scope_stats_reset (chunked);
+
+    microtouch3m_scope_stats_add (whole, signal, 1000);
+    for (done = 0, k = 1; done < 1000; done += k, k = (k * 3) % 17 + 1) {
+        if (k > 1000 - done)
+            k = 1000 - done;
+        microtouch3m_scope_stats_add (chunked, &signal[done * MICROTOUCH3M_SCOPE_N_CORNERS], k);
+    }
+
+    for (channel = 0; channel < MICROTOUCH3M_SCOPE_STATS_CHANNEL_N; channel++) {
+        get_summary (whole, (microtouch3m_scope_stats_channel_t) channel, &expected);
+        get_summary (chunked, (microtouch3m_scope_stats_channel_t) channel, &summary);
+        ck_assert_msg (memcmp (&expected, &summary, sizeof (summary)) == 0, "channel %u differs", channel);
+    }
+
+    microtouch3m_scope_stats_free (whole);
+    microtouch3m_scope_stats_free (chunked);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("stats");
+
+    tc = tcase_create ("scope-stats");
+    tcase_add_test (tc, test_stats_moments);
+    tcase_add_test (tc, test_stats_exact_percentiles);
+    tcase_add_test (tc, test_stats_estimated_percentiles);
+    tcase_add_test (tc, test_stats_chunked_and_reset);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,224 @@
+/* -*- Mode: C; tab-width: 4; indent-tabs-mode: nil; c-basic-offset: 4 -*- */
+/*
+ * libmicrotouch3m - MicroTouch 3M touchscreen control library
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Aleksander Morgado <aleksander@aleksander.es>
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include <check.h>
+
+#include <microtouch3m.h>
+
+/******************************************************************************/
+
+#define THRESHOLD 10000
+
+#define assert_close(value, expected, tolerance)                        \
+    ck_assert_msg (fabs ((value) - (expected)) <= (tolerance),          \
+                   "%s: %.9g, expected %.9g +/- %g",                    \
+                   #value, (double) (value), (double) (expected), (double) (tolerance))
+
+/* Baseline noise, a touch at (0.25, 0.75) and the release, in UL, UR, LL, LR
+ * order */
+static const int32_t touch_sequence[] = {
+      -50,    20,   -10,    30,
+        0,     0,     0,     0,
+    20000,  5000, 55000, 20000,
+    40000, 10000,110000, 40000,
+       40,   -30,    25,   -60,
+};
+
+#define N_SAMPLES (sizeof (touch_sequence) / (sizeof (touch_sequence[0]) * MICROTOUCH3M_SCOPE_N_CORNERS))
+
+static microtouch3m_touch_estimator_t *
+create_estimator (void)
+{
+    microtouch3m_touch_estimator_t *estimator;
+
+    estimator = microtouch3m_touch_estimator_new ();
+    ck_assert (estimator != NULL);
+    microtouch3m_touch_estimator_set_threshold (estimator, THRESHOLD);
+    return estimator;
+}
+
+/******************************************************************************/
+
+START_TEST (test_touch_sequence)
+{
+    microtouch3m_touch_estimator_t *estimator;
+    microtouch3m_touch_position_t   positions[N_SAMPLES];
+
+    estimator = create_estimator ();
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+
+    /* Baseline: negative corners count as zero, no touch */
+    ck_assert_int_eq (positions[0].strength, 50);
+    ck_assert (!positions[0].touched);
+
+    /* No signal at all falls back to the center */
+    ck_assert_int_eq (positions[1].strength, 0);
+    ck_assert (!positions[1].touched);
+    assert_close (positions[1].x, 0.5, 0.0);
+    assert_close (positions[1].y, 0.5, 0.0);
+
+    /* Touch, at the same position whatever the strength */
+    ck_assert_int_eq (positions[2].strength, 100000);
+    ck_assert (positions[2].touched);
+    assert_close (positions[2].x, 0.25, 1e-12);
+    assert_close (positions[2].y, 0.75, 1e-12);
+    ck_assert_int_eq (positions[3].strength, 200000);
+    ck_assert (positions[3].touched);
+    assert_close (positions[3].x, 0.25, 1e-12);
+    assert_close (positions[3].y, 0.75, 1e-12);
+
+    /* Release */
+    ck_assert_int_eq (positions[4].strength, 65);
+    ck_assert (!positions[4].touched);
+
+    microtouch3m_touch_estimator_free (estimator);
+}
+END_TEST
+
+/* The threshold is inclusive, and a zero threshold still needs some signal */
+START_TEST (test_touch_threshold)
+{
+    microtouch3m_touch_estimator_t *estimator;
+    microtouch3m_touch_position_t   positions[N_SAMPLES];
+
+    estimator = create_estimator ();
+    microtouch3m_touch_estimator_set_threshold (estimator, 100000);
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+    ck_assert (positions[2].touched);
+    microtouch3m_touch_estimator_set_threshold (estimator, 100001);
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+    ck_assert (!positions[2].touched);
+    ck_assert (positions[3].touched);
+
+    microtouch3m_touch_estimator_set_threshold (estimator, 0);
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+    ck_assert (positions[0].touched);
+    ck_assert (!positions[1].touched);
+
+    microtouch3m_touch_estimator_free (estimator);
+}
+END_TEST
+
+/******************************************************************************/
+
+/* Each orientation rotates the screen a quarter turn */
+START_TEST (test_touch_orientation)
+{
+    static const struct {
+        microtouch3m_device_orientation_t orientation;
+        double                            x;
+        double                            y;
+    } expected[] = {
+        { MICROTOUCH3M_DEVICE_ORIENTATION_LL, 0.25, 0.75 },
+        { MICROTOUCH3M_DEVICE_ORIENTATION_UL, 0.75, 0.75 },
+        { MICROTOUCH3M_DEVICE_ORIENTATION_UR, 0.75, 0.25 },
+        { MICROTOUCH3M_DEVICE_ORIENTATION_LR, 0.25, 0.25 },
+    };
+    microtouch3m_touch_estimator_t *estimator;
+    microtouch3m_touch_position_t   positions[N_SAMPLES];
+    unsigned int                    i;
+
+    estimator = create_estimator ();
+    for (i = 0; i < sizeof (expected) / sizeof (expected[0]); i++) {
+        microtouch3m_touch_estimator_set_orientation (estimator, expected[i].orientation);
+        microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+        assert_close (positions[2].x, expected[i].x, 1e-12);
+        assert_close (positions[2].y, expected[i].y, 1e-12);
+        ck_assert (positions[2].touched);
+    }
+    microtouch3m_touch_estimator_free (estimator);
+}
+END_TEST
+
+/* Uniform coefficients shift every position, none restores the raw ones */
+START_TEST (test_touch_linearization)
+{
+    struct microtouch3m_device_linearization_data_s data;
+    microtouch3m_touch_estimator_t                 *estimator;
+    microtouch3m_touch_position_t                   positions[N_SAMPLES];
+    unsigned int                                    row;
+    unsigned int                                    col;
+
+    for (row = 0; row < 5; row++) {
+        for (col = 0; col < 5; col++) {
+            data.items[row][col].x_coef = 64;
+            data.items[row][col].y_coef = -32;
+        }
+    }
+
+    estimator = create_estimator ();
+    microtouch3m_touch_estimator_set_linearization_data (estimator, &data);
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+    assert_close (positions[2].x, 0.25 + 0.125, 1e-12);
+    assert_close (positions[2].y, 0.75 - 0.0625, 1e-12);
+
+    /* A single grid point only moves the positions around it */
+    memset (&data, 0, sizeof (data));
+    data.items[4][4].x_coef = 127;
+    microtouch3m_touch_estimator_set_linearization_data (estimator, &data);
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+    assert_close (positions[2].x, 0.25, 1e-12);
+    assert_close (positions[2].y, 0.75, 1e-12);
+
+    microtouch3m_touch_estimator_set_linearization_data (estimator, NULL);
+    microtouch3m_touch_estimator_process (estimator, touch_sequence, positions, N_SAMPLES);
+    assert_close (positions[2].x, 0.25, 1e-12);
+    assert_close (positions[2].y, 0.75, 1e-12);
+
+    microtouch3m_touch_estimator_free (estimator);
+}
+END_TEST
+
+/******************************************************************************/
+
+int
+main (void)
+{
+    Suite   *s;
+    TCase   *tc;
+    SRunner *sr;
+    int      n_failed;
+
+    s = suite_create ("touch");
+
+    tc = tcase_create ("touch-estimator");
+    tcase_add_test (tc, test_touch_sequence);
+    tcase_add_test (tc, test_touch_threshold);
+    tcase_add_test (tc, test_touch_orientation);
+    tcase_add_test (tc, test_touch_linearization);
+    suite_add_tcase (s, tc);
+
+    sr = srunner_create (s);
+    srunner_run_all (sr, CK_NORMAL);
+    n_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (n_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
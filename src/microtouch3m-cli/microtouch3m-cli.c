@@ -31,14 +31,17 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <assert.h>
+#include <math.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <signal.h>
 #include <inttypes.h>
-#include <math.h>
 #include <time.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #include <common.h>
 
@@ -49,8 +52,6 @@
 
 #define CLEAR_LINE "\33[2K\r"
 
-#define PROCESS_IQ(i,q) (uint64_t) sqrt ((((double)i) * ((double)i)) + (((double)q) * ((double)q)))
-
 /******************************************************************************/
 /* Signals */
 
@@ -68,6 +69,80 @@ setup_signals (void)
     signal (SIGINT, sighandler);
 }
 
+/******************************************************************************/
+/* Helper: transfer statistics */
+
+/* A firmware update reboots the device, so more than one may be used */
+#define MAX_STATS_DEVICES 4
+
+static bool                   stats_enabled;
+static microtouch3m_device_t *stats_devices[MAX_STATS_DEVICES];
+static unsigned int           n_stats_devices;
+
+static void
+stats_track_device (microtouch3m_device_t *dev)
+{
+    if (!stats_enabled || n_stats_devices == MAX_STATS_DEVICES)
+        return;
+    stats_devices[n_stats_devices++] = microtouch3m_device_ref (dev);
+}
+
+static void
+print_transfer_stats (const char                                 *name,
+                      const microtouch3m_device_transfer_stats_t *stats)
+{
+    unsigned int i;
+    bool         first = true;
+
+    if (!stats->n_transfers)
+        return;
+
+    printf ("\t%-28s count %" PRIu64 ", errors %" PRIu64 ", bytes %" PRIu64 ", latency min/avg/max %" PRIu64 "/%" PRIu64 "/%" PRIu64 " us\n",
+            name,
+            stats->n_transfers,
+            stats->n_errors,
+            stats->n_bytes,
+            stats->latency_min_us,
+            stats->latency_total_us / stats->n_transfers,
+            stats->latency_max_us);
+
+    printf ("\t%-28s ", "");
+    for (i = 0; i < MICROTOUCH3M_DEVICE_STATS_LATENCY_BUCKETS; i++) {
+        if (!stats->latency_histogram[i])
+            continue;
+        if (i < MICROTOUCH3M_DEVICE_STATS_LATENCY_BUCKETS - 1)
+            printf ("%s<%uus: %" PRIu64, first ? "" : ", ", MICROTOUCH3M_LATENCY_BUCKET_BASE_US << i, stats->latency_histogram[i]);
+        else
+            printf ("%s>=%uus: %" PRIu64, first ? "" : ", ", MICROTOUCH3M_LATENCY_BUCKET_BASE_US << (i - 1), stats->latency_histogram[i]);
+        first = false;
+    }
+    printf ("\n");
+}
+
+static void
+print_stats (void)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < n_stats_devices; i++) {
+        microtouch3m_device_stats_t stats;
+
+        microtouch3m_device_get_stats (stats_devices[i], &stats);
+        printf ("microtouch 3m device %03u:%03u transfer statistics:\n",
+                microtouch3m_device_get_usb_bus_number (stats_devices[i]),
+                microtouch3m_device_get_usb_device_address (stats_devices[i]));
+        for (j = 0; j < MICROTOUCH3M_DEVICE_STATS_MAX_REQUESTS; j++) {
+            char name[32];
+
+            snprintf (name, sizeof (name), "%s (0x%02x)", microtouch3m_trace_request_to_string (j), j);
+            print_transfer_stats (name, &stats.control[j]);
+        }
+        print_transfer_stats ("interrupt", &stats.interrupt);
+        microtouch3m_device_unref (stats_devices[i]);
+    }
+    n_stats_devices = 0;
+}
+
 /******************************************************************************/
 /* Helper: create device based on bus (or first found) */
 
@@ -118,6 +193,7 @@ create_device (microtouch3m_context_t *ctx,
         return NULL;
     }
 
+    stats_track_device (dev);
     return dev;
 }
 
@@ -197,40 +273,627 @@ timespec_diff (struct timespec *start,
     }
 }
 
+/******************************************************************************/
+/* Helper: metrics endpoint */
+
+/* Counters are updated from the report callbacks with atomic operations only,
+ * and read by the server thread whenever a client connects, so serving a
+ * snapshot never blocks the monitoring. Plain 64-bit loads and stores may tear
+ * on 32-bit targets, so those go through atomic operations as well. */
+
+#define METRICS_BUFFER_SIZE       8192
+#define METRICS_REQUEST_WAIT_MS   100
+#define METRICS_POLL_PERIOD_MS    200
+
+enum {
+    METRICS_CORNER_UL,
+    METRICS_CORNER_UR,
+    METRICS_CORNER_LL,
+    METRICS_CORNER_LR,
+    METRICS_CORNER_N
+};
+
+static const char *metrics_corner_str[METRICS_CORNER_N] = {
+    [METRICS_CORNER_UL] = "ul",
+    [METRICS_CORNER_UR] = "ur",
+    [METRICS_CORNER_LL] = "ll",
+    [METRICS_CORNER_LR] = "lr",
+};
+
+struct metrics_corner_s {
+    volatile uint64_t n_samples;
+    volatile int64_t  last;
+    volatile int64_t  min;
+    volatile int64_t  max;
+    volatile int64_t  sum;
+};
+
+#define METRICS_LOAD(value) __sync_fetch_and_add (&(value), 0)
+
+static void
+metrics_store (volatile int64_t *value,
+               int64_t           new_value)
+{
+    int64_t current;
+
+    do {
+        current = METRICS_LOAD (*value);
+    } while (!__sync_bool_compare_and_swap (value, current, new_value));
+}
+
+static int                      metrics_fd = -1;
+static char                    *metrics_path;
+static pthread_t                metrics_thread;
+static volatile bool            metrics_stop;
+static struct timespec          metrics_start;
+static volatile uint64_t        metrics_n_reports;
+static volatile uint64_t        metrics_n_failed_reports;
+static struct metrics_corner_s  metrics_corners[METRICS_CORNER_N];
+/* Device being monitored, only used by the server thread */
+static pthread_mutex_t          metrics_dev_mutex = PTHREAD_MUTEX_INITIALIZER;
+static microtouch3m_device_t   *metrics_dev;
+
+static void
+metrics_set_device (microtouch3m_device_t *dev)
+{
+    if (metrics_fd < 0)
+        return;
+
+    pthread_mutex_lock (&metrics_dev_mutex);
+    if (metrics_dev)
+        microtouch3m_device_unref (metrics_dev);
+    metrics_dev = (dev ? microtouch3m_device_ref (dev) : NULL);
+    pthread_mutex_unlock (&metrics_dev_mutex);
+}
+
+static void
+metrics_add_report (microtouch3m_status_t status,
+                    int64_t               ul_signal,
+                    int64_t               ur_signal,
+                    int64_t               ll_signal,
+                    int64_t               lr_signal)
+{
+    int64_t      values[METRICS_CORNER_N];
+    int64_t      current;
+    unsigned int i;
+
+    if (metrics_fd < 0)
+        return;
+
+    /* Failed reports carry no signal values */
+    if (status != MICROTOUCH3M_STATUS_OK) {
+        __sync_fetch_and_add (&metrics_n_failed_reports, 1);
+        return;
+    }
+
+    values[METRICS_CORNER_UL] = ul_signal;
+    values[METRICS_CORNER_UR] = ur_signal;
+    values[METRICS_CORNER_LL] = ll_signal;
+    values[METRICS_CORNER_LR] = lr_signal;
+
+    for (i = 0; i < METRICS_CORNER_N; i++) {
+        struct metrics_corner_s *corner = &metrics_corners[i];
+
+        metrics_store (&corner->last, values[i]);
+        __sync_fetch_and_add (&corner->sum, values[i]);
+        __sync_fetch_and_add (&corner->n_samples, 1);
+        while ((values[i] < (current = METRICS_LOAD (corner->min))) &&
+               !__sync_bool_compare_and_swap (&corner->min, current, values[i]));
+        while ((values[i] > (current = METRICS_LOAD (corner->max))) &&
+               !__sync_bool_compare_and_swap (&corner->max, current, values[i]));
+    }
+    __sync_fetch_and_add (&metrics_n_reports, 1);
+}
+
+#define METRICS_APPEND(...) do {                                        \
+        if (len < size)                                                 \
+            len += snprintf (&buffer[len], size - len, __VA_ARGS__);   \
+    } while (0)
+
+#define METRICS_HEADER(name, type, help)                                \
+    METRICS_APPEND ("# HELP " name " " help "\n"                        \
+                    "# TYPE " name " " type "\n")
+
+static size_t
+metrics_format (char   *buffer,
+                size_t  size)
+{
+    size_t                                   len = 0;
+    unsigned int                             i;
+    struct timespec                          current;
+    struct timespec                          difference;
+    bool                                     have_dev = false;
+    microtouch3m_device_stats_t              stats;
+    microtouch3m_device_async_report_stats_t report_stats;
+    uint64_t                                 control_errors = 0;
+
+    pthread_mutex_lock (&metrics_dev_mutex);
+    if (metrics_dev) {
+        microtouch3m_device_get_stats (metrics_dev, &stats);
+        microtouch3m_device_get_async_report_stats (metrics_dev, &report_stats);
+        have_dev = true;
+    }
+    pthread_mutex_unlock (&metrics_dev_mutex);
+
+    clock_gettime (CLOCK_MONOTONIC, &current);
+    timespec_diff (&metrics_start, &current, &difference);
+
+    METRICS_HEADER ("microtouch3m_uptime_seconds", "gauge", "Time since the metrics endpoint was started.");
+    METRICS_APPEND ("microtouch3m_uptime_seconds %lf\n", difference.tv_sec + (difference.tv_nsec / 1E9));
+
+    METRICS_HEADER ("microtouch3m_reports_total", "counter", "Scope reports processed.");
+    METRICS_APPEND ("microtouch3m_reports_total %" PRIu64 "\n", METRICS_LOAD (metrics_n_reports));
+
+    METRICS_HEADER ("microtouch3m_reports_failed_total", "counter", "Scope reports dropped because of transfer failures.");
+    METRICS_APPEND ("microtouch3m_reports_failed_total %" PRIu64 "\n", METRICS_LOAD (metrics_n_failed_reports));
+
+    METRICS_HEADER ("microtouch3m_signal", "gauge", "Last signal value per corner.");
+    for (i = 0; i < METRICS_CORNER_N; i++)
+        METRICS_APPEND ("microtouch3m_signal{corner=\"%s\"} %" PRId64 "\n", metrics_corner_str[i], METRICS_LOAD (metrics_corners[i].last));
+
+    METRICS_HEADER ("microtouch3m_signal_min", "gauge", "Minimum signal value per corner.");
+    for (i = 0; i < METRICS_CORNER_N; i++) {
+        if (METRICS_LOAD (metrics_corners[i].n_samples))
+            METRICS_APPEND ("microtouch3m_signal_min{corner=\"%s\"} %" PRId64 "\n", metrics_corner_str[i], METRICS_LOAD (metrics_corners[i].min));
+    }
+
+    METRICS_HEADER ("microtouch3m_signal_max", "gauge", "Maximum signal value per corner.");
+    for (i = 0; i < METRICS_CORNER_N; i++) {
+        if (METRICS_LOAD (metrics_corners[i].n_samples))
+            METRICS_APPEND ("microtouch3m_signal_max{corner=\"%s\"} %" PRId64 "\n", metrics_corner_str[i], METRICS_LOAD (metrics_corners[i].max));
+    }
+
+    METRICS_HEADER ("microtouch3m_signal_sum", "gauge", "Sum of all signal values per corner.");
+    for (i = 0; i < METRICS_CORNER_N; i++)
+        METRICS_APPEND ("microtouch3m_signal_sum{corner=\"%s\"} %" PRId64 "\n", metrics_corner_str[i], METRICS_LOAD (metrics_corners[i].sum));
+
+    METRICS_HEADER ("microtouch3m_signal_count", "counter", "Number of signal values per corner.");
+    for (i = 0; i < METRICS_CORNER_N; i++)
+        METRICS_APPEND ("microtouch3m_signal_count{corner=\"%s\"} %" PRIu64 "\n", metrics_corner_str[i], METRICS_LOAD (metrics_corners[i].n_samples));
+
+    if (!have_dev)
+        return len;
+
+    METRICS_HEADER ("microtouch3m_report_rate_hz", "gauge", "Scope report rate during the last second.");
+    METRICS_APPEND ("microtouch3m_report_rate_hz %f\n", report_stats.report_rate);
+
+    METRICS_HEADER ("microtouch3m_report_interval_p99_seconds", "gauge", "99th percentile of the time between scope reports.");
+    METRICS_APPEND ("microtouch3m_report_interval_p99_seconds %lf\n", report_stats.interval_p99_us / 1E6);
+
+    METRICS_HEADER ("microtouch3m_short_transfers_total", "counter", "Interrupt transfers with less data than expected.");
+    METRICS_APPEND ("microtouch3m_short_transfers_total %" PRIu64 "\n", report_stats.n_short_transfers);
+
+    METRICS_HEADER ("microtouch3m_transfer_timeouts_total", "counter", "Interrupt transfers that timed out.");
+    METRICS_APPEND ("microtouch3m_transfer_timeouts_total %" PRIu64 "\n", report_stats.n_timeouts);
+
+    for (i = 0; i < MICROTOUCH3M_DEVICE_STATS_MAX_REQUESTS; i++)
+        control_errors += stats.control[i].n_errors;
+
+    METRICS_HEADER ("microtouch3m_usb_errors_total", "counter", "USB transfers failed, including timeouts.");
+    METRICS_APPEND ("microtouch3m_usb_errors_total{transfer=\"control\"} %" PRIu64 "\n", control_errors);
+    METRICS_APPEND ("microtouch3m_usb_errors_total{transfer=\"interrupt\"} %" PRIu64 "\n", stats.interrupt.n_errors);
+
+    return len;
+}
+
+#undef METRICS_HEADER
+#undef METRICS_APPEND
+
+static void
+metrics_serve_client (int fd)
+{
+    char          buffer[METRICS_BUFFER_SIZE];
+    char          request[256];
+    const char   *header = "";
+    size_t        len;
+    ssize_t       n_read = 0;
+    struct pollfd pfd;
+
+    /* Plain clients (e.g. socat) may not send anything at all; HTTP clients
+     * (e.g. curl --unix-socket) send a request first and expect a response
+     * header */
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    if (poll (&pfd, 1, METRICS_REQUEST_WAIT_MS) > 0)
+        n_read = read (fd, request, sizeof (request));
+    if (n_read >= 4 && strncmp (request, "GET ", 4) == 0)
+        header = ("HTTP/1.0 200 OK\r\n"
+                  "Content-Type: text/plain; version=0.0.4\r\n"
+                  "\r\n");
+
+    len = metrics_format (buffer, sizeof (buffer));
+    if (len >= sizeof (buffer))
+        len = sizeof (buffer) - 1;
+
+    /* MSG_NOSIGNAL: a client that goes away without reading must not kill
+     * the whole process with SIGPIPE */
+    if (send (fd, header, strlen (header), MSG_NOSIGNAL) < 0 || send (fd, buffer, len, MSG_NOSIGNAL) < 0) {
+        /* Client gone, nothing to report */
+        if (errno == EPIPE || errno == ECONNRESET)
+            return;
+        fprintf (stderr, "warning: couldn't write metrics: %s\n", strerror (errno));
+    }
+}
+
+static void *
+metrics_thread_func (void *user_data)
+{
+    struct pollfd pfd;
+    int           fd;
+
+    pfd.fd     = metrics_fd;
+    pfd.events = POLLIN;
+
+    while (!metrics_stop) {
+        if (poll (&pfd, 1, METRICS_POLL_PERIOD_MS) <= 0)
+            continue;
+        if ((fd = accept (metrics_fd, NULL, NULL)) < 0)
+            continue;
+        metrics_serve_client (fd);
+        close (fd);
+    }
+    return NULL;
+}
+
+static bool
+metrics_start_server (const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat        st;
+    unsigned int       i;
+    int                probe_fd;
+
+    if (strlen (path) >= sizeof (addr.sun_path)) {
+        fprintf (stderr, "error: metrics socket path too long\n");
+        return false;
+    }
+
+    memset (&addr, 0, sizeof (addr));
+    addr.sun_family = AF_UNIX;
+    strcpy (addr.sun_path, path);
+
+    /* Only replace stale sockets, never regular files nor the socket of
+     * another running instance: nobody listening means stale */
+    if (stat (path, &st) == 0) {
+        if (!S_ISSOCK (st.st_mode)) {
+            fprintf (stderr, "error: metrics socket path exists and is not a socket\n");
+            return false;
+        }
+        if ((probe_fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+            fprintf (stderr, "error: couldn't create metrics socket: %s\n", strerror (errno));
+            return false;
+        }
+        if (connect (probe_fd, (struct sockaddr *) &addr, sizeof (addr)) == 0) {
+            fprintf (stderr, "error: metrics socket already in use\n");
+            close (probe_fd);
+            return false;
+        }
+        if (errno != ECONNREFUSED) {
+            fprintf (stderr, "error: couldn't check metrics socket: %s\n", strerror (errno));
+            close (probe_fd);
+            return false;
+        }
+        close (probe_fd);
+        unlink (path);
+    }
+
+    if ((metrics_fd = socket (AF_UNIX, SOCK_STREAM, 0)) < 0) {
+        fprintf (stderr, "error: couldn't create metrics socket: %s\n", strerror (errno));
+        return false;
+    }
+
+    if (bind (metrics_fd, (struct sockaddr *) &addr, sizeof (addr)) < 0 ||
+        listen (metrics_fd, 4) < 0) {
+        fprintf (stderr, "error: couldn't listen on metrics socket: %s\n", strerror (errno));
+        goto err;
+    }
+
+    for (i = 0; i < METRICS_CORNER_N; i++) {
+        metrics_corners[i].min = INT64_MAX;
+        metrics_corners[i].max = INT64_MIN;
+    }
+    clock_gettime (CLOCK_MONOTONIC, &metrics_start);
+
+    if (pthread_create (&metrics_thread, NULL, metrics_thread_func, NULL) != 0) {
+        fprintf (stderr, "error: couldn't start metrics thread\n");
+        unlink (path);
+        goto err;
+    }
+
+    metrics_path = strdup (path);
+    return true;
+
+err:
+    close (metrics_fd);
+    metrics_fd = -1;
+    return false;
+}
+
+static void
+metrics_stop_server (void)
+{
+    if (metrics_fd < 0)
+        return;
+
+    metrics_stop = true;
+    pthread_join (metrics_thread, NULL);
+    metrics_set_device (NULL);
+    close (metrics_fd);
+    metrics_fd = -1;
+    unlink (metrics_path);
+    free (metrics_path);
+    metrics_path = NULL;
+}
+
 /******************************************************************************/
 /* Helper: firmware progress reporting */
 
 static bool disable_progress;
 
 static void
-firmware_progress (microtouch3m_device_t *dev,
-                   float                  progress,
-                   void                  *user_data)
+firmware_progress (microtouch3m_device_t                              *dev,
+                   const microtouch3m_device_firmware_progress_info_t *info,
+                   void                                               *user_data)
 {
+    unsigned int i;
+
     if (disable_progress)
         return;
 
-    printf (CLEAR_LINE " %.2f%%", progress);
+    printf (CLEAR_LINE " %.2f%% (%zu/%zu bytes, %.2f KiB/s, average %.2f KiB/s, ETA %.1fs)",
+            info->progress,
+            info->bytes_transferred,
+            info->bytes_total,
+            info->throughput / 1024.0,
+            info->average_throughput / 1024.0,
+            info->eta_us / 1000000.0);
+
+    /* On the last report, also show how long each transfer took */
+    if (info->bytes_transferred == info->bytes_total) {
+        printf ("\n %u transfers in %.2fs, latency min %" PRIu64 "us, max %" PRIu64 "us",
+                info->n_transfers,
+                info->elapsed_us / 1000000.0,
+                info->latency_min_us,
+                info->latency_max_us);
+        for (i = 0; i < MICROTOUCH3M_FW_PROGRESS_LATENCY_BUCKETS; i++) {
+            if (!info->latency_histogram[i])
+                continue;
+            if (i < MICROTOUCH3M_FW_PROGRESS_LATENCY_BUCKETS - 1)
+                printf ("\n\t<  %6uus: %u", MICROTOUCH3M_LATENCY_BUCKET_BASE_US << i, info->latency_histogram[i]);
+            else
+                printf ("\n\t>= %6uus: %u", MICROTOUCH3M_LATENCY_BUCKET_BASE_US << (i - 1), info->latency_histogram[i]);
+        }
+    }
     fflush (stdout);
 }
 
+/******************************************************************************/
+/* Helper: firmware file formats */
+
+/* Binary firmware images are selected by file extension, everything else is
+ * treated as an Intel HEX firmware file */
+static bool
+firmware_path_is_image (const char *path)
+{
+    size_t path_len;
+    size_t extension_len;
+
+    path_len = strlen (path);
+    extension_len = strlen (MICROTOUCH3M_FW_IMAGE_FILE_EXTENSION);
+    return (path_len > extension_len && strcasecmp (&path[path_len - extension_len], MICROTOUCH3M_FW_IMAGE_FILE_EXTENSION) == 0);
+}
+
+static microtouch3m_status_t
+firmware_path_read (const char                         *path,
+                    uint8_t                            *buffer,
+                    size_t                              buffer_size,
+                    microtouch3m_firmware_image_info_t *info,
+                    bool                               *info_available)
+{
+    if (firmware_path_is_image (path)) {
+        if (info_available)
+            *info_available = true;
+        return microtouch3m_firmware_image_read (path, buffer, buffer_size, info);
+    }
+
+    if (info_available)
+        *info_available = false;
+    return microtouch3m_firmware_file_read (path, buffer, buffer_size);
+}
+
+static void
+print_firmware_image_info (const microtouch3m_firmware_image_info_t *info)
+{
+    printf ("firmware image info:\n");
+    printf ("\tcontroller type:    0x%04x\n", info->controller_type);
+    printf ("\tfirmware major:     0x%02x\n", info->firmware_major);
+    printf ("\tfirmware minor:     0x%02x\n", info->firmware_minor);
+    printf ("\tconstants checksum: 0x%04x\n", info->constants_checksum);
+    printf ("\tpc checksum:        0x%08x\n", info->pc_checksum);
+    printf ("\tasic type:          0x%04x\n", info->asic_type);
+    printf ("\timage checksum:     0x%08x\n", info->image_checksum);
+}
+
 /******************************************************************************/
 /* ACTION: validate file */
 
 static int
 run_validate_fw_file (const char *path)
 {
-    microtouch3m_status_t st;
+    microtouch3m_status_t              st;
+    microtouch3m_firmware_image_info_t info;
+    bool                               info_available;
 
-    if ((st = microtouch3m_firmware_file_read (path, NULL, 0)) != MICROTOUCH3M_STATUS_OK) {
+    if ((st = firmware_path_read (path, NULL, 0, &info, &info_available)) != MICROTOUCH3M_STATUS_OK) {
         fprintf (stderr, "error: couldn't validate firmware file: %s\n", microtouch3m_status_to_string (st));
         return EXIT_FAILURE;
     }
 
+    if (info_available)
+        print_firmware_image_info (&info);
+
     printf ("successfully validated firmware file\n");
     return EXIT_SUCCESS;
 }
 
+/******************************************************************************/
+/* ACTION: trace decode */
+
+struct trace_stats_s {
+    unsigned int n_transfers;
+    unsigned int n_errors;
+    uint64_t     n_bytes;
+    uint64_t     latency_total_us;
+    uint32_t     latency_min_us;
+    uint32_t     latency_max_us;
+};
+
+struct trace_decode_context_s {
+    bool                 print_records;
+    unsigned int         n_records;
+    uint64_t             last_timestamp_us;
+    struct trace_stats_s control [256];
+    struct trace_stats_s interrupt;
+};
+
+static void
+trace_stats_add (struct trace_stats_s              *stats,
+                 const microtouch3m_trace_record_t *record)
+{
+    if (!stats->n_transfers || record->latency_us < stats->latency_min_us)
+        stats->latency_min_us = record->latency_us;
+    if (record->latency_us > stats->latency_max_us)
+        stats->latency_max_us = record->latency_us;
+    stats->latency_total_us += record->latency_us;
+    stats->n_transfers++;
+    if (record->result < 0)
+        stats->n_errors++;
+    else
+        stats->n_bytes += record->result;
+}
+
+static void
+trace_stats_print (const char                 *name,
+                   const struct trace_stats_s *stats)
+{
+    if (!stats->n_transfers)
+        return;
+
+    printf ("  %-28s %8u %8u %10" PRIu64 " %8u %8" PRIu64 " %8u\n",
+            name,
+            stats->n_transfers,
+            stats->n_errors,
+            stats->n_bytes,
+            stats->latency_min_us,
+            stats->latency_total_us / stats->n_transfers,
+            stats->latency_max_us);
+}
+
+static bool
+trace_record_cb (const microtouch3m_trace_record_t *record,
+                 void                              *user_data)
+{
+    struct trace_decode_context_s *ctx = user_data;
+
+    ctx->n_records++;
+    ctx->last_timestamp_us = record->timestamp_us;
+
+    if (record->type == MICROTOUCH3M_TRACE_TRANSFER_CONTROL)
+        trace_stats_add (&ctx->control[record->request], record);
+    else
+        trace_stats_add (&ctx->interrupt, record);
+
+    if (!ctx->print_records)
+        return true;
+
+    printf ("[%12.6lf] %03u:%03u ", (double) record->timestamp_us / 1000000.0, record->bus_number, record->device_address);
+    if (record->type == MICROTOUCH3M_TRACE_TRANSFER_CONTROL)
+        printf ("control   %-3s %s (0x%02x) value 0x%04x index 0x%04x length %u: ",
+                (record->request_type & 0x80) ? "in" : "out",
+                microtouch3m_trace_request_to_string (record->request),
+                record->request,
+                record->value,
+                record->index,
+                record->length);
+    else
+        printf ("interrupt in  endpoint 0x%02x length %u: ",
+                record->request_type,
+                record->length);
+
+    if (record->result < 0)
+        printf ("%s", microtouch3m_trace_result_to_string (record->result));
+    else
+        printf ("%d bytes", record->result);
+    printf (" (%u us)\n", record->latency_us);
+
+    if (record->payload_size) {
+        char *hex;
+
+        hex = strhex (record->payload, record->payload_size, ":");
+        printf ("               %s\n", hex ? hex : "");
+        free (hex);
+    }
+
+    return true;
+}
+
+static int
+run_trace_decode (const char *path,
+                  bool        print_records)
+{
+    microtouch3m_status_t          st;
+    microtouch3m_trace_info_t      info;
+    struct trace_decode_context_s *ctx;
+    time_t                         start_time;
+    char                           start_time_str[64];
+    unsigned int                   i;
+    int                            ret = EXIT_FAILURE;
+
+    if (!(ctx = calloc (1, sizeof (struct trace_decode_context_s)))) {
+        fprintf (stderr, "error: couldn't allocate memory\n");
+        return EXIT_FAILURE;
+    }
+    ctx->print_records = print_records;
+
+    st = microtouch3m_trace_file_read (path, &info, trace_record_cb, ctx);
+    if (st != MICROTOUCH3M_STATUS_OK && !ctx->n_records) {
+        fprintf (stderr, "error: couldn't read trace file: %s\n", microtouch3m_status_to_string (st));
+        goto out;
+    }
+
+    if (print_records)
+        printf ("\n");
+
+    start_time = info.start_time_us / 1000000;
+    if (!strftime (start_time_str, sizeof (start_time_str), "%Y-%m-%d %H:%M:%S", localtime (&start_time)))
+        start_time_str[0] = '\0';
+
+    printf ("trace started:   %s\n", start_time_str);
+    printf ("trace duration:  %.3lf s\n", (double) ctx->last_timestamp_us / 1000000.0);
+    printf ("records:         %u\n", ctx->n_records);
+    printf ("dropped records: %u\n", info.dropped_records);
+    printf ("\n");
+    printf ("  %-28s %8s %8s %10s %8s %8s %8s\n", "transfer", "count", "errors", "bytes", "min us", "avg us", "max us");
+    for (i = 0; i < (sizeof (ctx->control) / sizeof (ctx->control[0])); i++) {
+        char name[32];
+
+        snprintf (name, sizeof (name), "%s (0x%02x)", microtouch3m_trace_request_to_string (i), i);
+        trace_stats_print (name, &ctx->control[i]);
+    }
+    trace_stats_print ("interrupt", &ctx->interrupt);
+
+    if (st != MICROTOUCH3M_STATUS_OK) {
+        fprintf (stderr, "error: trace file is incomplete: %s\n", microtouch3m_status_to_string (st));
+        goto out;
+    }
+
+    ret = EXIT_SUCCESS;
+
+out:
+    free (ctx);
+    return ret;
+}
+
 /******************************************************************************/
 /* ACTION: list */
 
@@ -347,41 +1010,25 @@ run_info (microtouch3m_context_t *ctx,
     /* Stray capacitances */
     printf ("stray capacitances:\n");
     do {
-        int32_t  ul_stray_i;
-        int32_t  ul_stray_q;
-        int32_t  ur_stray_i;
-        int32_t  ur_stray_q;
-        int32_t  ll_stray_i;
-        int32_t  ll_stray_q;
-        int32_t  lr_stray_i;
-        int32_t  lr_stray_q;
-        uint64_t ul_stray_signal;
-        uint64_t ur_stray_signal;
-        uint64_t ll_stray_signal;
-        uint64_t lr_stray_signal;
+        int32_t  stray_i[MICROTOUCH3M_SCOPE_N_CORNERS];
+        int32_t  stray_q[MICROTOUCH3M_SCOPE_N_CORNERS];
+        uint64_t stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
 
         if ((st = microtouch3m_read_strays (dev,
-                                            &ul_stray_i,
-                                            &ul_stray_q,
-                                            &ur_stray_i,
-                                            &ur_stray_q,
-                                            &ll_stray_i,
-                                            &ll_stray_q,
-                                            &lr_stray_i,
-                                            &lr_stray_q)) != MICROTOUCH3M_STATUS_OK) {
+                                            &stray_i[0], &stray_q[0],
+                                            &stray_i[1], &stray_q[1],
+                                            &stray_i[2], &stray_q[2],
+                                            &stray_i[3], &stray_q[3])) != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't read stray capacitances: %s\n", microtouch3m_status_to_string (st));
             break;
         }
 
-        ul_stray_signal = PROCESS_IQ (ul_stray_i, ul_stray_q);
-        ur_stray_signal = PROCESS_IQ (ur_stray_i, ur_stray_q);
-        ll_stray_signal = PROCESS_IQ (ll_stray_i, ll_stray_q);
-        lr_stray_signal = PROCESS_IQ (lr_stray_i, lr_stray_q);
+        microtouch3m_iq_magnitude_batch (stray_i, stray_q, stray_signal, MICROTOUCH3M_SCOPE_N_CORNERS);
 
-        printf ("\tUL: %8" PRIu64 "\n", ul_stray_signal);
-        printf ("\tUR: %8" PRIu64 "\n", ur_stray_signal);
-        printf ("\tLL: %8" PRIu64 "\n", ll_stray_signal);
-        printf ("\tLR: %8" PRIu64 "\n", lr_stray_signal);
+        printf ("\tUL: %8" PRIu64 "\n", stray_signal[0]);
+        printf ("\tUR: %8" PRIu64 "\n", stray_signal[1]);
+        printf ("\tLL: %8" PRIu64 "\n", stray_signal[2]);
+        printf ("\tLR: %8" PRIu64 "\n", stray_signal[3]);
     } while (0);
 
     /* Now several settings */
@@ -915,93 +1562,263 @@ out:
 /******************************************************************************/
 /* ACTION: frequency check */
 
-/* Ignore the first 5 records. At least the first one seems to have some
- * huge signal values reported that we should better ignore.
- */
-#define FREQUENCY_CHECK_IGNORE_FIRST_N_RECORDS 5
+/* Records given while the controller settles, e.g. right after a reset, have
+ * some huge signal values that we should better ignore. The controller is
+ * considered settled once two consecutive windows of 32 records have a similar
+ * variance, and the last one doesn't drift more than its standard deviation;
+ * or after 500 records anyway. */
+#define SETTLING_WINDOW          32
+#define SETTLING_SLOPE_THRESHOLD 1.0
+#define SETTLING_VARIANCE_RATIO  4.0
+#define SETTLING_MAX_RECORDS     500
 
 /* Duration of the check for each frequency */
 #define FREQUENCY_CHECK_TIMEOUT_S 5
 
+/* In adaptive mode, the measurement of a frequency stops as soon as its noise,
+ * i.e. the total of the per-corner standard deviations, is known within the
+ * given relative confidence interval, or as soon as it is clearly worse than
+ * the best frequency found so far.
+ *
+ * The interval is estimated with batch means: the records are split in blocks,
+ * the noise is computed for each block, and the spread of those values tells
+ * how stable the measurement really is. No noise distribution is assumed, so
+ * interference that comes and goes, or that is periodic over longer than a
+ * block, widens the interval and the check runs longer. */
+#define FREQUENCY_CHECK_ADAPTIVE_BLOCK_RECORDS 20
+#define FREQUENCY_CHECK_ADAPTIVE_MIN_BLOCKS    10
+#define FREQUENCY_CHECK_ADAPTIVE_Z             1.96 /* 95% confidence */
+#define FREQUENCY_CHECK_ADAPTIVE_TOLERANCE     0.10
+
+typedef enum {
+    FREQUENCY_CHECK_END_TIMEOUT,
+    FREQUENCY_CHECK_END_CONVERGED,
+    FREQUENCY_CHECK_END_DROPPED,
+    FREQUENCY_CHECK_END_DATA,
+} frequency_check_end_t;
+
+static const char *frequency_check_end_str[] = {
+    [FREQUENCY_CHECK_END_TIMEOUT]   = "timeout",
+    [FREQUENCY_CHECK_END_CONVERGED] = "converged",
+    [FREQUENCY_CHECK_END_DROPPED]   = "dropped, clearly worse than the best one",
+    [FREQUENCY_CHECK_END_DATA]      = "no more replayed data",
+};
+
+/* Valid reports are processed in batches of one adaptive block, so that the
+ * adaptive checks run at the same points as with one report at a time */
+#define FREQUENCY_CHECK_BATCH_SIZE   FREQUENCY_CHECK_ADAPTIVE_BLOCK_RECORDS
+#define FREQUENCY_CHECK_BATCH_VALUES (FREQUENCY_CHECK_BATCH_SIZE * MICROTOUCH3M_SCOPE_N_CORNERS)
+
 struct async_report_frequency_check_context_s {
-    struct timespec start;
-    unsigned long   n_records;
-    uint64_t        ul_stray_signal;
-    uint64_t        ur_stray_signal;
-    uint64_t        ll_stray_signal;
-    uint64_t        lr_stray_signal;
-    int64_t         ul_min_corrected_signal;
-    int64_t         ur_min_corrected_signal;
-    int64_t         ll_min_corrected_signal;
-    int64_t         lr_min_corrected_signal;
-    int64_t         ul_max_corrected_signal;
-    int64_t         ur_max_corrected_signal;
-    int64_t         ll_max_corrected_signal;
-    int64_t         lr_max_corrected_signal;
+    struct timespec                   start;
+    unsigned long                     n_records;
+    uint64_t                          stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    microtouch3m_scope_stats_t       *stats;
+    microtouch3m_settling_detector_t *settling;
+
+    /* pending valid reports */
+    unsigned int                      n_pending;
+    int32_t                           pending_i[FREQUENCY_CHECK_BATCH_VALUES];
+    int32_t                           pending_q[FREQUENCY_CHECK_BATCH_VALUES];
+    int32_t                           signal[FREQUENCY_CHECK_BATCH_VALUES];
+
+    /* adaptive mode */
+    bool                              adaptive;
+    microtouch3m_scope_stats_t       *block_stats;
+    unsigned long                     n_blocks;
+    double                            block_noise_mean;
+    double                            block_noise_m2;
+    double                            best_noise_upper; /* < 0 if none yet */
+    double                            noise;
+    double                            noise_error;
+    frequency_check_end_t             end;
 };
 
-static bool
-async_report_frequency_check (microtouch3m_device_t *dev,
-                              microtouch3m_status_t  status,
-                              int32_t                ul_i,
-                              int32_t                ul_q,
-                              int32_t                ur_i,
-                              int32_t                ur_q,
-                              int32_t                ll_i,
-                              int32_t                ll_q,
-                              int32_t                lr_i,
-                              int32_t                lr_q,
-                              void                  *user_data)
+/* Total of the per-corner standard deviations */
+static double
+frequency_check_noise (const microtouch3m_scope_stats_t *stats)
 {
-    struct async_report_frequency_check_context_s *context;
-    uint64_t                                       ul_signal;
-    uint64_t                                       ur_signal;
-    uint64_t                                       ll_signal;
-    uint64_t                                       lr_signal;
-    int64_t                                        ul_corrected_signal = 0;
-    int64_t                                        ur_corrected_signal = 0;
-    int64_t                                        ll_corrected_signal = 0;
-    int64_t                                        lr_corrected_signal = 0;
-    struct timespec                                current;
-    struct timespec                                difference;
-    double                                         time_s;
-
-    context = (struct async_report_frequency_check_context_s *) user_data;
-    context->n_records++;
+    microtouch3m_scope_stats_summary_t summary;
+    unsigned int                       i;
+    double                             noise = 0.0;
 
-    if (context->n_records <= FREQUENCY_CHECK_IGNORE_FIRST_N_RECORDS)
-        return true;
+    for (i = 0; i < MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+        microtouch3m_scope_stats_get (stats, (microtouch3m_scope_stats_channel_t) i, &summary);
+        noise += summary.stddev;
+    }
+    return noise;
+}
 
-    /* Compute signals from I/Q components */
-    ul_signal = PROCESS_IQ (ul_i, ul_q);
-    ur_signal = PROCESS_IQ (ur_i, ur_q);
-    ll_signal = PROCESS_IQ (ll_i, ll_q);
-    lr_signal = PROCESS_IQ (lr_i, lr_q);
+/* Relative error of the measured noise, from the spread of the per-block
+ * noise values (Welford's running variance) */
+static void
+frequency_check_block_done (struct async_report_frequency_check_context_s *context)
+{
+    double block_noise;
+    double delta;
+    double variance;
 
-    ul_corrected_signal = ((int64_t) ul_signal) - ((int64_t) context->ul_stray_signal);
-    ur_corrected_signal = ((int64_t) ur_signal) - ((int64_t) context->ur_stray_signal);
-    ll_corrected_signal = ((int64_t) ll_signal) - ((int64_t) context->ll_stray_signal);
-    lr_corrected_signal = ((int64_t) lr_signal) - ((int64_t) context->lr_stray_signal);
+    block_noise = frequency_check_noise (context->block_stats);
+    microtouch3m_scope_stats_reset (context->block_stats);
 
-#if 0
-    printf ("\t\tUL(s): %" PRId64 " | UR(s): %" PRId64 " | LL(s): %" PRId64 " | LR(s): %" PRId64 "\n",
-            ul_corrected_signal, ur_corrected_signal, ll_corrected_signal, lr_corrected_signal);
-#endif
+    context->n_blocks++;
+    delta = block_noise - context->block_noise_mean;
+    context->block_noise_mean += delta / (double) context->n_blocks;
+    context->block_noise_m2   += delta * (block_noise - context->block_noise_mean);
 
-    if (context->n_records == (FREQUENCY_CHECK_IGNORE_FIRST_N_RECORDS + 1)) {
-        context->ul_min_corrected_signal = context->ul_max_corrected_signal = ul_corrected_signal;
-        context->ur_min_corrected_signal = context->ur_max_corrected_signal = ur_corrected_signal;
-        context->ll_min_corrected_signal = context->ll_max_corrected_signal = ll_corrected_signal;
-        context->lr_min_corrected_signal = context->lr_max_corrected_signal = lr_corrected_signal;
-    } else {
-        context->ul_min_corrected_signal = (ul_corrected_signal < context->ul_min_corrected_signal ? ul_corrected_signal : context->ul_min_corrected_signal);
-        context->ur_min_corrected_signal = (ur_corrected_signal < context->ur_min_corrected_signal ? ur_corrected_signal : context->ur_min_corrected_signal);
-        context->ll_min_corrected_signal = (ll_corrected_signal < context->ll_min_corrected_signal ? ll_corrected_signal : context->ll_min_corrected_signal);
-        context->lr_min_corrected_signal = (lr_corrected_signal < context->lr_min_corrected_signal ? lr_corrected_signal : context->lr_min_corrected_signal);
-        context->ul_max_corrected_signal = (ul_corrected_signal > context->ul_max_corrected_signal ? ul_corrected_signal : context->ul_max_corrected_signal);
-        context->ur_max_corrected_signal = (ur_corrected_signal > context->ur_max_corrected_signal ? ur_corrected_signal : context->ur_max_corrected_signal);
-        context->ll_max_corrected_signal = (ll_corrected_signal > context->ll_max_corrected_signal ? ll_corrected_signal : context->ll_max_corrected_signal);
-        context->lr_max_corrected_signal = (lr_corrected_signal > context->lr_max_corrected_signal ? lr_corrected_signal : context->lr_max_corrected_signal);
+    context->noise = frequency_check_noise (context->stats);
+    if (context->n_blocks < 2 || context->block_noise_mean <= 0.0) {
+        context->noise_error = 1.0;
+        return;
+    }
+    variance = context->block_noise_m2 / (double) (context->n_blocks - 1);
+    context->noise_error = (FREQUENCY_CHECK_ADAPTIVE_Z * sqrt (variance / (double) context->n_blocks)) / context->block_noise_mean;
+}
+
+static void
+frequency_check_queue (struct async_report_frequency_check_context_s *context,
+                       int32_t                                        ul_i,
+                       int32_t                                        ul_q,
+                       int32_t                                        ur_i,
+                       int32_t                                        ur_q,
+                       int32_t                                        ll_i,
+                       int32_t                                        ll_q,
+                       int32_t                                        lr_i,
+                       int32_t                                        lr_q)
+{
+    int32_t *i;
+    int32_t *q;
+
+    i = &context->pending_i[context->n_pending * MICROTOUCH3M_SCOPE_N_CORNERS];
+    q = &context->pending_q[context->n_pending * MICROTOUCH3M_SCOPE_N_CORNERS];
+    i[0] = ul_i; q[0] = ul_q;
+    i[1] = ur_i; q[1] = ur_q;
+    i[2] = ll_i; q[2] = ll_q;
+    i[3] = lr_i; q[3] = lr_q;
+    context->n_pending++;
+}
+
+static void
+frequency_check_settling_flush (struct async_report_frequency_check_context_s *context)
+{
+    if (!context->n_pending)
+        return;
+
+    microtouch3m_scope_signal_batch (context->pending_i, context->pending_q, NULL, 1.0,
+                                     context->signal, context->n_pending);
+    microtouch3m_settling_detector_add (context->settling, context->signal, context->n_pending);
+    context->n_pending = 0;
+}
+
+/* Runs until the controller has settled after the frequency change */
+static bool
+async_report_frequency_check_settling (microtouch3m_device_t *dev,
+                                       microtouch3m_status_t  status,
+                                       int32_t                ul_i,
+                                       int32_t                ul_q,
+                                       int32_t                ur_i,
+                                       int32_t                ur_q,
+                                       int32_t                ll_i,
+                                       int32_t                ll_q,
+                                       int32_t                lr_i,
+                                       int32_t                lr_q,
+                                       void                  *user_data)
+{
+    struct async_report_frequency_check_context_s *context;
+
+    context = (struct async_report_frequency_check_context_s *) user_data;
+
+    /* Failed reports carry no signal values */
+    if (status != MICROTOUCH3M_STATUS_OK)
+        return !stop_requested;
+
+    frequency_check_queue (context, ul_i, ul_q, ur_i, ur_q, ll_i, ll_q, lr_i, lr_q);
+    if (context->n_pending == FREQUENCY_CHECK_BATCH_SIZE)
+        frequency_check_settling_flush (context);
+
+    return (!stop_requested && !microtouch3m_settling_detector_is_settled (context->settling));
+}
+
+/* Returns false once the adaptive checks decided to stop */
+static bool
+frequency_check_flush (struct async_report_frequency_check_context_s *context)
+{
+    unsigned int   n;
+    const int32_t *corrected_signal;
+
+    if (!context->n_pending)
+        return true;
+
+    /* Compute stray corrected signals from I/Q components */
+    microtouch3m_scope_signal_batch (context->pending_i, context->pending_q, context->stray_signal, 1.0,
+                                     context->signal, context->n_pending);
+
+    for (n = 0; n < context->n_pending; n++) {
+        corrected_signal = &context->signal[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        metrics_add_report (MICROTOUCH3M_STATUS_OK,
+                            corrected_signal[0], corrected_signal[1], corrected_signal[2], corrected_signal[3]);
+#if 0
+        printf ("\t\tUL(s): %" PRId32 " | UR(s): %" PRId32 " | LL(s): %" PRId32 " | LR(s): %" PRId32 "\n",
+                corrected_signal[0], corrected_signal[1], corrected_signal[2], corrected_signal[3]);
+#endif
+    }
+
+    microtouch3m_scope_stats_add (context->stats, context->signal, context->n_pending);
+    context->n_records += context->n_pending;
+
+    /* Batches are whole blocks, only the last one may be partial */
+    if (context->adaptive) {
+        microtouch3m_scope_stats_add (context->block_stats, context->signal, context->n_pending);
+        if ((context->n_records % FREQUENCY_CHECK_ADAPTIVE_BLOCK_RECORDS) == 0)
+            frequency_check_block_done (context);
+    }
+    context->n_pending = 0;
+
+    if (context->adaptive &&
+        context->n_blocks >= FREQUENCY_CHECK_ADAPTIVE_MIN_BLOCKS &&
+        (context->n_records % FREQUENCY_CHECK_ADAPTIVE_BLOCK_RECORDS) == 0) {
+        if ((context->best_noise_upper >= 0.0) &&
+            (context->noise * (1.0 - context->noise_error) > context->best_noise_upper)) {
+            context->end = FREQUENCY_CHECK_END_DROPPED;
+            return false;
+        }
+        if (context->noise_error <= FREQUENCY_CHECK_ADAPTIVE_TOLERANCE) {
+            context->end = FREQUENCY_CHECK_END_CONVERGED;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool
+async_report_frequency_check (microtouch3m_device_t *dev,
+                              microtouch3m_status_t  status,
+                              int32_t                ul_i,
+                              int32_t                ul_q,
+                              int32_t                ur_i,
+                              int32_t                ur_q,
+                              int32_t                ll_i,
+                              int32_t                ll_q,
+                              int32_t                lr_i,
+                              int32_t                lr_q,
+                              void                  *user_data)
+{
+    struct async_report_frequency_check_context_s *context;
+    struct timespec                                current;
+    struct timespec                                difference;
+    double                                         time_s;
+
+    context = (struct async_report_frequency_check_context_s *) user_data;
+
+    /* Failed reports carry no signal values */
+    if (status != MICROTOUCH3M_STATUS_OK)
+        metrics_add_report (status, 0, 0, 0, 0);
+    else {
+        /* Signals are computed for the whole batch at once */
+        frequency_check_queue (context, ul_i, ul_q, ur_i, ur_q, ll_i, ll_q, lr_i, lr_q);
+        if (context->n_pending == FREQUENCY_CHECK_BATCH_SIZE && !frequency_check_flush (context))
+            return false;
     }
 
     /* Get current timer */
@@ -1015,93 +1832,183 @@ async_report_frequency_check (microtouch3m_device_t *dev,
 static microtouch3m_status_t
 run_frequency_check_iteration (microtouch3m_device_t           *dev,
                                microtouch3m_device_frequency_t  id,
+                               bool                             adaptive,
+                               double                          *inout_best_noise_upper,
                                uint64_t                        *out_pkpk_noise,
-                               uint64_t                        *out_pkst_noise)
+                               uint64_t                        *out_pkst_noise,
+                               uint64_t                        *out_spread_noise,
+                               uint64_t                        *out_stddev_noise,
+                               bool                            *out_end_of_data)
 {
     microtouch3m_status_t                         st;
     struct async_report_frequency_check_context_s context;
+    microtouch3m_scope_stats_summary_t            summary[MICROTOUCH3M_SCOPE_STATS_CHANNEL_N];
+    unsigned int                                  i;
 
     memset (&context, 0, sizeof (context));
+    context.adaptive         = adaptive;
+    context.best_noise_upper = *inout_best_noise_upper;
+    context.end              = FREQUENCY_CHECK_END_TIMEOUT;
+    *out_end_of_data         = false;
 
     printf ("running frequency check for %s...\n",
             microtouch3m_device_frequency_to_string (id));
 
+    if (!(context.stats = microtouch3m_scope_stats_new ())) {
+        fprintf (stderr, "error: couldn't allocate statistics\n");
+        return MICROTOUCH3M_STATUS_NO_MEMORY;
+    }
+
+    if (adaptive && !(context.block_stats = microtouch3m_scope_stats_new ())) {
+        fprintf (stderr, "error: couldn't allocate statistics\n");
+        st = MICROTOUCH3M_STATUS_NO_MEMORY;
+        goto out;
+    }
+
+    if (!(context.settling = microtouch3m_settling_detector_new (SETTLING_WINDOW,
+                                                                 SETTLING_SLOPE_THRESHOLD,
+                                                                 SETTLING_VARIANCE_RATIO,
+                                                                 SETTLING_MAX_RECORDS))) {
+        fprintf (stderr, "error: couldn't allocate settling detector\n");
+        st = MICROTOUCH3M_STATUS_NO_MEMORY;
+        goto out;
+    }
+
     /* Change frequency */
     {
         if ((st = microtouch3m_device_set_frequency (dev, id)) != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't set frequency: %s\n", microtouch3m_status_to_string (st));
-            return st;
+            goto out;
         }
 
         if ((st = microtouch3m_device_reset (dev, MICROTOUCH3M_DEVICE_RESET_SOFT)) != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't soft reset controller: %s\n", microtouch3m_status_to_string (st));
-            return st;
+            goto out;
+        }
+    }
+
+    /* Wait for the controller to settle, so that neither the strays nor the
+     * measurement get the values given meanwhile */
+    {
+        struct timespec current;
+        struct timespec difference;
+
+        clock_gettime (CLOCK_MONOTONIC, &context.start);
+        st = microtouch3m_device_monitor_async_reports (dev, async_report_frequency_check_settling, &context);
+        frequency_check_settling_flush (&context);
+        if (st == MICROTOUCH3M_STATUS_END_OF_DATA) {
+            printf ("\tNo more replayed data while settling, nothing measured\n");
+            goto out;
+        }
+        if (st != MICROTOUCH3M_STATUS_OK) {
+            fprintf (stderr, "error: couldn't run scope mode: %s\n", microtouch3m_status_to_string (st));
+            goto out;
         }
+        if (stop_requested) {
+            fprintf (stderr, "error: operation aborted");
+            st = MICROTOUCH3M_STATUS_FAILED;
+            goto out;
+        }
+
+        clock_gettime (CLOCK_MONOTONIC, &current);
+        timespec_diff (&context.start, &current, &difference);
+        printf ("\tSettled after %" PRIu64 " records in %.2lf s%s\n",
+                microtouch3m_settling_detector_get_n_settling (context.settling),
+                difference.tv_sec + (difference.tv_nsec / 1E9),
+                microtouch3m_settling_detector_is_timed_out (context.settling) ? " (timed out)" : "");
     }
 
     /* Read strays */
     {
-        int32_t ul_stray_i, ul_stray_q;
-        int32_t ur_stray_i, ur_stray_q;
-        int32_t ll_stray_i, ll_stray_q;
-        int32_t lr_stray_i, lr_stray_q;
+        int32_t stray_i[MICROTOUCH3M_SCOPE_N_CORNERS];
+        int32_t stray_q[MICROTOUCH3M_SCOPE_N_CORNERS];
 
         if ((st = microtouch3m_read_strays (dev,
-                                            &ul_stray_i, &ul_stray_q,
-                                            &ur_stray_i, &ur_stray_q,
-                                            &ll_stray_i, &ll_stray_q,
-                                            &lr_stray_i, &lr_stray_q)) != MICROTOUCH3M_STATUS_OK) {
+                                            &stray_i[0], &stray_q[0],
+                                            &stray_i[1], &stray_q[1],
+                                            &stray_i[2], &stray_q[2],
+                                            &stray_i[3], &stray_q[3])) != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't read strays: %s\n", microtouch3m_status_to_string (st));
-            return st;
+            goto out;
         }
 
-        context.ul_stray_signal = PROCESS_IQ (ul_stray_i, ul_stray_q);
-        context.ur_stray_signal = PROCESS_IQ (ur_stray_i, ur_stray_q);
-        context.ll_stray_signal = PROCESS_IQ (ll_stray_i, ll_stray_q);
-        context.lr_stray_signal = PROCESS_IQ (lr_stray_i, lr_stray_q);
+        microtouch3m_iq_magnitude_batch (stray_i, stray_q, context.stray_signal, MICROTOUCH3M_SCOPE_N_CORNERS);
     }
 
     /* Run scope mode */
     {
         clock_gettime (CLOCK_MONOTONIC, &context.start);
-        if ((st = microtouch3m_device_monitor_async_reports (dev, async_report_frequency_check, &context)) != MICROTOUCH3M_STATUS_OK) {
+        st = microtouch3m_device_monitor_async_reports (dev, async_report_frequency_check, &context);
+        /* Whatever is left is a partial block, no more adaptive checks */
+        frequency_check_flush (&context);
+        if (st == MICROTOUCH3M_STATUS_END_OF_DATA) {
+            if (!context.n_records) {
+                printf ("\tNo more replayed data, nothing measured\n");
+                goto out;
+            }
+            /* Report what was measured, the caller stops afterwards */
+            context.end      = FREQUENCY_CHECK_END_DATA;
+            *out_end_of_data = true;
+        } else if (st != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't run scope mode: %s\n", microtouch3m_status_to_string (st));
-            return st;
+            goto out;
         }
         if (stop_requested) {
             fprintf (stderr, "error: operation aborted");
-            return MICROTOUCH3M_STATUS_FAILED;
+            st = MICROTOUCH3M_STATUS_FAILED;
+            goto out;
         }
     }
 
     /* Process results */
+    for (i = 0; i < MICROTOUCH3M_SCOPE_STATS_CHANNEL_N; i++)
+        microtouch3m_scope_stats_get (context.stats, (microtouch3m_scope_stats_channel_t) i, &summary[i]);
+
+    context.noise = frequency_check_noise (context.stats);
+    *out_stddev_noise = (uint64_t) (context.noise + 0.5);
+
+    if (adaptive) {
+        struct timespec current;
+        struct timespec difference;
+
+        clock_gettime (CLOCK_MONOTONIC, &current);
+        timespec_diff (&context.start, &current, &difference);
+        printf ("\tMeasured %" PRIu64 " records in %.1lf s: %s (+/- %.0lf%%)\n",
+                summary[0].n_samples, difference.tv_sec + (difference.tv_nsec / 1E9),
+                frequency_check_end_str[context.end], context.noise_error * 100.0);
+
+        /* Dropped candidates can't be the best one */
+        if ((context.end != FREQUENCY_CHECK_END_DROPPED) &&
+            ((*inout_best_noise_upper < 0.0) || (context.noise * (1.0 + context.noise_error) < *inout_best_noise_upper)))
+            *inout_best_noise_upper = context.noise * (1.0 + context.noise_error);
+    } else if (*out_end_of_data)
+        printf ("\tMeasured %" PRIu64 " records: %s\n",
+                summary[0].n_samples, frequency_check_end_str[context.end]);
+
     {
-        int64_t  ul_noise;
-        int64_t  ur_noise;
-        int64_t  ll_noise;
-        int64_t  lr_noise;
+        int64_t  noise[MICROTOUCH3M_SCOPE_N_CORNERS];
         uint64_t total_noise;
 
 #if 0
         printf ("\tUL(smax): %" PRId64 " | UR(smax): %" PRId64 " | LL(smax): %" PRId64 " | LR(smax): %" PRId64 "\n",
-                context.ul_max_corrected_signal, context.ur_max_corrected_signal, context.ll_max_corrected_signal, context.lr_max_corrected_signal);
+                summary[0].max, summary[1].max, summary[2].max, summary[3].max);
         printf ("\tUL(smin): %" PRId64 " | UR(smin): %" PRId64 " | LL(smin): %" PRId64 " | LR(smin): %" PRId64 "\n",
-                context.ul_min_corrected_signal, context.ur_min_corrected_signal, context.ll_min_corrected_signal, context.lr_min_corrected_signal);
+                summary[0].min, summary[1].min, summary[2].min, summary[3].min);
 #endif
 
         /* peak to peak noise = (max - min). The difference between the maximum
          * and minimum signal measurement. Doesn't really matter if the stray
          * correction was applied or not to get this measurement. */
         {
-            ul_noise = (context.ul_max_corrected_signal - context.ul_min_corrected_signal);
-            ur_noise = (context.ur_max_corrected_signal - context.ur_min_corrected_signal);
-            ll_noise = (context.ll_max_corrected_signal - context.ll_min_corrected_signal);
-            lr_noise = (context.lr_max_corrected_signal - context.lr_min_corrected_signal);
-            assert ((ul_noise >= 0) && (ur_noise >= 0) && (ll_noise >= 0) && (lr_noise >= 0));
-            total_noise = ul_noise + ur_noise + ll_noise + lr_noise;
+            total_noise = 0;
+            for (i = 0; i < MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+                noise[i] = summary[i].max - summary[i].min;
+                assert (noise[i] >= 0);
+                total_noise += noise[i];
+            }
 
             printf ("\tMeasured noise (pk-pk): UL: %" PRId64 " | UR: %" PRId64 " | LL: %" PRId64 " | LR: %" PRId64 " | TOTAL: %" PRIu64 "\n",
-                    ul_noise, ur_noise, ll_noise, lr_noise, total_noise);
+                    noise[0], noise[1], noise[2], noise[3], total_noise);
 
             *out_pkpk_noise = total_noise;
         }
@@ -1109,31 +2016,50 @@ run_frequency_check_iteration (microtouch3m_device_t           *dev,
         /* peak to stray noise = |max|. Given that the values are corrected with
          * the strays, the max should be > 0 always (if it isn't, we warn about it) */
         {
-#define ABS(A) (A < 0 ? (0 - A) : A)
-            if (context.ul_max_corrected_signal < 0)
-                printf ("[WARNING] UL stray correction not correctly applied\n");
-            ul_noise = ABS (context.ul_max_corrected_signal);
-            if (context.ur_max_corrected_signal < 0)
-                printf ("[WARNING] UR stray correction not correctly applied\n");
-            ur_noise = ABS (context.ur_max_corrected_signal);
-            if (context.ll_max_corrected_signal < 0)
-                printf ("[WARNING] LL stray correction not correctly applied\n");
-            ll_noise = ABS (context.ll_max_corrected_signal);
-            if (context.lr_max_corrected_signal < 0)
-                printf ("[WARNING] LR stray correction not correctly applied\n");
-            lr_noise = ABS (context.lr_max_corrected_signal);
-            assert ((ul_noise >= 0) && (ur_noise >= 0) && (ll_noise >= 0) && (lr_noise >= 0));
-            total_noise = ul_noise + ur_noise + ll_noise + lr_noise;
+            static const char *corner_str[MICROTOUCH3M_SCOPE_N_CORNERS] = { "UL", "UR", "LL", "LR" };
+
+            total_noise = 0;
+            for (i = 0; i < MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+                if (summary[i].max < 0)
+                    printf ("[WARNING] %s stray correction not correctly applied\n", corner_str[i]);
+                noise[i] = (summary[i].max < 0 ? -summary[i].max : summary[i].max);
+                total_noise += noise[i];
+            }
 
             printf ("\tMeasured noise (pk-st): UL: %" PRId64 " | UR: %" PRId64 " | LL: %" PRId64 " | LR: %" PRId64 " | TOTAL: %" PRIu64 "\n",
-                    ul_noise, ur_noise, ll_noise, lr_noise, total_noise);
+                    noise[0], noise[1], noise[2], noise[3], total_noise);
 
             *out_pkst_noise = total_noise;
-#undef ABS
         }
+
+        /* 1st to 99th percentile spread. Same as the peak to peak noise, but
+         * not driven by a handful of outliers. */
+        {
+            total_noise = 0;
+            for (i = 0; i < MICROTOUCH3M_SCOPE_N_CORNERS; i++) {
+                noise[i] = (int64_t) (summary[i].p99 - summary[i].p1 + 0.5);
+                total_noise += noise[i];
+            }
+
+            printf ("\tMeasured noise (p1-p99): UL: %" PRId64 " | UR: %" PRId64 " | LL: %" PRId64 " | LR: %" PRId64 " | TOTAL: %" PRIu64 "\n",
+                    noise[0], noise[1], noise[2], noise[3], total_noise);
+
+            *out_spread_noise = total_noise;
+        }
+
+        /* RMS noise around the mean */
+        printf ("\tMeasured noise (stddev): UL: %.1lf | UR: %.1lf | LL: %.1lf | LR: %.1lf | TOTAL: %" PRIu64 "\n",
+                summary[0].stddev, summary[1].stddev, summary[2].stddev, summary[3].stddev,
+                *out_stddev_noise);
     }
 
-    return MICROTOUCH3M_STATUS_OK;
+    st = MICROTOUCH3M_STATUS_OK;
+
+out:
+    microtouch3m_settling_detector_free (context.settling);
+    microtouch3m_scope_stats_free (context.block_stats);
+    microtouch3m_scope_stats_free (context.stats);
+    return st;
 }
 
 struct freq_noise_s {
@@ -1143,16 +2069,17 @@ struct freq_noise_s {
 
 static void
 frequency_check_results_print (const char                *title,
-                               const struct freq_noise_s *array)
+                               const struct freq_noise_s *array,
+                               int                        n_array_items)
 {
     int i;
 
     printf ("\n%s:\n", title);
-    for (i = 0; i < N_FREQS; i++) {
+    for (i = 0; i < n_array_items; i++) {
         printf ("\t");
         if (i == 0)
             printf ("[best]  ");
-        else if (i == (N_FREQS - 1))
+        else if (i == (n_array_items - 1))
             printf ("[worst] ");
         else
             printf ("        ");
@@ -1180,6 +2107,8 @@ frequency_check_results_append (struct freq_noise_s             *array,
 
 static int
 run_frequency_check (microtouch3m_context_t *ctx,
+                     const char             *record_path,
+                     bool                    adaptive,
                      bool                    first,
                      uint8_t                 bus_number,
                      uint8_t                 device_address)
@@ -1188,12 +2117,26 @@ run_frequency_check (microtouch3m_context_t *ctx,
     microtouch3m_status_t            st;
     int                              ret = EXIT_FAILURE;
     int                              i;
+    int                              n_measured = 0;
+    bool                             end_of_data = false;
     struct freq_noise_s              freq_pkpk_noise[N_FREQS];
     struct freq_noise_s              freq_pkst_noise[N_FREQS];
+    struct freq_noise_s              freq_spread_noise[N_FREQS];
+    struct freq_noise_s              freq_stddev_noise[N_FREQS];
     microtouch3m_device_frequency_t  original_freq;
+    double                           best_noise_upper = -1.0;
+    struct timespec                  start;
+    struct timespec                  current;
+    struct timespec                  difference;
 
     if (!(dev = create_device (ctx, first, bus_number, device_address, NULL, 0)))
         goto out;
+    metrics_set_device (dev);
+
+    if (record_path && (st = microtouch3m_device_scope_recording_start (dev, record_path)) != MICROTOUCH3M_STATUS_OK) {
+        fprintf (stderr, "error: couldn't start scope recording: %s\n", microtouch3m_status_to_string (st));
+        goto out;
+    }
 
     printf ("backing up original frequency...\n");
     if ((st = microtouch3m_device_get_frequency (dev, &original_freq)) != MICROTOUCH3M_STATUS_OK) {
@@ -1202,20 +2145,51 @@ run_frequency_check (microtouch3m_context_t *ctx,
     }
     printf ("original frequency is: %s\n", microtouch3m_device_frequency_to_string (original_freq));
 
-    for (i = 0; i < N_FREQS; i++) {
+    clock_gettime (CLOCK_MONOTONIC, &start);
+
+    /* A replayed recording may be over before all frequencies are checked;
+     * the ones measured until then are still ranked */
+    for (i = 0; i < N_FREQS && !end_of_data; i++) {
         uint64_t pkpk_noise = 0;
         uint64_t pkst_noise = 0;
+        uint64_t spread_noise = 0;
+        uint64_t stddev_noise = 0;
 
-        if ((st = run_frequency_check_iteration (dev, freq_id[i].id, &pkpk_noise, &pkst_noise)) != MICROTOUCH3M_STATUS_OK)
+        st = run_frequency_check_iteration (dev, freq_id[i].id, adaptive, &best_noise_upper,
+                                            &pkpk_noise, &pkst_noise, &spread_noise, &stddev_noise,
+                                            &end_of_data);
+        if (st == MICROTOUCH3M_STATUS_END_OF_DATA)
+            break;
+        if (st != MICROTOUCH3M_STATUS_OK)
             goto out;
 
-        frequency_check_results_append (freq_pkpk_noise, i, freq_id[i].id, pkpk_noise);
-        frequency_check_results_append (freq_pkst_noise, i, freq_id[i].id, pkst_noise);
+        frequency_check_results_append (freq_pkpk_noise,   n_measured, freq_id[i].id, pkpk_noise);
+        frequency_check_results_append (freq_pkst_noise,   n_measured, freq_id[i].id, pkst_noise);
+        frequency_check_results_append (freq_spread_noise, n_measured, freq_id[i].id, spread_noise);
+        frequency_check_results_append (freq_stddev_noise, n_measured, freq_id[i].id, stddev_noise);
+        n_measured++;
     }
 
-    printf ("\nfrequency checks finished\n");
-    frequency_check_results_print ("peak-to-peak noise measurements",  freq_pkpk_noise);
-    frequency_check_results_print ("peak-to-stray noise measurements", freq_pkst_noise);
+    if (!n_measured) {
+        fprintf (stderr, "error: no more replayed data, no frequency checked\n");
+        goto out;
+    }
+
+    clock_gettime (CLOCK_MONOTONIC, &current);
+    timespec_diff (&start, &current, &difference);
+    printf ("\nfrequency checks finished in %.1lf s", difference.tv_sec + (difference.tv_nsec / 1E9));
+    if (n_measured < N_FREQS)
+        printf (" (%d out of %d frequencies checked, no more replayed data)", n_measured, (int) N_FREQS);
+    printf ("\n");
+
+    /* Peak based measurements depend on the measurement length, which in
+     * adaptive mode is different for each frequency */
+    if (!adaptive) {
+        frequency_check_results_print ("peak-to-peak noise measurements",  freq_pkpk_noise,   n_measured);
+        frequency_check_results_print ("peak-to-stray noise measurements", freq_pkst_noise,   n_measured);
+    }
+    frequency_check_results_print ("p1-to-p99 noise measurements",     freq_spread_noise, n_measured);
+    frequency_check_results_print ("stddev noise measurements",        freq_stddev_noise, n_measured);
 
     printf ("\nrecovering original frequency...\n");
     if ((st = microtouch3m_device_set_frequency (dev, original_freq)) != MICROTOUCH3M_STATUS_OK) {
@@ -1231,6 +2205,7 @@ run_frequency_check (microtouch3m_context_t *ctx,
     ret = EXIT_SUCCESS;
 
 out:
+    metrics_set_device (NULL);
     if (dev)
         microtouch3m_device_unref (dev);
     return ret;
@@ -1324,144 +2299,481 @@ out:
 
 #define STRAY_CORRECTION_TIMEOUT_MS 100
 
+/* With stray tracking, strays are read every 100ms up to every 6.4s, as long
+ * as they drift as predicted within the tolerance, in unscaled signal units */
+#define STRAY_TRACKING_MAX_INTERVAL_MS 6400
+#define STRAY_TRACKING_TOLERANCE       1000.0
+
+/* Reports are processed in batches, flushed when full or when the oldest
+ * pending report is older than the timeout */
+#define SCOPE_BATCH_SIZE       32
+#define SCOPE_BATCH_TIMEOUT_MS 50
+
+#define SCOPE_BATCH_VALUES (SCOPE_BATCH_SIZE * MICROTOUCH3M_SCOPE_N_CORNERS)
+
+/* Points a batch may give with the smallest decimation buckets, i.e. 2 */
+#define SCOPE_DECIMATED_MAX_POINTS (2 * ((SCOPE_BATCH_SIZE / 2) + 1) + 1)
+
+#define SCOPE_DECIMATED_FILE_SUFFIX ".decimated"
+#define SCOPE_FILTERED_FILE_SUFFIX  ".filtered"
+
 struct async_report_scope_context_s {
     uint64_t        n_records;
     int             fd;
     struct timespec start;
-    bool            scale_thousands;
+    double          scale;
+
+    /* records until the controller settles are ignored */
+    microtouch3m_settling_detector_t *settling;
 
     /* stray correction logic */
-    bool            stray_correction;
-    struct timespec stray_timestamp;
-    int32_t         ul_stray_i;
-    int32_t         ul_stray_q;
-    int32_t         ur_stray_i;
-    int32_t         ur_stray_q;
-    int32_t         ll_stray_i;
-    int32_t         ll_stray_q;
-    int32_t         lr_stray_i;
-    int32_t         lr_stray_q;
+    bool                          stray_correction;
+    bool                          strays_settled; /* last read once settled */
+    struct timespec               stray_timestamp;
+    uint64_t                      stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    int32_t                       scaled_stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+    microtouch3m_stray_tracker_t *stray_tracker;
+
+    /* pending reports */
+    unsigned int          n_pending;
+    microtouch3m_status_t pending_status[SCOPE_BATCH_SIZE];
+    double                pending_time_s[SCOPE_BATCH_SIZE];
+    int32_t               pending_i[SCOPE_BATCH_VALUES];
+    int32_t               pending_q[SCOPE_BATCH_VALUES];
+    int32_t               signal[SCOPE_BATCH_VALUES];
+    int32_t               corrected_signal[SCOPE_BATCH_VALUES];
+
+    /* noise figures of the values shown */
+    microtouch3m_scope_stats_t    *stats;
+    microtouch3m_scope_spectrum_t *spectrum;
+
+    /* values shown in the batch, valid ones only */
+    unsigned int n_shown;
+    double       shown_time_s[SCOPE_BATCH_SIZE];
+    int32_t      shown[SCOPE_BATCH_VALUES];
+
+    /* decimated companion of the output file */
+    microtouch3m_scope_decimator_t *decimator;
+    int                             decimated_fd;
+    double                          decimated_x[SCOPE_DECIMATED_MAX_POINTS * MICROTOUCH3M_SCOPE_N_CORNERS];
+    int32_t                         decimated[SCOPE_DECIMATED_MAX_POINTS * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+    /* filtered values, next to the raw ones */
+    microtouch3m_scope_filter_t *filter;
+    microtouch3m_scope_stats_t  *filtered_stats;
+    int                          filtered_fd;
+    unsigned int                 filter_decimation;
+    uint64_t                     n_filter_input;
+    uint64_t                     n_filter_output;
+    int32_t                      filtered[SCOPE_BATCH_VALUES];
+    bool                         filtered_last_valid;
+    int32_t                      filtered_last[MICROTOUCH3M_SCOPE_N_CORNERS];
 };
 
-static bool
-async_report_scope (microtouch3m_device_t *dev,
-                    microtouch3m_status_t  status,
-                    int32_t                ul_i,
-                    int32_t                ul_q,
-                    int32_t                ur_i,
-                    int32_t                ur_q,
-                    int32_t                ll_i,
-                    int32_t                ll_q,
-                    int32_t                lr_i,
-                    int32_t                lr_q,
-                    void                  *user_data)
+static void
+async_report_scope_filter (struct async_report_scope_context_s *context)
 {
-    struct async_report_scope_context_s *context;
-    uint64_t                             ul_signal;
-    uint64_t                             ur_signal;
-    uint64_t                             ll_signal;
-    uint64_t                             lr_signal;
-    uint64_t                             ul_stray_signal = 0;
-    uint64_t                             ur_stray_signal = 0;
-    uint64_t                             ll_stray_signal = 0;
-    uint64_t                             lr_stray_signal = 0;
-    int64_t                              ul_corrected_signal = 0;
-    int64_t                              ur_corrected_signal = 0;
-    int64_t                              ll_corrected_signal = 0;
-    int64_t                              lr_corrected_signal = 0;
-    struct timespec                      current;
-    struct timespec                      difference;
-    double                               time_s;
+    char   buffer[SCOPE_BATCH_SIZE * 128];
+    size_t buffer_len = 0;
+    size_t n_filtered;
+    size_t n;
+
+    n_filtered = microtouch3m_scope_filter_process (context->filter, context->shown, context->n_shown, context->filtered);
+    if (!n_filtered) {
+        context->n_filter_input += context->n_shown;
+        return;
+    }
 
-    context = (struct async_report_scope_context_s *) user_data;
-    context->n_records++;
+    microtouch3m_scope_stats_add (context->filtered_stats, context->filtered, n_filtered);
+    memcpy (context->filtered_last,
+            &context->filtered[(n_filtered - 1) * MICROTOUCH3M_SCOPE_N_CORNERS],
+            sizeof (context->filtered_last));
+    context->filtered_last_valid = true;
+
+    for (n = 0; n < n_filtered && !(context->filtered_fd < 0); n++) {
+        const int32_t *value = &context->filtered[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        uint64_t       input;
+        int            n_chars;
+
+        /* each output comes with the last input of its decimation period */
+        input = ((context->n_filter_output + n + 1) * context->filter_decimation) - 1 - context->n_filter_input;
+        n_chars = snprintf (&buffer[buffer_len], sizeof (buffer) - buffer_len,
+                            "%lf, %8" PRId32 ", %8" PRId32 ", %8" PRId32 ", %8" PRId32 "\n",
+                            context->shown_time_s[input], value[0], value[1], value[2], value[3]);
+        if (n_chars < 0 || (size_t) n_chars >= (sizeof (buffer) - buffer_len))
+            break;
+        buffer_len += n_chars;
+    }
 
-    /* Get current timer */
-    clock_gettime (CLOCK_MONOTONIC, &current);
-    timespec_diff (&context->start, &current, &difference);
-    time_s = difference.tv_sec + (difference.tv_nsec / 1E9);
+    context->n_filter_input  += context->n_shown;
+    context->n_filter_output += n_filtered;
 
-    /* Compute signals from I/Q components */
-    ul_signal = PROCESS_IQ (ul_i, ul_q);
-    ur_signal = PROCESS_IQ (ur_i, ur_q);
-    ll_signal = PROCESS_IQ (ll_i, ll_q);
-    lr_signal = PROCESS_IQ (lr_i, lr_q);
+    if (buffer_len > 0) {
+        if (write (context->filtered_fd, buffer, buffer_len) < 0)
+            fprintf (stderr, "error: couldn't write to filtered output file: %s\n", strerror (errno));
+        else
+            fsync (context->filtered_fd);
+    }
+}
 
-    if (context->scale_thousands) {
-        ul_signal /= 1000.0;
-        ur_signal /= 1000.0;
-        ll_signal /= 1000.0;
-        lr_signal /= 1000.0;
+static void
+async_report_scope_write_decimated (struct async_report_scope_context_s *context,
+                                    size_t                               n_points)
+{
+    char   buffer[SCOPE_DECIMATED_MAX_POINTS * 128];
+    size_t buffer_len = 0;
+    size_t n;
+
+    for (n = 0; n < n_points; n++) {
+        const double  *x     = &context->decimated_x[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        const int32_t *value = &context->decimated[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        int            n_chars;
+
+        n_chars = snprintf (&buffer[buffer_len], sizeof (buffer) - buffer_len,
+                            "%lf, %8" PRId32 ", %lf, %8" PRId32 ", %lf, %8" PRId32 ", %lf, %8" PRId32 "\n",
+                            x[0], value[0], x[1], value[1], x[2], value[2], x[3], value[3]);
+        if (n_chars < 0 || (size_t) n_chars >= (sizeof (buffer) - buffer_len))
+            break;
+        buffer_len += n_chars;
     }
 
-    /* Compute stray corrected signals */
-    if (context->stray_correction) {
-        ul_stray_signal = PROCESS_IQ (context->ul_stray_i, context->ul_stray_q);
-        ur_stray_signal = PROCESS_IQ (context->ur_stray_i, context->ur_stray_q);
-        ll_stray_signal = PROCESS_IQ (context->ll_stray_i, context->ll_stray_q);
-        lr_stray_signal = PROCESS_IQ (context->lr_stray_i, context->lr_stray_q);
+    if (buffer_len > 0) {
+        if (write (context->decimated_fd, buffer, buffer_len) < 0)
+            fprintf (stderr, "error: couldn't write to decimated output file: %s\n", strerror (errno));
+        else
+            fsync (context->decimated_fd);
+    }
+}
+
+/* Feeds the settling detector with the OK reports of the batch only, since
+ * failed reports carry no signal values. Returns the number of leading
+ * reports of the batch given while settling. */
+static size_t
+async_report_scope_settle (struct async_report_scope_context_s *context)
+{
+    size_t n_settling = 0;
+    size_t start;
+    size_t end;
+
+    for (end = 0; end < context->n_pending && !microtouch3m_settling_detector_is_settled (context->settling); ) {
+        for (start = end; start < context->n_pending && context->pending_status[start] != MICROTOUCH3M_STATUS_OK; start++);
+        for (end = start; end < context->n_pending && context->pending_status[end] == MICROTOUCH3M_STATUS_OK; end++);
+        n_settling = start + microtouch3m_settling_detector_add (context->settling,
+                                                                 &context->signal[start * MICROTOUCH3M_SCOPE_N_CORNERS],
+                                                                 end - start);
+    }
+
+    return n_settling;
+}
+
+static void
+async_report_scope_flush (microtouch3m_device_t               *dev,
+                          struct async_report_scope_context_s *context)
+{
+    char                                     buffer[SCOPE_BATCH_SIZE * 256];
+    size_t                                   buffer_len = 0;
+    unsigned int                             n;
+    size_t                                   n_settling;
+    size_t                                   start;
+    size_t                                   end;
+    const int32_t                           *signal;
+    const int32_t                           *corrected;
+    const int32_t                           *values;
+    microtouch3m_device_async_report_stats_t stats;
+    microtouch3m_scope_stats_summary_t       summary[MICROTOUCH3M_SCOPE_N_CORNERS];
+
+    if (!context->n_pending)
+        return;
+
+    /* Between stray reads, use the strays predicted for the batch */
+    if (context->stray_tracker) {
+        microtouch3m_stray_tracker_predict (context->stray_tracker, context->pending_time_s[0], context->stray_signal);
+        for (n = 0; n < MICROTOUCH3M_SCOPE_N_CORNERS; n++) {
+            double scaled;
 
-        if (context->scale_thousands) {
-            ul_stray_signal /= 1000.0;
-            ur_stray_signal /= 1000.0;
-            ll_stray_signal /= 1000.0;
-            lr_stray_signal /= 1000.0;
+            scaled = context->stray_signal[n] * context->scale;
+            context->scaled_stray_signal[n] = (scaled < (double) INT32_MAX) ? (int32_t) scaled : INT32_MAX;
         }
+    }
+
+    /* Compute signals from I/Q components */
+    microtouch3m_scope_signal_batch (context->pending_i, context->pending_q, NULL,
+                                     context->scale, context->signal, context->n_pending);
 
-        ul_corrected_signal = ((int64_t) ul_signal) - ((int64_t) ul_stray_signal);
-        ur_corrected_signal = ((int64_t) ur_signal) - ((int64_t) ur_stray_signal);
-        ll_corrected_signal = ((int64_t) ll_signal) - ((int64_t) ll_stray_signal);
-        lr_corrected_signal = ((int64_t) lr_signal) - ((int64_t) lr_stray_signal);
+    /* Compute stray corrected signals */
+    if (context->stray_correction)
+        microtouch3m_scope_signal_batch (context->pending_i, context->pending_q, context->stray_signal,
+                                         context->scale, context->corrected_signal, context->n_pending);
+
+    /* Skip the records given while settling, and until the strays are read
+     * again once settled */
+    n_settling = async_report_scope_settle (context);
+    if (context->stray_correction && !context->strays_settled)
+        n_settling = context->n_pending;
+
+    /* Statistics and spectrum take each run of valid reports at once */
+    values = (context->stray_correction ? context->corrected_signal : context->signal);
+    for (end = n_settling; end < context->n_pending; ) {
+        for (start = end; start < context->n_pending && context->pending_status[start] != MICROTOUCH3M_STATUS_OK; start++);
+        for (end = start; end < context->n_pending && context->pending_status[end] == MICROTOUCH3M_STATUS_OK; end++);
+        if (end == start)
+            continue;
+        microtouch3m_scope_stats_add (context->stats, &values[start * MICROTOUCH3M_SCOPE_N_CORNERS], end - start);
+        if (context->spectrum)
+            microtouch3m_scope_spectrum_add (context->spectrum, &values[start * MICROTOUCH3M_SCOPE_N_CORNERS], end - start);
     }
 
-    /* If output file requested, create record */
-    if (!(context->fd < 0)) {
-        char buffer[512];
-        int  n_chars;
+    for (n = (unsigned int) n_settling; n < context->n_pending; n++) {
+        int n_chars;
+
+        signal    = &context->signal[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+        corrected = &context->corrected_signal[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+        if (context->stray_correction)
+            metrics_add_report (context->pending_status[n], corrected[0], corrected[1], corrected[2], corrected[3]);
+        else
+            metrics_add_report (context->pending_status[n], signal[0], signal[1], signal[2], signal[3]);
+
+        /* Failed reports carry no signal values */
+        if (context->pending_status[n] == MICROTOUCH3M_STATUS_OK && (context->decimator || context->filter)) {
+            context->shown_time_s[context->n_shown] = context->pending_time_s[n];
+            memcpy (&context->shown[context->n_shown * MICROTOUCH3M_SCOPE_N_CORNERS],
+                    context->stray_correction ? corrected : signal,
+                    MICROTOUCH3M_SCOPE_N_CORNERS * sizeof (int32_t));
+            context->n_shown++;
+        }
+
+        /* If output file requested, create record */
+        if (context->fd < 0)
+            continue;
 
         if (context->stray_correction) {
-            n_chars = snprintf (buffer, sizeof (buffer),
+            n_chars = snprintf (&buffer[buffer_len], sizeof (buffer) - buffer_len,
                                 "%lf, "
-                                "%8" PRIu64 ", %8" PRIu64 ", %8" PRIu64 ", %8" PRIu64 ", "
-                                "%8" PRIu64 ", %8" PRIu64 ", %8" PRIu64 ", %8" PRIu64 ", "
-                                "%8" PRId64 ", %8" PRId64 ", %8" PRId64 ", %8" PRId64 "\n",
-                                time_s,
-                                ul_signal, ur_signal, ll_signal, lr_signal,
-                                ul_stray_signal, ur_stray_signal, ll_stray_signal, lr_stray_signal,
-                                ul_corrected_signal, ur_corrected_signal, ll_corrected_signal, lr_corrected_signal);
+                                "%8" PRId32 ", %8" PRId32 ", %8" PRId32 ", %8" PRId32 ", "
+                                "%8" PRId32 ", %8" PRId32 ", %8" PRId32 ", %8" PRId32 ", "
+                                "%8" PRId32 ", %8" PRId32 ", %8" PRId32 ", %8" PRId32 "\n",
+                                context->pending_time_s[n],
+                                signal[0], signal[1], signal[2], signal[3],
+                                context->scaled_stray_signal[0], context->scaled_stray_signal[1],
+                                context->scaled_stray_signal[2], context->scaled_stray_signal[3],
+                                corrected[0], corrected[1], corrected[2], corrected[3]);
         } else {
-            n_chars = snprintf (buffer, sizeof (buffer),
-                                "%lf, %8" PRIu64 ", %8" PRIu64 ", %8" PRIu64 ", %8" PRIu64 "\n",
-                                time_s, ul_signal, ur_signal, ll_signal, lr_signal);
+            n_chars = snprintf (&buffer[buffer_len], sizeof (buffer) - buffer_len,
+                                "%lf, %8" PRId32 ", %8" PRId32 ", %8" PRId32 ", %8" PRId32 "\n",
+                                context->pending_time_s[n], signal[0], signal[1], signal[2], signal[3]);
         }
 
-        if (write (context->fd, buffer, n_chars) < 0)
+        if (n_chars < 0 || (size_t) n_chars >= (sizeof (buffer) - buffer_len))
+            break;
+        buffer_len += n_chars;
+    }
+
+    if (buffer_len > 0) {
+        if (write (context->fd, buffer, buffer_len) < 0)
             fprintf (stderr, "error: couldn't write to output file: %s\n", strerror (errno));
         else
             fsync (context->fd);
     }
 
+    if (context->n_shown > 0) {
+        if (context->decimator)
+            async_report_scope_write_decimated (context,
+                                                microtouch3m_scope_decimator_add (context->decimator,
+                                                                                  context->shown_time_s,
+                                                                                  context->shown,
+                                                                                  context->n_shown,
+                                                                                  context->decimated_x,
+                                                                                  context->decimated));
+        if (context->filter)
+            async_report_scope_filter (context);
+        context->n_shown = 0;
+    }
+
+    /* Show the last report of the batch */
+    signal    = &context->signal[(context->n_pending - 1) * MICROTOUCH3M_SCOPE_N_CORNERS];
+    corrected = &context->corrected_signal[(context->n_pending - 1) * MICROTOUCH3M_SCOPE_N_CORNERS];
+
     printf (CLEAR_LINE);
     printf ("records: %" PRIu64 " | ", context->n_records);
-    printf ("time: %lf | ", time_s);
+    printf ("time: %lf | ", context->pending_time_s[context->n_pending - 1]);
     if (context->stray_correction) {
-        printf ("UL(c): %8"     PRId64 " | ", ul_corrected_signal);
-        printf ("UR(c): %8"     PRId64 " | ", ur_corrected_signal);
-        printf ("LL(c): %8"     PRId64 " | ", ll_corrected_signal);
-        printf ("LR(c): %8"     PRId64,       lr_corrected_signal);
+        printf ("UL(c): %8"     PRId32 " | ", corrected[0]);
+        printf ("UR(c): %8"     PRId32 " | ", corrected[1]);
+        printf ("LL(c): %8"     PRId32 " | ", corrected[2]);
+        printf ("LR(c): %8"     PRId32,       corrected[3]);
     } else {
-        printf ("UL: %8"     PRIu64 " | ", ul_signal);
-        printf ("UR: %8"     PRIu64 " | ", ur_signal);
-        printf ("LL: %8"     PRIu64 " | ", ll_signal);
-        printf ("LR: %8"     PRIu64,       lr_signal);
+        printf ("UL: %8"     PRId32 " | ", signal[0]);
+        printf ("UR: %8"     PRId32 " | ", signal[1]);
+        printf ("LL: %8"     PRId32 " | ", signal[2]);
+        printf ("LR: %8"     PRId32,       signal[3]);
     }
+    for (n = 0; n < MICROTOUCH3M_SCOPE_N_CORNERS; n++)
+        microtouch3m_scope_stats_get (context->stats, (microtouch3m_scope_stats_channel_t) n, &summary[n]);
+    printf (" | stddev: %.1lf/%.1lf/%.1lf/%.1lf",
+            summary[0].stddev, summary[1].stddev, summary[2].stddev, summary[3].stddev);
+    if (context->filtered_last_valid)
+        printf (" | filtered: %" PRId32 "/%" PRId32 "/%" PRId32 "/%" PRId32,
+                context->filtered_last[0], context->filtered_last[1],
+                context->filtered_last[2], context->filtered_last[3]);
+    if (context->stray_tracker)
+        printf (" | strays: every %u ms, residual %.0lf",
+                microtouch3m_stray_tracker_get_interval_ms (context->stray_tracker),
+                microtouch3m_stray_tracker_get_residual (context->stray_tracker));
+    microtouch3m_device_get_async_report_stats (dev, &stats);
+    printf (" | rate: %6.1f Hz", stats.report_rate);
+    printf (" | interval (min/mean/p99): %" PRIu64 "/%" PRIu64 "/%" PRIu64 " us",
+            stats.interval_min_us, stats.interval_mean_us, stats.interval_p99_us);
+    printf (" | short: %" PRIu64, stats.n_short_transfers);
+    printf (" | timeouts: %" PRIu64, stats.n_timeouts);
+    printf (" | errors: %" PRIu64, stats.n_errors);
+    printf (" | callback: %" PRIu64 " us", stats.callback_mean_us);
     fflush (stdout);
 
-    /* stray update required? */
+    context->n_pending = 0;
+}
+
+static void
+scope_stats_print (const char                       *title,
+                   const microtouch3m_scope_stats_t *stats)
+{
+    static const char                  *channel_str[MICROTOUCH3M_SCOPE_STATS_CHANNEL_N] = { "UL", "UR", "LL", "LR", "SUM" };
+    microtouch3m_scope_stats_summary_t  summary;
+    unsigned int                        i;
+
+    printf ("%s:\n", title);
+    printf ("\t%-3s  %8s  %10s  %10s  %10s  %10s  %10s  %10s  %10s  %10s\n",
+            "", "samples", "min", "p1", "p50", "p99", "max", "mean", "stddev", "rms");
+    for (i = 0; i < MICROTOUCH3M_SCOPE_STATS_CHANNEL_N; i++) {
+        microtouch3m_scope_stats_get (stats, (microtouch3m_scope_stats_channel_t) i, &summary);
+        printf ("\t%-3s  %8" PRIu64 "  %10" PRId64 "  %10.1lf  %10.1lf  %10.1lf  %10" PRId64 "  %10.1lf  %10.1lf  %10.1lf\n",
+                channel_str[i], summary.n_samples, summary.min, summary.p1, summary.p50, summary.p99, summary.max,
+                summary.mean, summary.stddev, summary.rms);
+    }
+}
+
+/* Segment size of the --scope-spectrum analysis */
+#define SCOPE_SPECTRUM_SIZE     256
+#define SCOPE_SPECTRUM_N_PEAKS  3
+
+static void
+scope_spectrum_print (const microtouch3m_scope_spectrum_t *spectrum,
+                      double                               rate)
+{
+    static const char *corner_str[MICROTOUCH3M_SCOPE_N_CORNERS] = { "UL", "UR", "LL", "LR" };
+    double             power[MICROTOUCH3M_SCOPE_N_CORNERS][SCOPE_SPECTRUM_SIZE / 2 + 1];
+    unsigned int       n_bins;
+    unsigned int       corner;
+    unsigned int       k;
+
+    n_bins = microtouch3m_scope_spectrum_get_n_bins (spectrum);
+    assert (n_bins == (SCOPE_SPECTRUM_SIZE / 2 + 1));
+
+    if (!microtouch3m_scope_spectrum_get_n_segments (spectrum)) {
+        printf ("Noise spectrum: not enough reports (%u needed)\n", SCOPE_SPECTRUM_SIZE);
+        return;
+    }
+
+    for (corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; corner++)
+        microtouch3m_scope_spectrum_get (spectrum, corner, power[corner]);
+
+    printf ("Noise spectrum (%" PRIu64 " segments of %u reports at %.1lf Hz, power in dB):\n",
+            microtouch3m_scope_spectrum_get_n_segments (spectrum), SCOPE_SPECTRUM_SIZE, rate);
+    printf ("\t%9s  %7s  %7s  %7s  %7s\n", "Hz", "UL", "UR", "LL", "LR");
+    for (k = 0; k < n_bins; k++) {
+        printf ("\t%9.2lf", k * rate / SCOPE_SPECTRUM_SIZE);
+        for (corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; corner++)
+            printf ("  %7.1lf", 10.0 * log10 (power[corner][k] + 1e-12));
+        printf ("\n");
+    }
+
+    /* Strongest local maxima, skipping what's left of the mean in the first bin */
+    printf ("Strongest noise components:\n");
+    for (corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; corner++) {
+        unsigned int peaks[SCOPE_SPECTRUM_N_PEAKS];
+        unsigned int n_peaks = 0;
+        unsigned int i;
+
+        for (k = 2; k < n_bins - 1; k++) {
+            if (power[corner][k] < power[corner][k - 1] || power[corner][k] < power[corner][k + 1])
+                continue;
+            for (i = n_peaks; i > 0 && power[corner][peaks[i - 1]] < power[corner][k]; i--) {
+                if (i < SCOPE_SPECTRUM_N_PEAKS)
+                    peaks[i] = peaks[i - 1];
+            }
+            if (i < SCOPE_SPECTRUM_N_PEAKS) {
+                peaks[i] = k;
+                if (n_peaks < SCOPE_SPECTRUM_N_PEAKS)
+                    n_peaks++;
+            }
+        }
+
+        printf ("\t%s:", corner_str[corner]);
+        for (i = 0; i < n_peaks; i++)
+            printf ("  %.2lf Hz (%.1lf dB)", peaks[i] * rate / SCOPE_SPECTRUM_SIZE, 10.0 * log10 (power[corner][peaks[i]] + 1e-12));
+        printf ("\n");
+    }
+}
+
+static bool
+async_report_scope (microtouch3m_device_t *dev,
+                    microtouch3m_status_t  status,
+                    int32_t                ul_i,
+                    int32_t                ul_q,
+                    int32_t                ur_i,
+                    int32_t                ur_q,
+                    int32_t                ll_i,
+                    int32_t                ll_q,
+                    int32_t                lr_i,
+                    int32_t                lr_q,
+                    void                  *user_data)
+{
+    struct async_report_scope_context_s *context;
+    struct timespec                      current;
+    struct timespec                      difference;
+    double                               time_s;
+    int32_t                             *i;
+    int32_t                             *q;
+
+    context = (struct async_report_scope_context_s *) user_data;
+    context->n_records++;
+
+    /* Get current timer */
+    clock_gettime (CLOCK_MONOTONIC, &current);
+    timespec_diff (&context->start, &current, &difference);
+    time_s = difference.tv_sec + (difference.tv_nsec / 1E9);
+
+    /* Queue the report, signals are computed for the whole batch at once */
+    i = &context->pending_i[context->n_pending * MICROTOUCH3M_SCOPE_N_CORNERS];
+    q = &context->pending_q[context->n_pending * MICROTOUCH3M_SCOPE_N_CORNERS];
+    i[0] = ul_i; q[0] = ul_q;
+    i[1] = ur_i; q[1] = ur_q;
+    i[2] = ll_i; q[2] = ll_q;
+    i[3] = lr_i; q[3] = lr_q;
+    context->pending_status[context->n_pending] = status;
+    context->pending_time_s[context->n_pending] = time_s;
+    context->n_pending++;
+
+    if ((context->n_pending == SCOPE_BATCH_SIZE) ||
+        ((time_s - context->pending_time_s[0]) > (SCOPE_BATCH_TIMEOUT_MS / 1000.0)))
+        async_report_scope_flush (dev, context);
+
+    /* stray update required? the pending batch is flushed once the
+     * monitor returns, before the strays are read again */
+    if (context->stray_correction &&
+        !context->strays_settled &&
+        microtouch3m_settling_detector_is_settled (context->settling))
+        return false;
+
     if (context->stray_correction) {
+        unsigned int timeout_ms;
+
+        timeout_ms = (context->stray_tracker ?
+                      microtouch3m_stray_tracker_get_interval_ms (context->stray_tracker) :
+                      STRAY_CORRECTION_TIMEOUT_MS);
         timespec_diff (&context->stray_timestamp, &current, &difference);
         time_s = difference.tv_sec + (difference.tv_nsec / 1E9);
-        if (time_s > (STRAY_CORRECTION_TIMEOUT_MS / 1000.0))
+        if (time_s > (timeout_ms / 1000.0))
             return false;
     }
 
@@ -1469,29 +2781,83 @@ async_report_scope (microtouch3m_device_t *dev,
 }
 
 static const char *basic_header_str  = "#   time,       UL,       UR,       LL,       LR\n";
+static const char *decimated_header_str = "#   time(UL),       UL,   time(UR),       UR,   time(LL),       LL,   time(LR),       LR\n";
 static const char *strays_header_str = "#   time,       UL,       UR,       LL,       LR,    UL(s),    UR(s),    LL(s),    LR(s),    UL(c),    UR(c),    LL(c),    LR(c)\n";
 
 static int
 run_scope (microtouch3m_context_t *ctx,
            const char             *out_file_path,
+           const char             *record_path,
            bool                    stray_correction,
+           bool                    stray_tracking,
            bool                    scale_thousands,
+           bool                    spectrum,
+           const char             *decimate,
+           const char             *filter,
+           double                  filter_rate,
            bool                    first,
            uint8_t                 bus_number,
            uint8_t                 device_address)
 {
-    microtouch3m_device_t               *dev;
+    microtouch3m_device_t               *dev = NULL;
     microtouch3m_status_t                st;
     int                                  ret = EXIT_FAILURE;
     struct async_report_scope_context_s  context = {
         .stray_correction = stray_correction,
-        .scale_thousands = scale_thousands,
+        .scale = (scale_thousands ? 0.001 : 1.0),
         .n_records = 0,
+        .n_pending = 0,
         .fd = -1,
+        .decimated_fd = -1,
+        .filtered_fd = -1,
     };
 
+    if (!(context.stats = microtouch3m_scope_stats_new ())) {
+        fprintf (stderr, "error: couldn't allocate statistics\n");
+        goto out;
+    }
+
+    if (!(context.settling = microtouch3m_settling_detector_new (SETTLING_WINDOW,
+                                                                 SETTLING_SLOPE_THRESHOLD,
+                                                                 SETTLING_VARIANCE_RATIO,
+                                                                 SETTLING_MAX_RECORDS))) {
+        fprintf (stderr, "error: couldn't allocate settling detector\n");
+        goto out;
+    }
+
+    if (filter) {
+        if (!(context.filter = microtouch3m_scope_filter_new (filter_rate)) ||
+            !(context.filtered_stats = microtouch3m_scope_stats_new ())) {
+            fprintf (stderr, "error: couldn't allocate filter\n");
+            goto out;
+        }
+        if (!microtouch3m_scope_filter_add_from_string (context.filter, filter)) {
+            fprintf (stderr, "error: invalid filter: %s\n", filter);
+            goto out;
+        }
+        context.filter_decimation = microtouch3m_scope_filter_get_decimation (context.filter);
+    }
+
+    if (stray_tracking && !(context.stray_tracker = microtouch3m_stray_tracker_new (STRAY_CORRECTION_TIMEOUT_MS,
+                                                                                    STRAY_TRACKING_MAX_INTERVAL_MS,
+                                                                                    STRAY_TRACKING_TOLERANCE))) {
+        fprintf (stderr, "error: couldn't allocate stray tracker\n");
+        goto out;
+    }
+
+    if (spectrum && !(context.spectrum = microtouch3m_scope_spectrum_new (SCOPE_SPECTRUM_SIZE))) {
+        fprintf (stderr, "error: couldn't allocate spectrum analyser\n");
+        goto out;
+    }
+
     if (!(dev = create_device (ctx, first, bus_number, device_address, NULL, 0)))
         goto out;
+    metrics_set_device (dev);
+
+    if (record_path && (st = microtouch3m_device_scope_recording_start (dev, record_path)) != MICROTOUCH3M_STATUS_OK) {
+        fprintf (stderr, "error: couldn't start scope recording: %s\n", microtouch3m_status_to_string (st));
+        goto out;
+    }
 
     if (out_file_path) {
         const char *header;
@@ -1509,6 +2875,74 @@ run_scope (microtouch3m_context_t *ctx,
             fsync (context.fd);
     }
 
+    if (out_file_path && decimate) {
+        microtouch3m_scope_decimator_mode_t  mode;
+        unsigned long                        bucket_size;
+        const char                          *bucket_str;
+        char                                *end = NULL;
+        char                                *decimated_path;
+
+        if (strncmp (decimate, "minmax:", strlen ("minmax:")) == 0) {
+            mode = MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX;
+            bucket_str = decimate + strlen ("minmax:");
+        } else if (strncmp (decimate, "lttb:", strlen ("lttb:")) == 0) {
+            mode = MICROTOUCH3M_SCOPE_DECIMATOR_MODE_LTTB;
+            bucket_str = decimate + strlen ("lttb:");
+        } else {
+            fprintf (stderr, "error: invalid decimation mode: %s\n", decimate);
+            goto out;
+        }
+
+        errno = 0;
+        bucket_size = strtoul (bucket_str, &end, 10);
+        if (errno || !end || end == bucket_str || *end || bucket_size < 2 || bucket_size > 1000000) {
+            fprintf (stderr, "error: invalid decimation bucket size: %s\n", bucket_str);
+            goto out;
+        }
+
+        if (!(context.decimator = microtouch3m_scope_decimator_new (mode, MICROTOUCH3M_SCOPE_N_CORNERS, (unsigned int) bucket_size))) {
+            fprintf (stderr, "error: couldn't allocate decimator\n");
+            goto out;
+        }
+        assert (microtouch3m_scope_decimator_get_max_points (context.decimator, SCOPE_BATCH_SIZE) <= SCOPE_DECIMATED_MAX_POINTS);
+
+        if (asprintf (&decimated_path, "%s" SCOPE_DECIMATED_FILE_SUFFIX, out_file_path) < 0) {
+            fprintf (stderr, "error: couldn't allocate decimated output file path\n");
+            goto out;
+        }
+        context.decimated_fd = open (decimated_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        free (decimated_path);
+        if (context.decimated_fd < 0) {
+            fprintf (stderr, "error: couldn't open decimated output file to write: %s\n", strerror (errno));
+            goto out;
+        }
+
+        if (write (context.decimated_fd, decimated_header_str, strlen (decimated_header_str)) < 0)
+            fprintf (stderr, "error: couldn't write header to decimated output file: %s\n", strerror (errno));
+        else
+            fsync (context.decimated_fd);
+    }
+
+    if (out_file_path && filter) {
+        char *filtered_path;
+
+        if (asprintf (&filtered_path, "%s" SCOPE_FILTERED_FILE_SUFFIX, out_file_path) < 0) {
+            fprintf (stderr, "error: couldn't allocate filtered output file path\n");
+            goto out;
+        }
+        context.filtered_fd = open (filtered_path, O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+        free (filtered_path);
+        if (context.filtered_fd < 0) {
+            fprintf (stderr, "error: couldn't open filtered output file to write: %s\n", strerror (errno));
+            goto out;
+        }
+
+        if (write (context.filtered_fd, basic_header_str, strlen (basic_header_str)) < 0)
+            fprintf (stderr, "error: couldn't write header to filtered output file: %s\n", strerror (errno));
+        else
+            fsync (context.filtered_fd);
+    }
+
     /* Start timer */
     clock_gettime (CLOCK_MONOTONIC, &context.start);
 
@@ -1516,22 +2950,46 @@ run_scope (microtouch3m_context_t *ctx,
     while (!stop_requested) {
         /* Update strays */
         if (stray_correction) {
+            int32_t stray_i[MICROTOUCH3M_SCOPE_N_CORNERS];
+            int32_t stray_q[MICROTOUCH3M_SCOPE_N_CORNERS];
+
             if ((st = microtouch3m_read_strays (dev,
-                                                &context.ul_stray_i,
-                                                &context.ul_stray_q,
-                                                &context.ur_stray_i,
-                                                &context.ur_stray_q,
-                                                &context.ll_stray_i,
-                                                &context.ll_stray_q,
-                                                &context.lr_stray_i,
-                                                &context.lr_stray_q)) != MICROTOUCH3M_STATUS_OK) {
+                                                &stray_i[0], &stray_q[0],
+                                                &stray_i[1], &stray_q[1],
+                                                &stray_i[2], &stray_q[2],
+                                                &stray_i[3], &stray_q[3])) != MICROTOUCH3M_STATUS_OK) {
                 fprintf (stderr, "error: couldn't read strays: %s\n", microtouch3m_status_to_string (st));
                 goto out;
             }
+            microtouch3m_iq_magnitude_batch (stray_i, stray_q, context.stray_signal, MICROTOUCH3M_SCOPE_N_CORNERS);
+            microtouch3m_scope_signal_batch (stray_i, stray_q, NULL, context.scale, context.scaled_stray_signal, 1);
             clock_gettime (CLOCK_MONOTONIC, &context.stray_timestamp);
+
+            /* Reads done while settling don't tell the drift */
+            if (!context.strays_settled && microtouch3m_settling_detector_is_settled (context.settling)) {
+                context.strays_settled = true;
+                if (context.stray_tracker)
+                    microtouch3m_stray_tracker_reset (context.stray_tracker);
+            }
+
+            if (context.stray_tracker) {
+                struct timespec difference;
+
+                timespec_diff (&context.start, &context.stray_timestamp, &difference);
+                microtouch3m_stray_tracker_update (context.stray_tracker,
+                                                   difference.tv_sec + (difference.tv_nsec / 1E9),
+                                                   context.stray_signal);
+            }
         }
 
-        if ((st = microtouch3m_device_monitor_async_reports (dev, async_report_scope, &context)) != MICROTOUCH3M_STATUS_OK) {
+        st = microtouch3m_device_monitor_async_reports (dev, async_report_scope, &context);
+        async_report_scope_flush (dev, &context);
+        /* A replayed recording being over is a normal end */
+        if (st == MICROTOUCH3M_STATUS_END_OF_DATA) {
+            printf ("\nNo more replayed data\n");
+            break;
+        }
+        if (st != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't run scope mode: %s\n", microtouch3m_status_to_string (st));
             goto out;
         }
@@ -1540,11 +2998,53 @@ run_scope (microtouch3m_context_t *ctx,
     printf ("\n");
     printf ("Scope mode disabled\n");
 
+    if (context.decimator)
+        async_report_scope_write_decimated (&context,
+                                            microtouch3m_scope_decimator_flush (context.decimator,
+                                                                                context.decimated_x,
+                                                                                context.decimated));
+
+    printf ("Settling: %" PRIu64 " records ignored%s\n",
+            microtouch3m_settling_detector_get_n_settling (context.settling),
+            !microtouch3m_settling_detector_is_settled (context.settling) ? " (not settled yet)" :
+            microtouch3m_settling_detector_is_timed_out (context.settling) ? " (timed out)" : "");
+
+    scope_stats_print ("Signal statistics", context.stats);
+    if (context.filter)
+        scope_stats_print ("Filtered signal statistics", context.filtered_stats);
+
+    if (context.stray_tracker)
+        printf ("Stray reads: %" PRIu64 " (%" PRIu64 " out of tolerance, last residual %.0lf)\n",
+                microtouch3m_stray_tracker_get_n_updates (context.stray_tracker),
+                microtouch3m_stray_tracker_get_n_fallbacks (context.stray_tracker),
+                microtouch3m_stray_tracker_get_residual (context.stray_tracker));
+
+    if (context.spectrum) {
+        microtouch3m_device_async_report_stats_t stats;
+
+        microtouch3m_device_get_async_report_stats (dev, &stats);
+        scope_spectrum_print (context.spectrum, stats.elapsed_us ? (stats.n_reports * 1E6 / stats.elapsed_us) : 0.0);
+    }
+
     ret = EXIT_SUCCESS;
 
 out:
+    metrics_set_device (NULL);
+    if (context.stats)
+        microtouch3m_scope_stats_free (context.stats);
+    microtouch3m_scope_spectrum_free (context.spectrum);
+    microtouch3m_scope_decimator_free (context.decimator);
+    microtouch3m_scope_filter_free (context.filter);
+    if (context.filtered_stats)
+        microtouch3m_scope_stats_free (context.filtered_stats);
+    microtouch3m_stray_tracker_free (context.stray_tracker);
+    microtouch3m_settling_detector_free (context.settling);
     if (!(context.fd < 0))
         close (context.fd);
+    if (!(context.decimated_fd < 0))
+        close (context.decimated_fd);
+    if (!(context.filtered_fd < 0))
+        close (context.filtered_fd);
     if (dev)
         microtouch3m_device_unref (dev);
     return ret;
@@ -1568,14 +3068,37 @@ run_firmware_dump (microtouch3m_context_t *ctx,
     if (!(dev = create_device (ctx, first, bus_number, device_address, NULL, 0)))
         goto out;
 
-    microtouch3m_device_firmware_progress_register (dev, firmware_progress, 1.0, NULL);
+    microtouch3m_device_firmware_progress_full_register (dev, firmware_progress, 1.0, NULL);
     if ((st = microtouch3m_device_firmware_dump (dev, buffer, sizeof (buffer))) != MICROTOUCH3M_STATUS_OK) {
         fprintf (stderr, "error: couldn't dump device firmware: %s\n", microtouch3m_status_to_string (st));
         goto out;
     }
     printf ("\n");
 
-    if ((st = microtouch3m_firmware_file_write (path, buffer, sizeof (buffer))) != MICROTOUCH3M_STATUS_OK) {
+    /* Never leave a truncated firmware file behind, e.g. if overwriting a
+     * previous dump and something goes wrong */
+    if (firmware_path_is_image (path)) {
+        microtouch3m_firmware_image_info_t info;
+
+        memset (&info, 0, sizeof (info));
+        if ((st = microtouch3m_device_query_controller_id (dev,
+                                                           &info.controller_type,
+                                                           &info.firmware_major,
+                                                           &info.firmware_minor,
+                                                           NULL,
+                                                           &info.constants_checksum,
+                                                           NULL,
+                                                           &info.pc_checksum,
+                                                           &info.asic_type)) != MICROTOUCH3M_STATUS_OK) {
+            fprintf (stderr, "error: couldn't query controller id: %s\n", microtouch3m_status_to_string (st));
+            goto out;
+        }
+
+        st = microtouch3m_firmware_image_write (path, buffer, sizeof (buffer), &info, MICROTOUCH3M_FIRMWARE_FILE_WRITE_FLAG_ATOMIC);
+    } else
+        st = microtouch3m_firmware_file_write_full (path, buffer, sizeof (buffer), MICROTOUCH3M_FIRMWARE_FILE_WRITE_FLAG_ATOMIC);
+
+    if (st != MICROTOUCH3M_STATUS_OK) {
         fprintf (stderr, "error: couldn't write firmware to file: %s\n", microtouch3m_status_to_string (st));
         goto out;
     }
@@ -1673,26 +3196,193 @@ out:
     return (microtouch3m_device_data_t *) buffer;
 }
 
+/* The controller ID values reported when running a given firmware image can't
+ * be computed from the image contents themselves, so they're learnt after each
+ * successful update, and stored in a local cache keyed by the image checksum.
+ * Binary firmware images already include these values in the header. */
+
+#define FIRMWARE_IMAGE_CACHE_FILE_NAME "microtouch3m-firmware-images"
+
+static char *
+firmware_image_cache_path (void)
+{
+    const char *cache_dir;
+    char       *path = NULL;
+
+    cache_dir = getenv ("XDG_CACHE_HOME");
+    if (cache_dir && cache_dir[0]) {
+        if (asprintf (&path, "%s/" FIRMWARE_IMAGE_CACHE_FILE_NAME, cache_dir) == -1)
+            return NULL;
+        return path;
+    }
+
+    cache_dir = getenv ("HOME");
+    if (!cache_dir || !cache_dir[0])
+        return NULL;
+
+    if (asprintf (&path, "%s/.cache", cache_dir) == -1)
+        return NULL;
+    /* Make sure the default cache directory exists */
+    if (mkdir (path, S_IRWXU) < 0 && errno != EEXIST) {
+        free (path);
+        return NULL;
+    }
+    free (path);
+
+    if (asprintf (&path, "%s/.cache/" FIRMWARE_IMAGE_CACHE_FILE_NAME, cache_dir) == -1)
+        return NULL;
+    return path;
+}
+
+static bool
+firmware_image_cache_lookup (uint32_t                            image_checksum,
+                             microtouch3m_firmware_image_info_t *info)
+{
+    char         *path;
+    FILE         *f;
+    char          line[128];
+    bool          found = false;
+
+    if (!(path = firmware_image_cache_path ()))
+        return false;
+
+    f = fopen (path, "r");
+    free (path);
+    if (!f)
+        return false;
+
+    /* The last matching entry wins */
+    while (fgets (line, sizeof (line), f)) {
+        unsigned int checksum, controller_type, major, minor, constants_checksum, asic_type, pc_checksum;
+
+        if (sscanf (line, "%x %x %x %x %x %x %x",
+                    &checksum, &controller_type, &major, &minor,
+                    &constants_checksum, &asic_type, &pc_checksum) != 7)
+            continue;
+        if (checksum != image_checksum)
+            continue;
+
+        info->image_checksum     = checksum;
+        info->controller_type    = (uint16_t) controller_type;
+        info->firmware_major     = (uint8_t) major;
+        info->firmware_minor     = (uint8_t) minor;
+        info->constants_checksum = (uint16_t) constants_checksum;
+        info->asic_type          = (uint16_t) asic_type;
+        info->pc_checksum        = (uint32_t) pc_checksum;
+        found = true;
+    }
+
+    fclose (f);
+    return found;
+}
+
+static void
+firmware_image_cache_store (const microtouch3m_firmware_image_info_t *info)
+{
+    microtouch3m_firmware_image_info_t  cached;
+    char                               *path;
+    FILE                               *f;
+
+    /* Already stored? */
+    if (firmware_image_cache_lookup (info->image_checksum, &cached) &&
+        memcmp (&cached, info, sizeof (cached)) == 0)
+        return;
+
+    if (!(path = firmware_image_cache_path ()))
+        return;
+
+    f = fopen (path, "a");
+    if (!f) {
+        fprintf (stderr, "warning: couldn't open firmware image cache '%s': %s\n", path, strerror (errno));
+        free (path);
+        return;
+    }
+    free (path);
+
+    fprintf (f, "%08x %04x %02x %02x %04x %04x %08x\n",
+             info->image_checksum, info->controller_type, info->firmware_major, info->firmware_minor,
+             info->constants_checksum, info->asic_type, info->pc_checksum);
+    fclose (f);
+}
+
+static microtouch3m_status_t
+query_firmware_info (microtouch3m_device_t              *dev,
+                     uint32_t                            image_checksum,
+                     microtouch3m_firmware_image_info_t *info)
+{
+    memset (info, 0, sizeof (microtouch3m_firmware_image_info_t));
+    info->image_checksum = image_checksum;
+    return microtouch3m_device_query_controller_id (dev,
+                                                    &info->controller_type,
+                                                    &info->firmware_major,
+                                                    &info->firmware_minor,
+                                                    NULL,
+                                                    &info->constants_checksum,
+                                                    NULL,
+                                                    &info->pc_checksum,
+                                                    &info->asic_type);
+}
+
 static int
 run_firmware_update (microtouch3m_context_t *ctx,
                      bool                    first,
                      uint8_t                 bus_number,
                      uint8_t                 device_address,
                      const char             *path,
+                     bool                    force,
                      bool                    skip_removing_data_backup,
                      const char             *data_backup_path)
 {
-    microtouch3m_status_t       st;
-    uint8_t                     buffer[MICROTOUCH3M_FW_IMAGE_SIZE];
-    microtouch3m_device_data_t *dev_data = NULL;
-    size_t                      dev_data_size = 0;
-    microtouch3m_device_t      *dev;
-    char                       *dev_data_tmpfile = NULL;
-    int                         ret = EXIT_FAILURE;
+    microtouch3m_status_t              st;
+    uint8_t                            buffer[MICROTOUCH3M_FW_IMAGE_SIZE];
+    microtouch3m_firmware_image_info_t image_info;
+    bool                               image_info_available = false;
+    microtouch3m_device_data_t        *dev_data = NULL;
+    size_t                             dev_data_size = 0;
+    microtouch3m_device_t             *dev;
+    char                              *dev_data_tmpfile = NULL;
+    int                                ret = EXIT_FAILURE;
 
     if (!(dev = create_device (ctx, first, bus_number, device_address, NULL, 0)))
         goto out;
 
+    /* Load and validate the firmware file before doing anything else */
+    if (path) {
+        printf ("reading firmware file...\n");
+        if ((st = firmware_path_read (path, buffer, sizeof (buffer), &image_info, &image_info_available)) != MICROTOUCH3M_STATUS_OK) {
+            fprintf (stderr, "error: couldn't load firmware file: %s\n", microtouch3m_status_to_string (st));
+            goto out;
+        }
+        if (!image_info_available) {
+            image_info.image_checksum = microtouch3m_firmware_image_checksum (buffer, sizeof (buffer));
+            image_info_available = firmware_image_cache_lookup (image_info.image_checksum, &image_info);
+        }
+    }
+
+    /* Skip the update if the controller is already running the same firmware */
+    if (path && image_info_available && !force) {
+        microtouch3m_firmware_image_info_t device_info;
+
+        if ((st = query_firmware_info (dev, image_info.image_checksum, &device_info)) != MICROTOUCH3M_STATUS_OK) {
+            fprintf (stderr, "error: couldn't query controller id: %s\n", microtouch3m_status_to_string (st));
+            goto out;
+        }
+
+        if (device_info.controller_type == image_info.controller_type &&
+            device_info.firmware_major  == image_info.firmware_major &&
+            device_info.firmware_minor  == image_info.firmware_minor &&
+            device_info.pc_checksum     == image_info.pc_checksum) {
+            printf ("controller already running firmware %x.%x (pc checksum 0x%08x): skipping update\n",
+                    device_info.firmware_major, device_info.firmware_minor, device_info.pc_checksum);
+            /* If an explicit data backup was given, still restore it */
+            if (!data_backup_path) {
+                ret = EXIT_SUCCESS;
+                goto out;
+            }
+            path = NULL;
+        }
+    }
+
     /* Ask the user for confirmation */
     if (path) {
         char ans;
@@ -1755,14 +3445,10 @@ run_firmware_update (microtouch3m_context_t *ctx,
 
     /* If path given, perform FW update */
     if (path) {
-        printf ("reading firmware file...\n");
-        if ((st = microtouch3m_firmware_file_read (path, buffer, sizeof (buffer))) != MICROTOUCH3M_STATUS_OK) {
-            fprintf (stderr, "error: couldn't load firmware file: %s\n", microtouch3m_status_to_string (st));
-            goto out;
-        }
+        microtouch3m_firmware_image_info_t device_info;
 
         printf ("downloading firmware to device EEPROM...\n");
-        microtouch3m_device_firmware_progress_register (dev, firmware_progress, 1.0, NULL);
+        microtouch3m_device_firmware_progress_full_register (dev, firmware_progress, 1.0, NULL);
         if ((st = microtouch3m_device_firmware_update (dev, buffer, sizeof (buffer))) != MICROTOUCH3M_STATUS_OK) {
             fprintf (stderr, "error: couldn't download firmware to device EEPROM: %s\n", microtouch3m_status_to_string (st));
             goto out;
@@ -1774,6 +3460,14 @@ run_firmware_update (microtouch3m_context_t *ctx,
             fprintf (stderr, "error: controller didn't reboot correctly\n");
             goto out;
         }
+
+        /* Learn which controller ID values this image reports, so that the
+         * next update of the same image to an already updated unit is
+         * skipped right away */
+        if ((st = query_firmware_info (dev, microtouch3m_firmware_image_checksum (buffer, sizeof (buffer)), &device_info)) != MICROTOUCH3M_STATUS_OK)
+            fprintf (stderr, "warning: couldn't query controller id after update: %s\n", microtouch3m_status_to_string (st));
+        else
+            firmware_image_cache_store (&device_info);
     }
 
     printf ("restoring device data...\n");
@@ -1865,6 +3559,7 @@ print_help (void)
             "\n"
             "Frequency check device actions:\n"
             "  -F, --frequency-check                        Run frequency check mode.\n"
+            "  -A, --frequency-check-adaptive               Stop checking each frequency once its noise is known (See Notes).\n"
             "\n"
             "Linearization data actions:\n"
             "  -P, --linearization-data-load=[PATH]         Load linearization data from a .bk2 file.\n"
@@ -1873,28 +3568,90 @@ print_help (void)
             "Scope device actions:\n"
             "  -S, --scope                                  Run scope mode.\n"
             "  -O, --scope-file=[PATH]                      Store the scope results in an output file.\n"
+            "  -k, --scope-file-decimate=[MODE:N]           Also store a decimated copy of the scope results (See Notes).\n"
             "  -C, --scope-stray-correction                 Perform stray correction during the scope operation.\n"
+            "  -K, --scope-stray-tracking                   Read the strays less often while their drift is predictable (See Notes).\n"
             "  -T, --scope-scale-thousands                  Scale the values by 1000.\n"
+            "  -G, --scope-spectrum                         Report the noise spectrum of each corner (See Notes).\n"
+            "  -X, --scope-filter=[SPEC]                    Filter the values shown, next to the raw ones (See Notes).\n"
+            "  -Z, --scope-filter-rate=[HZ]                 Report rate the --scope-filter frequencies refer to.\n"
+            "\n"
+            "Scope and frequency check options:\n"
+            "  -m, --metrics-socket=[PATH]                  Serve live metrics on a Unix domain socket (See Notes).\n"
+            "  -W, --scope-record=[PATH]                    Record the raw scope reports into a file.\n"
             "\n"
             "Firmware device actions:\n"
             "  -x, --firmware-dump=[PATH]                   Dump firmware to a file.\n"
             "  -u, --firmware-update=[PATH]                 Update firmware in the device (See Notes).\n"
+            "  -U, --force-firmware-update                  Update firmware even if the device already runs it (See Notes).\n"
             "  -N, --skip-removing-data-backup              Don't remove data backup on firmware update success.\n"
             "  -B, --restore-data-backup=[PATH]             Restore the given device data (See Notes).\n"
             "\n"
             "Firmware file actions:\n"
             "  -z, --validate-fw-file=[PATH]                Validate firmware file.\n"
             "\n"
+            "Trace file actions:\n"
+            "  -y, --trace-summary=[PATH]                   Show per-request statistics of a USB transfer trace file.\n"
+            "  -Y, --trace-decode=[PATH]                    Show all transfers in a USB transfer trace file, plus statistics.\n"
+            "\n"
             "Common options:\n"
             "  -d, --debug                                  Enable verbose logging.\n"
+            "  -D, --debug-deferred                         Enable verbose logging, formatted in a background thread.\n"
+            "  -t, --trace=[PATH]                           Record all USB transfers into a trace file.\n"
+            "  -e, --replay=[PATH]                          Run against an emulated device replaying a scope recording (See Notes).\n"
+            "  -E, --replay-max-speed                       Replay the scope recording as fast as possible.\n"
+            "  -a, --stats                                  Show USB transfer statistics after a device action.\n"
             "  -h, --help                                   Show help.\n"
             "  -v, --version                                Show version.\n"
             "\n"
             "Notes:\n"
             "  * The --firmware-update action will perform a controller reboot automatically.\n"
+            "  * The [PATH] given to --firmware-dump, --firmware-update and --validate-fw-file is\n"
+            "    treated as a binary firmware image if its extension is " MICROTOUCH3M_FW_IMAGE_FILE_EXTENSION ", and as an\n"
+            "    Intel HEX firmware file otherwise.\n"
+            "  * The --firmware-update action is skipped if the device already runs the given firmware,\n"
+            "    as reported in the binary firmware image header or learnt in a previous update of the\n"
+            "    same image. Use --force-firmware-update to always update.\n"
             "  * The --restore-data-backup may be given as an additional option to the --firmware-update\n"
             "    command, or alternatively as a command itself.\n"
             "\n"
+            "  * The --metrics-socket endpoint serves a Prometheus text format snapshot to every\n"
+            "    client connecting, either raw (e.g. socat - UNIX-CONNECT:[PATH]) or over HTTP\n"
+            "    (e.g. curl --unix-socket [PATH] http://localhost/metrics).\n"
+            "\n"
+            "  * With --frequency-check-adaptive, each frequency is checked until its stddev noise is\n"
+            "    known within 10%%, or until it is clearly worse than the best one found so far. The\n"
+            "    error is estimated from how much the noise varies between blocks of 20 records, so\n"
+            "    unstable or intermittent noise is checked for longer. The peak based rankings are\n"
+            "    not shown, as they depend on the length of each check.\n"
+            "\n"
+            "  * The --scope-spectrum report is shown when scope mode stops. It averages the power\n"
+            "    spectra of Hann-windowed segments of 256 reports, overlapping by half, of the values\n"
+            "    shown (stray corrected if requested). Frequencies are relative to the report rate,\n"
+            "    so components above half of it show up aliased.\n"
+            "\n"
+            "  * With --scope-stray-tracking, the strays are predicted between reads from their recent\n"
+            "    trend. The read interval doubles, from 100ms up to 6.4s, while each read is within\n"
+            "    1000 (unscaled) of the prediction, and goes back to 100ms otherwise. The status line\n"
+            "    shows the current interval and the last prediction error (residual).\n"
+            "\n"
+            "  * The --scope-file-decimate option writes the values of the output file (stray corrected\n"
+            "    if requested) into a companion file, with the same path plus a '" SCOPE_DECIMATED_FILE_SUFFIX "' suffix.\n"
+            "    [MODE] may be 'minmax', which keeps the minimum and maximum of every [N] reports, or\n"
+            "    'lttb', which keeps the one report of every [N] that best preserves the shape of the\n"
+            "    signal. Each corner keeps its own reports, so each has its own time column.\n"
+            "\n"
+            "  * The --scope-filter [SPEC] is a comma separated list of stages, applied in order to\n"
+            "    the values shown (stray corrected if requested): 'notch:HZ[:Q]' and 'lowpass:HZ[:Q]'\n"
+            "    biquads (Q defaults to 30 and 0.707), 'average:N' moving averages and 'decimate:N'\n"
+            "    FIR decimators, e.g. 'notch:50,notch:100,lowpass:20'. Frequencies need the report\n"
+            "    rate given in --scope-filter-rate, and stages after a decimator run at its output\n"
+            "    rate. Statistics of the filtered values are shown when scope mode stops, and with\n"
+            "    --scope-file they are stored in a companion file with a '" SCOPE_FILTERED_FILE_SUFFIX "' suffix.\n"
+            "\n"
+            "  * The [PATH] given to --replay is a file created with --scope-record. Scope mode and the\n"
+            "    frequency check finish once all the recorded reports have been replayed.\n"
+            "\n"
             "  * The [OR] value in --set-orientation may be any of: LL, LR, UL, UR\n"
             "\n"
             "  * The --set-sensitivity-level action will perform a controller reboot automatically.\n"
@@ -1968,6 +3725,7 @@ int main (int argc, char **argv)
     unsigned int            n_actions;
     unsigned int            n_actions_require_device;
     microtouch3m_context_t *ctx                        = NULL;
+    microtouch3m_status_t   st;
     int                     idx, iarg                  = 0;
     bool                    list                       = false;
     char                   *bus_number_device_address  = NULL;
@@ -1984,18 +3742,34 @@ int main (int argc, char **argv)
     bool                    reset_soft                 = false;
     bool                    reset_hard                 = false;
     bool                    frequency_check            = false;
+    bool                    frequency_check_adaptive   = false;
     char                   *linearization_data_load    = NULL;
     char                   *linearization_data_save    = NULL;
     bool                    scope                      = false;
     char                   *scope_file                 = NULL;
+    char                   *scope_file_decimate        = NULL;
     bool                    scope_stray_correction     = false;
+    bool                    scope_stray_tracking       = false;
     bool                    scope_scale_thousands      = false;
+    bool                    scope_spectrum             = false;
+    char                   *scope_filter               = NULL;
+    char                   *scope_filter_rate          = NULL;
+    double                  filter_rate                = 0.0;
+    char                   *metrics_socket             = NULL;
+    char                   *scope_record               = NULL;
     char                   *firmware_dump              = NULL;
     char                   *firmware_update            = NULL;
+    bool                    force_firmware_update      = false;
     bool                    skip_removing_data_backup  = false;
     char                   *restore_data_backup        = NULL;
     char                   *validate_fw_file           = NULL;
     bool                    debug                      = false;
+    bool                    debug_deferred             = false;
+    char                   *trace                      = NULL;
+    char                   *replay                     = NULL;
+    bool                    replay_max_speed           = false;
+    char                   *trace_summary              = NULL;
+    char                   *trace_decode               = NULL;
     int                     ret                        = EXIT_FAILURE;
 
     const struct option longopts[] = {
@@ -2012,18 +3786,34 @@ int main (int argc, char **argv)
         { "reset-soft",                 no_argument,       0, 'r' },
         { "reset-hard",                 no_argument,       0, 'R' },
         { "frequency-check",            no_argument,       0, 'F' },
+        { "frequency-check-adaptive",   no_argument,       0, 'A' },
         { "linearization-data-load",    required_argument, 0, 'P' },
         { "linearization-data-save",    required_argument, 0, 'Q' },
         { "scope",                      no_argument,       0, 'S' },
         { "scope-file",                 required_argument, 0, 'O' },
+        { "scope-file-decimate",        required_argument, 0, 'k' },
         { "scope-stray-correction",     no_argument,       0, 'C' },
+        { "scope-stray-tracking",       no_argument,       0, 'K' },
         { "scope-scale-thousands",      no_argument,       0, 'T' },
+        { "scope-spectrum",             no_argument,       0, 'G' },
+        { "scope-filter",               required_argument, 0, 'X' },
+        { "scope-filter-rate",          required_argument, 0, 'Z' },
+        { "metrics-socket",             required_argument, 0, 'm' },
+        { "scope-record",               required_argument, 0, 'W' },
         { "firmware-dump",              required_argument, 0, 'x' },
         { "firmware-update",            required_argument, 0, 'u' },
+        { "force-firmware-update",      no_argument,       0, 'U' },
         { "restore-data-backup",        required_argument, 0, 'B' },
         { "skip-removing-data-backup",  no_argument,       0, 'N' },
         { "validate-fw-file",           required_argument, 0, 'z' },
+        { "trace-summary",              required_argument, 0, 'y' },
+        { "trace-decode",               required_argument, 0, 'Y' },
         { "debug",                      no_argument,       0, 'd' },
+        { "debug-deferred",             no_argument,       0, 'D' },
+        { "trace",                      required_argument, 0, 't' },
+        { "replay",                     required_argument, 0, 'e' },
+        { "replay-max-speed",           no_argument,       0, 'E' },
+        { "stats",                      no_argument,       0, 'a' },
         { "version",                    no_argument,       0, 'v' },
         { "help",                       no_argument,       0, 'h' },
         { 0,                            0,                 0, 0   },
@@ -2032,7 +3822,7 @@ int main (int argc, char **argv)
     /* turn off getopt error message */
     opterr = 1;
     while (iarg != -1) {
-        iarg = getopt_long (argc, argv, "ns:fiI:o:l:L:p:c:rRFP:Q:SO:CTx:u:B:Nz:dhv", longopts, &idx);
+        iarg = getopt_long (argc, argv, "ns:fiI:o:l:L:p:c:rRFAP:Q:SO:k:CKTGX:Z:m:W:x:u:UB:Nz:y:Y:dDt:e:Eahv", longopts, &idx);
         switch (iarg) {
         case 'n':
             list = true;
@@ -2073,6 +3863,9 @@ int main (int argc, char **argv)
         case 'F':
             frequency_check = true;
             break;
+        case 'A':
+            frequency_check_adaptive = true;
+            break;
         case 'P':
             linearization_data_load = strdup (optarg);
             break;
@@ -2085,18 +3878,42 @@ int main (int argc, char **argv)
         case 'O':
             scope_file = strdup (optarg);
             break;
+        case 'k':
+            scope_file_decimate = strdup (optarg);
+            break;
         case 'C':
             scope_stray_correction = true;
             break;
+        case 'K':
+            scope_stray_tracking = true;
+            break;
         case 'T':
             scope_scale_thousands = true;
             break;
+        case 'G':
+            scope_spectrum = true;
+            break;
+        case 'X':
+            scope_filter = strdup (optarg);
+            break;
+        case 'Z':
+            scope_filter_rate = strdup (optarg);
+            break;
+        case 'm':
+            metrics_socket = strdup (optarg);
+            break;
+        case 'W':
+            scope_record = strdup (optarg);
+            break;
         case 'x':
             firmware_dump = strdup (optarg);
             break;
         case 'u':
             firmware_update = strdup (optarg);
             break;
+        case 'U':
+            force_firmware_update = true;
+            break;
         case 'B':
             restore_data_backup = strdup (optarg);
             break;
@@ -2106,9 +3923,31 @@ int main (int argc, char **argv)
         case 'z':
             validate_fw_file = strdup (optarg);
             break;
+        case 'y':
+            trace_summary = strdup (optarg);
+            break;
+        case 'Y':
+            trace_decode = strdup (optarg);
+            break;
         case 'd':
             debug = true;
             break;
+        case 'D':
+            debug = true;
+            debug_deferred = true;
+            break;
+        case 't':
+            trace = strdup (optarg);
+            break;
+        case 'e':
+            replay = strdup (optarg);
+            break;
+        case 'E':
+            replay_max_speed = true;
+            break;
+        case 'a':
+            stats_enabled = true;
+            break;
         case 'h':
             print_help ();
             return 0;
@@ -2119,6 +3958,10 @@ int main (int argc, char **argv)
     }
 
     /* Error out on invalid combinations */
+    if (force_firmware_update && !firmware_update) {
+        fprintf (stderr, "error: --force-firmware-update can only be run with --firmware-update\n");
+        goto out;
+    }
     if (skip_removing_data_backup && !firmware_update) {
         fprintf (stderr, "error: --skip-removing-data-backup can only be run with --firmware-update\n");
         goto out;
@@ -2127,14 +3970,68 @@ int main (int argc, char **argv)
         fprintf (stderr, "error: --scope-file can only be run with --scope\n");
         goto out;
     }
+    if (scope_file_decimate && !scope_file) {
+        fprintf (stderr, "error: --scope-file-decimate can only be run with --scope-file\n");
+        goto out;
+    }
     if (scope_stray_correction && !scope) {
         fprintf (stderr, "error: --scope-stray-correction can only be run with --scope\n");
         goto out;
     }
+    if (scope_stray_tracking && !scope_stray_correction) {
+        fprintf (stderr, "error: --scope-stray-tracking can only be run with --scope-stray-correction\n");
+        goto out;
+    }
     if (scope_scale_thousands && !scope) {
         fprintf (stderr, "error: --scope-scale-thousands can only be run with --scope\n");
         goto out;
     }
+    if (scope_spectrum && !scope) {
+        fprintf (stderr, "error: --scope-spectrum can only be run with --scope\n");
+        goto out;
+    }
+    if (scope_filter && !scope) {
+        fprintf (stderr, "error: --scope-filter can only be run with --scope\n");
+        goto out;
+    }
+    if (scope_filter && !scope_filter_rate) {
+        fprintf (stderr, "error: --scope-filter requires --scope-filter-rate\n");
+        goto out;
+    }
+    if (scope_filter_rate && !scope_filter) {
+        fprintf (stderr, "error: --scope-filter-rate can only be run with --scope-filter\n");
+        goto out;
+    }
+    if (scope_filter_rate) {
+        char *end = NULL;
+
+        errno = 0;
+        filter_rate = strtod (scope_filter_rate, &end);
+        if (errno || !end || end == scope_filter_rate || *end || !(filter_rate > 0.0)) {
+            fprintf (stderr, "error: invalid filter rate: %s\n", scope_filter_rate);
+            goto out;
+        }
+    }
+    if (frequency_check_adaptive && !frequency_check) {
+        fprintf (stderr, "error: --frequency-check-adaptive can only be run with --frequency-check\n");
+        goto out;
+    }
+    if (metrics_socket && !scope && !frequency_check) {
+        fprintf (stderr, "error: --metrics-socket can only be run with --scope or --frequency-check\n");
+        goto out;
+    }
+    if (scope_record && !scope && !frequency_check) {
+        fprintf (stderr, "error: --scope-record can only be run with --scope or --frequency-check\n");
+        goto out;
+    }
+    if (replay_max_speed && !replay) {
+        fprintf (stderr, "error: --replay-max-speed can only be run with --replay\n");
+        goto out;
+    }
+    if (trace && (trace_summary || trace_decode)) {
+        fprintf (stderr, "error: --trace cannot be run with --trace-summary or --trace-decode\n");
+        goto out;
+    }
 
     /* Track actions */
     n_actions_require_device =
@@ -2157,6 +4054,8 @@ int main (int argc, char **argv)
     n_actions =
         list +
         !!(validate_fw_file) +
+        !!(trace_summary) +
+        !!(trace_decode) +
         n_actions_require_device;
 
     if (n_actions > 1) {
@@ -2167,19 +4066,35 @@ int main (int argc, char **argv)
         fprintf (stderr, "error: no actions requested\n");
         return EXIT_FAILURE;
     }
+    if (stats_enabled && !n_actions_require_device) {
+        fprintf (stderr, "error: --stats can only be run with device actions\n");
+        return EXIT_FAILURE;
+    }
 
     /* Setup library logging */
     if (debug) {
         main_tid = pthread_self ();
         microtouch3m_log_set_handler (log_handler);
+        if (debug_deferred && microtouch3m_log_set_mode (MICROTOUCH3M_LOG_MODE_DEFERRED) != MICROTOUCH3M_STATUS_OK)
+            fprintf (stderr, "warning: couldn't enable deferred logging\n");
         disable_progress = true;
     }
 
     /* Setup signals */
     setup_signals ();
 
-    /* Initialize library */
-    ctx = microtouch3m_context_new ();
+    /* Initialize library, optionally replaying a scope recording */
+    if (replay) {
+        char *config;
+
+        if (asprintf (&config, "replay=%s%s", replay, replay_max_speed ? ",pace=max" : "") == -1) {
+            fprintf (stderr, "error: couldn't build emulator configuration\n");
+            goto out;
+        }
+        ctx = microtouch3m_context_new_emulated (config);
+        free (config);
+    } else
+        ctx = microtouch3m_context_new ();
     if (!ctx) {
         fprintf (stderr, "error: libmicrotouch3m initialization failed\n");
         goto out;
@@ -2197,8 +4112,22 @@ int main (int argc, char **argv)
         }
     }
 
+    /* Record USB transfers */
+    if (trace && (st = microtouch3m_context_trace_start (ctx, trace)) != MICROTOUCH3M_STATUS_OK) {
+        fprintf (stderr, "error: couldn't start USB transfer trace: %s\n", microtouch3m_status_to_string (st));
+        goto out;
+    }
+
+    /* Serve live metrics */
+    if (metrics_socket && !metrics_start_server (metrics_socket))
+        goto out;
+
     /* Run actions */
-    if (validate_fw_file)
+    if (trace_summary)
+        ret = run_trace_decode (trace_summary, false);
+    else if (trace_decode)
+        ret = run_trace_decode (trace_decode, true);
+    else if (validate_fw_file)
         ret = run_validate_fw_file (validate_fw_file);
     else if (list)
         ret = run_list (ctx);
@@ -2221,9 +4150,9 @@ int main (int argc, char **argv)
     else if (reset_hard)
         ret = run_reset (ctx, first, bus_number, device_address, MICROTOUCH3M_DEVICE_RESET_HARD);
     else if (scope)
-        ret = run_scope (ctx, scope_file, scope_stray_correction, scope_scale_thousands, first, bus_number, device_address);
+        ret = run_scope (ctx, scope_file, scope_record, scope_stray_correction, scope_stray_tracking, scope_scale_thousands, scope_spectrum, scope_file_decimate, scope_filter, filter_rate, first, bus_number, device_address);
     else if (frequency_check)
-        ret = run_frequency_check (ctx, first, bus_number, device_address);
+        ret = run_frequency_check (ctx, scope_record, frequency_check_adaptive, first, bus_number, device_address);
     else if (linearization_data_load)
         ret = run_linearization_data_load (ctx, first, bus_number, device_address, linearization_data_load);
     else if (linearization_data_save)
@@ -2231,22 +4160,38 @@ int main (int argc, char **argv)
     else if (firmware_dump)
         ret = run_firmware_dump (ctx, first, bus_number, device_address, firmware_dump);
     else if (firmware_update || restore_data_backup)
-        ret = run_firmware_update (ctx, first, bus_number, device_address, firmware_update, skip_removing_data_backup, restore_data_backup);
+        ret = run_firmware_update (ctx, first, bus_number, device_address, firmware_update, force_firmware_update, skip_removing_data_backup, restore_data_backup);
     else
         assert (0);
 
 out:
+    metrics_stop_server ();
+    print_stats ();
+
     if (ctx)
         microtouch3m_context_unref (ctx);
 
+    /* Flush pending deferred log messages */
+    if (debug_deferred)
+        microtouch3m_log_set_mode (MICROTOUCH3M_LOG_MODE_IMMEDIATE);
+
     free (linearization_data_load);
     free (linearization_data_save);
     free (scope_file);
+    free (scope_file_decimate);
+    free (scope_filter);
+    free (scope_filter_rate);
+    free (metrics_socket);
+    free (scope_record);
     free (bus_number_device_address);
     free (firmware_dump);
     free (firmware_update);
     free (restore_data_backup);
     free (validate_fw_file);
+    free (trace);
+    free (replay);
+    free (trace_summary);
+    free (trace_decode);
     free (set_constant_touch_timeout);
     free (set_frequency);
     free (set_extended_sensitivity);
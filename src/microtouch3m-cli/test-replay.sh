@@ -0,0 +1,33 @@
+#!/bin/sh
+# Records a short scope capture from an emulated device and replays it to
+# completion: scope mode must finish cleanly once the capture is over.
+
+CAPTURE=test-replay.rec
+OUTPUT=test-replay.out
+
+command -v timeout >/dev/null 2>&1 || exit 77
+
+rm -f $CAPTURE $OUTPUT
+
+# Recording only stops when interrupted
+MICROTOUCH3M_EMULATOR=rate=500 timeout -s INT 1 ./microtouch3m-cli -f -S -W $CAPTURE >/dev/null
+if [ ! -s $CAPTURE ]; then
+    echo "error: couldn't record scope capture"
+    exit 1
+fi
+
+if ! ./microtouch3m-cli -f -S -e $CAPTURE -E >$OUTPUT 2>&1; then
+    cat $OUTPUT
+    echo "error: replay didn't finish cleanly"
+    exit 1
+fi
+
+# The summaries are given after the replay
+if ! grep -q "^Signal statistics" $OUTPUT; then
+    cat $OUTPUT
+    echo "error: replay didn't print the summaries"
+    exit 1
+fi
+
+rm -f $CAPTURE $OUTPUT
+exit 0
@@ -0,0 +1,78 @@
+/*
+ * microtouch3m-scope - Graphical tool for monitoring MicroTouch 3M touchscreen scope
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Sergey Zhuravlevich
+ */
+
+
+#include "ChartDecimator.hpp"
+
+ChartDecimator::ChartDecimator() :
+    m_decimator(0),
+    m_mode(MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX),
+    m_bucket_size(0)
+{
+}
+
+ChartDecimator::ChartDecimator(const ChartDecimator &) :
+    m_decimator(0),
+    m_mode(MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX),
+    m_bucket_size(0)
+{
+}
+
+ChartDecimator &ChartDecimator::operator=(const ChartDecimator &)
+{
+    return *this;
+}
+
+ChartDecimator::~ChartDecimator()
+{
+    microtouch3m_scope_decimator_free(m_decimator);
+}
+
+size_t ChartDecimator::decimate(microtouch3m_scope_decimator_mode_t mode, unsigned int bucket_size,
+                                const std::vector<int32_t> &values)
+{
+    if (!m_decimator || mode != m_mode || bucket_size != m_bucket_size)
+    {
+        microtouch3m_scope_decimator_free(m_decimator);
+
+        m_decimator = microtouch3m_scope_decimator_new(mode, 1, bucket_size);
+        m_mode = mode;
+        m_bucket_size = bucket_size;
+    }
+
+    if (!m_decimator || values.empty())
+    {
+        return 0;
+    }
+
+    m_x.resize(microtouch3m_scope_decimator_get_max_points(m_decimator, values.size()));
+    m_values.resize(m_x.size());
+
+    // the whole curve is a stream of its own
+    microtouch3m_scope_decimator_reset(m_decimator);
+
+    size_t n_points = microtouch3m_scope_decimator_add(m_decimator, 0, &values[0], values.size(), &m_x[0], &m_values[0]);
+
+    n_points += microtouch3m_scope_decimator_flush(m_decimator, &m_x[n_points], &m_values[n_points]);
+
+    return n_points;
+}
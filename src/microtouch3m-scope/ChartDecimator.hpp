@@ -0,0 +1,66 @@
+/*
+ * microtouch3m-scope - Graphical tool for monitoring MicroTouch 3M touchscreen scope
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Sergey Zhuravlevich
+ */
+
+
+#ifndef MICROTOUCH3M_SCOPE_CHARTDECIMATOR_HPP
+#define MICROTOUCH3M_SCOPE_CHARTDECIMATOR_HPP
+
+#include <vector>
+
+#include <stdint.h>
+
+#include "microtouch3m.h"
+
+// Reduces the values of a curve to the points worth drawing, with the library
+// decimator. Charts are copied around by value, so copies don't share the
+// decimator, they create their own when first used.
+class ChartDecimator
+{
+public:
+    ChartDecimator();
+    ChartDecimator(const ChartDecimator &other);
+    ChartDecimator &operator=(const ChartDecimator &other);
+    ~ChartDecimator();
+
+    // returns the number of points, available until the next call
+    size_t decimate(microtouch3m_scope_decimator_mode_t mode, unsigned int bucket_size,
+                    const std::vector<int32_t> &values);
+
+    double x(size_t i) const
+    {
+        return m_x[i];
+    }
+
+    int32_t value(size_t i) const
+    {
+        return m_values[i];
+    }
+
+private:
+    microtouch3m_scope_decimator_t *m_decimator;
+    microtouch3m_scope_decimator_mode_t m_mode;
+    unsigned int m_bucket_size;
+    std::vector<double> m_x;
+    std::vector<int32_t> m_values;
+};
+
+#endif // MICROTOUCH3M_SCOPE_CHARTDECIMATOR_HPP
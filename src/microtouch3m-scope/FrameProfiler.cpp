@@ -0,0 +1,172 @@
+/*
+ * microtouch3m-scope - Graphical tool for monitoring MicroTouch 3M touchscreen scope
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Sergey Zhuravlevich
+ */
+
+#include "FrameProfiler.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+#include <time.h>
+
+const uint32_t FrameProfiler::s_window_size = 256;
+
+FrameProfiler::FrameProfiler() :
+    m_frame_count(0),
+    m_start_us(now_us()),
+    m_csv_header_written(false)
+{ }
+
+FrameProfiler::~FrameProfiler()
+{ }
+
+uint64_t FrameProfiler::now_us()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+uint32_t FrameProfiler::add_phase(const std::string &name)
+{
+    m_phases.push_back(phase_t(name, s_window_size));
+    return (uint32_t) (m_phases.size() - 1);
+}
+
+void FrameProfiler::begin(uint32_t phase)
+{
+    m_phases.at(phase).start_us = now_us();
+}
+
+void FrameProfiler::end(uint32_t phase)
+{
+    phase_t &p = m_phases.at(phase);
+
+    p.frame_us += (uint32_t) (now_us() - p.start_us);
+}
+
+void FrameProfiler::end_frame()
+{
+    const uint32_t slot = (uint32_t) (m_frame_count % s_window_size);
+
+    if (m_csv.is_open())
+    {
+        if (!m_csv_header_written)
+        {
+            m_csv << "frame,time_us";
+            for (std::vector<phase_t>::const_iterator it = m_phases.begin(); it != m_phases.end(); ++it)
+            {
+                m_csv << "," << it->name << "_us";
+            }
+            m_csv << "\n";
+            m_csv_header_written = true;
+        }
+
+        m_csv << m_frame_count << "," << (now_us() - m_start_us);
+        for (std::vector<phase_t>::const_iterator it = m_phases.begin(); it != m_phases.end(); ++it)
+        {
+            m_csv << "," << it->frame_us;
+        }
+        m_csv << "\n";
+    }
+
+    for (std::vector<phase_t>::iterator it = m_phases.begin(); it != m_phases.end(); ++it)
+    {
+        it->samples[slot] = it->frame_us;
+        it->frame_us = 0;
+    }
+
+    ++m_frame_count;
+}
+
+bool FrameProfiler::open_csv(const std::string &file_path)
+{
+    m_csv.open(file_path.c_str(), std::ios::out | std::ios::trunc);
+    m_csv_header_written = false;
+
+    return m_csv.is_open();
+}
+
+uint32_t FrameProfiler::phase_count() const
+{
+    return (uint32_t) m_phases.size();
+}
+
+const std::string &FrameProfiler::phase_name(uint32_t phase) const
+{
+    return m_phases.at(phase).name;
+}
+
+FrameProfiler::stats_t FrameProfiler::phase_stats(uint32_t phase) const
+{
+    stats_t stats;
+
+    const uint64_t count = std::min<uint64_t>(m_frame_count, s_window_size);
+
+    if (count == 0)
+        return stats;
+
+    std::vector<uint32_t> samples(m_phases.at(phase).samples.begin(), m_phases.at(phase).samples.begin() + count);
+
+    uint64_t total = 0;
+    for (std::vector<uint32_t>::const_iterator it = samples.begin(); it != samples.end(); ++it)
+    {
+        total += *it;
+    }
+
+    const size_t p99_index = (size_t) ((count * 99 - 1) / 100);
+    std::nth_element(samples.begin(), samples.begin() + p99_index, samples.end());
+
+    stats.p99_us = samples[p99_index];
+    stats.min_us = *std::min_element(samples.begin(), samples.end());
+    stats.avg_us = (uint32_t) (total / count);
+
+    return stats;
+}
+
+std::string FrameProfiler::report() const
+{
+    std::ostringstream oss;
+
+    size_t name_width = 5;
+    for (std::vector<phase_t>::const_iterator it = m_phases.begin(); it != m_phases.end(); ++it)
+    {
+        name_width = std::max(name_width, it->name.length());
+    }
+
+    oss << std::left << std::setw((int) name_width) << "PHASE"
+        << std::right << std::setw(8) << "MIN" << std::setw(8) << "AVG" << std::setw(8) << "P99" << std::endl;
+
+    for (uint32_t i = 0; i < m_phases.size(); ++i)
+    {
+        const stats_t stats = phase_stats(i);
+
+        oss << std::left << std::setw((int) name_width) << m_phases[i].name
+            << std::right << std::setw(8) << stats.min_us << std::setw(8) << stats.avg_us << std::setw(8) << stats.p99_us
+            << std::endl;
+    }
+
+    // the bitmap font has no parentheses nor commas
+    oss << "US - LAST " << std::min<uint64_t>(m_frame_count, s_window_size) << " FRAMES";
+
+    return oss.str();
+}
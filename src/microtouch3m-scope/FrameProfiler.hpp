@@ -0,0 +1,87 @@
+/*
+ * microtouch3m-scope - Graphical tool for monitoring MicroTouch 3M touchscreen scope
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA 02110-1301 USA.
+ *
+ * Copyright (C) 2017 Zodiac Inflight Innovations
+ * Copyright (C) 2017 Sergey Zhuravlevich
+ */
+
+#ifndef MICROTOUCH3M_SCOPE_FRAMEPROFILER_HPP
+#define MICROTOUCH3M_SCOPE_FRAMEPROFILER_HPP
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include <stdint.h>
+
+// Measures how long each phase of a frame takes. A phase may be entered
+// several times in the same frame, its durations are added up. Statistics are
+// computed over the last s_window_size frames.
+class FrameProfiler
+{
+public:
+    struct stats_t
+    {
+        stats_t() : min_us(0), avg_us(0), p99_us(0)
+        {}
+
+        uint32_t min_us;
+        uint32_t avg_us;
+        uint32_t p99_us;
+    };
+
+    FrameProfiler();
+    virtual ~FrameProfiler();
+
+    uint32_t add_phase(const std::string &name);
+    void begin(uint32_t phase);
+    void end(uint32_t phase);
+    void end_frame();
+
+    bool open_csv(const std::string &file_path);
+
+    uint32_t phase_count() const;
+    const std::string &phase_name(uint32_t phase) const;
+    stats_t phase_stats(uint32_t phase) const;
+    std::string report() const;
+
+    static uint64_t now_us();
+
+private:
+    struct phase_t
+    {
+        phase_t(const std::string &name, uint32_t window_size) :
+            name(name), start_us(0), frame_us(0), samples(window_size, 0)
+        {}
+
+        std::string name;
+        uint64_t start_us;
+        uint32_t frame_us;
+        std::vector<uint32_t> samples;
+    };
+
+    static const uint32_t s_window_size;
+
+    std::vector<phase_t> m_phases;
+    uint64_t m_frame_count;
+    uint64_t m_start_us;
+    std::ofstream m_csv;
+    bool m_csv_header_written;
+};
+
+#endif // MICROTOUCH3M_SCOPE_FRAMEPROFILER_HPP
@@ -29,6 +29,7 @@
 
 #include "SDLUtils.hpp"
 #include "Utils.hpp"
+#include "ChartDecimator.hpp"
 
 template<class T>
 class LineChart
@@ -67,7 +68,8 @@ public:
         std::vector<T> data;
     };
 
-    LineChart() : m_width(0), m_height(0), m_left(0), m_top(0), m_right(0), m_bottom(0), m_progress(0.0f)
+    LineChart() : m_width(0), m_height(0), m_left(0), m_top(0), m_right(0), m_bottom(0), m_progress(0.0f),
+                  m_decimation(false), m_decimation_mode(MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX)
     {}
 
     Curve &add_curve(const Color &color, typename std::vector<T>::size_type fill_count, T fill_value)
@@ -87,6 +89,13 @@ public:
         return m_curves.at(i);
     }
 
+    // curves with more than two values per pixel column are decimated before drawing them
+    void set_decimation(bool enable, microtouch3m_scope_decimator_mode_t mode = MICROTOUCH3M_SCOPE_DECIMATOR_MODE_MINMAX)
+    {
+        m_decimation = enable;
+        m_decimation_mode = mode;
+    }
+
     void set_progress(float progress)
     {
         m_progress = progress;
@@ -129,6 +138,33 @@ public:
             int32_t px = 0, py = 0;
             const Uint32 col = curve.color.map_rgb(surface->format);
 
+            if (m_decimation && m_width > 0 && curve.data.size() > m_width * 2)
+            {
+                m_decimation_values.assign(curve.data.begin(), curve.data.end());
+
+                const size_t n_points = m_decimator.decimate(m_decimation_mode,
+                                                             (unsigned int) (curve.data.size() / m_width),
+                                                             m_decimation_values);
+
+                for (size_t i = 0; i < n_points; ++i)
+                {
+                    const int y = m_decimator.value(i);
+                    const int x = (const int) (w_step * m_decimator.x(i));
+
+                    if (i > 0)
+                    {
+                        sdl_utils::draw_line(surface,
+                                            px + m_left, m_top + m_height / 2 - py,
+                                            x + m_left, m_top + m_height / 2 - y,
+                                            col);
+                    }
+
+                    px = x; py = y;
+                }
+
+                continue;
+            }
+
             for (int i = 0; i < curve.data.size(); ++i)
             {
                 const int y = curve.data.at(i);
@@ -248,6 +284,10 @@ protected:
     uint32_t m_grid_cell_h;
     uint32_t m_middle_y;
     uint32_t m_grid_stub_h;
+    bool m_decimation;
+    microtouch3m_scope_decimator_mode_t m_decimation_mode;
+    ChartDecimator m_decimator;
+    std::vector<int32_t> m_decimation_values;
 };
 
 #endif // MICROTOUCH_3M_SCOPE_GRAPH_HPP
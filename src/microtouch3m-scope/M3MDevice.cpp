@@ -24,14 +24,13 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <cstring>
 #include <cmath>
 
 #include <unistd.h>
 
 #include "Utils.hpp"
 
-#define PROCESS_IQ(i,q) (uint64_t) sqrt ((((double)i) * ((double)i)) + (((double)q) * ((double)q)))
-
 M3MContext::M3MContext()
 {
     if (!(m_ctx = microtouch3m_context_new()))
@@ -128,10 +127,16 @@ void M3MDevice::read_strays()
         throw std::runtime_error("M3M: Couldn't read strays - " + std::string(microtouch3m_status_to_string(st)));
     }
 
-    m_ul_stray_signal = PROCESS_IQ(ul_stray_i, ul_stray_q);
-    m_ur_stray_signal = PROCESS_IQ(ur_stray_i, ur_stray_q);
-    m_ll_stray_signal = PROCESS_IQ(ll_stray_i, ll_stray_q);
-    m_lr_stray_signal = PROCESS_IQ(lr_stray_i, lr_stray_q);
+    const int32_t stray_i[4] = { ul_stray_i, ur_stray_i, ll_stray_i, lr_stray_i };
+    const int32_t stray_q[4] = { ul_stray_q, ur_stray_q, ll_stray_q, lr_stray_q };
+    uint64_t stray_signal[4];
+
+    microtouch3m_iq_magnitude_batch(stray_i, stray_q, stray_signal, 4);
+
+    m_ul_stray_signal = stray_signal[0];
+    m_ur_stray_signal = stray_signal[1];
+    m_ll_stray_signal = stray_signal[2];
+    m_lr_stray_signal = stray_signal[3];
 }
 
 void M3MDevice::get_fw_version(int *major, int *minor)
@@ -224,34 +229,79 @@ uint8_t M3MDevice::stray_alpha() const
     return m_stray_alpha;
 }
 
+bool M3MDevice::get_linearization_data(struct microtouch3m_device_linearization_data_s *data)
+{
+    return microtouch3m_device_get_linearization_data(m_dev, data) == MICROTOUCH3M_STATUS_OK;
+}
+
+bool M3MDevice::get_orientation(microtouch3m_device_orientation_t *orientation)
+{
+    return microtouch3m_device_get_orientation(m_dev, orientation) == MICROTOUCH3M_STATUS_OK;
+}
+
 void M3MDevice::monitor_async_reports(microtouch3m_device_async_report_scope_f *callback, void *user_data)
 {
     microtouch3m_status_t st;
 
-    if ((st = microtouch3m_device_monitor_async_reports(m_dev, callback, user_data)) != MICROTOUCH3M_STATUS_OK)
+    st = microtouch3m_device_monitor_async_reports(m_dev, callback, user_data);
+    // A replayed recording being over is a normal end
+    if (st != MICROTOUCH3M_STATUS_OK && st != MICROTOUCH3M_STATUS_END_OF_DATA)
     {
         throw std::runtime_error("M3M: Couldn't monitor async reports - " + std::string(microtouch3m_status_to_string(st)));
     }
 }
 
+void M3MDevice::get_async_report_stats(microtouch3m_device_async_report_stats_t *stats) const
+{
+    microtouch3m_device_get_async_report_stats(m_dev, stats);
+}
+
+// strays are read every 500ms, up to every 8s while their drift is predictable
+// within 1000 signal units
+static const unsigned int s_stray_min_interval_ms = 500;
+static const unsigned int s_stray_max_interval_ms = 8000;
+static const double s_stray_tolerance = 1000.0;
+
+// reports are dropped until the controller settles, see the frequency check of
+// the cli
+static const unsigned int s_settling_window = 32;
+static const double s_settling_slope_threshold = 1.0;
+static const double s_settling_variance_ratio = 4.0;
+static const uint64_t s_settling_max_reports = 500;
+// reports given to the settling detector at once
+static const size_t s_settling_batch_reports = 16;
+
+// report stats are refreshed every second, as often as the report rate changes
+static const unsigned int s_report_stats_interval_ms = 1000;
+
 M3MDeviceMonitorThread::M3MDeviceMonitorThread() :
     Thread("m3m-dev-mon"),
-    m_signals_r(&m_signals0),
-    m_signals_w(&m_signals1),
+    m_reports_r(&m_reports0),
+    m_reports_w(&m_reports1),
+    m_stray_tracker(microtouch3m_stray_tracker_new(s_stray_min_interval_ms, s_stray_max_interval_ms, s_stray_tolerance)),
+    m_settling(microtouch3m_settling_detector_new(s_settling_window, s_settling_slope_threshold,
+                                                  s_settling_variance_ratio, s_settling_max_reports)),
+    m_stray_interval_ms(s_stray_min_interval_ms),
+    m_stray_residual(0.0),
     m_callback_failures(0)
-{ }
+{
+    memset(&m_report_stats, 0, sizeof(m_report_stats));
+}
 
 M3MDeviceMonitorThread::~M3MDeviceMonitorThread()
 {
     exit();
     join();
+
+    microtouch3m_stray_tracker_free(m_stray_tracker);
+    microtouch3m_settling_detector_free(m_settling);
 }
 
-std::queue<M3MDeviceMonitorThread::signal_t> *M3MDeviceMonitorThread::get_signals_r()
+M3MDeviceMonitorThread::reports_t *M3MDeviceMonitorThread::get_reports_r()
 {
-    MutexLock lock(&m_mut_signals);
-    std::swap(m_signals_r, m_signals_w);
-    return m_signals_r;
+    MutexLock lock(&m_mut_reports);
+    std::swap(m_reports_r, m_reports_w);
+    return m_reports_r;
 }
 
 M3MDeviceMonitorThread::signal_t M3MDeviceMonitorThread::get_strays()
@@ -264,10 +314,28 @@ M3MDeviceMonitorThread::signal_t M3MDeviceMonitorThread::get_strays()
     return strays;
 }
 
-void M3MDeviceMonitorThread::push_signal(const M3MDeviceMonitorThread::signal_t &sig)
+void M3MDeviceMonitorThread::get_stray_tracking(unsigned int *interval_ms, double *residual)
+{
+    MutexLock lock(&m_mut_strays);
+    *interval_ms = m_stray_interval_ms;
+    *residual = m_stray_residual;
+}
+
+microtouch3m_device_async_report_stats_t M3MDeviceMonitorThread::get_report_stats()
+{
+    microtouch3m_device_async_report_stats_t stats;
+    {
+        MutexLock lock(&m_mut_report_stats);
+        stats = m_report_stats;
+    }
+    return stats;
+}
+
+void M3MDeviceMonitorThread::push_report(int32_t ul_i, int32_t ul_q, int32_t ur_i, int32_t ur_q,
+                                         int32_t ll_i, int32_t ll_q, int32_t lr_i, int32_t lr_q)
 {
-    MutexLock lock(&m_mut_signals);
-    m_signals_w->push(sig);
+    MutexLock lock(&m_mut_reports);
+    m_reports_w->push(ul_i, ul_q, ur_i, ur_q, ll_i, ll_q, lr_i, lr_q);
 }
 
 void M3MDeviceMonitorThread::set_strays(const M3MDeviceMonitorThread::signal_t &sig)
@@ -276,13 +344,72 @@ void M3MDeviceMonitorThread::set_strays(const M3MDeviceMonitorThread::signal_t &
     m_strays = sig;
 }
 
+// reads the strays, and feeds them to the drift tracker
+void M3MDeviceMonitorThread::update_strays(const timespec &now)
+{
+    m_m3m_dev->read_strays();
+    m_strays_update_time = now;
+
+    set_strays(signal_t(
+        m_m3m_dev->m_ul_stray_signal,
+        m_m3m_dev->m_ur_stray_signal,
+        m_m3m_dev->m_ll_stray_signal,
+        m_m3m_dev->m_lr_stray_signal
+    ));
+
+    if (m_stray_tracker)
+    {
+        const timespec elapsed = Utils::timespec_diff(m_start_time, now);
+        const uint64_t stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS] = {
+            m_m3m_dev->m_ul_stray_signal, m_m3m_dev->m_ur_stray_signal,
+            m_m3m_dev->m_ll_stray_signal, m_m3m_dev->m_lr_stray_signal
+        };
+
+        microtouch3m_stray_tracker_update(m_stray_tracker, elapsed.tv_sec + elapsed.tv_nsec / 1e9, stray_signal);
+
+        MutexLock lock(&m_mut_strays);
+        m_stray_interval_ms = microtouch3m_stray_tracker_get_interval_ms(m_stray_tracker);
+        m_stray_residual = microtouch3m_stray_tracker_get_residual(m_stray_tracker);
+    }
+}
+
+// follows the stray drift between reads
+void M3MDeviceMonitorThread::predict_strays(const timespec &now)
+{
+    if (!m_stray_tracker)
+    {
+        return;
+    }
+
+    const timespec elapsed = Utils::timespec_diff(m_start_time, now);
+    uint64_t stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS];
+
+    microtouch3m_stray_tracker_predict(m_stray_tracker, elapsed.tv_sec + elapsed.tv_nsec / 1e9, stray_signal);
+
+    set_strays(signal_t((int64_t) stray_signal[0], (int64_t) stray_signal[1],
+                        (int64_t) stray_signal[2], (int64_t) stray_signal[3]));
+}
+
+void M3MDeviceMonitorThread::set_report_stats(const microtouch3m_device_async_report_stats_t &stats)
+{
+    MutexLock lock(&m_mut_report_stats);
+    m_report_stats = stats;
+}
+
 bool M3MDeviceMonitorThread::run()
 {
     try
     {
-        clock_gettime(CLOCK_REALTIME, &m_strays_update_time);
+        clock_gettime(CLOCK_REALTIME, &m_start_time);
+        m_strays_update_time = m_start_time;
+        m_report_stats_update_time = m_start_time;
 
 #ifdef TEST_VALUES
+        // magnitudes can't be negative, so the test values are offset by the strays
+        const int test_stray = 100000000;
+
+        set_strays(signal_t(test_stray, test_stray, test_stray, test_stray));
+
         while (!get_exit())
         {
             static uint64_t count = 0;
@@ -296,17 +423,7 @@ bool M3MDeviceMonitorThread::run()
             int val2 = (int) (scale * ((sin(test_time * 0.01) + cos(test_time * 0.02)) * 100 + 50));
             int val3 = (int) (scale * (count % 30 - 100));
 
-            push_signal(signal_t(val0, val1, val2, val3));
-
-            timespec now;
-            clock_gettime(CLOCK_REALTIME, &now);
-            const timespec time_diff = Utils::timespec_diff(m_strays_update_time, now);
-
-            if (time_diff.tv_sec * 1000000000 + time_diff.tv_nsec >= 500000000)
-            {
-                m_strays_update_time = now;
-                set_strays(signal_t(val0, val1, val2, val3));
-            }
+            push_report(val0 + test_stray, 0, val1 + test_stray, 0, val2 + test_stray, 0, val3 + test_stray, 0);
 
             ++count;
 
@@ -316,7 +433,7 @@ bool M3MDeviceMonitorThread::run()
         m_m3m_dev = new M3MDevice();
 
         m_m3m_dev->open();
-        m_m3m_dev->read_strays();
+        update_strays(m_start_time);
 
         m_m3m_dev->monitor_async_reports(M3MDeviceMonitorThread::monitor_async_reports_callback, this);
 
@@ -357,34 +474,69 @@ bool M3MDeviceMonitorThread::monitor_async_reports_callback(microtouch3m_device_
         return true;
     }
 
-    const uint64_t ul_signal = PROCESS_IQ(ul_i, ul_q);
-    const uint64_t ur_signal = PROCESS_IQ(ur_i, ur_q);
-    const uint64_t ll_signal = PROCESS_IQ(ll_i, ll_q);
-    const uint64_t lr_signal = PROCESS_IQ(lr_i, lr_q);
-
-    thread->push_signal(signal_t(
-        ((int64_t) ul_signal) - ((int64_t) thread->m_m3m_dev->m_ul_stray_signal),
-        ((int64_t) ur_signal) - ((int64_t) thread->m_m3m_dev->m_ur_stray_signal),
-        ((int64_t) ll_signal) - ((int64_t) thread->m_m3m_dev->m_ll_stray_signal),
-        ((int64_t) lr_signal) - ((int64_t) thread->m_m3m_dev->m_lr_stray_signal)
-    ));
-
     timespec now;
     clock_gettime(CLOCK_REALTIME, &now);
 
+    // the strays read before the controller settled are no good either
+    if (thread->m_settling && !microtouch3m_settling_detector_is_settled(thread->m_settling))
+    {
+        reports_t &pending = thread->m_settling_reports;
+
+        pending.push(ul_i, ul_q, ur_i, ur_q, ll_i, ll_q, lr_i, lr_q);
+        if (pending.size() < s_settling_batch_reports)
+        {
+            return !thread->get_exit();
+        }
+
+        // the reports of the batch after the settling point are dropped too,
+        // as they were given before the strays are read again
+        thread->m_settling_signal.resize(pending.i.size());
+        microtouch3m_scope_signal_batch(&pending.i[0], &pending.q[0], NULL, 1.0,
+                                        &thread->m_settling_signal[0], pending.size());
+        microtouch3m_settling_detector_add(thread->m_settling, &thread->m_settling_signal[0], pending.size());
+        pending.clear();
+
+        if (microtouch3m_settling_detector_is_settled(thread->m_settling))
+        {
+            if (thread->m_stray_tracker)
+            {
+                microtouch3m_stray_tracker_reset(thread->m_stray_tracker);
+            }
+
+            thread->update_strays(now);
+        }
+
+        return !thread->get_exit();
+    }
+
+    // signals are computed in batches by the consumer
+    thread->push_report(ul_i, ul_q, ur_i, ur_q, ll_i, ll_q, lr_i, lr_q);
+
     const timespec time_diff = Utils::timespec_diff(thread->m_strays_update_time, now);
 
-    if (time_diff.tv_sec * 1000000000 + time_diff.tv_nsec >= 500000000)
+    unsigned int interval_ms;
+    double residual;
+
+    thread->get_stray_tracking(&interval_ms, &residual);
+
+    if (time_diff.tv_sec * 1000000000LL + time_diff.tv_nsec >= interval_ms * 1000000LL)
+    {
+        thread->update_strays(now);
+    }
+    else
+    {
+        thread->predict_strays(now);
+    }
+
+    // independent of the stray reads, which may be up to 8s apart
+    const timespec stats_diff = Utils::timespec_diff(thread->m_report_stats_update_time, now);
+
+    if (stats_diff.tv_sec * 1000000000LL + stats_diff.tv_nsec >= s_report_stats_interval_ms * 1000000LL)
     {
-        thread->m_m3m_dev->read_strays();
-        thread->m_strays_update_time = now;
-
-        thread->set_strays(signal_t(
-            thread->m_m3m_dev->m_ul_stray_signal,
-            thread->m_m3m_dev->m_ur_stray_signal,
-            thread->m_m3m_dev->m_ll_stray_signal,
-            thread->m_m3m_dev->m_lr_stray_signal
-        ));
+        microtouch3m_device_async_report_stats_t stats;
+        thread->m_m3m_dev->get_async_report_stats(&stats);
+        thread->set_report_stats(stats);
+        thread->m_report_stats_update_time = now;
     }
 
     return !thread->get_exit();
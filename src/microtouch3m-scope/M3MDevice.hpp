@@ -24,7 +24,7 @@
 #define MICROTOUCH3M_SCOPE_M3MDEVICE_HPP
 
 #include <iostream>
-#include <queue>
+#include <vector>
 
 #include <time.h>
 
@@ -65,7 +65,10 @@ public:
     uint8_t palm() const;
     uint8_t stray() const;
     uint8_t stray_alpha() const;
+    bool get_linearization_data(struct microtouch3m_device_linearization_data_s *data);
+    bool get_orientation(microtouch3m_device_orientation_t *orientation);
     void monitor_async_reports(microtouch3m_device_async_report_scope_f *callback, void *user_data);
+    void get_async_report_stats(microtouch3m_device_async_report_stats_t *stats) const;
 
 private:
     M3MContext m_ctx;
@@ -115,13 +118,51 @@ public:
         int64_t lr;
     };
 
-    std::queue<signal_t> *get_signals_r();
+    // Raw I/Q components of the reports, corners of each report contiguous as
+    // expected by microtouch3m_scope_signal_batch()
+    struct reports_t
+    {
+        size_t size() const
+        {
+            return i.size() / MICROTOUCH3M_SCOPE_N_CORNERS;
+        }
+
+        void clear()
+        {
+            i.clear();
+            q.clear();
+        }
+
+        void push(int32_t ul_i, int32_t ul_q, int32_t ur_i, int32_t ur_q,
+                  int32_t ll_i, int32_t ll_q, int32_t lr_i, int32_t lr_q)
+        {
+            i.push_back(ul_i);
+            i.push_back(ur_i);
+            i.push_back(ll_i);
+            i.push_back(lr_i);
+            q.push_back(ul_q);
+            q.push_back(ur_q);
+            q.push_back(ll_q);
+            q.push_back(lr_q);
+        }
+
+        std::vector<int32_t> i;
+        std::vector<int32_t> q;
+    };
+
+    reports_t *get_reports_r();
     signal_t get_strays();
+    void get_stray_tracking(unsigned int *interval_ms, double *residual);
+    microtouch3m_device_async_report_stats_t get_report_stats();
 
 private:
 
-    void push_signal(const signal_t &sig);
+    void push_report(int32_t ul_i, int32_t ul_q, int32_t ur_i, int32_t ur_q,
+                     int32_t ll_i, int32_t ll_q, int32_t lr_i, int32_t lr_q);
     void set_strays(const signal_t &sig);
+    void update_strays(const timespec &now);
+    void predict_strays(const timespec &now);
+    void set_report_stats(const microtouch3m_device_async_report_stats_t &stats);
     virtual bool run();
 
     static bool monitor_async_reports_callback(microtouch3m_device_t *dev, microtouch3m_status_t status, int32_t ul_i,
@@ -129,11 +170,21 @@ private:
                                                int32_t lr_i, int32_t lr_q, void *user_data);
 
     M3MDevice *m_m3m_dev;
-    std::queue<signal_t> m_signals0, m_signals1, *m_signals_r, *m_signals_w;
-    Mutex m_mut_signals;
+    reports_t m_reports0, m_reports1, *m_reports_r, *m_reports_w;
+    Mutex m_mut_reports;
+    timespec m_start_time;
     timespec m_strays_update_time;
+    microtouch3m_stray_tracker_t *m_stray_tracker;
+    microtouch3m_settling_detector_t *m_settling;
+    reports_t m_settling_reports;
+    std::vector<int32_t> m_settling_signal;
     Mutex m_mut_strays;
     signal_t m_strays;
+    unsigned int m_stray_interval_ms;
+    double m_stray_residual;
+    Mutex m_mut_report_stats;
+    microtouch3m_device_async_report_stats_t m_report_stats;
+    timespec m_report_stats_update_time;
     int m_callback_failures;
 };
 
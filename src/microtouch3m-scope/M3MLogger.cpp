@@ -30,6 +30,8 @@ M3MLogger::M3MLogger()
 
 M3MLogger::~M3MLogger()
 {
+    // flush pending deferred messages
+    microtouch3m_log_set_mode(MICROTOUCH3M_LOG_MODE_IMMEDIATE);
 }
 
 void M3MLogger::log_handler(pthread_t thread_id, const char *message)
@@ -45,9 +47,15 @@ void M3MLogger::enable(bool e)
     if (e)
     {
         microtouch3m_log_set_handler(log_handler);
+        // Keep formatting out of the monitor thread
+        if (microtouch3m_log_set_mode(MICROTOUCH3M_LOG_MODE_DEFERRED) != MICROTOUCH3M_STATUS_OK)
+        {
+            std::cerr << "Couldn't enable deferred m3m logging" << std::endl;
+        }
     }
     else
     {
+        microtouch3m_log_set_mode(MICROTOUCH3M_LOG_MODE_IMMEDIATE);
         microtouch3m_log_set_handler(0);
     }
 }
@@ -29,6 +29,7 @@
 #include <cstring>
 #include <iomanip>
 #include <algorithm>
+#include <limits>
 
 #include <fcntl.h>
 #include <unistd.h>
@@ -39,6 +40,13 @@ volatile sig_atomic_t g_make_screenshot = 0;
 
 uint32_t M3MScopeApp::s_text_margin = 20;
 
+// noise spectrum of the deltas: 256 point segments, peaks refreshed every 16 of them
+const unsigned int M3MScopeApp::s_spectrum_size = 256;
+const uint64_t M3MScopeApp::s_spectrum_segments = 16;
+
+// touched positions kept in the touch trace panel
+const size_t M3MScopeApp::s_touch_trace_size = 512;
+
 M3MScopeApp::M3MScopeApp(uint32_t width, uint32_t height, uint8_t bits_per_pixel, uint32_t flags,
                          uint32_t fps_limit, bool verbose, bool vsync, bool m3m_log, uint32_t samples,
                          ChartMode chart_mode) :
@@ -54,8 +62,25 @@ M3MScopeApp::M3MScopeApp(uint32_t width, uint32_t height, uint8_t bits_per_pixel
     m_old_chart_prog(0.0f),
     m_clear_color(Color(0, 0, 0).map_rgb(screen_surface()->format)),
     m_static_version_text_string("SW Version: " + std::string(PACKAGE_VERSION)),
-    m_mac_suffix(Utils::mac().substr(9, 8).erase(2, 1).erase(4, 1))
+    m_spectrum(microtouch3m_scope_spectrum_new(s_spectrum_size)),
+    m_touch_estimator(microtouch3m_touch_estimator_new()),
+    m_filter(0),
+    m_mac_suffix(Utils::mac().substr(9, 8).erase(2, 1).erase(4, 1)),
+    m_phase_charts(profiler().add_phase("charts")),
+    m_phase_text(profiler().add_phase("text")),
+    m_profiler_overlay(false),
+    m_clear_all(false),
+    m_profiler_update_time(0)
 {
+    memset(&m_report_stats, 0, sizeof(m_report_stats));
+    m_stray_interval_ms = 0;
+    m_stray_residual = 0.0;
+    std::fill(m_peak_hz, m_peak_hz + MICROTOUCH3M_SCOPE_N_CORNERS, 0.0);
+    std::fill(m_filtered_hold, m_filtered_hold + MICROTOUCH3M_SCOPE_N_CORNERS, 0);
+    m_filter_phase = 0;
+    memset(&m_profiler_text_rect, 0, sizeof(m_profiler_text_rect));
+    memset(&m_touch_rect, 0, sizeof(m_touch_rect));
+
     m_m3m_logger.enable(m3m_log);
 
     // print m3m info
@@ -108,6 +133,23 @@ M3MScopeApp::M3MScopeApp(uint32_t width, uint32_t height, uint8_t bits_per_pixel
 
         m3m_dev.get_sensitivity_info();
 
+        // estimate touches as the controller would, if it lets us know how
+        if (m_touch_estimator)
+        {
+            struct microtouch3m_device_linearization_data_s linearization_data;
+            microtouch3m_device_orientation_t orientation;
+
+            if (m3m_dev.get_linearization_data(&linearization_data))
+            {
+                microtouch3m_touch_estimator_set_linearization_data(m_touch_estimator, &linearization_data);
+            }
+
+            if (m3m_dev.get_orientation(&orientation))
+            {
+                microtouch3m_touch_estimator_set_orientation(m_touch_estimator, orientation);
+            }
+        }
+
         {
             std::vector<size_t> len_value, len_label;
 
@@ -218,6 +260,9 @@ M3MScopeApp::M3MScopeApp(uint32_t width, uint32_t height, uint8_t bits_per_pixel
 
 M3MScopeApp::~M3MScopeApp()
 {
+    microtouch3m_scope_spectrum_free(m_spectrum);
+    microtouch3m_touch_estimator_free(m_touch_estimator);
+    microtouch3m_scope_filter_free(m_filter);
 }
 
 void M3MScopeApp::set_print_fps(bool enable)
@@ -233,6 +278,30 @@ void M3MScopeApp::set_scale(uint32_t scale)
     oss << m_scale_target;
 
     m_scale_target_string = oss.str();
+
+    // touches are the reports whose summed deltas reach 1% of the chart scale
+    if (m_touch_estimator)
+    {
+        microtouch3m_touch_estimator_set_threshold(m_touch_estimator, m_scale_target / 100);
+    }
+}
+
+void M3MScopeApp::set_profiler_overlay(bool enable)
+{
+    m_profiler_overlay = enable;
+    m_clear_all = true;
+}
+
+// filtered curves are drawn over the raw ones; the filter itself is created
+// once the report rate its frequencies refer to is known
+void M3MScopeApp::set_filter(const std::string &spec)
+{
+    m_filter_spec = spec;
+
+    microtouch3m_scope_filter_free(m_filter);
+    m_filter = 0;
+
+    create_charts();
 }
 
 void M3MScopeApp::on_start()
@@ -268,6 +337,16 @@ void M3MScopeApp::update(uint32_t delta_time)
         }
     }
 
+    if (m_profiler_overlay)
+    {
+        if ((m_profiler_update_time += delta_time) > 1000)
+        {
+            m_profiler_text_string = profiler().report();
+
+            m_profiler_update_time = 0;
+        }
+    }
+
     if (m_m3m_dev_mon_thread.done())
     {
         m_exit = true;
@@ -278,19 +357,68 @@ void M3MScopeApp::update(uint32_t delta_time)
 
     m_upd_start = m_upd_end;
 
-    std::queue<M3MDeviceMonitorThread::signal_t> * const signals = m_m3m_dev_mon_thread.get_signals_r();
+    M3MDeviceMonitorThread::reports_t * const reports = m_m3m_dev_mon_thread.get_reports_r();
+    const size_t n_reports = reports->size();
 
-    while (!signals->empty())
+    m_strays = m_m3m_dev_mon_thread.get_strays();
+
+    if (n_reports > 0)
     {
         const double scale = (double) (screen_surface()->h / 2 - 10) / m_scale_target;
+        const uint64_t stray_signal[MICROTOUCH3M_SCOPE_N_CORNERS] = {
+            (uint64_t) m_strays.ul, (uint64_t) m_strays.ur, (uint64_t) m_strays.ll, (uint64_t) m_strays.lr
+        };
+        const size_t n_values = n_reports * MICROTOUCH3M_SCOPE_N_CORNERS;
+
+        // chart values, scaled and saturated by the kernel itself
+        m_chart_values.resize(n_values);
+        microtouch3m_scope_signal_batch(&reports->i[0], &reports->q[0], stray_signal, scale,
+                                        &m_chart_values[0], n_reports);
+
+        // unscaled deltas: the text panel shows the last one, and the noise
+        // spectrum, touch trace and filter use all of them when enabled
+        const bool all_deltas = m_spectrum || m_touch_estimator || !m_filter_spec.empty();
+        const size_t first_delta = all_deltas ? 0 : n_reports - 1;
+
+        m_delta_values.resize((n_reports - first_delta) * MICROTOUCH3M_SCOPE_N_CORNERS);
+        microtouch3m_scope_signal_batch(&reports->i[first_delta * MICROTOUCH3M_SCOPE_N_CORNERS],
+                                        &reports->q[first_delta * MICROTOUCH3M_SCOPE_N_CORNERS], stray_signal, 1.0,
+                                        &m_delta_values[0], n_reports - first_delta);
+
+        const int32_t * const signal = &m_delta_values[m_delta_values.size() - MICROTOUCH3M_SCOPE_N_CORNERS];
+        m_signal = M3MDeviceMonitorThread::signal_t(signal[0], signal[1], signal[2], signal[3]);
+
+        if (m_spectrum)
+        {
+            microtouch3m_scope_spectrum_add(m_spectrum, &m_delta_values[0], n_reports);
 
-        m_signal = signals->front();
-        signals->pop();
+            if (microtouch3m_scope_spectrum_get_n_segments(m_spectrum) >= s_spectrum_segments)
+            {
+                update_spectrum_peaks();
+            }
+        }
 
-        int val0 = (int) (m_signal.ul * scale);
-        int val1 = (int) (m_signal.ur * scale);
-        int val2 = (int) (m_signal.ll * scale);
-        int val3 = (int) (m_signal.lr * scale);
+        if (m_touch_estimator)
+        {
+            update_touch_trace(n_reports);
+        }
+
+        if (!m_filter_spec.empty())
+        {
+            update_filtered_values(n_reports, scale);
+        }
+
+        reports->clear();
+    }
+
+    for (size_t n = 0; n < n_reports; ++n)
+    {
+        const int32_t * const values = &m_chart_values[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+        const int val0 = values[0];
+        const int val1 = values[1];
+        const int val2 = values[2];
+        const int val3 = values[3];
 
         switch (m_chart_mode)
         {
@@ -306,6 +434,16 @@ void M3MScopeApp::update(uint32_t delta_time)
                     chart.curve(1).set(pos, val1);
                     chart.curve(2).set(pos, val2);
                     chart.curve(3).set(pos, val3);
+
+                    if (chart.curves_count() == 8)
+                    {
+                        const int32_t * const filtered = &m_filtered_values[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+                        chart.curve(4).set(pos, filtered[0]);
+                        chart.curve(5).set(pos, filtered[1]);
+                        chart.curve(6).set(pos, filtered[2]);
+                        chart.curve(7).set(pos, filtered[3]);
+                    }
                 }
             }
                 break;
@@ -320,6 +458,16 @@ void M3MScopeApp::update(uint32_t delta_time)
                     m_charts.at(1).curve(0).set(pos, val1);
                     m_charts.at(2).curve(0).set(pos, val2);
                     m_charts.at(3).curve(0).set(pos, val3);
+
+                    if (m_charts.at(0).curves_count() == 2)
+                    {
+                        const int32_t * const filtered = &m_filtered_values[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+                        for (size_t i = 0; i < m_charts.size(); ++i)
+                        {
+                            m_charts.at(i).curve(1).set(pos, filtered[i]);
+                        }
+                    }
                 }
             }
                 break;
@@ -330,7 +478,8 @@ void M3MScopeApp::update(uint32_t delta_time)
 
     m_upd_end = (uint32_t) ((m_current_pos - 1) % m_sample_count);
 
-    m_strays = m_m3m_dev_mon_thread.get_strays();
+    m_report_stats = m_m3m_dev_mon_thread.get_report_stats();
+    m_m3m_dev_mon_thread.get_stray_tracking(&m_stray_interval_ms, &m_stray_residual);
 
     m_old_chart_prog = m_chart_prog;
     m_chart_prog = (float) (m_current_pos % m_sample_count) / m_sample_count;
@@ -341,6 +490,158 @@ void M3MScopeApp::update(uint32_t delta_time)
     }
 }
 
+void M3MScopeApp::update_spectrum_peaks()
+{
+    const unsigned int n_bins = microtouch3m_scope_spectrum_get_n_bins(m_spectrum);
+
+    m_spectrum_power.resize(n_bins);
+
+    for (unsigned int corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; ++corner)
+    {
+        microtouch3m_scope_spectrum_get(m_spectrum, corner, &m_spectrum_power[0]);
+
+        // skip the DC bin and its window leakage
+        const std::vector<double>::const_iterator peak =
+            std::max_element(m_spectrum_power.begin() + 2, m_spectrum_power.end());
+
+        m_peak_hz[corner] = (peak - m_spectrum_power.begin()) * m_report_stats.report_rate / s_spectrum_size;
+    }
+
+    microtouch3m_scope_spectrum_reset(m_spectrum);
+}
+
+// filtered deltas, scaled for the charts; all the reports of the frame go
+// through the filter at once, and when decimating each filtered value is held
+// until the next one
+void M3MScopeApp::update_filtered_values(size_t n_reports, double scale)
+{
+    if (!m_filter && m_report_stats.report_rate > 0.0f)
+    {
+        m_filter = microtouch3m_scope_filter_new(m_report_stats.report_rate);
+        m_filter_phase = 0;
+
+        if (!m_filter || !microtouch3m_scope_filter_add_from_string(m_filter, m_filter_spec.c_str()))
+        {
+            std::cerr << "Can't set up filter '" << m_filter_spec << "' at " << m_report_stats.report_rate << " Hz"
+                      << std::endl;
+
+            microtouch3m_scope_filter_free(m_filter);
+            m_filter = 0;
+            m_filter_spec.clear();
+            create_charts();
+            return;
+        }
+    }
+
+    size_t n_out = 0;
+    size_t decimation = 1;
+
+    m_filtered_output.resize(n_reports * MICROTOUCH3M_SCOPE_N_CORNERS);
+    m_filtered_values.resize(n_reports * MICROTOUCH3M_SCOPE_N_CORNERS);
+
+    if (m_filter)
+    {
+        n_out = microtouch3m_scope_filter_process(m_filter, &m_delta_values[0], n_reports, &m_filtered_output[0]);
+        decimation = microtouch3m_scope_filter_get_decimation(m_filter);
+    }
+
+    // output k of the stream belongs to report (k + 1) * decimation - 1, so
+    // the phase counts the reports since the last output, across frames
+    for (size_t n = 0, out = 0; n < n_reports; ++n)
+    {
+        int32_t * const filtered = &m_filtered_values[n * MICROTOUCH3M_SCOPE_N_CORNERS];
+
+        if (m_filter && ++m_filter_phase == decimation && out < n_out)
+        {
+            std::copy(&m_filtered_output[out * MICROTOUCH3M_SCOPE_N_CORNERS],
+                      &m_filtered_output[out * MICROTOUCH3M_SCOPE_N_CORNERS] + MICROTOUCH3M_SCOPE_N_CORNERS,
+                      m_filtered_hold);
+            m_filter_phase = 0;
+            ++out;
+        }
+
+        // saturated like the chart values, the cast alone is undefined out of range
+        for (unsigned int corner = 0; corner < MICROTOUCH3M_SCOPE_N_CORNERS; ++corner)
+        {
+            const double value = m_filtered_hold[corner] * scale;
+
+            filtered[corner] = (int32_t) std::max((double) std::numeric_limits<int32_t>::min(),
+                                                  std::min((double) std::numeric_limits<int32_t>::max(), value));
+        }
+    }
+}
+
+void M3MScopeApp::update_touch_trace(size_t n_reports)
+{
+    m_touch_positions.resize(n_reports);
+    microtouch3m_touch_estimator_process(m_touch_estimator, &m_delta_values[0], &m_touch_positions[0], n_reports);
+
+    // keep the touched positions, with a single untouched one marking each lift off
+    for (size_t n = 0; n < n_reports; ++n)
+    {
+        const microtouch3m_touch_position_t &position = m_touch_positions[n];
+
+        if (position.touched || (!m_touch_trace.empty() && m_touch_trace.back().touched))
+        {
+            m_touch_trace.push_back(position);
+        }
+    }
+
+    while (m_touch_trace.size() > s_touch_trace_size)
+    {
+        m_touch_trace.pop_front();
+    }
+}
+
+void M3MScopeApp::draw_touch_trace()
+{
+    if (m_touch_rect.w < 2 || m_touch_rect.h < 2)
+    {
+        return;
+    }
+
+    const Uint32 border_color = Color(0x80, 0x80, 0x80).map_rgb(screen_surface()->format);
+    const Uint32 trace_color = Color(0xff, 0xff, 0).map_rgb(screen_surface()->format);
+    const int32_t x0 = m_touch_rect.x;
+    const int32_t y0 = m_touch_rect.y;
+    const int32_t x1 = m_touch_rect.x + m_touch_rect.w - 1;
+    const int32_t y1 = m_touch_rect.y + m_touch_rect.h - 1;
+
+    sdl_utils::draw_line(screen_surface(), x0, y0, x1, y0, border_color);
+    sdl_utils::draw_line(screen_surface(), x1, y0, x1, y1, border_color);
+    sdl_utils::draw_line(screen_surface(), x1, y1, x0, y1, border_color);
+    sdl_utils::draw_line(screen_surface(), x0, y1, x0, y0, border_color);
+
+    int32_t prev_x = 0;
+    int32_t prev_y = 0;
+    bool prev_touched = false;
+
+    for (std::deque<microtouch3m_touch_position_t>::const_iterator it = m_touch_trace.begin();
+         it != m_touch_trace.end(); ++it)
+    {
+        const double x = std::min(std::max(it->x, 0.0), 1.0);
+        const double y = std::min(std::max(it->y, 0.0), 1.0);
+        const int32_t px = x0 + (int32_t) (x * (x1 - x0));
+        const int32_t py = y0 + (int32_t) (y * (y1 - y0));
+
+        if (it->touched)
+        {
+            if (prev_touched)
+            {
+                sdl_utils::draw_line(screen_surface(), prev_x, prev_y, px, py, trace_color);
+            }
+            else
+            {
+                sdl_utils::set_pixel(screen_surface(), (uint32_t) px, (uint32_t) py, trace_color);
+            }
+        }
+
+        prev_x = px;
+        prev_y = py;
+        prev_touched = it->touched;
+    }
+}
+
 void M3MScopeApp::draw()
 {
     sdl_utils::set_clip_area(0, 0, screen_surface()->w, screen_surface()->h);
@@ -355,7 +656,7 @@ void M3MScopeApp::draw()
 
             SDL_Rect bounds;
 
-            if ((m_upd_start == m_upd_end && m_upd_start == 0) || m_upd_end < m_upd_start)
+            if ((m_upd_start == m_upd_end && m_upd_start == 0) || m_upd_end < m_upd_start || m_clear_all)
             {
                 bounds.x = 0;
                 bounds.y = 0;
@@ -392,7 +693,10 @@ void M3MScopeApp::draw()
                 oss << std::left << "STRAYS UL: " << std::setw(11) << std::right << m_strays.ul << std::endl
                     << std::left << "STRAYS UR: " << std::setw(11) << std::right << m_strays.ur << std::endl
                     << std::left << "STRAYS LL: " << std::setw(11) << std::right << m_strays.ll << std::endl
-                    << std::left << "STRAYS LR: " << std::setw(11) << std::right << m_strays.lr;
+                    << std::left << "STRAYS LR: " << std::setw(11) << std::right << m_strays.lr << std::endl
+                    << std::left << "STRAYS MS: " << std::setw(11) << std::right << m_stray_interval_ms << std::endl
+                    << std::left << "STRAYS RES:" << std::setw(11) << std::right << std::fixed << std::setprecision(0)
+                    << m_stray_residual;
 
                 const int64_t delta_strays_ul = m_signal.ul;
                 const int64_t delta_strays_ur = m_signal.ur;
@@ -409,6 +713,24 @@ void M3MScopeApp::draw()
                 oss << std::endl << std::endl
                     << std::left << "DELTA SUM: " << std::setw(11) << std::right << delta_strays_sum << std::endl;
 
+                oss << std::endl
+                    << std::left << "PEAK UL:   " << std::setw(11) << std::right << std::fixed << std::setprecision(1)
+                    << m_peak_hz[0] << std::endl
+                    << std::left << "PEAK UR:   " << std::setw(11) << std::right << m_peak_hz[1] << std::endl
+                    << std::left << "PEAK LL:   " << std::setw(11) << std::right << m_peak_hz[2] << std::endl
+                    << std::left << "PEAK LR:   " << std::setw(11) << std::right << m_peak_hz[3] << std::endl;
+
+                oss << std::endl
+                    << std::left << "RATE HZ:   " << std::setw(11) << std::right << std::fixed << std::setprecision(1)
+                    << m_report_stats.report_rate << std::endl
+                    << std::left << "INT MIN:   " << std::setw(11) << std::right << m_report_stats.interval_min_us << std::endl
+                    << std::left << "INT MEAN:  " << std::setw(11) << std::right << m_report_stats.interval_mean_us << std::endl
+                    << std::left << "INT P99:   " << std::setw(11) << std::right << m_report_stats.interval_p99_us << std::endl
+                    << std::left << "SHORT:     " << std::setw(11) << std::right << m_report_stats.n_short_transfers << std::endl
+                    << std::left << "TIMEOUTS:  " << std::setw(11) << std::right << m_report_stats.n_timeouts << std::endl
+                    << std::left << "ERRORS:    " << std::setw(11) << std::right << m_report_stats.n_errors << std::endl
+                    << std::left << "CALLBACK:  " << std::setw(11) << std::right << m_report_stats.callback_mean_us << std::endl;
+
                 m_strays_text_string = oss.str();
 
                 const uint32_t text_width = m_bmp_font_renderer.text_width(m_strays_text_string);
@@ -424,6 +746,27 @@ void M3MScopeApp::draw()
 
                 m_prev_strays = m_strays;
             }
+
+            // clear touch trace area, below the strays text and with the screen aspect ratio
+            {
+                m_touch_rect.w = m_strays_text_rect.w;
+                m_touch_rect.h = (Uint16) (m_touch_rect.w * screen_surface()->h / screen_surface()->w);
+                m_touch_rect.x = m_strays_text_rect.x;
+                m_touch_rect.y = m_strays_text_rect.y + m_strays_text_rect.h + s_text_margin;
+
+                SDL_FillRect(screen_surface(), &m_touch_rect, m_clear_color);
+            }
+
+            // clear profiler text area
+            if (m_profiler_overlay && !m_profiler_text_string.empty())
+            {
+                m_profiler_text_rect.w = (Uint16) m_bmp_font_renderer.text_width(m_profiler_text_string);
+                m_profiler_text_rect.h = (Uint16) m_bmp_font_renderer.text_height(m_profiler_text_string);
+                m_profiler_text_rect.x = s_text_margin;
+                m_profiler_text_rect.y = s_text_margin * 3;
+
+                SDL_FillRect(screen_surface(), &m_profiler_text_rect, m_clear_color);
+            }
         }
             break;
 
@@ -443,13 +786,24 @@ void M3MScopeApp::draw()
         }
     }
 
+    m_clear_all = false;
+
     // draw charts
 
+    profiler().begin(m_phase_charts);
+
     for (std::vector<LineChart<int> >::iterator it = m_charts.begin(); it != m_charts.end(); ++it)
     {
         it->draw(screen_surface());
     }
 
+    if (m_chart_mode == CHART_MODE_ONE && m_touch_estimator)
+    {
+        draw_touch_trace();
+    }
+
+    profiler().end(m_phase_charts);
+
     if (SDL_MUSTLOCK(screen_surface()))
     {
         SDL_UnlockSurface(screen_surface());
@@ -457,6 +811,8 @@ void M3MScopeApp::draw()
 
     // draw text
 
+    profiler().begin(m_phase_text);
+
     const int text_margin = s_text_margin;
 
     switch (m_chart_mode)
@@ -508,6 +864,14 @@ void M3MScopeApp::draw()
 
     draw_text(screen_surface()->w - text_margin, screen_surface()->h - text_margin,
               m_static_version_text_string, true, true);
+
+    if (m_profiler_overlay && !m_profiler_text_string.empty())
+    {
+        // below the chart scale label
+        draw_text(text_margin, text_margin * 3, m_profiler_text_string);
+    }
+
+    profiler().end(m_phase_text);
 }
 
 void M3MScopeApp::on_event(const SDL_Event &event)
@@ -518,6 +882,11 @@ void M3MScopeApp::on_event(const SDL_Event &event)
             if (event.key.keysym.sym == SDLK_ESCAPE)
                 m_exit = true;
 
+            if (event.key.keysym.sym == SDLK_p)
+            {
+                set_profiler_overlay(!m_profiler_overlay);
+            }
+
             if (event.key.keysym.sym == SDLK_SPACE)
             {
                 m_chart_mode = m_chart_mode == CHART_MODE_ONE ? CHART_MODE_FOUR : CHART_MODE_ONE;
@@ -556,6 +925,16 @@ void M3MScopeApp::create_charts()
             chart.add_curve(Color(0, 0, 0xff), m_sample_count, 0);
             chart.add_curve(Color(0xff, 0xff, 0xff), m_sample_count, 0);
 
+            if (!m_filter_spec.empty())
+            {
+                chart.add_curve(Color(0xff, 0xa0, 0xa0), m_sample_count, 0);
+                chart.add_curve(Color(0xa0, 0xff, 0xa0), m_sample_count, 0);
+                chart.add_curve(Color(0xa0, 0xa0, 0xff), m_sample_count, 0);
+                chart.add_curve(Color(0xa0, 0xa0, 0xa0), m_sample_count, 0);
+            }
+
+            chart.set_decimation(true);
+
             m_charts.push_back(chart);
         }
             break;
@@ -577,6 +956,19 @@ void M3MScopeApp::create_charts()
             lc_ll.add_curve(Color(0, 0, 0xff), m_sample_count, 0);
             lc_lr.add_curve(Color(0xff, 0xff, 0xff), m_sample_count, 0);
 
+            if (!m_filter_spec.empty())
+            {
+                lc_ul.add_curve(Color(0xff, 0xa0, 0xa0), m_sample_count, 0);
+                lc_ur.add_curve(Color(0xa0, 0xff, 0xa0), m_sample_count, 0);
+                lc_ll.add_curve(Color(0xa0, 0xa0, 0xff), m_sample_count, 0);
+                lc_lr.add_curve(Color(0xa0, 0xa0, 0xa0), m_sample_count, 0);
+            }
+
+            lc_ul.set_decimation(true);
+            lc_ur.set_decimation(true);
+            lc_ll.set_decimation(true);
+            lc_lr.set_decimation(true);
+
             m_charts.push_back(lc_ul);
             m_charts.push_back(lc_ur);
             m_charts.push_back(lc_ll);
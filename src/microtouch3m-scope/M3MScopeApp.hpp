@@ -24,6 +24,7 @@
 #define MICROTOUCH_3M_SCOPE_MICROTOUCH3MSCOPEAPP_HPP
 
 #include <csignal>
+#include <deque>
 
 #include "SDLApp.hpp"
 #include "LineChart.hpp"
@@ -51,6 +52,8 @@ public:
 
     void set_print_fps(bool enable);
     void set_scale(uint32_t scale);
+    void set_profiler_overlay(bool enable);
+    void set_filter(const std::string &spec);
 
 protected:
     virtual void on_start();
@@ -62,8 +65,15 @@ private:
     void create_charts();
     void draw_text(int32_t x, int32_t y, const std::string &text, bool align_right = false, bool align_bottom = false);
     void make_screenshot();
+    void update_spectrum_peaks();
+    void update_touch_trace(size_t n_reports);
+    void update_filtered_values(size_t n_reports, double scale);
+    void draw_touch_trace();
 
     static uint32_t s_text_margin;
+    static const unsigned int s_spectrum_size;
+    static const uint64_t s_spectrum_segments;
+    static const size_t s_touch_trace_size;
 
     uint32_t m_sample_count;
     uint64_t m_current_pos;
@@ -86,10 +96,35 @@ private:
     M3MDeviceMonitorThread::signal_t m_strays;
     M3MDeviceMonitorThread::signal_t m_prev_strays;
     M3MDeviceMonitorThread::signal_t m_signal;
+    std::vector<int32_t> m_chart_values;
+    std::vector<int32_t> m_delta_values;
+    std::vector<double> m_spectrum_power;
+    microtouch3m_scope_spectrum_t *m_spectrum;
+    double m_peak_hz[MICROTOUCH3M_SCOPE_N_CORNERS];
+    microtouch3m_touch_estimator_t *m_touch_estimator;
+    std::vector<microtouch3m_touch_position_t> m_touch_positions;
+    std::deque<microtouch3m_touch_position_t> m_touch_trace;
+    SDL_Rect m_touch_rect;
+    std::string m_filter_spec;
+    microtouch3m_scope_filter_t *m_filter;
+    std::vector<int32_t> m_filtered_output;
+    std::vector<int32_t> m_filtered_values;
+    int32_t m_filtered_hold[MICROTOUCH3M_SCOPE_N_CORNERS];
+    size_t m_filter_phase;
+    microtouch3m_device_async_report_stats_t m_report_stats;
+    unsigned int m_stray_interval_ms;
+    double m_stray_residual;
     SDL_Rect m_strays_text_rect;
     std::string m_strays_text_string;
     std::string m_sensitivity_info_string;
     std::string m_mac_suffix;
+    uint32_t m_phase_charts;
+    uint32_t m_phase_text;
+    bool m_profiler_overlay;
+    bool m_clear_all;
+    uint32_t m_profiler_update_time;
+    std::string m_profiler_text_string;
+    SDL_Rect m_profiler_text_rect;
 };
 
 #endif // MICROTOUCH_3M_SCOPE_MICROTOUCH3MSCOPEAPP_HPP
@@ -44,7 +44,13 @@ SDLApp::SDLApp(uint32_t width, uint32_t height, uint8_t bits_per_pixel, uint32_t
     m_fps(0),
     m_fbdev(-1),
     m_vsync(vsync),
-    m_make_screenshot(false)
+    m_make_screenshot(false),
+    m_phase_events(m_profiler.add_phase("events")),
+    m_phase_update(m_profiler.add_phase("update")),
+    m_phase_draw(m_profiler.add_phase("draw")),
+    m_phase_vsync(m_profiler.add_phase("vsync")),
+    m_phase_flip(m_profiler.add_phase("flip")),
+    m_phase_frame(m_profiler.add_phase("frame"))
 {
     if (verbose)
     {
@@ -131,8 +137,12 @@ int SDLApp::exec()
     {
         Uint32 iteration_start = SDL_GetTicks();
 
+        m_profiler.begin(m_phase_frame);
+
         // poll events
 
+        m_profiler.begin(m_phase_events);
+
         SDL_Event event;
 
         while (SDL_PollEvent(&event))
@@ -150,13 +160,19 @@ int SDLApp::exec()
             }
         }
 
+        m_profiler.end(m_phase_events);
+
         // update
 
+        m_profiler.begin(m_phase_update);
         update(iteration_start - last_iteration_start);
+        m_profiler.end(m_phase_update);
 
         // draw
 
+        m_profiler.begin(m_phase_draw);
         draw();
+        m_profiler.end(m_phase_draw);
 
         ++frame_count;
 
@@ -173,10 +189,14 @@ int SDLApp::exec()
 
         if (m_vsync)
         {
+            m_profiler.begin(m_phase_vsync);
             ioctl(m_fbdev, FBIO_WAITFORVSYNC, 0);
+            m_profiler.end(m_phase_vsync);
         }
 
+        m_profiler.begin(m_phase_flip);
         SDL_Flip(screen_surface());
+        m_profiler.end(m_phase_flip);
 
         // screenshot
 
@@ -189,6 +209,11 @@ int SDLApp::exec()
             m_make_screenshot = false;
         }
 
+        // time spent sleeping below is not part of the frame
+
+        m_profiler.end(m_phase_frame);
+        m_profiler.end_frame();
+
         // sleep until next frame to keep CPU load sane
 
         int32_t frame_time_remaining = (int32_t) round(1000.0 / m_fps_limit - (SDL_GetTicks() - iteration_start));
@@ -222,7 +247,17 @@ void SDLApp::screenshot(const std::string &file_path)
     m_screenshot_path = file_path;
 }
 
+bool SDLApp::set_profiler_csv(const std::string &file_path)
+{
+    return m_profiler.open_csv(file_path);
+}
+
 SDL_Surface *SDLApp::screen_surface() const
 {
     return m_screen_surface;
 }
+
+FrameProfiler &SDLApp::profiler()
+{
+    return m_profiler;
+}
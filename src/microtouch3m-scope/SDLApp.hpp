@@ -27,6 +27,8 @@
 
 #include "SDL.h"
 
+#include "FrameProfiler.hpp"
+
 class SDLApp
 {
 public:
@@ -38,9 +40,11 @@ public:
     void enable_cursor(bool enable);
     uint32_t fps() const;
     void screenshot(const std::string &file_path);
+    bool set_profiler_csv(const std::string &file_path);
 
 protected:
     SDL_Surface *screen_surface() const;
+    FrameProfiler &profiler();
 
     virtual void on_start() = 0;
     virtual void update(uint32_t delta_time) = 0;
@@ -60,6 +64,13 @@ private:
     bool m_vsync;
     bool m_make_screenshot;
     std::string m_screenshot_path;
+    FrameProfiler m_profiler;
+    uint32_t m_phase_events;
+    uint32_t m_phase_update;
+    uint32_t m_phase_draw;
+    uint32_t m_phase_vsync;
+    uint32_t m_phase_flip;
+    uint32_t m_phase_frame;
 };
 
 #endif // MICROTOUCH_3M_SCOPE_SDLAPP_HPP
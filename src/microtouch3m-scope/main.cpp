@@ -48,7 +48,9 @@ static void sig_handler(int sig);
 
 enum Options
 {
-    OPT_FPS_LIMIT = 1000
+    OPT_FPS_LIMIT = 1000,
+    OPT_PROFILE_CSV,
+    OPT_FILTER
 };
 
 uint32_t opt_samples = 4000;
@@ -65,6 +67,9 @@ int main(int argc, char *argv[])
     int m3m_log = 0;
     int four_charts = 0;
     int no_vsync = 0;
+    int profile = 0;
+    std::string profile_csv;
+    std::string filter;
 
     const option long_options[] = {
     { "help",        no_argument,       0,            'h' },
@@ -78,6 +83,9 @@ int main(int argc, char *argv[])
     { "fps-limit",   required_argument, 0,            OPT_FPS_LIMIT },
     { "four-charts", no_argument,       &four_charts, 1 },
     { "no-vsync",    no_argument,       &no_vsync,    1 },
+    { "profile",     no_argument,       &profile,     1 },
+    { "profile-csv", required_argument, 0,            OPT_PROFILE_CSV },
+    { "filter",      required_argument, 0,            OPT_FILTER },
     { 0, 0,                             0,            0 }
     };
 
@@ -183,6 +191,28 @@ int main(int argc, char *argv[])
                     return 1;
                 }
                 break;
+
+            case OPT_PROFILE_CSV:
+                profile_csv = optarg;
+                break;
+
+            case OPT_FILTER:
+            {
+                // frequencies are checked against the report rate once known
+                microtouch3m_scope_filter_t * const check = microtouch3m_scope_filter_new(1e9);
+                const bool valid = check && microtouch3m_scope_filter_add_from_string(check, optarg);
+
+                microtouch3m_scope_filter_free(check);
+
+                if (!valid)
+                {
+                    std::cerr << "Invalid filter argument: " << optarg << std::endl;
+                    return 1;
+                }
+
+                filter = optarg;
+            }
+                break;
         }
     }
 
@@ -210,6 +240,18 @@ int main(int argc, char *argv[])
 
         sdlApp.set_print_fps((bool) print_fps);
         sdlApp.set_scale(opt_scale);
+        sdlApp.set_profiler_overlay((bool) profile);
+
+        if (!filter.empty())
+        {
+            sdlApp.set_filter(filter);
+        }
+
+        if (!profile_csv.empty() && !sdlApp.set_profiler_csv(profile_csv))
+        {
+            std::cerr << "Can't open profile CSV file: " << profile_csv << std::endl;
+            return 1;
+        }
 
         return sdlApp.exec();
     }
@@ -236,6 +278,10 @@ void print_help()
               << "      --fps-limit      FPS limit. Default: " << opt_fps_limit << std::endl
               << "      --four-charts    Draw four charts." << std::endl
               << "      --no-vsync       Disable VSYNC." << std::endl
+              << "      --profile        Show frame phase timings (min/avg/p99) on screen. Toggle with P key." << std::endl
+              << "      --profile-csv    Write the phase timings of every frame to the given CSV file." << std::endl
+              << "      --filter         Also draw the signals filtered by the given stages, e.g. notch:50,lowpass:20." << std::endl
+              << "                       Stages: notch:HZ[:Q], lowpass:HZ[:Q], average:N, decimate:N." << std::endl
               << std::endl
               << "  Send USR1 signal to it to make a screenshot. E.g.:" << std::endl
               << std::endl